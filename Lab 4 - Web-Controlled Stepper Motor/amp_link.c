@@ -0,0 +1,128 @@
+/*
+ * amp_link.c
+ * ----------------------------------------
+ * Inter-Core Motion Link Implementation
+ *
+ * Description:
+ * The lock-free command ring and telemetry seqlock shared by the two
+ * cores. Each index and the telemetry block have a single writer, and
+ * __sync_synchronize() (a dmb on the A9) orders the data against the
+ * index or sequence that publishes it; the shared block is uncached, so
+ * no cache maintenance is needed.
+ *
+ * Key Functions:
+ * - amp_ring_push(): Adds a command (CPU0; FALSE when the ring is full)
+ * - amp_ring_peek() / amp_ring_release(): Takes the oldest command (CPU1)
+ * - amp_telemetry_write(): Publishes a sample (CPU1, never waits)
+ * - amp_telemetry_read(): Consistent copy of the sample (CPU0)
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "amp_link.h"
+
+// Telemetry fields after the sequence word
+#define AMP_TELEMETRY_DATA  offsetof(amp_telemetry_t, position)
+
+
+/*
+ * Empty the ring. Only while neither core is using it (CPU1 does this
+ * before writing AMP_MAGIC).
+ */
+void amp_ring_init(amp_ring_t *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    __sync_synchronize();
+}
+
+/*
+ * Add a command. Producer side only; returns FALSE if the ring is full.
+ */
+_Bool amp_ring_push(amp_ring_t *ring, const amp_command_t *command)
+{
+    u32 head = ring->head;
+
+    if (head - ring->tail >= AMP_RING_SIZE) {
+        return 0;
+    }
+    memcpy(&ring->slots[head & (AMP_RING_SIZE - 1)], command, sizeof(*command));
+    AMP_LINK_PREEMPT();
+    // The slot must be complete before the consumer can see it
+    __sync_synchronize();
+    ring->head = head + 1;
+    return 1;
+}
+
+/*
+ * Copy out the oldest command without taking it off the ring. Consumer
+ * side only; returns FALSE if the ring is empty.
+ */
+_Bool amp_ring_peek(amp_ring_t *ring, amp_command_t *command)
+{
+    u32 tail = ring->tail;
+
+    if (ring->head == tail) {
+        return 0;
+    }
+    // No slot read may pass the head read that made it visible
+    __sync_synchronize();
+    AMP_LINK_PREEMPT();
+    memcpy(command, &ring->slots[tail & (AMP_RING_SIZE - 1)], sizeof(*command));
+    return 1;
+}
+
+/*
+ * Take the command amp_ring_peek() returned off the ring, once it has
+ * been acted on; the producer may then reuse its slot.
+ */
+void amp_ring_release(amp_ring_t *ring)
+{
+    AMP_LINK_PREEMPT();
+    __sync_synchronize();
+    ring->tail = ring->tail + 1;
+}
+
+/*
+ * Commands not yet released. Either side.
+ */
+u32 amp_ring_level(const amp_ring_t *ring)
+{
+    return ring->head - ring->tail;
+}
+
+/*
+ * Publish a sample (single writer). sample->sequence is ignored.
+ */
+void amp_telemetry_write(amp_telemetry_t *shared, const amp_telemetry_t *sample)
+{
+    u32 sequence = shared->sequence;
+
+    shared->sequence = sequence + 1;
+    __sync_synchronize();
+    AMP_LINK_PREEMPT();
+    memcpy((u8 *)shared + AMP_TELEMETRY_DATA, (const u8 *)sample + AMP_TELEMETRY_DATA,
+           sizeof(amp_telemetry_t) - AMP_TELEMETRY_DATA);
+    AMP_LINK_PREEMPT();
+    __sync_synchronize();
+    shared->sequence = sequence + 2;
+}
+
+/*
+ * Copy out the latest sample, retried while it overlaps a write.
+ */
+void amp_telemetry_read(const amp_telemetry_t *shared, amp_telemetry_t *sample)
+{
+    u32 sequence;
+
+    do {
+        sequence = shared->sequence;
+        __sync_synchronize();
+        memcpy((u8 *)sample + AMP_TELEMETRY_DATA, (const u8 *)shared + AMP_TELEMETRY_DATA,
+               sizeof(amp_telemetry_t) - AMP_TELEMETRY_DATA);
+        AMP_LINK_PREEMPT();
+        __sync_synchronize();
+    } while ((sequence & 1) || sequence != shared->sequence);
+
+    sample->sequence = sequence;
+}
@@ -0,0 +1,138 @@
+/*
+ * amp_link.h
+ * ----------------------------------------
+ * Inter-Core Motion Link Interface
+ *
+ * Description:
+ * Shared memory between the two Cortex-A9 cores of the AMP build: CPU0
+ * runs FreeRTOS, the network and the planner; CPU1 runs the step engine
+ * bare-metal (cpu1/motion_core.c). They share one amp_shared_t in the
+ * on-chip memory at AMP_SHARED_BASE, mapped uncached on both cores, and
+ * nothing else.
+ *
+ * - Command ring: CPU0 -> CPU1, single producer, single consumer, no
+ *   lock. Each index is written by one core only and sits on its own
+ *   cache line. CPU1 releases a command only after applying it and
+ *   publishing telemetry, so an empty ring means the telemetry reflects
+ *   every command sent.
+ * - Emergency stop: a request counter outside the ring, so a stop never
+ *   waits behind a full ring. CPU0 bumps it from the button ISR; CPU1
+ *   polls it ahead of the ring.
+ * - Telemetry: CPU1 -> CPU0, a seqlock (odd while CPU1 writes, readers
+ *   retry), so CPU1 never waits for a reader.
+ *
+ * Only the ring and seqlock live here, with no FreeRTOS or BSP calls, so
+ * tools/host/amp_ring_stress.c can run them between two host threads.
+ *
+ * Definitions:
+ * - AMP_SHARED_BASE:  Shared block, in the high OCM (uncached on both cores)
+ * - AMP_RING_SIZE:    Command ring slots (a power of two)
+ * - AMP_MAGIC:        Written by CPU1 once it serves the ring
+ * - AMP_CPU1_ENTRY:   Start address of the CPU1 application (its lscript)
+ */
+
+#ifndef SRC_AMP_LINK_H_
+#define SRC_AMP_LINK_H_
+
+#include "xil_types.h"
+
+#define AMP_SHARED_BASE     0xFFFF0000U
+#define AMP_OCM_ATTRIBUTES  0x14DE2U       // Xil_SetTlbAttributes(): shareable, uncached
+#define AMP_CPU1_ENTRY      0x02000000U
+#define AMP_CPU1_RELEASE    0xFFFFFFF0U    // CPU1 boot ROM waits for an address here
+#define AMP_CACHE_LINE      32
+#define AMP_RING_SIZE       32
+#define AMP_MAGIC           0x314B4E4CU    // "LNK1"
+
+#define AMP_SHARED  ((amp_shared_t *)AMP_SHARED_BASE)
+
+typedef enum {
+    AMP_CMD_INIT = 1,       // stepper_initialize()
+    AMP_CMD_SET_POS,        // position
+    AMP_CMD_STEP_MODE,      // step_mode
+    AMP_CMD_MOVE,           // stepper_move_start() with the motion settings
+    AMP_CMD_FEED,           // value: percent
+    AMP_CMD_DISABLE,        // release the coils
+    AMP_CMD_ESTOP_CLEAR,
+    AMP_CMD_STREAM_STEP     // direction, value: step time (us)
+} amp_command_type_t;
+
+typedef struct {
+    u32   type;             // amp_command_type_t
+    u32   move;             // MOVE: id CPU0 gave the move
+    s32   position;         // MOVE: target; SET_POS: position
+    s32   direction;        // STREAM_STEP
+    u32   value;
+    u8    step_mode;        // STEP_MODE
+    u8    profile;          // MOVE, from here down
+    u8    full_step_cruise;
+    u8    reserved;
+    float entry_speed;
+    float exit_speed;
+    float speed;
+    float accel;
+    float decel;
+    float jerk;
+} amp_command_t;
+
+typedef struct {
+    volatile u32 head;      // next slot to fill (CPU0)
+    u8  head_line[AMP_CACHE_LINE - sizeof(u32)];
+    volatile u32 tail;      // next slot to apply (CPU1)
+    u8  tail_line[AMP_CACHE_LINE - sizeof(u32)];
+    amp_command_t slots[AMP_RING_SIZE];
+} amp_ring_t;
+
+typedef struct {
+    volatile u32 sequence;  // odd while CPU1 writes
+    s32   position;         // steps
+    float velocity;         // steps/s, signed
+    s32   direction;        // +1, -1, or 0 at rest
+    s32   phase;
+    u32   timestamp_us;     // step_timer_get_time_us() of the last step
+    u32   move_started;     // id of the latest MOVE applied
+    u32   move_done;        // id of the latest MOVE complete
+    u8    running;          // step engine running
+    u8    complete;         // stepper_motion_complete()
+    u8    estop_latched;
+    u8    reserved;
+    s32   queued_dir;       // step_dir: direction of the last step queued
+    u32   fifo_space;       // free step FIFO entries (streaming)
+    u32   estop_taken;      // estop_request value last acted on
+    u32   estop_stops;      // stops that recorded a latency
+    u32   estop_latency_us; // button to first decelerating step, last stop
+    u32   feed_override;    // percent
+    u32   stream_rejected;  // stream steps the engine refused
+} amp_telemetry_t;
+
+typedef struct {
+    volatile u32 magic;
+    volatile u32 estop_request;     // CPU0 increments, after press_us and decel
+    volatile u32 estop_press_us;
+    volatile u32 estop_decel;
+    u8  estop_line[AMP_CACHE_LINE - 4 * sizeof(u32)];
+    amp_ring_t      commands;
+    amp_telemetry_t telemetry;
+} amp_shared_t;
+
+// Points where the other core may get in. The host stress test builds
+// with AMP_LINK_STRESS and yields its thread there.
+#ifdef AMP_LINK_STRESS
+void amp_link_preempt(void);
+#define AMP_LINK_PREEMPT()  amp_link_preempt()
+#else
+#define AMP_LINK_PREEMPT()
+#endif
+
+// Command ring
+void  amp_ring_init(amp_ring_t *ring);
+_Bool amp_ring_push(amp_ring_t *ring, const amp_command_t *command);
+_Bool amp_ring_peek(amp_ring_t *ring, amp_command_t *command);
+void  amp_ring_release(amp_ring_t *ring);
+u32   amp_ring_level(const amp_ring_t *ring);
+
+// Telemetry seqlock
+void  amp_telemetry_write(amp_telemetry_t *shared, const amp_telemetry_t *sample);
+void  amp_telemetry_read(const amp_telemetry_t *shared, amp_telemetry_t *sample);
+
+#endif /* SRC_AMP_LINK_H_ */
@@ -0,0 +1,234 @@
+/*
+ * batch.c
+ * ----------------------------------------
+ * Move-Order Optimizer Implementation
+ *
+ * Description:
+ * Times a visiting order the way the planner would run it and improves
+ * the order with a bounded local search. Only orders of indices are
+ * moved around; the targets themselves are not touched.
+ *
+ * Key Functions:
+ * - batch_route_time(): Motion time of the targets in a given order
+ * - batch_optimize(): Chooses a fast order, in bounded time
+ */
+
+#include "planner.h"
+#include "batch.h"
+
+
+static int batch_direction(long from, long to)
+{
+    return (to > from) - (to < from);
+}
+
+static float batch_min(float a, float b)
+{
+    return (a < b) ? a : b;
+}
+
+/*
+ * Motion time (s) of visiting targets[order[0..count-1]] from start,
+ * dwells included. Junction speeds follow the planner: a move blends
+ * into the next when there is no dwell and both go the same way, at
+ * most at the speed the next move can still stop from.
+ */
+float batch_route_time(const motor_parameters_t *params, long start,
+                       const long *targets, const u8 *order, u32 count)
+{
+    long  ends[BATCH_MAX_TARGETS + 1];
+    int   directions[BATCH_MAX_TARGETS];
+    float exit_max[BATCH_MAX_TARGETS];
+    float entry = 0.0f;
+    float total = count * params->dwell_time / 1000.0f;
+    u32 i;
+
+    if (count == 0) {
+        return 0.0f;
+    }
+
+    ends[0] = start;
+    for (i = 0; i < count; i++) {
+        long target = targets[order[i]];
+        if (params->rotary) {
+            target = stepper_rotary_target(ends[i], target, params->step_mode);
+        }
+        ends[i + 1]   = target;
+        directions[i] = batch_direction(ends[i], target);
+    }
+
+    // Backward pass: the last move ends at rest
+    exit_max[count - 1] = 0.0f;
+    for (i = count - 1; i > 0; i--) {
+        if (params->dwell_time == 0 && directions[i - 1] != 0 && directions[i - 1] == directions[i]) {
+            float next_distance = (float)labs(ends[i + 1] - ends[i]);
+            exit_max[i - 1] = batch_min(params->rotational_speed,
+                                        sqrtf(exit_max[i] * exit_max[i]
+                                              + 2.0f * params->rotational_decel * next_distance));
+        } else {
+            exit_max[i - 1] = 0.0f;
+        }
+    }
+
+    // Forward pass: limited by what each move can accelerate to
+    for (i = 0; i < count; i++) {
+        long distance = labs(ends[i + 1] - ends[i]);
+        float exit = batch_min(exit_max[i], sqrtf(entry * entry
+                                                  + 2.0f * params->rotational_accel * distance));
+        total += planner_segment_time(params, distance, entry, exit);
+        entry = exit;
+    }
+    return total;
+}
+
+/*
+ * Time order and keep it in best if it is faster.
+ */
+static void batch_consider(const motor_parameters_t *params, long start, const long *targets,
+                           const u8 *order, u32 count, u8 best[], batch_result_t *result)
+{
+    float time = batch_route_time(params, start, targets, order, count);
+
+    result->timings++;
+    if (time < result->optimized_s) {
+        result->optimized_s = time;
+        memcpy(best, order, count);
+    }
+}
+
+/*
+ * Greedy start: always the target whose stop-to-stop move is quickest.
+ */
+static void batch_nearest_neighbour(const motor_parameters_t *params, long start,
+                                    const long *targets, u32 count, u8 order[])
+{
+    _Bool visited[BATCH_MAX_TARGETS] = { 0 };
+    long position = start;
+    u32 i, k;
+
+    for (i = 0; i < count; i++) {
+        float quickest = 0.0f;
+        u32 next = 0;
+        _Bool found = 0;
+
+        for (k = 0; k < count; k++) {
+            long target;
+            float time;
+
+            if (visited[k]) {
+                continue;
+            }
+            target = params->rotary ? stepper_rotary_target(position, targets[k], params->step_mode)
+                                    : targets[k];
+            time = planner_segment_time(params, labs(target - position), 0.0f, 0.0f);
+            if (!found || time < quickest) {
+                quickest = time;
+                next = k;
+                found = 1;
+            }
+        }
+        visited[next] = 1;
+        order[i] = (u8)next;
+        position = params->rotary ? stepper_rotary_target(position, targets[next], params->step_mode)
+                                  : targets[next];
+    }
+}
+
+/*
+ * Sweeps: the targets on one side of start, nearest first, then the
+ * ones on the other side, also nearest first. first_down picks the side.
+ */
+static void batch_sweep(long start, const long *targets, u32 count, _Bool first_down, u8 order[])
+{
+    u8 sorted[BATCH_MAX_TARGETS];
+    u32 below = 0;
+    u32 n = 0;
+    u32 i, k;
+
+    // Insertion sort by position
+    for (i = 0; i < count; i++) {
+        for (k = i; k > 0 && targets[sorted[k - 1]] > targets[i]; k--) {
+            sorted[k] = sorted[k - 1];
+        }
+        sorted[k] = (u8)i;
+    }
+    while (below < count && targets[sorted[below]] < start) {
+        below++;
+    }
+
+    if (first_down) {
+        for (i = below; i > 0; i--) {
+            order[n++] = sorted[i - 1];
+        }
+        for (i = below; i < count; i++) {
+            order[n++] = sorted[i];
+        }
+    } else {
+        for (i = below; i < count; i++) {
+            order[n++] = sorted[i];
+        }
+        for (i = below; i > 0; i--) {
+            order[n++] = sorted[i - 1];
+        }
+    }
+}
+
+static void batch_reverse(u8 order[], u32 first, u32 last)
+{
+    while (first < last) {
+        u8 swap = order[first];
+        order[first++] = order[last];
+        order[last--]  = swap;
+    }
+}
+
+/*
+ * Choose an order for targets[0..count-1] (count at most
+ * BATCH_MAX_TARGETS) starting from start, into order[]. result gets the
+ * motion time of submission order and of the order chosen.
+ */
+void batch_optimize(const motor_parameters_t *params, long start,
+                    const long *targets, u32 count, u8 order[], batch_result_t *result)
+{
+    u8 candidate[BATCH_MAX_TARGETS];
+    u32 i, k;
+    _Bool improved = 1;
+
+    for (i = 0; i < count; i++) {
+        order[i] = (u8)i;
+    }
+    result->passes      = 0;
+    result->timings     = 1;
+    result->submitted_s = batch_route_time(params, start, targets, order, count);
+    result->optimized_s = result->submitted_s;
+    if (count < 2) {
+        return;
+    }
+
+    // Starting points
+    batch_nearest_neighbour(params, start, targets, count, candidate);
+    batch_consider(params, start, targets, candidate, count, order, result);
+    batch_sweep(start, targets, count, 1, candidate);
+    batch_consider(params, start, targets, candidate, count, order, result);
+    batch_sweep(start, targets, count, 0, candidate);
+    batch_consider(params, start, targets, candidate, count, order, result);
+
+    // 2-opt: reverse order[i..k] while that helps, a bounded number of passes
+    while (improved && result->passes < BATCH_MAX_PASSES) {
+        improved = 0;
+        result->passes++;
+        for (i = 0; i + 1 < count; i++) {
+            for (k = i + 1; k < count; k++) {
+                float best = result->optimized_s;
+
+                memcpy(candidate, order, count);
+                batch_reverse(candidate, i, k);
+                batch_consider(params, start, targets, candidate, count, order, result);
+                // Require a real gain, so float noise cannot keep a pass going
+                if (result->optimized_s < best - 1e-4f) {
+                    improved = 1;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * batch.h
+ * ----------------------------------------
+ * Move-Order Optimizer Interface
+ *
+ * Description:
+ * A batch is a set of up to BATCH_MAX_TARGETS positions, all with the
+ * same motion parameters, to be visited in any order (GET /setBatch with
+ * one fis= per target). batch_optimize() picks an order that shortens
+ * the total motion time before the targets go into motor_queue.
+ *
+ * Orders are timed with the planner's model: planner_segment_time() for
+ * each move, with junction speeds planned as planner_recalculate() plans
+ * them, so consecutive targets in the same direction blend when the
+ * batch has no dwell. Positions are the ones validate_input() leaves,
+ * folded into 0..MAX_POSITION; a rotary batch takes the shortest way
+ * round at each move.
+ *
+ * The search is bounded: the better of submission order, nearest
+ * neighbour and the two sweeps, then at most BATCH_MAX_PASSES passes of
+ * 2-opt (reverse a run of targets when that is faster). Each pass times
+ * count^2 / 2 orders of count moves, so a full batch costs at most about
+ * 50k move timings. The result is never slower than submission order.
+ *
+ * Definitions:
+ * - BATCH_MAX_TARGETS:  Largest batch (the depth of motor_queue)
+ * - BATCH_MAX_PASSES:   2-opt passes, at most
+ */
+
+#ifndef SRC_BATCH_H_
+#define SRC_BATCH_H_
+
+#include "stepper.h"
+
+#define BATCH_MAX_TARGETS   25
+#define BATCH_MAX_PASSES    6
+
+typedef struct {
+    float submitted_s;      // motion time in submission order
+    float optimized_s;      // in the order chosen
+    u32   passes;           // 2-opt passes run
+    u32   timings;          // orders timed
+} batch_result_t;
+
+float batch_route_time(const motor_parameters_t *params, long start,
+                       const long *targets, const u8 *order, u32 count);
+void  batch_optimize(const motor_parameters_t *params, long start,
+                     const long *targets, u32 count, u8 order[], batch_result_t *result);
+
+#endif /* SRC_BATCH_H_ */
@@ -0,0 +1,130 @@
+/*
+ * console.c
+ * ----------------------------------------
+ * UART Debug Console Implementation
+ *
+ * Description:
+ * Polls the PS UART for characters, collects them into a line and runs
+ * the matching command from console_commands[]. Commands only print
+ * diagnostics, so the console never blocks motion.
+ *
+ * Key Functions:
+ * - console_task(): Reads command lines and dispatches them
+ */
+
+#include <string.h>
+#include "xuartps.h"
+#include "stepper.h"
+#include "planner.h"
+#include "estop.h"
+#include "program.h"
+#include "stream.h"
+#include "timesync.h"
+#include "httpd.h"
+#include "console.h"
+
+extern XUartPs UART;
+extern QueueHandle_t motor_queue;
+extern QueueHandle_t motor_urgent_queue;
+
+typedef struct {
+    const char *name;
+    void (*handler)(void);
+    const char *help;
+} console_command_t;
+
+static void console_help(void);
+static void console_trace(void);
+static void console_queue(void);
+
+static const console_command_t console_commands[] = {
+    { "help",    console_help,           "list commands" },
+    { "latency", estop_print_latency,    "emergency stop latency histogram" },
+    { "ramps",   ramp_cache_print_stats, "ramp cache statistics" },
+    { "plan",    planner_print_stats,    "last planned sequence timing" },
+    { "queue",   console_queue,          "motor command lanes, wait times and ETA" },
+    { "trace",   console_trace,          "binary step trace dump" },
+    { "program", program_print_status,   "motion program status" },
+    { "stream",  stream_print_stats,     "trajectory stream counters" },
+    { "sync",    timesync_print_stats,   "time sync estimate and timed starts" },
+    { "http",    httpd_print_stats,      "HTTP connections and counters" },
+};
+
+#define CONSOLE_COMMAND_COUNT  (sizeof(console_commands) / sizeof(console_commands[0]))
+
+
+static void console_help(void)
+{
+    u32 i;
+
+    for (i = 0; i < CONSOLE_COMMAND_COUNT; i++) {
+        xil_printf("  %-8s %s\n", console_commands[i].name, console_commands[i].help);
+    }
+}
+
+/* stepper_trace_export() sink: raw bytes out of the UART (blocking) */
+static _Bool console_write_raw(void *context, const void *data, u32 length)
+{
+    const u8 *bytes = data;
+    u32 i;
+
+    for (i = 0; i < length; i++) {
+        XUartPs_SendByte(UART.Config.BaseAddress, bytes[i]);
+    }
+    return 1;
+}
+
+/*
+ * Dump the step trace between two text markers. Capture the UART to a
+ * file and run tools/trace_decode.c on it; the decoder finds the trace
+ * by its header.
+ */
+static void console_trace(void)
+{
+    u32 bytes;
+
+    xil_printf("TRACE BEGIN\n");
+    bytes = stepper_trace_export(console_write_raw, NULL);
+    xil_printf("\nTRACE END %lu bytes\n", bytes);
+}
+
+static void console_queue(void)
+{
+    planner_print_lane_stats(motor_queue, motor_urgent_queue);
+}
+
+static void console_run(const char *line)
+{
+    u32 i;
+
+    if (line[0] == '\0') {
+        return;
+    }
+    for (i = 0; i < CONSOLE_COMMAND_COUNT; i++) {
+        if (strcmp(line, console_commands[i].name) == 0) {
+            console_commands[i].handler();
+            return;
+        }
+    }
+    xil_printf("unknown command '%s' (try help)\n", line);
+}
+
+void console_task(void *p)
+{
+    char line[CONSOLE_LINE_SIZE];
+    u32 length = 0;
+    u8 c;
+
+    while (1) {
+        while (XUartPs_Recv(&UART, &c, 1) == 1) {
+            if (c == '\r' || c == '\n') {
+                line[length] = '\0';
+                console_run(line);
+                length = 0;
+            } else if (length < CONSOLE_LINE_SIZE - 1) {
+                line[length++] = (char)c;
+            }
+        }
+        vTaskDelay(CONSOLE_POLL_TICKS);
+    }
+}
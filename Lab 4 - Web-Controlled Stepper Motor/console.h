@@ -0,0 +1,26 @@
+/*
+ * console.h
+ * ----------------------------------------
+ * UART Debug Console Interface
+ *
+ * Description:
+ * A line-based command console on the PS UART (the one xil_printf uses).
+ * Type a command name and press enter; "help" lists the commands.
+ *
+ * Definitions:
+ * - CONSOLE_LINE_SIZE:  Longest command line accepted
+ * - CONSOLE_POLL_TICKS: UART polling period
+ */
+
+#ifndef SRC_CONSOLE_H_
+#define SRC_CONSOLE_H_
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define CONSOLE_LINE_SIZE   32
+#define CONSOLE_POLL_TICKS  pdMS_TO_TICKS(20)
+
+void console_task(void *p);
+
+#endif /* SRC_CONSOLE_H_ */
@@ -0,0 +1,47 @@
+/*
+ * FreeRTOS.h (motion core)
+ * ----------------------------------------
+ * The FreeRTOS kernel definitions stepper.c and step_timer.c use, for
+ * the bare-metal build on CPU1 (cpu1/motion_core.c). There is no
+ * scheduler: critical sections mask the IRQ, with nesting, and the step
+ * ISR runs with the IRQ already masked.
+ */
+
+#ifndef MOTION_CORE_FREERTOS_H_
+#define MOTION_CORE_FREERTOS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "xil_types.h"
+
+typedef uint32_t      TickType_t;
+typedef long          BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE   1
+#define pdFALSE  0
+#define pdPASS   1
+#define pdFAIL   0
+
+#define portMAX_DELAY       0xFFFFFFFFUL
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+#define configMAX_PRIORITIES      8
+#define configMINIMAL_STACK_SIZE  200
+
+void motion_core_enter_critical(void);
+void motion_core_exit_critical(void);
+
+#define portYIELD_FROM_ISR(woken)          ((void)(woken))
+#define taskENTER_CRITICAL()               motion_core_enter_critical()
+#define taskEXIT_CRITICAL()                motion_core_exit_critical()
+#define taskENTER_CRITICAL_FROM_ISR()      0
+#define taskEXIT_CRITICAL_FROM_ISR(mask)   ((void)(mask))
+
+// Interrupts, on the GIC driver (see motion_core.c)
+BaseType_t xPortInstallInterruptHandler(uint8_t id, XInterruptHandler handler, void *context);
+void       vPortEnableInterrupt(uint8_t id);
+
+#endif /* MOTION_CORE_FREERTOS_H_ */
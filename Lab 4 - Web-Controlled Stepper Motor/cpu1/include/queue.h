@@ -0,0 +1,14 @@
+/*
+ * queue.h (motion core)
+ * ----------------------------------------
+ * Queue handle type for the driver headers. CPU1 has no queues.
+ */
+
+#ifndef MOTION_CORE_QUEUE_H_
+#define MOTION_CORE_QUEUE_H_
+
+#include "FreeRTOS.h"
+
+typedef void *QueueHandle_t;
+
+#endif /* MOTION_CORE_QUEUE_H_ */
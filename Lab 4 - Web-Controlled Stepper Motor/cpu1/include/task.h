@@ -0,0 +1,26 @@
+/*
+ * task.h (motion core)
+ * ----------------------------------------
+ * Task API used by stepper.c. The one "task" on CPU1 is the step engine
+ * service task, run as the main loop; its notification is a flag, and
+ * its wait polls the command ring (see motion_core.c).
+ */
+
+#ifndef MOTION_CORE_TASK_H_
+#define MOTION_CORE_TASK_H_
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+
+BaseType_t   xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack,
+                         void *parameters, UBaseType_t priority, TaskHandle_t *handle);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t   xTaskGetTickCount(void);
+void         vTaskSuspendAll(void);
+BaseType_t   xTaskResumeAll(void);
+BaseType_t   xTaskNotifyGive(TaskHandle_t task);
+void         vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+uint32_t     ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+#endif /* MOTION_CORE_TASK_H_ */
@@ -0,0 +1,327 @@
+/*
+ * motion_core.c
+ * ----------------------------------------
+ * Motion Core: the Step Engine on CPU1 (AMP Build)
+ *
+ * Description:
+ * Bare-metal application for the second Cortex-A9. It runs the
+ * unchanged step engine (stepper.c, ramp_cache.c, step_timer.c) with the
+ * step timer interrupt routed to this core, so the network stack and
+ * the FreeRTOS tasks on CPU0 no longer share a core with the step ISR
+ * and the planning of steps.
+ *
+ * The step engine service task is the main loop. Its waits poll, ahead
+ * of everything else, the emergency stop request and then the command
+ * ring from CPU0 (amp_link.h), applying each command with the
+ * stepper.c call CPU0 would have made; telemetry is published whenever
+ * it changes. The FreeRTOS calls stepper.c makes are provided here over
+ * the cpu1/include headers.
+ *
+ * Build (Vitis): a standalone application for ps7_cortexa9_1 in the
+ * same platform as the CPU0 application, with
+ * - BSP compiler flags: -DUSE_AMP=1 (CPU0 owns the GIC distributor)
+ * - sources: this file, ../stepper.c, ../ramp_cache.c, ../step_timer.c,
+ *   ../amp_link.c
+ * - symbols: STEPPER_AMP and STEPPER_AMP_CPU1
+ * - include paths: cpu1/include ahead of the Lab 4 directory
+ * - lscript: code at AMP_CPU1_ENTRY, in DDR the CPU0 lscript leaves out
+ * The CPU0 application is built with STEPPER_AMP (motion_link.c then
+ * takes the place of stepper.c) and the boot image holds both ELFs.
+ * CPU0 releases this core from the boot ROM on its first
+ * stepper_initialize().
+ *
+ * Key Functions:
+ * - main(): Sets up the GIC, the motor GPIO and the shared block
+ * - motion_core_poll(): Emergency stop, commands, telemetry
+ * - motion_core_apply(): Runs one command from CPU0
+ */
+
+#include "stepper.h"
+#include "estop.h"
+#include "amp_link.h"
+#include "xil_mmu.h"
+
+#define MOTOR_DEVICE_ID  XPAR_GPIO_2_DEVICE_ID   // as in main.c
+
+static amp_shared_t *const shared = AMP_SHARED;
+static XScuGic gic;
+
+static u32 critical_nesting;
+static volatile _Bool notified;     // the service task's notification
+
+static stepper_move_handle_t local_move;   // this core's id for the latest move
+static u32 move_started;                   // CPU0's id for it
+static u32 estop_taken;
+static volatile u32 estop_stops;
+static volatile u32 estop_latency_us;
+static u32 stream_rejected;
+static amp_telemetry_t published;
+
+
+/*
+ * Critical sections mask the IRQ, the only thing that can preempt the
+ * main loop.
+ */
+void motion_core_enter_critical(void)
+{
+    Xil_ExceptionDisable();
+    critical_nesting++;
+}
+
+void motion_core_exit_critical(void)
+{
+    if (--critical_nesting == 0) {
+        Xil_ExceptionEnable();
+    }
+}
+
+/*
+ * Connect an interrupt and route it to this core.
+ */
+BaseType_t xPortInstallInterruptHandler(uint8_t id, XInterruptHandler handler, void *context)
+{
+    if (XScuGic_Connect(&gic, id, handler, context) != XST_SUCCESS) {
+        return pdFAIL;
+    }
+    XScuGic_InterruptMaptoCpu(&gic, XPAR_CPU_ID, id);
+    return pdPASS;
+}
+
+void vPortEnableInterrupt(uint8_t id)
+{
+    XScuGic_Enable(&gic, id);
+}
+
+/*
+ * The service task is not created: main() runs it. The handle only
+ * needs to be non-NULL so stepper.c notifies it.
+ */
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *handle)
+{
+    (void)code; (void)name; (void)stack; (void)parameters; (void)priority;
+    if (handle != NULL) {
+        *handle = (TaskHandle_t)&notified;
+    }
+    return pdPASS;
+}
+
+/*
+ * No task owns a move here: completion goes to CPU0 in the telemetry.
+ */
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return NULL;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    XTime now;
+
+    XTime_GetTime(&now);
+    return (TickType_t)(now / (COUNTS_PER_SECOND / 1000));
+}
+
+void vTaskSuspendAll(void)
+{
+}
+
+BaseType_t xTaskResumeAll(void)
+{
+    return pdFALSE;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    (void)task;
+    notified = 1;
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    (void)task; (void)woken;
+    notified = 1;
+}
+
+/*
+ * Called by stepper.c on this core when the step ISR starts a fast
+ * deceleration; CPU0 puts it in its histogram.
+ */
+void estop_record_latency(u32 latency_us)
+{
+    estop_latency_us = latency_us;
+    estop_stops++;
+}
+
+/*
+ * Take an emergency stop request from CPU0. The stop is set up with the
+ * IRQ masked, as it would be inside the button ISR.
+ */
+static void motion_core_check_estop(void)
+{
+    u32 request = shared->estop_request;
+
+    if (request == estop_taken) {
+        return;
+    }
+    __sync_synchronize();
+    motion_core_enter_critical();
+    stepper_emergency_stop_from_isr(shared->estop_press_us, shared->estop_decel);
+    motion_core_exit_critical();
+    estop_taken = request;
+}
+
+/*
+ * Publish telemetry if anything in it has changed, or always with force.
+ */
+static void motion_core_publish(_Bool force)
+{
+    amp_telemetry_t sample;
+    stepper_telemetry_t engine;
+
+    stepper_get_telemetry(&engine);
+    memset(&sample, 0, sizeof(sample));
+    sample.position         = engine.position;
+    sample.velocity         = engine.velocity;
+    sample.direction        = engine.direction;
+    sample.phase            = engine.phase;
+    sample.timestamp_us     = engine.timestamp_us;
+    sample.move_started     = move_started;
+    sample.move_done        = (local_move == 0 || stepper_move_is_complete(local_move))
+                              ? move_started : published.move_done;
+    sample.running          = step_engine_running;
+    sample.complete         = stepper_motion_complete();
+    sample.estop_latched    = stepper_emergency_latched();
+    sample.queued_dir       = step_dir;
+    sample.fifo_space       = stepper_stream_space();
+    sample.estop_taken      = estop_taken;
+    sample.estop_stops      = estop_stops;
+    sample.estop_latency_us = estop_latency_us;
+    sample.feed_override    = stepper_get_feed_override();
+    sample.stream_rejected  = stream_rejected;
+
+    sample.sequence = published.sequence;
+    if (force || memcmp(&sample, &published, sizeof(sample)) != 0) {
+        amp_telemetry_write(&shared->telemetry, &sample);
+        published = sample;
+    }
+}
+
+/*
+ * Run one command from CPU0.
+ */
+static void motion_core_apply(const amp_command_t *command)
+{
+    switch (command->type) {
+    case AMP_CMD_INIT:
+        stepper_pmod_pins_to_output();
+        stepper_initialize();
+        local_move = 0;
+        break;
+    case AMP_CMD_SET_POS:
+        stepper_set_pos(command->position);
+        break;
+    case AMP_CMD_STEP_MODE:
+        if (!step_engine_running) {
+            stepper_set_step_mode(command->step_mode);
+        }
+        break;
+    case AMP_CMD_MOVE:
+        stepper_set_speed(command->speed);
+        stepper_set_accel(command->accel);
+        stepper_set_decel(command->decel);
+        stepper_set_profile((motion_profile_t)command->profile, command->jerk);
+        stepper_set_full_step_cruise(command->full_step_cruise);
+        local_move = stepper_move_start(command->position, command->entry_speed,
+                                        command->exit_speed, NULL, NULL);
+        move_started = command->move;
+        break;
+    case AMP_CMD_FEED:
+        stepper_set_feed_override(command->value);
+        break;
+    case AMP_CMD_DISABLE:
+        stepper_disable_motor();
+        break;
+    case AMP_CMD_ESTOP_CLEAR:
+        stepper_emergency_clear();
+        break;
+    case AMP_CMD_STREAM_STEP:
+        if (!stepper_stream_step(command->direction, command->value)) {
+            stream_rejected++;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * One pass over everything CPU0 can ask for. A command leaves the ring
+ * only once it is applied and its effect published.
+ */
+static void motion_core_poll(void)
+{
+    amp_command_t command;
+
+    motion_core_check_estop();
+    while (amp_ring_peek(&shared->commands, &command)) {
+        motion_core_apply(&command);
+        motion_core_check_estop();
+        motion_core_publish(0);
+        amp_ring_release(&shared->commands);
+    }
+    motion_core_publish(0);
+}
+
+/*
+ * The service task's wait: poll CPU0 until notified or ticks pass.
+ */
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    TickType_t start = xTaskGetTickCount();
+    uint32_t value;
+
+    (void)clear;
+    while (!notified && xTaskGetTickCount() - start < ticks) {
+        motion_core_poll();
+    }
+    value = notified;
+    notified = 0;
+    return value;
+}
+
+int main(void)
+{
+    XScuGic_Config *config;
+
+    shared->magic = 0;
+    Xil_SetTlbAttributes(AMP_SHARED_BASE, AMP_OCM_ATTRIBUTES);
+
+    // CPU interface only (USE_AMP): CPU0 has set up the distributor
+    config = XScuGic_LookupConfig(XPAR_SCUGIC_SINGLE_DEVICE_ID);
+    if (config == NULL || XScuGic_CfgInitialize(&gic, config, config->CpuBaseAddress) != XST_SUCCESS) {
+        return XST_FAILURE;
+    }
+    Xil_ExceptionInit();
+    Xil_ExceptionRegisterHandler(XIL_EXCEPTION_ID_INT,
+                                 (Xil_ExceptionHandler)XScuGic_InterruptHandler, &gic);
+    Xil_ExceptionEnable();
+
+    if (XGpio_Initialize(&pmod_motor_inst, MOTOR_DEVICE_ID) != XST_SUCCESS) {
+        return XST_FAILURE;
+    }
+    stepper_pmod_pins_to_output();
+    stepper_initialize();
+
+    // Serve the ring: telemetry first, so CPU0 never reads a stale block
+    amp_ring_init(&shared->commands);
+    estop_taken = shared->estop_request;
+    shared->telemetry.sequence = 0;
+    motion_core_publish(1);
+    __sync_synchronize();
+    shared->magic = AMP_MAGIC;
+
+    stepper_service_task(NULL);
+    return 0;
+}
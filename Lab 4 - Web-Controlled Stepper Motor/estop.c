@@ -0,0 +1,134 @@
+/*
+ * estop.c
+ * ----------------------------------------
+ * Interrupt-Driven Emergency Stop Implementation
+ *
+ * Description:
+ * Handles the buttons GPIO interrupt. A BTN0 press is accepted when the
+ * button reads pressed ESTOP_FILTER_READS times in a row after reading
+ * released for at least ESTOP_LOCKOUT_US. The release is timed from the
+ * first released edge after the button last read pressed, so bounce on
+ * either edge, and a press held for any length of time, counts as one
+ * press: emergency_task takes the next one as the clear. An accepted
+ * press decelerates the motor from inside the ISR, so the stop does not
+ * wait for any task to run.
+ *
+ * Key Functions:
+ * - estop_initialize(): Enables the buttons GPIO interrupt
+ * - estop_record_latency(): Adds a button-to-first-decel-step sample
+ * - estop_print_latency(): Prints the latency histogram
+ */
+
+#include "stepper.h"
+#include "gpio.h"
+#include "estop.h"
+
+static XGpio *estop_gpio;
+static u32  release_us;         // start of the current release
+static _Bool released;          // BTN0 read released since it last read pressed
+static estop_latency_stats_t latency_stats;
+
+static void estop_isr(void *callback_ref);
+
+
+/*
+ * Hook the buttons GPIO interrupt. The GPIO must already be initialized
+ * with BTN0 as an input.
+ */
+int estop_initialize(XGpio *button_gpio)
+{
+    estop_gpio = button_gpio;
+    // Up at boot: the first press is accepted
+    released   = 1;
+    release_us = step_timer_get_time_us() - ESTOP_LOCKOUT_US;
+
+    if (xPortInstallInterruptHandler(ESTOP_INTR_ID, estop_isr, NULL) != pdPASS) {
+        return XST_FAILURE;
+    }
+    XGpio_InterruptEnable(estop_gpio, XGPIO_IR_CH1_MASK);
+    XGpio_InterruptGlobalEnable(estop_gpio);
+    vPortEnableInterrupt(ESTOP_INTR_ID);
+
+    return XST_SUCCESS;
+}
+
+/*
+ * Add one latency sample (us). Called from the step ISR on the first
+ * step of an emergency deceleration.
+ */
+void estop_record_latency(u32 latency_us)
+{
+    u32 bin = (latency_us > 0) ? (31 - __builtin_clz(latency_us)) : 0;
+
+    if (bin >= ESTOP_HISTOGRAM_BINS) {
+        bin = ESTOP_HISTOGRAM_BINS - 1;
+    }
+    latency_stats.bins[bin]++;
+    latency_stats.count++;
+    latency_stats.last_us = latency_us;
+    if (latency_us > latency_stats.max_us) {
+        latency_stats.max_us = latency_us;
+    }
+}
+
+/*
+ * Copy out the latency histogram.
+ */
+void estop_get_latency_stats(estop_latency_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    *stats = latency_stats;
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Print the latency histogram, skipping empty bins.
+ */
+void estop_print_latency(void)
+{
+    estop_latency_stats_t stats;
+    int i;
+
+    estop_get_latency_stats(&stats);
+    xil_printf("\nemergency stop latency: %lu stops, last %lu us, max %lu us, %lu edges filtered\n",
+               stats.count, stats.last_us, stats.max_us, stats.rejected);
+    for (i = 0; i < ESTOP_HISTOGRAM_BINS; i++) {
+        if (stats.bins[i] != 0) {
+            xil_printf("  %6lu - %6lu us: %lu\n",
+                       (i == 0) ? 0UL : (1UL << i), (2UL << i) - 1, stats.bins[i]);
+        }
+    }
+}
+
+static void estop_isr(void *callback_ref)
+{
+    const u8 emergency_signal = 1;
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    u32 press_us = step_timer_get_time_us();
+    int i;
+
+    XGpio_InterruptClear(estop_gpio, XGPIO_IR_CH1_MASK);
+
+    // Bounce filter: BTN0 must read pressed every time...
+    for (i = 0; i < ESTOP_FILTER_READS; i++) {
+        if (!(XGpio_DiscreteRead(estop_gpio, BUTTONS_CHANNEL) & ESTOP_BUTTON_MASK)) {
+            // Release edge or glitch: time the release from its first edge
+            if (!released) {
+                released   = 1;
+                release_us = press_us;
+            }
+            return;
+        }
+    }
+    // ...after a release that lasted, not bounce around a press or release
+    if (!released || (press_us - release_us) < ESTOP_LOCKOUT_US) {
+        released = 0;
+        latency_stats.rejected++;
+        return;
+    }
+    released = 0;
+
+    stepper_emergency_stop_from_isr(press_us, ESTOP_DECEL);
+    xQueueSendFromISR(emergency_queue, &emergency_signal, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
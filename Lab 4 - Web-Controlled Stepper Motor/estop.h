@@ -0,0 +1,52 @@
+/*
+ * estop.h
+ * ----------------------------------------
+ * Interrupt-Driven Emergency Stop Interface
+ *
+ * Description:
+ * BTN0 raises the AXI GPIO (buttons) interrupt. The ISR filters contact
+ * bounce, starts a fast deceleration directly in the step engine and
+ * then signals emergency_task through emergency_queue. The time from the
+ * button edge to the first step of the deceleration is kept in a latency
+ * histogram that the console prints with the "latency" command.
+ *
+ * The buttons GPIO must have its interrupt output connected to the GIC
+ * in the hardware design (IP2INTC_Irpt).
+ *
+ * Definitions:
+ * - ESTOP_INTR_ID:          GIC interrupt of the buttons GPIO
+ * - ESTOP_BUTTON_MASK:      BTN0 in the buttons channel
+ * - ESTOP_FILTER_READS:     Consecutive pressed reads needed to accept an edge
+ * - ESTOP_LOCKOUT_US:       BTN0 must read released this long before the next
+ *                           press is accepted
+ * - ESTOP_DECEL:            Emergency deceleration (steps/s^2)
+ * - ESTOP_HISTOGRAM_BINS:   Latency bins; bin i counts [2^i, 2^(i+1)) us
+ */
+
+#ifndef SRC_ESTOP_H_
+#define SRC_ESTOP_H_
+
+#include "xgpio.h"
+#include "xil_types.h"
+
+#define ESTOP_INTR_ID         XPAR_FABRIC_AXI_GPIO_INPUTS_IP2INTC_IRPT_INTR
+#define ESTOP_BUTTON_MASK     0x01
+#define ESTOP_FILTER_READS    4
+#define ESTOP_LOCKOUT_US      50000
+#define ESTOP_DECEL           2000
+#define ESTOP_HISTOGRAM_BINS  16
+
+typedef struct {
+    u32 bins[ESTOP_HISTOGRAM_BINS];
+    u32 count;
+    u32 last_us;
+    u32 max_us;
+    u32 rejected;       // pressed edges dropped before a whole release (bounce)
+} estop_latency_stats_t;
+
+int  estop_initialize(XGpio *button_gpio);
+void estop_record_latency(u32 latency_us);
+void estop_get_latency_stats(estop_latency_stats_t *stats);
+void estop_print_latency(void);
+
+#endif /* SRC_ESTOP_H_ */
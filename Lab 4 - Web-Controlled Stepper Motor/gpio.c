@@ -9,6 +9,8 @@
  * Description:
  * This file defines FreeRTOS tasks for:
  * - pushbutton_task: Reads button states and sends them to the appropriate queues.
+ *   BTN0 (emergency stop) is interrupt driven, see estop.c. BTN1/BTN2
+ *   lower/raise the feed-rate override by STEPPER_FEED_STEP, BTN3 resets it.
  * - led_task: Displays an LED animation based on the motor step mode.
  */
 
@@ -17,6 +19,9 @@
 #include <stdbool.h>
 
 #define BTN0_MASK 0x01
+#define BTN1_MASK 0x02
+#define BTN2_MASK 0x04
+#define BTN3_MASK 0x08
 #define POLLING_PERIOD pdMS_TO_TICKS(100)
 extern volatile bool emergencyActive = false;
 
@@ -26,27 +31,29 @@ void pushbutton_task(void *p)
 {
     u8 button_val;
     u8 last_button_val = 0;
-    int btn0_press_duration = 0;
-    const u8 emergencySignal = 1;  // signal value sent to emergency_queue
+    u32 changed;
 
     while(1) {
         // Read current button states
         button_val = XGpio_DiscreteRead(&buttons, BUTTONS_CHANNEL);
 
-        // Check BTN0 (assume mask is 0x01)
-        if (button_val & 0x01) {
-            btn0_press_duration++;
-        } else {
-            btn0_press_duration = 0; // reset counter if BTN0 not pressed
-        }
-
-        // Trigger emergency if BTN0 pressed for 3 consecutive polling cycles
-        if(btn0_press_duration == 3){
-            xil_printf("Emergency!!! Sending signal...\n");
-
-            // Send emergency signal
-            if (xQueueSend(emergency_queue, &emergencySignal, 0) != pdPASS) {
-                xil_printf("Failed to send emergency signal!\n");
+        // BTN0 (emergency stop) is handled by the GPIO interrupt in
+        // estop.c; report changes of the other buttons
+        changed = (button_val ^ last_button_val) & ~BTN0_MASK;
+        if (changed) {
+            u32 pressed = button_val & ~BTN0_MASK;
+            xQueueSend(button_queue, &pressed, 0);
+
+            // Feed-rate override on press
+            if (changed & pressed & BTN1_MASK) {
+                stepper_set_feed_override(stepper_get_feed_override() - STEPPER_FEED_STEP);
+            } else if (changed & pressed & BTN2_MASK) {
+                stepper_set_feed_override(stepper_get_feed_override() + STEPPER_FEED_STEP);
+            } else if (changed & pressed & BTN3_MASK) {
+                stepper_set_feed_override(100);
+            }
+            if (changed & pressed & (BTN1_MASK | BTN2_MASK | BTN3_MASK)) {
+                xil_printf("feed override %lu%%\n", stepper_get_feed_override());
             }
         }
 
@@ -0,0 +1,387 @@
+/*
+ * httpd.c
+ * ----------------------------------------
+ * Event-Driven HTTP Connection Implementation
+ *
+ * Description:
+ * The poll() loop and per-connection state machines of the HTTP server
+ * (see httpd.h). Every pass builds the poll set from the connection
+ * slots (the listening socket only while a slot is free), closes the
+ * connections past their timeout and sleeps until a socket is ready or
+ * the next timeout falls due.
+ *
+ * Key Functions:
+ * - httpd_serve(): Listens on a port and runs the loop (never returns
+ *   unless the socket cannot be set up)
+ * - httpd_attach(): Sends a handler's own buffer after the response
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lwip/sockets.h"
+#include "xil_printf.h"
+#include "task.h"
+#include "httpd.h"
+
+#define HTTPD_TIMEOUT_TICKS  pdMS_TO_TICKS(HTTPD_TIMEOUT_MS)
+
+static httpd_connection_t connections[HTTPD_MAX_CONNECTIONS];
+static volatile httpd_stats_t httpd_stats;
+
+
+static _Bool httpd_would_block(void)
+{
+    return errno == EWOULDBLOCK || errno == EAGAIN;
+}
+
+static void httpd_set_nonblocking(int sd)
+{
+    lwip_fcntl(sd, F_SETFL, O_NONBLOCK);
+}
+
+static void httpd_write(httpd_connection_t *c);
+
+static void httpd_close(httpd_connection_t *c)
+{
+    if (c->release != NULL) {
+        c->release(c->release_context);
+    }
+    close(c->sd);
+    c->state = HTTPD_FREE;
+    httpd_stats.open--;
+}
+
+/*
+ * Move a connection to WRITING with a response formatted in place.
+ */
+static void httpd_respond(httpd_connection_t *c)
+{
+    c->response_length = strlen(c->response);
+    c->sent  = 0;
+    c->state = HTTPD_WRITING;
+}
+
+/*
+ * Does the header line at line start with name? Header names are case
+ * insensitive (RFC 9110); name is given in lower case.
+ */
+static _Bool httpd_header_is(const char *line, const char *name)
+{
+    while (*name != '\0') {
+        if (tolower((unsigned char)*line) != *name) {
+            return 0;
+        }
+        line++;
+        name++;
+    }
+    return 1;
+}
+
+/*
+ * Content-Length of the request, 0 if it has none. Returns 0 on
+ * success, -1 if the value is not a plain decimal number (a sign, no
+ * digits, trailing junk) or does not fit an unsigned long.
+ */
+static int httpd_content_length(const char *request, const char *headers_end, u32 *length)
+{
+    const char *line = strstr(request, "\r\n");
+    const char *value;
+    char *end;
+    unsigned long parsed;
+
+    *length = 0;
+    while (line != NULL && line < headers_end) {
+        line += 2;
+        if (httpd_header_is(line, "content-length:")) {
+            value = line + 15;
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+            if (*value < '0' || *value > '9') {
+                return -1;
+            }
+            errno = 0;
+            parsed = strtoul(value, &end, 10);
+            while (*end == ' ' || *end == '\t') {
+                end++;
+            }
+            if (errno == ERANGE || end[0] != '\r' || end[1] != '\n') {
+                return -1;
+            }
+            *length = (parsed > HTTPD_REQUEST_SIZE) ? HTTPD_REQUEST_SIZE : (u32)parsed;
+            return 0;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return 0;
+}
+
+/*
+ * Whole request in the buffer? Returns 1 if so (the request line is
+ * then NUL-terminated and the body found), 0 if more is to come, -1 if
+ * it cannot fit, -2 if its Content-Length is not a valid length.
+ */
+static int httpd_parse(httpd_connection_t *c)
+{
+    char *headers_end = strstr(c->request, "\r\n\r\n");
+    char *line_end;
+    u32 header_size, length;
+
+    if (headers_end == NULL) {
+        return (c->received >= HTTPD_REQUEST_SIZE - 1) ? -1 : 0;
+    }
+    header_size = (u32)(headers_end + 4 - c->request);
+    if (httpd_content_length(c->request, headers_end, &length) < 0) {
+        return -2;
+    }
+    if (length > HTTPD_REQUEST_SIZE - 1 - header_size) {
+        return -1;
+    }
+    if (c->received < header_size + length) {
+        return 0;
+    }
+
+    c->body        = (length > 0) ? headers_end + 4 : NULL;
+    c->body_length = length;
+    line_end = strstr(c->request, "\r\n");
+    *line_end = '\0';
+    return 1;
+}
+
+/*
+ * READING: take what has arrived and run the handler once the request
+ * is complete.
+ */
+static void httpd_read(httpd_connection_t *c, httpd_handler_t handler)
+{
+    int n = read(c->sd, c->request + c->received, HTTPD_REQUEST_SIZE - 1 - c->received);
+    int complete;
+
+    if (n <= 0) {
+        if (n < 0 && httpd_would_block()) {
+            return;
+        }
+        httpd_stats.dropped++;
+        httpd_close(c);
+        return;
+    }
+    c->received += n;
+    c->request[c->received] = '\0';
+    c->last_progress = xTaskGetTickCount();
+
+    complete = httpd_parse(c);
+    if (complete == -2) {
+        httpd_stats.malformed++;
+        snprintf(c->response, sizeof(c->response),
+                 "HTTP/1.1 400 Bad Request\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Connection: close\r\n\r\n"
+                 "{\"error\": \"Invalid Content-Length\"}");
+        httpd_respond(c);
+    } else if (complete < 0) {
+        httpd_stats.oversized++;
+        snprintf(c->response, sizeof(c->response),
+                 "HTTP/1.1 413 Payload Too Large\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Connection: close\r\n\r\n"
+                 "{\"error\": \"Request over %d bytes\"}", HTTPD_REQUEST_SIZE - 1);
+        httpd_respond(c);
+    } else if (complete > 0) {
+        c->response[0] = '\0';
+        handler(c);
+        httpd_respond(c);
+    } else {
+        return;
+    }
+    // Most responses fit the socket's send buffer: no need to wait a pass
+    httpd_write(c);
+}
+
+/*
+ * WRITING: send as much as the socket takes; close once all is out.
+ */
+static void httpd_write(httpd_connection_t *c)
+{
+    int n;
+
+    if (c->sent < c->response_length) {
+        n = write(c->sd, c->response + c->sent, c->response_length - c->sent);
+    } else {
+        n = write(c->sd, c->attached + (c->sent - c->response_length),
+                  c->attached_length - (c->sent - c->response_length));
+    }
+    if (n < 0) {
+        if (httpd_would_block()) {
+            return;
+        }
+        httpd_stats.dropped++;
+        httpd_close(c);
+        return;
+    }
+    c->sent += n;
+    c->last_progress = xTaskGetTickCount();
+    if (c->sent == c->response_length + c->attached_length) {
+        httpd_stats.served++;
+        httpd_close(c);
+    }
+}
+
+/*
+ * Accept waiting clients into free slots.
+ */
+static void httpd_accept(int sock)
+{
+    u32 i;
+
+    for (i = 0; i < HTTPD_MAX_CONNECTIONS; i++) {
+        httpd_connection_t *c = &connections[i];
+        struct sockaddr_in remote;
+        socklen_t size = sizeof(remote);
+        int sd;
+
+        if (c->state != HTTPD_FREE) {
+            continue;
+        }
+        sd = lwip_accept(sock, (struct sockaddr *)&remote, &size);
+        if (sd < 0) {
+            return;
+        }
+        httpd_set_nonblocking(sd);
+        c->sd              = sd;
+        c->state           = HTTPD_READING;
+        c->last_progress   = xTaskGetTickCount();
+        c->request[0]      = '\0';
+        c->received        = 0;
+        c->body            = NULL;
+        c->attached        = NULL;
+        c->attached_length = 0;
+        c->release         = NULL;
+
+        httpd_stats.accepted++;
+        httpd_stats.open++;
+        if (httpd_stats.open > httpd_stats.peak) {
+            httpd_stats.peak = httpd_stats.open;
+        }
+    }
+}
+
+/*
+ * Send length bytes of data after the response; release(context) is
+ * called once they are sent or the connection is dropped. The buffer
+ * must stay valid until then. Handler only.
+ */
+void httpd_attach(httpd_connection_t *connection, const void *data, u32 length,
+                  httpd_release_t release, void *context)
+{
+    connection->attached        = data;
+    connection->attached_length = length;
+    connection->release         = release;
+    connection->release_context = context;
+}
+
+/*
+ * Listen on port and serve clients with handler, forever. Returns only
+ * if the listening socket cannot be set up.
+ */
+void httpd_serve(u16 port, httpd_handler_t handler)
+{
+    struct pollfd fds[HTTPD_MAX_CONNECTIONS + 1];
+    httpd_connection_t *polled[HTTPD_MAX_CONNECTIONS + 1];
+    struct sockaddr_in address;
+    int sock;
+
+    memset(&address, 0, sizeof(address));
+    if ((sock = lwip_socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        xil_printf("Error creating socket.\r\n");
+        return;
+    }
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = INADDR_ANY;
+    if (lwip_bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        xil_printf("Error on lwip_bind.\r\n");
+        close(sock);
+        return;
+    }
+    lwip_listen(sock, HTTPD_BACKLOG);
+    httpd_set_nonblocking(sock);
+
+    while (1) {
+        TickType_t now = xTaskGetTickCount();
+        TickType_t wait = portMAX_DELAY;
+        int nfds = 0;
+        int i;
+
+        if (httpd_stats.open < HTTPD_MAX_CONNECTIONS) {
+            fds[nfds].fd     = sock;
+            fds[nfds].events = POLLIN;
+            polled[nfds++]   = NULL;
+        }
+        for (i = 0; i < HTTPD_MAX_CONNECTIONS; i++) {
+            httpd_connection_t *c = &connections[i];
+            TickType_t idle;
+
+            if (c->state == HTTPD_FREE) {
+                continue;
+            }
+            idle = now - c->last_progress;
+            if (idle >= HTTPD_TIMEOUT_TICKS) {
+                httpd_stats.timeouts++;
+                httpd_close(c);
+                continue;
+            }
+            if (HTTPD_TIMEOUT_TICKS - idle < wait) {
+                wait = HTTPD_TIMEOUT_TICKS - idle;
+            }
+            fds[nfds].fd     = c->sd;
+            fds[nfds].events = (c->state == HTTPD_READING) ? POLLIN : POLLOUT;
+            polled[nfds++]   = c;
+        }
+        if (nfds == 0) {
+            // Every slot timed out this pass; the listener is back next pass
+            continue;
+        }
+
+        if (poll(fds, nfds, (wait == portMAX_DELAY) ? -1 : (int)(wait * portTICK_PERIOD_MS)) <= 0) {
+            continue;
+        }
+        for (i = 0; i < nfds; i++) {
+            httpd_connection_t *c = polled[i];
+
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            if (c == NULL) {
+                httpd_accept(sock);
+            } else if (c->state == HTTPD_READING) {
+                httpd_read(c, handler);
+            } else {
+                httpd_write(c);
+            }
+        }
+    }
+}
+
+/*
+ * Copy out the connection counters.
+ */
+void httpd_get_stats(httpd_stats_t *stats)
+{
+    *stats = *(httpd_stats_t *)&httpd_stats;
+}
+
+/*
+ * Print the connection counters.
+ */
+void httpd_print_stats(void)
+{
+    httpd_stats_t stats;
+
+    httpd_get_stats(&stats);
+    xil_printf("http: %lu open (peak %lu of %d), %lu accepted, %lu served, %lu timed out, %lu oversized, %lu malformed, %lu dropped\n",
+               stats.open, stats.peak, HTTPD_MAX_CONNECTIONS, stats.accepted, stats.served,
+               stats.timeouts, stats.oversized, stats.malformed, stats.dropped);
+}
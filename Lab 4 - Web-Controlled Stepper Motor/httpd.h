@@ -0,0 +1,101 @@
+/*
+ * httpd.h
+ * ----------------------------------------
+ * Event-Driven HTTP Connection Interface
+ *
+ * Description:
+ * One thread serves up to HTTPD_MAX_CONNECTIONS clients at once: a
+ * poll() loop over the listening socket and every open connection, all
+ * non-blocking. Each connection is a small state machine:
+ *
+ *   READING  request bytes arrive in as many pieces as the client sends
+ *            them, until the header block is complete and, with a
+ *            Content-Length, the body too; then the handler runs
+ *   WRITING  the response, and any body attached to it, goes out as
+ *            fast as the socket takes it
+ *
+ * and the connection is closed once the response is out (Connection:
+ * close, as before). A connection that makes no progress for
+ * HTTPD_TIMEOUT_MS is closed, so a slow or stalled client only holds
+ * its own slot. While every slot is taken, new clients wait in the
+ * listen backlog (HTTPD_BACKLOG; lwipopts.h needs TCP_LISTEN_BACKLOG
+ * for lwIP to hold them). With no connection open the loop sleeps in
+ * poll() until a client connects.
+ *
+ * The handler (server.c) gets the whole request: the request line,
+ * NUL-terminated, at the start of request, and the body, if any. It
+ * formats the response into response and may attach a longer body from
+ * its own buffer with httpd_attach(), released once sent. A request
+ * whose Content-Length (header name in any case) is not a plain decimal
+ * number gets 400 Bad Request, one too long for HTTPD_REQUEST_SIZE 413.
+ *
+ * Only socket calls lwIP and POSIX share are used, so
+ * tools/host/http_load.c runs this loop on a host.
+ *
+ * Definitions:
+ * - HTTPD_MAX_CONNECTIONS: Clients served at once
+ * - HTTPD_BACKLOG:         Clients waiting to be accepted
+ * - HTTPD_TIMEOUT_MS:      A connection idle this long is closed
+ * - HTTPD_REQUEST_SIZE:    Largest request, headers and body (2kB)
+ * - HTTPD_RESPONSE_SIZE:   Largest formatted response (1kB)
+ */
+
+#ifndef SRC_HTTPD_H_
+#define SRC_HTTPD_H_
+
+#include "xil_types.h"
+#include "FreeRTOS.h"
+
+#define HTTPD_MAX_CONNECTIONS  8
+#define HTTPD_BACKLOG          8
+#define HTTPD_TIMEOUT_MS       5000
+#define HTTPD_REQUEST_SIZE     2048
+#define HTTPD_RESPONSE_SIZE    1024
+
+typedef enum {
+    HTTPD_FREE,
+    HTTPD_READING,
+    HTTPD_WRITING
+} httpd_state_t;
+
+// Called once an attached body has been sent, or the connection dropped
+typedef void (*httpd_release_t)(void *context);
+
+typedef struct {
+    int           sd;
+    httpd_state_t state;
+    TickType_t    last_progress;
+    char          request[HTTPD_REQUEST_SIZE];   // NUL-terminated
+    u32           received;
+    char         *body;                          // NULL without a body
+    u32           body_length;
+    char          response[HTTPD_RESPONSE_SIZE]; // NUL-terminated
+    u32           response_length;
+    u32           sent;                          // response, then attached
+    const u8     *attached;
+    u32           attached_length;
+    httpd_release_t release;
+    void         *release_context;
+} httpd_connection_t;
+
+// Formats the response to a complete request
+typedef void (*httpd_handler_t)(httpd_connection_t *connection);
+
+typedef struct {
+    u32 accepted;           // connections accepted
+    u32 served;             // responses sent whole
+    u32 timeouts;           // connections closed for making no progress
+    u32 oversized;          // requests that did not fit HTTPD_REQUEST_SIZE
+    u32 malformed;          // requests with an invalid Content-Length
+    u32 dropped;            // closed by the client or a socket error
+    u32 open;               // connections open now
+    u32 peak;               // most connections open at once
+} httpd_stats_t;
+
+void httpd_serve(u16 port, httpd_handler_t handler);
+void httpd_attach(httpd_connection_t *connection, const void *data, u32 length,
+                  httpd_release_t release, void *context);
+void httpd_get_stats(httpd_stats_t *stats);
+void httpd_print_stats(void);
+
+#endif /* SRC_HTTPD_H_ */
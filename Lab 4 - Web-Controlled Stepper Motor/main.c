@@ -12,17 +12,34 @@
  * following tasks:
  *
  * - stepper_control_task:
- *   Receives motor parameters via a queue and configures the stepper motor
- *   using functions from stepper.c. Executes absolute motion and sends visual
- *   feedback to the LED task.
+ *   Receives motor parameters via a queue through the look-ahead planner
+ *   (planner.c) and configures the stepper motor using functions from
+ *   stepper.c. Starts absolute moves without blocking, carrying speed
+ *   through same-direction targets with no dwell, keeps accepting new
+ *   targets while the motor runs, and sends visual feedback to the LED
+ *   task. A target sent with rt=1 takes over at once, even mid-move or
+ *   mid-dwell, replanning from the current position and speed. Targets
+ *   sent through the urgent lane (ur=1) run ahead of the queued
+ *   sequence, interrupting the segment in progress, which then runs
+ *   again. The steps themselves are planned by the stepper service task. While no
+ *   target is queued it follows a streamed trajectory (stream.c) or runs
+ *   an uploaded motion program (program.c). A target with a start time
+ *   (st=) waits for it on the leader board's clock (timesync.c), so
+ *   several boards can start moves together; a follower not synced yet
+ *   holds it until it is.
  *
  * - pushbutton_task:
  *   Monitors the state of pushbuttons and triggers corresponding events.
  *
  * - emergency_task:
- *   Executes an emergency stop when Btn0 is pressed for three consecutive
- *   polling cycles. The motor decelerates to a stop, and a red LED flashes at
- *   2 Hz to indicate the emergency state.
+ *   Handles an emergency stop signalled by the Btn0 interrupt (estop.c).
+ *   The button ISR has already started a fast deceleration in the step
+ *   engine; the task waits for the motor to stop, releases the coils and
+ *   flashes a red LED at 2 Hz to indicate the emergency state. A second
+ *   press releases the stop and restarts the motor task.
+ *
+ * - console_task:
+ *   UART command console for diagnostics (console.c).
  *
  * - led_task:
  *   Controls visual feedback using on-board LEDs based on system state.
@@ -32,6 +49,10 @@
  *   Supports up to 25 (target position, dwell time) pairs and communicates
  *   them to stepper_control_task through a queue.
  *
+ * Built with STEPPER_AMP, the step engine (step ISR and step planning)
+ * runs on the second Cortex-A9 instead (cpu1/motion_core.c) and these
+ * tasks reach it through motion_link.c; see amp_link.h.
+ *
  * Hardware Used:
  * - PMOD for motor signals (JC PMOD)
  * - AXI GPIOs for buttons, LEDs, and motor control
@@ -42,6 +63,7 @@
  * - Final Position (steps)
  * - Rotational Speed (steps/sec)
  * - Acceleration / Deceleration (steps/sec�)
+ * - Motion Profile (trapezoid or jerk-limited S-curve) and Jerk (steps/sec^3)
  * - Dwell Time (ms)
  *
  */
@@ -50,7 +72,13 @@
 #include <stdbool.h>
 #include "network.h"
 #include "stepper.h"
+#include "planner.h"
+#include "program.h"
+#include "stream.h"
+#include "timesync.h"
 #include "gpio.h"
+#include "estop.h"
+#include "console.h"
 
 #define BUTTONS_DEVICE_ID 	XPAR_AXI_GPIO_INPUTS_DEVICE_ID
 #define GREEN_LED_DEVICE_ID XPAR_GPIO_1_DEVICE_ID
@@ -78,6 +106,9 @@ XGpio RGB;
 #define POLLING_PERIOD pdMS_TO_TICKS(100)
 
 static void stepper_control_task( void *pvParameters );
+static void apply_segment_parameters(const planner_segment_t *segment);
+static _Bool run_urgent_lane(void);
+static _Bool wait_start_time(planner_segment_t *segment);
 static void emergency_task( void *pvParameters );
 static void toggleLED(void *pvParameters);
 int Initialize_UART();
@@ -88,6 +119,7 @@ TaskHandle_t togleledHandle = NULL;
 
 QueueHandle_t button_queue    = NULL;
 QueueHandle_t motor_queue     = NULL;
+QueueHandle_t motor_urgent_queue = NULL;
 QueueHandle_t emergency_queue = NULL;
 QueueHandle_t led_queue       = NULL;
 QueueHandle_t rgb_queue       = NULL;
@@ -117,17 +149,26 @@ int main()
 	motor_parameters.rotational_speed = 0.0;
 	motor_parameters.rotational_accel = 0.0;
 	motor_parameters.rotational_decel = 0.0;
+	motor_parameters.motion_profile   = PROFILE_TRAPEZOID;
+	motor_parameters.rotational_jerk  = 0.0;
+	motor_parameters.retarget         = 0;
+	motor_parameters.rotary           = 0;
+	motor_parameters.full_step_cruise = 0;
+	motor_parameters.urgent           = 0;
+	motor_parameters.start_at_us      = 0;
 
     button_queue    = xQueueCreate(1, sizeof(u32));
     led_queue       = xQueueCreate(1, sizeof(u8));
     rgb_queue       = xQueueCreate(1, sizeof(RgbLedState));
     motor_queue     = xQueueCreate( 25, sizeof(motor_parameters_t) );
+    motor_urgent_queue = xQueueCreate( 5, sizeof(motor_parameters_t) );
     emergency_queue = xQueueCreate(1, sizeof(u8));
 
     configASSERT(led_queue);
     configASSERT(emergency_queue);
     configASSERT(button_queue);
 	configASSERT(motor_queue);
+	configASSERT(motor_urgent_queue);
 
 	// Initialize the PMOD for motor signals (JC PMOD is being used)
 	status = XGpio_Initialize(&pmod_motor_inst, MOTOR_DEVICE_ID);
@@ -155,6 +196,14 @@ int main()
 
     XGpio_SetDataDirection(&buttons, BUTTONS_CHANNEL, 0xFF);
 
+    // Btn0 emergency stop on the buttons GPIO interrupt
+    status = estop_initialize(&buttons);
+
+    if (status != XST_SUCCESS) {
+        xil_printf("Emergency stop interrupt setup failed\r\n");
+        return XST_FAILURE;
+    }
+
     // TODO: Initialize green LEDS
     status = XGpio_Initialize(&green_leds, GREEN_LED_DEVICE_ID);
 
@@ -201,6 +250,14 @@ int main()
 			   , NULL
 			   );
 
+    xTaskCreate( console_task
+			   , "ConsoleTask"
+			   , THREAD_STACKSIZE
+			   , NULL
+			   , DEFAULT_THREAD_PRIO - 1
+			   , NULL
+			   );
+
     sys_thread_new( "main_thrd"
 				  , (void(*)(void*))main_thread
 				  , 0
@@ -218,35 +275,179 @@ static void stepper_control_task( void *pvParameters )
 	u32 loops=0;
 	const u8 stop_animation = 0;
 	long motor_position = 0;
+	planner_segment_t segment;
+	stepper_move_handle_t move;
+	_Bool retargeted;
+	TickType_t dwell_start;
 
 	stepper_pmod_pins_to_output();
 	stepper_initialize();
+	planner_reset();
+	program_abort();
+	stream_abort();
+
+#ifdef STEPPER_RAMP_BENCHMARK
+	// stepper_initialize() leaves decel at 0 until the first /setParams
+	stepper_set_speed(2048.0f / 4.0f);
+	stepper_set_accel(2048.0f / 10.0f);
+	stepper_set_decel(2048.0f / 10.0f);
+	// Float vs fixed-point ramp: cycles per step and timestamp deviation
+	stepper_ramp_benchmark(STEPS_PER_REVOLUTION_FULL_DRIVE, NULL);
+	// Planned step times of the trapezoid and S-curve profiles
+	stepper_set_profile(PROFILE_S_CURVE, 2000.0f);
+	stepper_profile_compare(STEPS_PER_REVOLUTION_FULL_DRIVE / 2);
+	stepper_set_profile(PROFILE_TRAPEZOID, 0.0f);
+	// Coil output: legacy if/switch chain vs table-driven step path
+	stepper_output_benchmark(STEPS_PER_REVOLUTION_FULL_DRIVE);
+#endif
 
 	while(1){
-		// get the motor parameters from the queue. The structure "motor_parameters" stores the received data.
-		while(xQueueReceive(motor_queue, &motor_parameters, 0)!= pdPASS){
+		// Urgent targets go ahead of the sequence
+		run_urgent_lane();
+
+		// get the next segment from the look-ahead planner, which pulls the
+		// motor parameters from the queue. The structure "motor_parameters"
+		// stores the received data.
+		while(!planner_next_segment(motor_queue, &segment)){
+			if (run_urgent_lane()) {
+				continue;
+			}
+			if (stream_pending()) {
+				// Follow a setpoint stream until the client is done
+				stream_execute();
+				continue;
+			}
+			if (program_run_pending()) {
+				// Targets queued meanwhile run after the program
+				program_execute();
+				continue;
+			}
 			vTaskDelay(POLLING_PERIOD); // polling period
 		}
-		xil_printf("\nreceived a package on motor queue. motor parameters:\n");
-		stepper_set_speed(motor_parameters.rotational_speed);
-		stepper_set_accel(motor_parameters.rotational_accel);
-		stepper_set_decel(motor_parameters.rotational_decel);
-		stepper_set_pos(motor_parameters.current_position);
-		stepper_set_step_mode(motor_parameters.step_mode);
-		xil_printf("\npars:\n");
-		xQueueSend(led_queue, &motor_parameters.step_mode, 0);
-		xil_printf("Sent step mode %d to LED task\n", motor_parameters.step_mode);
-		motor_position = stepper_get_pos();
-		stepper_move_abs(motor_parameters.final_position);
-		xQueueSend(led_queue, &stop_animation, 0);
-		motor_position = stepper_get_pos();
-		xil_printf("finished on position: %lli", motor_position);
-		vTaskDelay(motor_parameters.dwell_time);
+		do {
+			motor_parameters = segment.params;
+			xil_printf("\nreceived a package on motor queue. motor parameters:\n");
+			apply_segment_parameters(&segment);
+			if (!segment.continuing && !segment.params.retarget && segment.params.start_at_us != 0 &&
+			    wait_start_time(&segment)) {
+				retargeted = 1;
+				continue;
+			}
+			motor_position = stepper_get_pos();
+			move = stepper_move_start(motor_parameters.final_position,
+			                          segment.entry_speed, segment.exit_speed, NULL, NULL);
+			retargeted = 0;
+			while (!retargeted && !stepper_move_wait(move, POLLING_PERIOD)) {
+				// Accept new commands into the look-ahead window while moving;
+				// urgent targets interrupt the segment, which then runs again
+				planner_fill(motor_queue);
+				retargeted = planner_take_retarget(stepper_get_pos(), &segment) ||
+				             (run_urgent_lane() && planner_resume_segment(&segment));
+			}
+			if (!retargeted && segment.exit_speed == 0.0f) {
+				stepper_disable_motor();
+				xQueueSend(led_queue, &stop_animation, 0);
+				motor_position = stepper_get_pos();
+				xil_printf("finished on position: %lli", motor_position);
+
+				// Dwell, cut short by a retarget
+				dwell_start = xTaskGetTickCount();
+				while (!retargeted && xTaskGetTickCount() - dwell_start < (TickType_t)motor_parameters.dwell_time) {
+					vTaskDelay(POLLING_PERIOD);
+					planner_fill(motor_queue);
+					retargeted = planner_take_retarget(stepper_get_pos(), &segment) ||
+					             (run_urgent_lane() && planner_resume_segment(&segment));
+				}
+			}
+			if (retargeted) {
+				xil_printf("\nreplanned to %ld from %ld\n", segment.params.final_position, stepper_get_pos());
+			}
+		} while (retargeted);
+		planner_segment_done();
 		loops++;
 		xil_printf("\n\nloops: %d\n", loops);
+		ramp_cache_print_stats();
+	}
+}
+
+
+/*
+ * Set up the driver for a segment. The step mode and position are only
+ * set when the motor is at rest.
+ */
+static void apply_segment_parameters(const planner_segment_t *segment)
+{
+	const motor_parameters_t *params = &segment->params;
+
+	stepper_set_speed(params->rotational_speed);
+	stepper_set_accel(params->rotational_accel);
+	stepper_set_decel(params->rotational_decel);
+	stepper_set_profile(params->motion_profile, params->rotational_jerk);
+	stepper_set_full_step_cruise(params->full_step_cruise);
+	if (!segment->continuing && !step_engine_running) {
+		// Retarget, rotary, urgent and resumed moves keep the position the
+		// motor is really at
+		if (!segment->keep_position) {
+			stepper_set_pos(segment->start_position);
+		}
+		stepper_set_step_mode(params->step_mode);
+		xil_printf("\npars:\n");
+		xQueueSend(led_queue, &params->step_mode, 0);
+		xil_printf("Sent step mode %d to LED task\n", params->step_mode);
+	}
+}
+
+/*
+ * Run the targets waiting in the urgent lane, oldest first. The first
+ * one takes over the sequence segment in progress from its current
+ * speed; each runs to its target and dwells there.
+ * Returns FALSE if the lane was empty.
+ */
+static _Bool run_urgent_lane(void)
+{
+	planner_segment_t urgent;
+	stepper_move_handle_t move;
+	_Bool ran = 0;
+
+	while (planner_take_urgent(motor_urgent_queue, stepper_get_pos(), &urgent)) {
+		xil_printf("\nurgent target %ld from %ld\n", urgent.params.final_position, stepper_get_pos());
+		apply_segment_parameters(&urgent);
+		move = stepper_move_start(urgent.params.final_position, 0.0f, 0.0f, NULL, NULL);
+		stepper_move_wait(move, portMAX_DELAY);
+		stepper_disable_motor();
+		vTaskDelay((TickType_t)urgent.params.dwell_time);
+		ran = 1;
 	}
+	return ran;
 }
 
+/*
+ * Hold a segment queued with a start time (st=) until that time on the
+ * leader clock (timesync.h), still taking retargets and urgent targets.
+ * A follower that is not synced yet holds it until it is. The last
+ * TIMESYNC_SPIN_US are busy-waited so the start is not rounded to a
+ * tick. Returns TRUE if the segment was replaced meanwhile.
+ */
+static _Bool wait_start_time(planner_segment_t *segment)
+{
+	s64 remaining_us;
+	_Bool synced;
+
+	while (!(synced = timesync_synced()) ||
+	       (remaining_us = timesync_until_us(segment->params.start_at_us)) > TIMESYNC_SPIN_US) {
+		TickType_t ticks = synced ? pdMS_TO_TICKS((u32)((remaining_us - TIMESYNC_SPIN_US) / 1000))
+		                          : POLLING_PERIOD;
+
+		vTaskDelay((ticks == 0) ? 1 : (ticks < POLLING_PERIOD) ? ticks : POLLING_PERIOD);
+		planner_fill(motor_queue);
+		if (planner_take_retarget(stepper_get_pos(), segment) ||
+		    (run_urgent_lane() && planner_resume_segment(segment))) {
+			return 1;
+		}
+	}
+	timesync_start_at(segment->params.start_at_us);
+	return 0;
+}
 
 static void emergency_task(void *pvParameters)
 {
@@ -254,10 +455,8 @@ static void emergency_task(void *pvParameters)
 
     for (;;) {
         if (xQueueReceive(emergency_queue, &emergency, portMAX_DELAY) == pdPASS) {
-            // Trigger graceful stop
+            // The button ISR has already started the fast deceleration
             if (motorTaskHandle != NULL) {
-		stepper_setup_stop();
-                stepper_disable_motor();
 		emergencyActive = true;
 		xTaskCreate( toggleLED
 		   , "toggleLED"
@@ -266,13 +465,18 @@ static void emergency_task(void *pvParameters)
 		   , DEFAULT_THREAD_PRIO
 		   , &togleledHandle
 		   );
-		while(stepper_get_speed() > 0){
-			vTaskDelay(POLLING_PERIOD);
+		while(step_engine_running){
+			vTaskDelay(pdMS_TO_TICKS(1));
 		}
+                // Coils stay energized until stopped, so no steps are lost
+                stepper_disable_motor();
                 vTaskDelete(motorTaskHandle);
                 motorTaskHandle = NULL;
+                xil_printf("Emergency stop at position %ld\n", stepper_get_pos());
+                estop_print_latency();
             } else {
             	vTaskDelete(togleledHandle);
+            	stepper_emergency_clear();
             	xTaskCreate( stepper_control_task
 		   , "Motor Task"
 		   , configMINIMAL_STACK_SIZE*10
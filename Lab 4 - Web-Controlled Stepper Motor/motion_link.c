@@ -0,0 +1,495 @@
+/*
+ * motion_link.c
+ * ----------------------------------------
+ * Step Engine Stand-In for CPU0 (AMP Build)
+ *
+ * Description:
+ * Built only with STEPPER_AMP, on CPU0. Provides the stepper.c calls the
+ * CPU0 tasks make (motor task, planner, programs, stream follower,
+ * server, console, buttons) by sending commands through the amp_link.h
+ * ring to the step engine on CPU1 and reading its telemetry block.
+ *
+ * The motion settings (speed, accel, decel, profile, jerk, full-step
+ * cruise) are kept in the stepper.h globals on this side and go to CPU1
+ * with each move. Calls that change what the caller reads next (move
+ * start, set position, initialize, clear) wait until CPU1 has applied
+ * them, which takes microseconds; the others return at once. CPU1 is
+ * released from the boot ROM by the first stepper_initialize().
+ *
+ * Not available across cores: move completion callbacks (no caller in
+ * the tree passes one), the step trace (the export is an empty trace),
+ * the ramp cache statistics (the cache is on CPU1), the ramp and output
+ * benchmarks and coordinated linear moves.
+ *
+ * Key Functions:
+ * - stepper_move_start() / stepper_move_wait(): Moves run by CPU1
+ * - stepper_get_telemetry(): From CPU1's telemetry block
+ * - stepper_emergency_stop_from_isr(): Raises CPU1's stop request
+ * - stepper_stream_step(): Streams one timed step to CPU1
+ */
+
+#include "stepper.h"
+
+#ifdef STEPPER_AMP_REMOTE
+
+#include "xil_io.h"
+#include "xil_mmu.h"
+#include "estop.h"
+#include "amp_link.h"
+
+#define MOTION_LINK_SPIN_POLLS  1000    // quick polls before sleeping a tick
+#define MOTION_LINK_BOOT_MS     1000    // CPU1 start-up, at most
+
+static amp_shared_t *const shared = AMP_SHARED;
+
+static _Bool link_up;
+static stepper_move_handle_t move_last_id;
+static _Bool full_step_cruise;
+static volatile u32 feed_override = 100;
+static int stream_dir;          // direction of the last stream step sent
+static u32 estop_stops_seen;
+
+
+/*
+ * Latest telemetry from CPU1. An emergency stop CPU1 has recorded since
+ * the last read goes into this core's latency histogram.
+ */
+static void motion_link_sample(amp_telemetry_t *sample)
+{
+    // Before CPU1 is up the block holds nothing yet
+    if (!link_up) {
+        memset(sample, 0, sizeof(*sample));
+        return;
+    }
+    amp_telemetry_read(&shared->telemetry, sample);
+
+    taskENTER_CRITICAL();
+    if (sample->estop_stops != estop_stops_seen) {
+        estop_stops_seen = sample->estop_stops;
+        estop_record_latency(sample->estop_latency_us);
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Add a command to the ring. The ring has one producer, so pushes from
+ * different tasks are serialized; a full ring is retried a tick later.
+ * Nothing is sent before CPU1 is up.
+ */
+static void motion_link_send(const amp_command_t *command)
+{
+    _Bool sent;
+
+    while (link_up) {
+        taskENTER_CRITICAL();
+        sent = amp_ring_push(&shared->commands, command);
+        taskEXIT_CRITICAL();
+        if (sent) {
+            return;
+        }
+        vTaskDelay(1);
+    }
+}
+
+/*
+ * Wait until CPU1 has applied every command sent, so its telemetry
+ * reflects them.
+ */
+static void motion_link_sync(void)
+{
+    u32 polls = 0;
+
+    while (link_up && amp_ring_level(&shared->commands) != 0) {
+        if (++polls > MOTION_LINK_SPIN_POLLS) {
+            vTaskDelay(1);
+        }
+    }
+}
+
+static void motion_link_command(amp_command_type_t type, amp_command_t *command)
+{
+    memset(command, 0, sizeof(*command));
+    command->type = type;
+}
+
+/*
+ * Map the shared block uncached and release CPU1 from the boot ROM.
+ * Returns XST_FAILURE if CPU1 does not come up.
+ */
+static int motion_link_start(void)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    Xil_SetTlbAttributes(AMP_SHARED_BASE, AMP_OCM_ATTRIBUTES);
+    if (shared->magic != AMP_MAGIC) {
+        Xil_Out32(AMP_CPU1_RELEASE, AMP_CPU1_ENTRY);
+        __sync_synchronize();
+        __asm__ volatile ("sev");
+    }
+    while (shared->magic != AMP_MAGIC) {
+        if (xTaskGetTickCount() - start > pdMS_TO_TICKS(MOTION_LINK_BOOT_MS)) {
+            return XST_FAILURE;
+        }
+        vTaskDelay(1);
+    }
+    return XST_SUCCESS;
+}
+
+_Bool motion_link_engine_running(void)
+{
+    amp_telemetry_t sample;
+
+    motion_link_sample(&sample);
+    return sample.running;
+}
+
+int motion_link_step_dir(void)
+{
+    amp_telemetry_t sample;
+
+    motion_link_sample(&sample);
+    return sample.queued_dir;
+}
+
+/*
+ * CPU1 owns the motor GPIO and sets it up itself.
+ */
+void stepper_pmod_pins_to_output(void)
+{
+}
+
+/*
+ * Start CPU1 on the first call, then reset its step engine as
+ * stepper_initialize() does on a single core.
+ */
+void stepper_initialize(void)
+{
+    amp_command_t command;
+
+    if (!link_up) {
+        if (motion_link_start() != XST_SUCCESS) {
+            xil_printf("Motion core did not start\n");
+            return;
+        }
+        link_up = 1;
+    }
+
+    target_speed   = 2048.0f / 4.0f;
+    accel          = 2048.0f / 10.0f;
+    motion_profile = PROFILE_TRAPEZOID;
+    jerk           = 2048.0f;
+
+    motion_link_command(AMP_CMD_INIT, &command);
+    motion_link_send(&command);
+    motion_link_command(AMP_CMD_STEP_MODE, &command);
+    command.step_mode = (u8)current_step_mode;
+    motion_link_send(&command);
+    // The override may have been set before CPU1 was up
+    motion_link_command(AMP_CMD_FEED, &command);
+    command.value = feed_override;
+    motion_link_send(&command);
+    motion_link_sync();
+}
+
+void stepper_set_step_mode(unsigned char new_mode)
+{
+    amp_command_t command;
+
+    current_step_mode = (step_mode_t)new_mode;
+    motion_link_command(AMP_CMD_STEP_MODE, &command);
+    command.step_mode = new_mode;
+    motion_link_send(&command);
+}
+
+/*
+ * Set current position (in steps) without causing rotation.
+ * Call only when the motor is at rest.
+ */
+void stepper_set_pos(long pos)
+{
+    amp_command_t command;
+
+    motion_link_command(AMP_CMD_SET_POS, &command);
+    command.position = (s32)pos;
+    motion_link_send(&command);
+    motion_link_sync();
+}
+
+long stepper_get_pos(void)
+{
+    amp_telemetry_t sample;
+
+    motion_link_sample(&sample);
+    return sample.position;
+}
+
+float stepper_get_speed(void)
+{
+    amp_telemetry_t sample;
+
+    motion_link_sample(&sample);
+    return sample.velocity;
+}
+
+void stepper_set_speed(float speed_sps)
+{
+    target_speed = speed_sps;
+}
+
+void stepper_set_accel(float accel_sps2)
+{
+    accel = accel_sps2;
+}
+
+void stepper_set_decel(float decel_sps2)
+{
+    decel = decel_sps2;
+}
+
+void stepper_set_profile(motion_profile_t profile, float jerk_sps3)
+{
+    motion_profile = profile;
+    jerk = jerk_sps3;
+}
+
+void stepper_set_full_step_cruise(_Bool enable)
+{
+    full_step_cruise = enable;
+}
+
+_Bool stepper_get_full_step_cruise(void)
+{
+    return full_step_cruise;
+}
+
+/*
+ * Clamped as on a single core; CPU1 applies it to the running move.
+ */
+void stepper_set_feed_override(u32 percent)
+{
+    amp_command_t command;
+
+    if (percent < STEPPER_FEED_MIN) {
+        percent = STEPPER_FEED_MIN;
+    } else if (percent > STEPPER_FEED_MAX) {
+        percent = STEPPER_FEED_MAX;
+    }
+    if (percent == feed_override) {
+        return;
+    }
+    feed_override = percent;
+
+    motion_link_command(AMP_CMD_FEED, &command);
+    command.value = percent;
+    motion_link_send(&command);
+}
+
+u32 stepper_get_feed_override(void)
+{
+    return feed_override;
+}
+
+/*
+ * Start a move on CPU1 with the current motion settings and return once
+ * CPU1 has set it up. callback must be NULL: completion is only seen
+ * through stepper_move_wait() and stepper_move_is_complete().
+ */
+stepper_move_handle_t stepper_move_start(long absolute_steps, float entry_speed, float exit_speed,
+                                         stepper_move_callback_t callback, void *context)
+{
+    amp_command_t command;
+
+    (void)callback;
+    (void)context;
+
+    move_last_id++;
+    if (move_last_id == 0) {
+        move_last_id = 1;
+    }
+    motion_link_command(AMP_CMD_MOVE, &command);
+    command.move             = move_last_id;
+    command.position         = (s32)absolute_steps;
+    command.entry_speed      = entry_speed;
+    command.exit_speed       = exit_speed;
+    command.speed            = target_speed;
+    command.accel            = accel;
+    command.decel            = decel;
+    command.jerk             = jerk;
+    command.profile          = (u8)motion_profile;
+    command.full_step_cruise = full_step_cruise;
+    motion_link_send(&command);
+    motion_link_sync();
+    return move_last_id;
+}
+
+_Bool stepper_move_is_complete(stepper_move_handle_t move)
+{
+    amp_telemetry_t sample;
+
+    motion_link_sample(&sample);
+    return (s32)(sample.move_done - move) >= 0;
+}
+
+/*
+ * Block until move completes or timeout ticks pass, polling CPU1's
+ * telemetry every tick. Returns TRUE if the move is complete.
+ */
+_Bool stepper_move_wait(stepper_move_handle_t move, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    while (!stepper_move_is_complete(move)) {
+        if (timeout != portMAX_DELAY && xTaskGetTickCount() - start >= timeout) {
+            return 0;
+        }
+        vTaskDelay(1);
+    }
+    return 1;
+}
+
+/*
+ * TRUE if the motor is at its target position, with nothing left in the
+ * ring for CPU1.
+ */
+_Bool stepper_motion_complete(void)
+{
+    amp_telemetry_t sample;
+
+    motion_link_sample(&sample);
+    return sample.complete && amp_ring_level(&shared->commands) == 0;
+}
+
+/*
+ * Free step FIFO entries on CPU1, less the stream steps still in the
+ * ring.
+ */
+u32 stepper_stream_space(void)
+{
+    amp_telemetry_t sample;
+    u32 queued = amp_ring_level(&shared->commands);
+
+    motion_link_sample(&sample);
+    return (sample.fifo_space > queued) ? sample.fifo_space - queued : 0;
+}
+
+/*
+ * Send one timed step (see stepper.c). Refused, as on a single core,
+ * while steps the other way are still queued or running; CPU1 counts
+ * any it still has to refuse in stream_rejected.
+ */
+_Bool stepper_stream_step(int direction, u32 step_time_us)
+{
+    amp_telemetry_t sample;
+    amp_command_t command;
+    _Bool sent;
+
+    motion_link_sample(&sample);
+    if (!link_up || sample.estop_latched || sample.estop_taken != shared->estop_request) {
+        return 0;
+    }
+    if (direction != stream_dir &&
+        (sample.running || amp_ring_level(&shared->commands) != 0)) {
+        return 0;
+    }
+
+    motion_link_command(AMP_CMD_STREAM_STEP, &command);
+    command.direction = direction;
+    command.value     = step_time_us;
+    taskENTER_CRITICAL();
+    sent = amp_ring_push(&shared->commands, &command);
+    taskEXIT_CRITICAL();
+    if (sent) {
+        stream_dir = direction;
+    }
+    return sent;
+}
+
+void stepper_get_telemetry(stepper_telemetry_t *telemetry)
+{
+    amp_telemetry_t sample;
+
+    motion_link_sample(&sample);
+    telemetry->position     = sample.position;
+    telemetry->velocity     = sample.velocity;
+    telemetry->direction    = sample.direction;
+    telemetry->phase        = sample.phase;
+    telemetry->move         = sample.move_started;
+    telemetry->timestamp_us = sample.timestamp_us;
+    telemetry->sequence     = sample.sequence;
+}
+
+/*
+ * The trace ring is in CPU1's memory: export an empty trace, so readers
+ * still get a valid header.
+ */
+u32 stepper_trace_export(stepper_trace_write_t write, void *context)
+{
+    stepper_trace_header_t header;
+
+    header.magic             = STEPPER_TRACE_MAGIC;
+    header.version           = STEPPER_TRACE_VERSION;
+    header.record_size       = sizeof(stepper_trace_record_t);
+    header.counts_per_second = step_timer_counts_per_second();
+    header.record_count      = 0;
+    header.lost              = 0;
+    return write(context, &header, sizeof(header)) ? sizeof(header) : 0;
+}
+
+/*
+ * Emergency stop from the button ISR: raise CPU1's stop request, which
+ * it polls ahead of everything else. The fast deceleration and its
+ * latency measurement run on CPU1. Returns TRUE if the motor was moving.
+ */
+_Bool stepper_emergency_stop_from_isr(u32 press_us, u32 decel_sps2)
+{
+    amp_telemetry_t sample;
+
+    if (!link_up) {
+        return 0;
+    }
+    amp_telemetry_read(&shared->telemetry, &sample);
+    shared->estop_press_us = press_us;
+    shared->estop_decel    = decel_sps2;
+    __sync_synchronize();
+    shared->estop_request  = shared->estop_request + 1;
+    return sample.running;
+}
+
+/*
+ * TRUE while an emergency stop is latched, or requested and not yet
+ * taken by CPU1.
+ */
+_Bool stepper_emergency_latched(void)
+{
+    amp_telemetry_t sample;
+
+    motion_link_sample(&sample);
+    return sample.estop_latched || sample.estop_taken != shared->estop_request;
+}
+
+void stepper_emergency_clear(void)
+{
+    amp_command_t command;
+
+    motion_link_command(AMP_CMD_ESTOP_CLEAR, &command);
+    motion_link_send(&command);
+    motion_link_sync();
+}
+
+void stepper_disable_motor(void)
+{
+    amp_command_t command;
+
+    motion_link_command(AMP_CMD_DISABLE, &command);
+    motion_link_send(&command);
+}
+
+/*
+ * The ramp cache is on CPU1 with the step engine.
+ */
+void ramp_cache_print_stats(void)
+{
+    xil_printf("ramp cache: on the motion core (CPU1)\n");
+}
+
+#endif /* STEPPER_AMP_REMOTE */
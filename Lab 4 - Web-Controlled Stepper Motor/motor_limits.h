@@ -0,0 +1,21 @@
+/*
+ * motor_limits.h
+ * ----------------------------------------
+ * Per-Step-Mode Speed Limits
+ *
+ * Description:
+ * Generated by tools/host/motor_model.c from its 28BYJ-48 model: 80% of
+ * the highest speed (steps/s of the mode) a gentle ramp holds.
+ * Regenerate after changing the model constants:
+ *   ./motor_model tables motor_limits.h
+ *
+ * Definitions:
+ * - MOTOR_LIMIT_SPEED:  Highest speed by step mode (wave, full, half)
+ */
+
+#ifndef SRC_MOTOR_LIMITS_H_
+#define SRC_MOTOR_LIMITS_H_
+
+#define MOTOR_LIMIT_SPEED  { 460, 780, 1520 }      // steps/s
+
+#endif /* SRC_MOTOR_LIMITS_H_ */
@@ -13,7 +13,7 @@
  *
  * Components:
  * - main_thread(): Initializes lwIP, configures static IP settings, and starts
- *                  the server thread.
+ *                  the HTTP server, trajectory stream and time sync threads.
  * - network_thread(): Adds and configures the network interface.
  * - print_ip_setup(): Prints IP, subnet mask, and gateway info to the console.
  */
@@ -21,6 +21,8 @@
 
 #include "network.h"
 #include "server.h"
+#include "stream.h"
+#include "timesync.h"
 
 
 static struct netif server_netif;
@@ -84,6 +86,24 @@ int main_thread()
 			  , "--------------------"
 			  );
 
+	xil_printf( "%20s %6d %s\r\n"
+			  , "HTTP"
+			  , SERVER_PORT
+			  , "browser / curl"
+			  );
+
+	xil_printf( "%20s %6d %s\r\n"
+			  , "Trajectory stream"
+			  , STREAM_PORT
+			  , "TCP setpoints (stream.h)"
+			  );
+
+	xil_printf( "%20s %6d %s\r\n"
+			  , "Time sync"
+			  , TIMESYNC_PORT
+			  , "UDP, other boards (timesync.h)"
+			  );
+
 	xil_printf("\r\n");
 
 	sys_thread_new( "server_app"
@@ -93,6 +113,20 @@ int main_thread()
 				  , DEFAULT_THREAD_PRIO
 				  );
 
+	sys_thread_new( "stream_app"
+				  , stream_server_thread
+				  , 0
+				  , THREAD_STACKSIZE
+				  , DEFAULT_THREAD_PRIO
+				  );
+
+	sys_thread_new( "timesync_app"
+				  , timesync_thread
+				  , 0
+				  , THREAD_STACKSIZE
+				  , DEFAULT_THREAD_PRIO
+				  );
+
 	vTaskDelete(NULL);
 
 	return 0;
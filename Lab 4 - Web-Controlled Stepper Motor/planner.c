@@ -0,0 +1,692 @@
+/*
+ * planner.c
+ * ----------------------------------------
+ * Look-ahead Motion Planner Implementation
+ *
+ * Description:
+ * Pulls queued targets into a look-ahead window and plans the speed at
+ * every junction with a backward pass (each segment must still be able
+ * to slow down to the next junction speed) and a forward pass (each
+ * segment can only reach what its acceleration allows). The last
+ * segment in the window always ends at rest, so the plan stays safe
+ * while more targets are still arriving.
+ *
+ * Key Functions:
+ * - planner_fill(): Accepts queued targets while a segment is running
+ * - planner_next_segment(): Returns the next segment with entry/exit speeds
+ * - planner_segment_done(): Retires it and updates sequence statistics
+ * - planner_take_retarget(): Hands over a queued retarget command early
+ * - planner_take_urgent(): Next target of the urgent lane, ahead of the sequence
+ * - planner_resume_segment(): Runs an interrupted segment again
+ * - planner_segment_time(): Closed-form duration of a segment
+ * - planner_eta_queued(): Times a target as it is queued
+ * - planner_queue_end(): Where the normal lane leaves the motor
+ * - planner_get_eta(): Arrival of the current segment and of the queue
+ * - planner_print_stats(): Measured vs estimated time of the last sequence
+ * - planner_get_lane_stats(): Depth and waiting time of each lane
+ */
+
+#include "planner.h"
+
+static planner_segment_t window[PLANNER_LOOKAHEAD];
+static u32 window_head;
+static u32 window_count;
+static _Bool head_started;      // window[0] handed to the driver
+
+// Urgent targets ran: the head segment starts where the motor is
+static _Bool resumed;
+
+// Motion carried over from the last retired segment
+static _Bool moving;
+static long  last_final_position;
+static float committed_exit_speed;
+
+// Statistics for the sequence in progress
+static _Bool sequence_active;
+static TickType_t sequence_start;
+static u32   sequence_segments;
+static float estimate_blended_s;
+static float estimate_stopping_s;
+static planner_stats_t last_stats;
+
+// Arrival estimates: queued targets not yet started, the last one queued
+// and the segment in progress
+static volatile s32 eta_pending_ms;
+static volatile u32 eta_pending_count;
+static long  eta_last_position;
+static long  eta_last_dwell;
+static int   eta_last_direction;
+static step_mode_t eta_last_mode;
+static volatile _Bool eta_running;
+static volatile TickType_t eta_start_tick;
+static volatile u32 eta_move_ms;
+static volatile u32 eta_dwell_ms;
+
+// Lane statistics: targets started and how long they waited
+static struct {
+    u32 started;
+    u32 total_wait_ticks;
+    u32 max_wait_ticks;
+} lanes[PLANNER_LANES];
+
+
+static planner_segment_t *planner_window_at(u32 i)
+{
+    return &window[(window_head + i) % PLANNER_LOOKAHEAD];
+}
+
+static int planner_direction(long from, long to)
+{
+    return (to > from) ? 1 : ((to < from) ? -1 : 0);
+}
+
+static float planner_min(float a, float b)
+{
+    return (a < b) ? a : b;
+}
+
+/*
+ * Rotary segments: turn the target angle into the nearest unwrapped
+ * position from from. Repeating it with the same from is harmless.
+ */
+static void planner_resolve_rotary(planner_segment_t *seg, long from)
+{
+    if (seg->params.rotary) {
+        seg->params.final_position = stepper_rotary_target(from, seg->params.final_position,
+                                                           seg->params.step_mode);
+    }
+}
+
+/*
+ * Take a queued target off the queue ETA (started or dropped).
+ */
+static void planner_eta_remove(const motor_parameters_t *params)
+{
+    taskENTER_CRITICAL();
+    eta_pending_ms -= (s32)params->estimate_ms;
+    eta_pending_count--;
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Estimated duration (ms) of a move at the feed-rate override in force,
+ * held to the step mode's speed limit as the driver holds it, dwell not
+ * included.
+ */
+static u32 planner_eta_move_ms(const motor_parameters_t *params, long distance,
+                               float entry_speed, float exit_speed)
+{
+    motor_parameters_t fed = *params;
+    float limit = stepper_move_max_speed(params->step_mode, params->full_step_cruise);
+
+    if (limit < params->rotational_speed) {
+        limit = params->rotational_speed;
+    }
+    fed.rotational_speed = params->rotational_speed * stepper_get_feed_override() / 100.0f;
+    if (fed.rotational_speed > limit) {
+        fed.rotational_speed = limit;
+    }
+    return (u32)(planner_segment_time(&fed, labs(distance), entry_speed, exit_speed) * 1000.0f);
+}
+
+/*
+ * Time the segment that is starting.
+ */
+static void planner_eta_start(const planner_segment_t *seg)
+{
+    eta_running    = 0;
+    eta_start_tick = xTaskGetTickCount();
+    eta_move_ms    = planner_eta_move_ms(&seg->params, seg->params.final_position - seg->start_position,
+                                         seg->entry_speed, seg->exit_speed);
+    eta_dwell_ms   = (seg->exit_speed == 0.0f) ? (u32)seg->params.dwell_time : 0;
+    eta_running    = 1;
+}
+
+/*
+ * Count a target of lane as started.
+ */
+static void planner_lane_started(planner_lane_t lane, const motor_parameters_t *params)
+{
+    u32 wait = (u32)(xTaskGetTickCount() - params->queued_tick);
+
+    planner_eta_remove(params);
+
+    lanes[lane].started++;
+    lanes[lane].total_wait_ticks += wait;
+    if (wait > lanes[lane].max_wait_ticks) {
+        lanes[lane].max_wait_ticks = wait;
+    }
+}
+
+/*
+ * Forget any queued segments and carried motion. Call when the motor
+ * task (re)starts.
+ */
+void planner_reset(void)
+{
+    u32 i;
+
+    // Targets pulled into the window but not started are lost
+    for (i = head_started; i < window_count; i++) {
+        planner_eta_remove(&planner_window_at(i)->params);
+    }
+    eta_running = 0;
+
+    window_head = 0;
+    window_count = 0;
+    head_started = 0;
+    resumed = 0;
+    moving = 0;
+    committed_exit_speed = 0.0f;
+    sequence_active = 0;
+}
+
+/*
+ * Work out start positions and directions across the window, then plan
+ * junction speeds with a backward and a forward pass.
+ */
+static void planner_recalculate(void)
+{
+    _Bool blend[PLANNER_LOOKAHEAD];
+    float exit_max[PLANNER_LOOKAHEAD];
+    float entry;
+    u32 i;
+
+    // Start positions, directions and which junctions may carry speed
+    for (i = 0; i < window_count; i++) {
+        planner_segment_t *seg = planner_window_at(i);
+
+        if (i == 0) {
+            if (moving) {
+                seg->start_position = last_final_position;
+            } else if (resumed || seg->params.rotary) {
+                seg->start_position = stepper_get_pos();
+            } else {
+                seg->start_position = seg->params.current_position;
+            }
+            seg->keep_position = resumed || seg->params.rotary || seg->params.retarget;
+            planner_resolve_rotary(seg, seg->start_position);
+        } else {
+            planner_segment_t *prev = planner_window_at(i - 1);
+            long chained_start = prev->params.final_position;
+
+            planner_resolve_rotary(seg, chained_start);
+            blend[i - 1] = prev->params.dwell_time == 0 &&
+                           seg->params.start_at_us == 0 &&
+                           prev->params.step_mode == seg->params.step_mode &&
+                           prev->direction != 0 &&
+                           prev->direction == planner_direction(chained_start, seg->params.final_position);
+
+            seg->start_position = (blend[i - 1] || seg->params.rotary) ? chained_start
+                                                                       : seg->params.current_position;
+            seg->keep_position = seg->params.rotary || seg->params.retarget;
+        }
+        seg->direction = planner_direction(seg->start_position, seg->params.final_position);
+    }
+
+    // Backward pass: the last segment in the window ends at rest
+    exit_max[window_count - 1] = 0.0f;
+    for (i = window_count - 1; i > 0; i--) {
+        planner_segment_t *seg  = planner_window_at(i - 1);
+        planner_segment_t *next = planner_window_at(i);
+        long next_distance = labs(next->params.final_position - next->start_position);
+
+        if (blend[i - 1]) {
+            float next_entry_max = sqrtf(exit_max[i] * exit_max[i]
+                                         + 2.0f * next->params.rotational_decel * next_distance);
+            exit_max[i - 1] = planner_min(planner_min(seg->params.rotational_speed,
+                                                      next->params.rotational_speed),
+                                          next_entry_max);
+        } else {
+            exit_max[i - 1] = 0.0f;
+        }
+    }
+
+    // Forward pass: limited by what each segment can accelerate to
+    entry = moving ? committed_exit_speed : 0.0f;
+    for (i = 0; i < window_count; i++) {
+        planner_segment_t *seg = planner_window_at(i);
+        long distance = labs(seg->params.final_position - seg->start_position);
+        float reachable = sqrtf(entry * entry + 2.0f * seg->params.rotational_accel * distance);
+
+        seg->continuing  = (entry > 0.0f);
+        seg->entry_speed = entry;
+        seg->exit_speed  = planner_min(exit_max[i], reachable);
+        entry = seg->exit_speed;
+    }
+}
+
+/*
+ * Pull newly queued targets into the window (non-blocking) so they are
+ * part of the next plan. Returns the number of segments in the window.
+ */
+u32 planner_fill(QueueHandle_t queue)
+{
+    while (window_count < PLANNER_LOOKAHEAD &&
+           xQueueReceive(queue, &planner_window_at(window_count)->params, 0) == pdPASS) {
+        window_count++;
+    }
+    return window_count;
+}
+
+/*
+ * Top up the window from queue (non-blocking) and return the next
+ * segment to run. Returns FALSE when nothing is queued.
+ */
+_Bool planner_next_segment(QueueHandle_t queue, planner_segment_t *segment)
+{
+    planner_fill(queue);
+
+    if (window_count == 0) {
+        // Window drained: close out the sequence statistics
+        if (sequence_active) {
+            last_stats.segments = sequence_segments;
+            last_stats.elapsed_ms = (u32)((xTaskGetTickCount() - sequence_start) * portTICK_PERIOD_MS);
+            last_stats.estimate_blended_ms = (u32)(estimate_blended_s * 1000.0f);
+            last_stats.estimate_stopping_ms = (u32)(estimate_stopping_s * 1000.0f);
+            sequence_active = 0;
+            planner_print_stats();
+        }
+        return 0;
+    }
+
+    if (!sequence_active) {
+        sequence_active = 1;
+        sequence_start = xTaskGetTickCount();
+        sequence_segments = 0;
+        estimate_blended_s = 0.0f;
+        estimate_stopping_s = 0.0f;
+    }
+
+    planner_recalculate();
+    *segment = *planner_window_at(0);
+    if (!head_started) {
+        head_started = 1;
+        planner_lane_started(PLANNER_LANE_NORMAL, &segment->params);
+        planner_eta_start(segment);
+    }
+    return 1;
+}
+
+/*
+ * Retire the segment returned by planner_next_segment() once it has been
+ * handed to the driver (and its dwell, if any, has elapsed).
+ */
+void planner_segment_done(void)
+{
+    planner_segment_t *seg = planner_window_at(0);
+    long distance = labs(seg->params.final_position - seg->start_position);
+    float dwell_s = seg->params.dwell_time / 1000.0f;
+
+    estimate_blended_s  += planner_segment_time(&seg->params, distance,
+                                                seg->entry_speed, seg->exit_speed) + dwell_s;
+    estimate_stopping_s += planner_segment_time(&seg->params, distance, 0.0f, 0.0f) + dwell_s;
+    sequence_segments++;
+
+    moving = (seg->exit_speed > 0.0f);
+    committed_exit_speed = seg->exit_speed;
+    last_final_position = seg->params.final_position;
+
+    window_head = (window_head + 1) % PLANNER_LOOKAHEAD;
+    window_count--;
+    head_started = 0;
+    resumed = 0;
+    eta_running = 0;
+}
+
+/*
+ * Look behind the running segment for targets queued with
+ * params.retarget. The newest one replaces the running segment and every
+ * segment queued before it, and is returned to be started at once from
+ * the current motion; it starts at position and ends at rest. Returns
+ * FALSE if none is queued.
+ */
+_Bool planner_take_retarget(long position, planner_segment_t *segment)
+{
+    planner_segment_t *seg;
+    u32 found = 0;
+    u32 i;
+
+    for (i = 1; i < window_count; i++) {
+        if (planner_window_at(i)->params.retarget) {
+            found = i;
+        }
+    }
+    if (found == 0) {
+        return 0;
+    }
+
+    // The running segment has started; the ones queued behind it have not
+    for (i = 1; i < found; i++) {
+        planner_eta_remove(&planner_window_at(i)->params);
+    }
+    window_head = (window_head + found) % PLANNER_LOOKAHEAD;
+    window_count -= found;
+
+    seg = planner_window_at(0);
+    planner_resolve_rotary(seg, position);
+    seg->start_position = position;
+    seg->direction      = planner_direction(position, seg->params.final_position);
+    seg->entry_speed    = 0.0f;
+    seg->exit_speed     = 0.0f;
+    seg->continuing     = 0;
+    seg->keep_position  = 1;
+    *segment = *seg;
+    planner_lane_started(PLANNER_LANE_NORMAL, &seg->params);
+    planner_eta_start(seg);
+    return 1;
+}
+
+/*
+ * Take the next target of the urgent lane (non-blocking), as a segment
+ * from position that ends at rest. It is started at once, taking over
+ * whatever move is in progress. Returns FALSE if the lane is empty.
+ */
+_Bool planner_take_urgent(QueueHandle_t urgent_queue, long position, planner_segment_t *segment)
+{
+    if (xQueueReceive(urgent_queue, &segment->params, 0) != pdPASS) {
+        return 0;
+    }
+    planner_lane_started(PLANNER_LANE_URGENT, &segment->params);
+
+    planner_resolve_rotary(segment, position);
+    segment->start_position = position;
+    segment->direction      = planner_direction(position, segment->params.final_position);
+    segment->entry_speed    = 0.0f;
+    segment->exit_speed     = 0.0f;
+    segment->continuing     = 0;
+    segment->keep_position  = 1;
+    planner_eta_start(segment);
+
+    // The sequence picks up from rest where the urgent targets leave it
+    resumed = 1;
+    moving = 0;
+    committed_exit_speed = 0.0f;
+    return 1;
+}
+
+/*
+ * Plan the running segment again from where the motor is, once urgent
+ * targets that interrupted it are done, and return it to be restarted
+ * from rest. Returns FALSE if there is no segment to resume.
+ */
+_Bool planner_resume_segment(planner_segment_t *segment)
+{
+    if (window_count == 0) {
+        return 0;
+    }
+    planner_recalculate();
+    *segment = *planner_window_at(0);
+    planner_eta_start(segment);
+    return 1;
+}
+
+/*
+ * Time a target about to be queued and add it to the queue ETA; the
+ * estimate (stop to stop, dwell included) is stored in
+ * params->estimate_ms. Like the planner, a target starts where the one
+ * queued before it ends if the two can blend (or it is rotary), and at
+ * params->current_position otherwise. An urgent target runs from where
+ * the motor is and is not chained to, nor chained from, the normal
+ * lane. Call from the one task that queues targets, before xQueueSend().
+ */
+void planner_eta_queued(motor_parameters_t *params)
+{
+    long from = params->current_position;
+    long target = params->final_position;
+    _Bool chained = !params->urgent && (eta_pending_count > 0 || eta_running);
+
+    if (chained && params->rotary) {
+        from = eta_last_position;
+    }
+    if (params->rotary) {
+        target = stepper_rotary_target(from, target, params->step_mode);
+    } else if (chained && eta_last_dwell == 0 && eta_last_mode == params->step_mode &&
+               eta_last_direction != 0 &&
+               eta_last_direction == planner_direction(eta_last_position, target)) {
+        from = eta_last_position;
+    }
+
+    params->estimate_ms = planner_eta_move_ms(params, target - from, 0.0f, 0.0f)
+                        + (u32)params->dwell_time;
+    taskENTER_CRITICAL();
+    eta_pending_ms += (s32)params->estimate_ms;
+    eta_pending_count++;
+    taskEXIT_CRITICAL();
+
+    if (params->urgent) {
+        return;
+    }
+    eta_last_direction = planner_direction(from, target);
+    eta_last_position  = target;
+    eta_last_dwell     = params->dwell_time;
+    eta_last_mode      = params->step_mode;
+}
+
+/*
+ * Where the motor will be once the normal lane is done: the final
+ * position of the last target queued there, or position (where the
+ * motor is now) if nothing is queued or running. Call from the task
+ * that queues targets.
+ */
+long planner_queue_end(long position)
+{
+    if (eta_pending_count > 0 || eta_running) {
+        return eta_last_position;
+    }
+    return position;
+}
+
+/*
+ * Undo planner_eta_queued() for a target that could not be queued.
+ */
+void planner_eta_cancel(const motor_parameters_t *params)
+{
+    planner_eta_remove(params);
+}
+
+/*
+ * Time left on the segment in progress and on the whole queue. Constant
+ * time: the queued targets were timed as they were queued.
+ */
+void planner_get_eta(planner_eta_t *eta)
+{
+    u32 elapsed = (u32)((xTaskGetTickCount() - eta_start_tick) * portTICK_PERIOD_MS);
+    u32 current = 0;
+    s32 pending = eta_pending_ms;
+
+    eta->move_ms = 0;
+    if (eta_running) {
+        if (elapsed < eta_move_ms) {
+            eta->move_ms = eta_move_ms - elapsed;
+        }
+        if (elapsed < eta_move_ms + eta_dwell_ms) {
+            current = eta_move_ms + eta_dwell_ms - elapsed;
+        }
+    }
+    eta->queue_ms = current + ((pending > 0) ? (u32)pending : 0);
+    eta->queued   = eta_pending_count;
+}
+
+/*
+ * Duration (s) of a ramp that changes speed by dv at acceleration a. An
+ * S-curve ramp adds a jerk phase at each end, or is all jerk phase when
+ * dv is too small to reach a.
+ */
+static float planner_ramp_time(const motor_parameters_t *params, float dv, float a)
+{
+    float j = params->rotational_jerk;
+
+    if (dv <= 0.0f) {
+        return 0.0f;
+    }
+    if (params->motion_profile == PROFILE_S_CURVE && j > 0.0f) {
+        return (dv * j >= a * a) ? dv / a + a / j : 2.0f * sqrtf(dv / j);
+    }
+    return dv / a;
+}
+
+/*
+ * Steps covered by a ramp from speed v0 to v at acceleration a: its
+ * mean speed times its duration, as the S-curve is point symmetric too.
+ */
+static float planner_ramp_distance(const motor_parameters_t *params, float v0, float v, float a)
+{
+    return 0.5f * (v0 + v) * planner_ramp_time(params, v - v0, a);
+}
+
+/*
+ * Closed-form duration (s) of a segment of distance steps from
+ * entry_speed to exit_speed, with the peak speed clamped by the distance
+ * the same way the driver clamps it. A half-step
+ * move from rest with full_step_cruise is timed as the driver splits it
+ * (stepper_full_step_split()): a full-step part at the same step rate,
+ * slowing to half of it, then the half-step stop.
+ */
+float planner_segment_time(const motor_parameters_t *params, long distance,
+                           float entry_speed, float exit_speed)
+{
+    float a = params->rotational_accel;
+    float d = params->rotational_decel;
+    float j = params->rotational_jerk;
+    float peak;
+    float accel_time, decel_time, cruise_dist;
+
+    if (distance <= 0 || a <= 0.0f || d <= 0.0f) {
+        return 0.0f;
+    }
+
+    if (params->full_step_cruise && params->step_mode == HALF_STEP &&
+        entry_speed == 0.0f && exit_speed == 0.0f) {
+        float v = params->rotational_speed;
+        long fine_steps = (long)(v * v / (2.0f * d)) + 1;
+        long coarse_steps = (distance - fine_steps) / 2;
+
+        if (coarse_steps > (long)(v * v / (8.0f * a))) {
+            motor_parameters_t part = *params;
+
+            part.full_step_cruise = 0;
+            return planner_segment_time(&part, coarse_steps, 0.0f, v / 2.0f)
+                 + planner_segment_time(&part, fine_steps, v, 0.0f);
+        }
+    }
+
+    if (params->motion_profile == PROFILE_S_CURVE && j > 0.0f) {
+        // The ramps may or may not reach the acceleration limit, so the
+        // peak is found by bisection, as stepper_scurve_speed() does
+        float low = (entry_speed > exit_speed) ? entry_speed : exit_speed;
+        float high = params->rotational_speed;
+        int i;
+
+        peak = high;
+        if (planner_ramp_distance(params, entry_speed, peak, a)
+            + planner_ramp_distance(params, exit_speed, peak, d) > distance) {
+            for (i = 0; i < 20; i++) {
+                float mid = 0.5f * (low + high);
+                if (planner_ramp_distance(params, entry_speed, mid, a)
+                    + planner_ramp_distance(params, exit_speed, mid, d) <= distance) {
+                    low = mid;
+                } else {
+                    high = mid;
+                }
+            }
+            peak = low;
+        }
+    } else {
+        peak = sqrtf( (2.0f * a * d * distance + d * entry_speed * entry_speed
+                       + a * exit_speed * exit_speed) / (a + d) );
+    }
+    if (peak > params->rotational_speed) {
+        peak = params->rotational_speed;
+    }
+    if (peak < entry_speed || peak < exit_speed) {
+        peak = (entry_speed > exit_speed) ? entry_speed : exit_speed;
+    }
+
+    // A ramp covers its mean speed times its duration
+    accel_time  = planner_ramp_time(params, peak - entry_speed, a);
+    decel_time  = planner_ramp_time(params, peak - exit_speed, d);
+    cruise_dist = distance
+                - 0.5f * (peak + entry_speed) * accel_time
+                - 0.5f * (peak + exit_speed) * decel_time;
+    if (cruise_dist < 0.0f) {
+        cruise_dist = 0.0f;
+    }
+
+    return accel_time + decel_time + cruise_dist / peak;
+}
+
+/*
+ * Copy out the statistics of the last completed sequence.
+ */
+void planner_get_stats(planner_stats_t *stats)
+{
+    *stats = last_stats;
+}
+
+/*
+ * Depth, oldest waiting target and queued-to-started times of each lane.
+ * queue and urgent_queue are the lanes' FreeRTOS queues; normal targets
+ * already pulled into the window but not started count as waiting too.
+ */
+void planner_get_lane_stats(QueueHandle_t queue, QueueHandle_t urgent_queue,
+                            planner_lane_stats_t stats[PLANNER_LANES])
+{
+    QueueHandle_t lane_queue[PLANNER_LANES];
+    TickType_t now = xTaskGetTickCount();
+    motor_parameters_t oldest;
+    u32 lane;
+
+    lane_queue[PLANNER_LANE_URGENT] = urgent_queue;
+    lane_queue[PLANNER_LANE_NORMAL] = queue;
+
+    for (lane = 0; lane < PLANNER_LANES; lane++) {
+        _Bool waiting = 0;
+
+        stats[lane].depth = uxQueueMessagesWaiting(lane_queue[lane]);
+        if (lane == PLANNER_LANE_NORMAL && window_count > head_started) {
+            stats[lane].depth += window_count - head_started;
+            oldest = planner_window_at(head_started)->params;
+            waiting = 1;
+        } else {
+            waiting = (xQueuePeek(lane_queue[lane], &oldest, 0) == pdPASS);
+        }
+        stats[lane].oldest_ms    = waiting ? (u32)((now - oldest.queued_tick) * portTICK_PERIOD_MS) : 0;
+        stats[lane].started      = lanes[lane].started;
+        stats[lane].mean_wait_ms = lanes[lane].started
+                                 ? lanes[lane].total_wait_ticks / lanes[lane].started * portTICK_PERIOD_MS : 0;
+        stats[lane].max_wait_ms  = lanes[lane].max_wait_ticks * portTICK_PERIOD_MS;
+    }
+}
+
+/*
+ * Print the statistics of each lane and the arrival estimates.
+ */
+void planner_print_lane_stats(QueueHandle_t queue, QueueHandle_t urgent_queue)
+{
+    static const char *const names[PLANNER_LANES] = { "urgent", "normal" };
+    planner_lane_stats_t stats[PLANNER_LANES];
+    planner_eta_t eta;
+    u32 lane;
+
+    planner_get_lane_stats(queue, urgent_queue, stats);
+    for (lane = 0; lane < PLANNER_LANES; lane++) {
+        xil_printf("%s lane: %lu waiting (oldest %lu ms), %lu started, wait mean %lu ms, max %lu ms\n",
+                   names[lane], stats[lane].depth, stats[lane].oldest_ms, stats[lane].started,
+                   stats[lane].mean_wait_ms, stats[lane].max_wait_ms);
+    }
+    planner_get_eta(&eta);
+    xil_printf("eta: move %lu ms, queue %lu ms (%lu targets)\n", eta.move_ms, eta.queue_ms, eta.queued);
+}
+
+/*
+ * Print measured and estimated time of the last completed sequence.
+ */
+void planner_print_stats(void)
+{
+    xil_printf("sequence: %lu segments in %lu ms (estimated %lu ms blended, %lu ms stopping at each target)\n",
+               last_stats.segments,
+               last_stats.elapsed_ms,
+               last_stats.estimate_blended_ms,
+               last_stats.estimate_stopping_ms);
+}
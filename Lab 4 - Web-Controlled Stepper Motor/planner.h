@@ -0,0 +1,117 @@
+/*
+ * planner.h
+ * ----------------------------------------
+ * Look-ahead Motion Planner Interface
+ *
+ * Description:
+ * Header file for the look-ahead planner that sits between motor_queue
+ * and the stepper driver. Queued motor_parameters_t targets are pulled
+ * into a small window and the junction speed between consecutive
+ * segments is planned across the whole window, so velocity carries
+ * through same-direction targets instead of ramping down to zero at
+ * each one.
+ *
+ * A junction is blended (non-zero speed) only when:
+ * - the first segment has dwell_time == 0,
+ * - the second segment has no start time (start_at_us == 0),
+ * - both segments use the same step mode, and
+ * - both segments move in the same direction.
+ * A blended segment starts where the previous one ends; its
+ * current_position field is ignored.
+ *
+ * With params.rotary set, final_position is an angle in steps modulo one
+ * revolution: the planner starts from where the previous segment (or
+ * the motor) is, ignores current_position, and rewrites final_position
+ * to the nearest unwrapped position at that angle, so the motor takes
+ * the short way round and positions keep counting past a revolution.
+ *
+ * A target queued with params.retarget set does not wait its turn:
+ * planner_take_retarget() hands it over while the current segment runs
+ * (or dwells), dropping that segment and any queued before it.
+ *
+ * Targets arrive through two lanes: the normal sequence (motor_queue)
+ * and an urgent lane. planner_take_urgent() hands over urgent targets
+ * one at a time, ahead of the sequence; each takes over the move in
+ * progress from its current speed, stopping first if it reverses. The
+ * interrupted segment is not dropped: planner_resume_segment() runs it
+ * again from wherever the urgent targets left the motor, dwell included,
+ * and the sequence carries on after it. An urgent target that takes
+ * over a running move keeps that move's step mode.
+ *
+ * Arrival estimates: every target is timed once, when it is queued
+ * (planner_eta_queued()), and taken off a running total when it starts,
+ * so planner_get_eta() costs the same however long the queue is. Queued
+ * targets are timed stop to stop, so the queue ETA is an upper bound
+ * where targets blend; the segment in progress is timed with its planned
+ * junction speeds. Both use the feed-rate override in force when they
+ * were timed, and leave out waits for start times (timesync.h).
+ *
+ * Definitions:
+ * - PLANNER_LOOKAHEAD: Number of queued segments planned at once
+ * - PLANNER_LANES:     Command lanes, in priority order (planner_lane_t)
+ */
+
+#ifndef SRC_PLANNER_H_
+#define SRC_PLANNER_H_
+
+#include "stepper.h"
+
+#define PLANNER_LOOKAHEAD  8
+
+typedef enum {
+    PLANNER_LANE_URGENT,
+    PLANNER_LANE_NORMAL,
+    PLANNER_LANES
+} planner_lane_t;
+
+typedef struct {
+    motor_parameters_t params;
+    long  start_position;   // steps, where the segment begins
+    int   direction;        // +1, -1 or 0 for an empty segment
+    float entry_speed;      // steps/s when the segment starts
+    float exit_speed;       // steps/s when final_position is reached
+    _Bool continuing;       // starts while the motor is still moving
+    _Bool keep_position;    // starts where the motor is: no stepper_set_pos()
+} planner_segment_t;
+
+typedef struct {
+    u32 segments;           // segments in the last sequence
+    u32 elapsed_ms;         // measured start-to-stop time, dwells included
+    u32 estimate_blended_ms;
+    u32 estimate_stopping_ms;   // same sequence, stopping at every target
+} planner_stats_t;
+
+typedef struct {
+    u32 depth;              // targets waiting, not yet started
+    u32 oldest_ms;          // age of the oldest one waiting
+    u32 started;            // targets started since reset
+    u32 mean_wait_ms;       // queued to started
+    u32 max_wait_ms;
+} planner_lane_stats_t;
+
+typedef struct {
+    u32 move_ms;            // until the segment in progress reaches its target
+    u32 queue_ms;           // until every queued target is done, dwells included
+    u32 queued;             // targets queued, not yet started
+} planner_eta_t;
+
+void  planner_reset(void);
+u32   planner_fill(QueueHandle_t queue);
+_Bool planner_next_segment(QueueHandle_t queue, planner_segment_t *segment);
+void  planner_segment_done(void);
+_Bool planner_take_retarget(long position, planner_segment_t *segment);
+_Bool planner_take_urgent(QueueHandle_t urgent_queue, long position, planner_segment_t *segment);
+_Bool planner_resume_segment(planner_segment_t *segment);
+float planner_segment_time(const motor_parameters_t *params, long distance,
+                           float entry_speed, float exit_speed);
+void  planner_eta_queued(motor_parameters_t *params);
+void  planner_eta_cancel(const motor_parameters_t *params);
+long  planner_queue_end(long position);
+void  planner_get_eta(planner_eta_t *eta);
+void  planner_get_stats(planner_stats_t *stats);
+void  planner_print_stats(void);
+void  planner_get_lane_stats(QueueHandle_t queue, QueueHandle_t urgent_queue,
+                             planner_lane_stats_t stats[PLANNER_LANES]);
+void  planner_print_lane_stats(QueueHandle_t queue, QueueHandle_t urgent_queue);
+
+#endif /* SRC_PLANNER_H_ */
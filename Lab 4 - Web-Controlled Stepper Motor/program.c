@@ -0,0 +1,404 @@
+/*
+ * program.c
+ * ----------------------------------------
+ * Motion Program Interpreter Implementation
+ *
+ * Description:
+ * Checks an uploaded motion program once, when it is loaded (known
+ * opcodes, operands inside the code, values in the step engine's range,
+ * balanced loops that each move or wait on every pass), so the
+ * interpreter can run it without further checks. The step mode a move runs in is only known
+ * when it starts, so speed, accel and decel are held to that mode's
+ * limits then. The motor task runs the program between queued
+ * targets; moves are started with the non-blocking move API and the
+ * next instruction runs as soon as the service task reports the move
+ * complete.
+ *
+ * Key Functions:
+ * - program_load(): Validates a program image and copies it to RAM
+ * - program_request_run() / program_request_stop(): From any task
+ * - program_execute(): Runs the loaded program (motor task)
+ * - program_get_status(): State, program counter and move count
+ */
+
+#include "stepper.h"
+#include "gpio.h"
+#include "program.h"
+
+typedef struct {
+    u32 body;               // offset of the first instruction in the loop
+    u16 count;              // passes left, 0: forever
+} program_loop_t;
+
+static u8  program_code[PROGRAM_MAX_SIZE];
+static u32 program_size;
+static volatile program_state_t program_state = PROGRAM_EMPTY;
+static volatile _Bool run_requested;
+static volatile _Bool stop_requested;
+static volatile u32 program_pc;
+static volatile u32 program_moves;
+static volatile u32 program_cycles;
+
+
+static u16 program_u16(const u8 *p)
+{
+    return (u16)(p[0] | (p[1] << 8));
+}
+
+static u32 program_u32(const u8 *p)
+{
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+/*
+ * Operand bytes of an opcode, or -1 if it is not one.
+ */
+static int program_operand_size(u8 opcode)
+{
+    switch (opcode) {
+        case PROGRAM_OP_END:
+        case PROGRAM_OP_END_LOOP:    return 0;
+        case PROGRAM_OP_WAIT_BUTTON: return 1;
+        case PROGRAM_OP_SPEED:
+        case PROGRAM_OP_ACCEL:
+        case PROGRAM_OP_DECEL:
+        case PROGRAM_OP_LOOP:        return 2;
+        case PROGRAM_OP_MOVE_ABS:
+        case PROGRAM_OP_MOVE_REL:
+        case PROGRAM_OP_DWELL:       return 4;
+        default:                     return -1;
+    }
+}
+
+/*
+ * Check a program image and, if it is valid, replace the loaded program
+ * with it. A running program is not replaced. On failure *error_offset
+ * is the offset (in the image) of the offending byte.
+ * Returns XST_SUCCESS or XST_FAILURE.
+ */
+int program_load(const u8 *image, u32 length, u32 *error_offset)
+{
+    const u8 *code = image + PROGRAM_HEADER_SIZE;
+    u32 code_size;
+    u32 depth = 0;
+    u32 pc = 0;
+    _Bool blocks[PROGRAM_LOOP_DEPTH + 1];           // loop body waits on something
+    _Bool has_abs[PROGRAM_LOOP_DEPTH + 1] = { 0 };  // loop body has a MOVE_ABS...
+    u32 abs_target[PROGRAM_LOOP_DEPTH + 1];         // ...to this position
+
+    *error_offset = 0;
+    if (program_state == PROGRAM_RUNNING || run_requested ||
+        length < PROGRAM_HEADER_SIZE || length > PROGRAM_MAX_SIZE ||
+        program_u32(image) != PROGRAM_MAGIC ||
+        program_u16(image + 4) != PROGRAM_VERSION) {
+        return XST_FAILURE;
+    }
+    code_size = program_u16(image + 6);
+    if (code_size == 0 || code_size > length - PROGRAM_HEADER_SIZE) {
+        *error_offset = 6;
+        return XST_FAILURE;
+    }
+
+    while (pc < code_size) {
+        u8 opcode = code[pc];
+        int operand = program_operand_size(opcode);
+        *error_offset = PROGRAM_HEADER_SIZE + pc;
+
+        if (operand < 0 || pc + 1 + operand > code_size) {
+            return XST_FAILURE;
+        }
+        switch (opcode) {
+            case PROGRAM_OP_MOVE_ABS:
+                // Only a second, different target moves on every pass
+                if (!has_abs[depth]) {
+                    has_abs[depth]    = 1;
+                    abs_target[depth] = program_u32(code + pc + 1);
+                } else if (program_u32(code + pc + 1) != abs_target[depth]) {
+                    blocks[depth] = 1;
+                }
+                break;
+            case PROGRAM_OP_MOVE_REL:
+                if (program_u32(code + pc + 1) != 0) {
+                    blocks[depth] = 1;
+                }
+                break;
+            case PROGRAM_OP_DWELL:
+                if (program_u32(code + pc + 1) != 0) {
+                    blocks[depth] = 1;
+                }
+                break;
+            case PROGRAM_OP_SPEED:
+                if (program_u16(code + pc + 1) == 0 || program_u16(code + pc + 1) > STEPPER_MAX_SPEED) {
+                    return XST_FAILURE;
+                }
+                break;
+            case PROGRAM_OP_ACCEL:
+            case PROGRAM_OP_DECEL:
+                if (program_u16(code + pc + 1) == 0 || program_u16(code + pc + 1) > STEPPER_MAX_ACCEL) {
+                    return XST_FAILURE;
+                }
+                break;
+            case PROGRAM_OP_WAIT_BUTTON:
+                if (code[pc + 1] == 0) {
+                    return XST_FAILURE;
+                }
+                blocks[depth] = 1;
+                break;
+            case PROGRAM_OP_LOOP:
+                if (++depth > PROGRAM_LOOP_DEPTH) {
+                    return XST_FAILURE;
+                }
+                blocks[depth]  = 0;
+                has_abs[depth] = 0;
+                break;
+            case PROGRAM_OP_END_LOOP:
+                // A loop that never waits would starve the lower priority
+                // tasks: after its first pass, a move back to where the
+                // motor already is completes at once
+                if (depth == 0 || !blocks[depth]) {
+                    return XST_FAILURE;
+                }
+                depth--;
+                blocks[depth] = 1;
+                break;
+        }
+        pc += 1 + operand;
+    }
+    if (depth != 0) {
+        *error_offset = PROGRAM_HEADER_SIZE + code_size;
+        return XST_FAILURE;
+    }
+
+    memcpy(program_code, code, code_size);
+    program_size  = code_size;
+    program_pc    = 0;
+    program_state = PROGRAM_READY;
+    return XST_SUCCESS;
+}
+
+/*
+ * Ask the motor task to run the loaded program from the start once it is
+ * idle.
+ */
+void program_request_run(void)
+{
+    if (program_state != PROGRAM_EMPTY && program_state != PROGRAM_RUNNING) {
+        stop_requested = 0;
+        run_requested = 1;
+    }
+}
+
+/*
+ * Stop the running program after the move in progress.
+ */
+void program_request_stop(void)
+{
+    run_requested = 0;
+    if (program_state == PROGRAM_RUNNING) {
+        stop_requested = 1;
+    }
+}
+
+_Bool program_run_pending(void)
+{
+    return run_requested;
+}
+
+/*
+ * Mark a program cut off by an emergency stop. Called when the motor
+ * task restarts; the program is not resumed.
+ */
+void program_abort(void)
+{
+    run_requested = 0;
+    if (program_state == PROGRAM_RUNNING) {
+        program_state = PROGRAM_ABORTED;
+    }
+}
+
+/*
+ * Hold the speed, accel and decel of the next move to the limits of the
+ * step mode it runs in (that of the last /setParams target).
+ */
+static void program_hold_limits(void)
+{
+    float max_speed = stepper_move_max_speed(current_step_mode, stepper_get_full_step_cruise());
+    float max_accel = stepper_max_accel(current_step_mode);
+
+    if (target_speed > max_speed) {
+        stepper_set_speed(max_speed);
+    }
+    if (accel > max_accel) {
+        stepper_set_accel(max_accel);
+    }
+    if (decel > max_accel) {
+        stepper_set_decel(max_accel);
+    }
+}
+
+/*
+ * Wait for ticks, or less if a stop is requested.
+ * Returns FALSE if it was cut short.
+ */
+static _Bool program_wait(TickType_t ticks)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    while (xTaskGetTickCount() - start < ticks) {
+        TickType_t left = ticks - (xTaskGetTickCount() - start);
+        if (stop_requested) {
+            return 0;
+        }
+        vTaskDelay((left < PROGRAM_POLL_TICKS) ? left : PROGRAM_POLL_TICKS);
+    }
+    return !stop_requested;
+}
+
+/*
+ * Wait for a press (released to pressed) of a button in mask.
+ * Returns FALSE if a stop was requested first.
+ */
+static _Bool program_wait_button(u8 mask)
+{
+    u32 last = XGpio_DiscreteRead(&buttons, BUTTONS_CHANNEL);
+
+    while (!stop_requested) {
+        u32 now = XGpio_DiscreteRead(&buttons, BUTTONS_CHANNEL);
+        if (now & ~last & mask) {
+            return 1;
+        }
+        last = now;
+        vTaskDelay(PROGRAM_POLL_TICKS);
+    }
+    return 0;
+}
+
+/*
+ * Run the loaded program to its end, a stop request or an emergency
+ * stop. Call from the motor task while no queued target is running.
+ */
+void program_execute(void)
+{
+    program_loop_t loops[PROGRAM_LOOP_DEPTH];
+    u32 depth = 0;
+    u32 pc = 0;
+    _Bool running = 1;
+
+    run_requested  = 0;
+    stop_requested = 0;
+    program_moves  = 0;
+    program_cycles = 0;
+    program_state  = PROGRAM_RUNNING;
+    xil_printf("\nprogram: running %lu bytes\n", program_size);
+
+    while (running && pc < program_size) {
+        const u8 *op = &program_code[pc];
+        program_pc = pc;
+        pc += 1 + program_operand_size(op[0]);
+
+        if (stop_requested || stepper_emergency_latched()) {
+            break;
+        }
+
+        switch (op[0]) {
+            case PROGRAM_OP_END:
+                running = 0;
+                break;
+            case PROGRAM_OP_MOVE_ABS:
+            case PROGRAM_OP_MOVE_REL: {
+                long start = stepper_get_pos();
+                long target = (long)(s32)program_u32(op + 1);
+                if (op[0] == PROGRAM_OP_MOVE_REL) {
+                    target += start;
+                }
+                program_hold_limits();
+                stepper_move_wait(stepper_move_start(target, 0.0f, 0.0f, NULL, NULL), portMAX_DELAY);
+                program_moves++;
+                if (target == start) {
+                    // Completed at once: let the lower priority tasks run
+                    vTaskDelay(1);
+                }
+                break;
+            }
+            case PROGRAM_OP_DWELL:
+                program_wait(pdMS_TO_TICKS(program_u32(op + 1)));
+                break;
+            case PROGRAM_OP_SPEED:
+                stepper_set_speed(program_u16(op + 1));
+                break;
+            case PROGRAM_OP_ACCEL:
+                stepper_set_accel(program_u16(op + 1));
+                break;
+            case PROGRAM_OP_DECEL:
+                stepper_set_decel(program_u16(op + 1));
+                break;
+            case PROGRAM_OP_LOOP:
+                loops[depth].body  = pc;
+                loops[depth].count = program_u16(op + 1);
+                depth++;
+                break;
+            case PROGRAM_OP_END_LOOP:
+                if (depth == 1) {
+                    program_cycles++;
+                }
+                if (loops[depth - 1].count == 0 || --loops[depth - 1].count != 0) {
+                    pc = loops[depth - 1].body;
+                } else {
+                    depth--;
+                }
+                break;
+            case PROGRAM_OP_WAIT_BUTTON:
+                program_wait_button(op[1]);
+                break;
+        }
+    }
+
+    stepper_disable_motor();
+    if (stepper_emergency_latched()) {
+        program_state = PROGRAM_ABORTED;
+    } else if (stop_requested) {
+        program_state = PROGRAM_STOPPED;
+    } else {
+        program_state = PROGRAM_DONE;
+    }
+    stop_requested = 0;
+    xil_printf("program: %s after %lu moves at position %ld\n",
+               program_state_name(program_state), program_moves, stepper_get_pos());
+}
+
+/*
+ * Copy out the interpreter state.
+ */
+void program_get_status(program_status_t *status)
+{
+    status->state     = program_state;
+    status->pc        = program_pc;
+    status->code_size = program_size;
+    status->moves     = program_moves;
+    status->cycles    = program_cycles;
+}
+
+const char *program_state_name(program_state_t state)
+{
+    switch (state) {
+        case PROGRAM_READY:   return "ready";
+        case PROGRAM_RUNNING: return "running";
+        case PROGRAM_DONE:    return "done";
+        case PROGRAM_STOPPED: return "stopped";
+        case PROGRAM_ABORTED: return "aborted";
+        default:              return "empty";
+    }
+}
+
+/*
+ * Print the interpreter state.
+ */
+void program_print_status(void)
+{
+    program_status_t status;
+
+    program_get_status(&status);
+    xil_printf("\nprogram: %s, %lu bytes, pc %lu, %lu moves, %lu cycles\n",
+               program_state_name(status.state), status.code_size, status.pc,
+               status.moves, status.cycles);
+}
@@ -0,0 +1,105 @@
+/*
+ * program.h
+ * ----------------------------------------
+ * Motion Program Interpreter Interface
+ *
+ * Description:
+ * A motion program is a short bytecode sequence uploaded once (POST
+ * /loadProgram) and run from RAM by the motor task, so a repetitive
+ * cycle needs no request per move and moves follow each other as soon
+ * as the previous one completes. tools/program_asm.c assembles a text
+ * listing into this format.
+ *
+ * Format (little endian): a program_header_t, then code_size bytes of
+ * instructions, each an opcode byte followed by its operand:
+ *
+ *   PROGRAM_OP_END          -         stop the program
+ *   PROGRAM_OP_MOVE_ABS     s32       move to an absolute position (steps)
+ *   PROGRAM_OP_MOVE_REL     s32       move by a number of steps
+ *   PROGRAM_OP_DWELL        u32       wait, ms
+ *   PROGRAM_OP_SPEED        u16       steps/s for the following moves
+ *   PROGRAM_OP_ACCEL        u16       steps/s^2
+ *   PROGRAM_OP_DECEL        u16       steps/s^2
+ *   PROGRAM_OP_LOOP         u16       repeat up to the matching END_LOOP
+ *                                     count times (0: forever)
+ *   PROGRAM_OP_END_LOOP     -
+ *   PROGRAM_OP_WAIT_BUTTON  u8        wait for a press of a button in mask
+ *
+ * Moves use the step mode and motion profile of the last /setParams
+ * target and start and end at rest. SPEED, ACCEL and DECEL are checked
+ * against the step engine's STEPPER_MAX_SPEED and STEPPER_MAX_ACCEL when
+ * the program is loaded, and held to the limits of the step mode as each
+ * move starts. Every loop must wait on each pass: a nonzero DWELL, a
+ * WAIT_BUTTON, a nonzero MOVE_REL or MOVE_ABS to two different
+ * positions; a loop that could spin without blocking is rejected. A
+ * stop request takes effect after the move in progress; dwells and
+ * button waits end at once. BTN0 (the emergency stop) aborts the
+ * program.
+ *
+ * Definitions:
+ * - PROGRAM_MAX_SIZE:    Largest program accepted, header included
+ * - PROGRAM_LOOP_DEPTH:  Deepest LOOP nesting
+ * - PROGRAM_POLL_TICKS:  Stop request / button polling period
+ */
+
+#ifndef SRC_PROGRAM_H_
+#define SRC_PROGRAM_H_
+
+#include "xil_types.h"
+
+#define PROGRAM_MAX_SIZE     1024
+#define PROGRAM_LOOP_DEPTH   4
+#define PROGRAM_POLL_TICKS   pdMS_TO_TICKS(10)
+
+#define PROGRAM_MAGIC        0x4752504D   // "MPRG"
+#define PROGRAM_VERSION      1
+
+typedef enum {
+    PROGRAM_OP_END         = 0x00,
+    PROGRAM_OP_MOVE_ABS    = 0x01,
+    PROGRAM_OP_MOVE_REL    = 0x02,
+    PROGRAM_OP_DWELL       = 0x03,
+    PROGRAM_OP_SPEED       = 0x04,
+    PROGRAM_OP_ACCEL       = 0x05,
+    PROGRAM_OP_DECEL       = 0x06,
+    PROGRAM_OP_LOOP        = 0x07,
+    PROGRAM_OP_END_LOOP    = 0x08,
+    PROGRAM_OP_WAIT_BUTTON = 0x09
+} program_opcode_t;
+
+typedef struct {
+    u32 magic;
+    u16 version;
+    u16 code_size;          // bytes of code after the header
+} program_header_t;
+
+#define PROGRAM_HEADER_SIZE  8
+
+typedef enum {
+    PROGRAM_EMPTY,          // nothing loaded
+    PROGRAM_READY,          // loaded, not started
+    PROGRAM_RUNNING,
+    PROGRAM_DONE,
+    PROGRAM_STOPPED,        // by program_request_stop()
+    PROGRAM_ABORTED         // by an emergency stop
+} program_state_t;
+
+typedef struct {
+    program_state_t state;
+    u32 pc;                 // offset of the instruction being run
+    u32 code_size;
+    u32 moves;              // moves completed since the program started
+    u32 cycles;             // outermost loop passes completed
+} program_status_t;
+
+int   program_load(const u8 *image, u32 length, u32 *error_offset);
+void  program_request_run(void);
+void  program_request_stop(void);
+_Bool program_run_pending(void);
+void  program_execute(void);
+void  program_abort(void);
+void  program_get_status(program_status_t *status);
+const char *program_state_name(program_state_t state);
+void  program_print_status(void);
+
+#endif /* SRC_PROGRAM_H_ */
@@ -0,0 +1,114 @@
+/*
+ * ramp_cache.c
+ * ----------------------------------------
+ * Acceleration Ramp Table Cache Implementation
+ *
+ * Description:
+ * Looks up the ramp table for a motion profile, building it into the
+ * least recently used slot on a miss. Tables are filled by
+ * stepper_build_ramp_table() so they follow the same recurrence as the
+ * per-step planner.
+ *
+ * Key Functions:
+ * - ramp_cache_get(): Returns the table for a profile (NULL if too long)
+ * - ramp_cache_print_stats(): Prints hit/miss counts and memory footprint
+ */
+
+#include "stepper.h"
+#include "ramp_cache.h"
+
+// In the AMP build the cache belongs to the step engine on CPU1
+#ifndef STEPPER_AMP_REMOTE
+
+static u32 ramp_arena[RAMP_CACHE_SLOTS][RAMP_TABLE_MAX_STEPS];
+static ramp_table_t ramp_tables[RAMP_CACHE_SLOTS];
+static u32 ramp_use_counter;
+static ramp_cache_stats_t ramp_stats;
+
+
+/*
+ * Return the table for (speed, accel, decel, jerk), building it on a miss.
+ * Returns NULL if the profile's ramps do not fit in a slot.
+ * Task context only; the table must not be rebuilt while a move uses it.
+ */
+const ramp_table_t *ramp_cache_get(u32 speed, u32 accel, u32 decel, u32 jerk)
+{
+    ramp_table_t *victim = &ramp_tables[0];
+    int victim_index = 0;
+    u64 ramp_steps;
+    int i;
+
+    ramp_use_counter++;
+
+    for (i = 0; i < RAMP_CACHE_SLOTS; i++) {
+        ramp_table_t *table = &ramp_tables[i];
+        if (table->valid && table->speed == speed &&
+            table->accel == accel && table->decel == decel &&
+            table->jerk == jerk) {
+            table->last_used = ramp_use_counter;
+            ramp_stats.hits++;
+            return table;
+        }
+    }
+    ramp_stats.misses++;
+
+    // Ramp lengths are about v^2/(2a) + v^2/(2d), plus v*(a + d)/(2j) at
+    // most for an S-curve; don't evict for a profile that cannot fit anyway.
+    ramp_steps = ((u64)speed * speed) / (2ULL * accel) + ((u64)speed * speed) / (2ULL * decel);
+    if (jerk > 0) {
+        ramp_steps += ((u64)speed * (accel + decel)) / (2ULL * jerk);
+    }
+    if (ramp_steps >= RAMP_TABLE_MAX_STEPS) {
+        ramp_stats.uncacheable++;
+        return NULL;
+    }
+
+    // Pick an empty slot, otherwise the least recently used one
+    for (i = 0; i < RAMP_CACHE_SLOTS; i++) {
+        if (!ramp_tables[i].valid) {
+            victim = &ramp_tables[i];
+            victim_index = i;
+            break;
+        }
+        if (ramp_tables[i].last_used < victim->last_used) {
+            victim = &ramp_tables[i];
+            victim_index = i;
+        }
+    }
+
+    victim->speed = speed;
+    victim->accel = accel;
+    victim->decel = decel;
+    victim->jerk = jerk;
+    victim->last_used = ramp_use_counter;
+    victim->valid = stepper_build_ramp_table(victim, ramp_arena[victim_index], RAMP_TABLE_MAX_STEPS);
+
+    if (!victim->valid) {
+        ramp_stats.uncacheable++;
+        return NULL;
+    }
+    return victim;
+}
+
+/*
+ * Copy out the cache counters.
+ */
+void ramp_cache_get_stats(ramp_cache_stats_t *stats)
+{
+    *stats = ramp_stats;
+    stats->footprint_bytes = sizeof(ramp_arena) + sizeof(ramp_tables);
+}
+
+/*
+ * Print the cache counters and its static memory footprint.
+ */
+void ramp_cache_print_stats(void)
+{
+    ramp_cache_stats_t stats;
+
+    ramp_cache_get_stats(&stats);
+    xil_printf("ramp cache: %lu hits, %lu misses, %lu uncacheable, %lu bytes\n",
+               stats.hits, stats.misses, stats.uncacheable, stats.footprint_bytes);
+}
+
+#endif /* STEPPER_AMP_REMOTE */
@@ -0,0 +1,55 @@
+/*
+ * ramp_cache.h
+ * ----------------------------------------
+ * Acceleration Ramp Table Cache
+ *
+ * Description:
+ * Precomputed per-step interval tables for the accel and decel segments
+ * of a motion profile, keyed by (speed, accel, decel, jerk). jerk 0 is
+ * a trapezoid, anything else a jerk-limited S-curve. A small LRU of
+ * tables lives in a fixed arena so repeated production cycles do not
+ * recompute their ramps on every move.
+ *
+ * Definitions:
+ * - RAMP_CACHE_SLOTS:      Number of profiles kept at once
+ * - RAMP_TABLE_MAX_STEPS:  Arena entries per slot (accel + decel steps)
+ *
+ * A profile whose ramps do not fit in one slot is reported as
+ * uncacheable and the driver falls back to the per-step recurrence.
+ */
+
+#ifndef SRC_RAMP_CACHE_H_
+#define SRC_RAMP_CACHE_H_
+
+#include "xil_types.h"
+
+#define RAMP_CACHE_SLOTS      4
+#define RAMP_TABLE_MAX_STEPS  2048
+
+typedef struct {
+    u32 speed;          // steps/s
+    u32 accel;          // steps/s^2
+    u32 decel;          // steps/s^2
+    u32 jerk;           // steps/s^3, 0 for a trapezoid
+    u32 cruise_us;      // step period at speed
+    u32 accel_steps;    // entries in accel_us
+    u32 decel_steps;    // entries in decel_us (full-speed stop margin)
+    u32 *accel_us;      // accel_us[k]: period before step k of a move
+    u32 *decel_us;      // decel_us[r - 1]: period before a step with r steps left
+    u32 last_used;      // LRU stamp
+    _Bool valid;
+} ramp_table_t;
+
+// Cache statistics
+typedef struct {
+    u32 hits;
+    u32 misses;
+    u32 uncacheable;
+    u32 footprint_bytes;
+} ramp_cache_stats_t;
+
+const ramp_table_t *ramp_cache_get(u32 speed, u32 accel, u32 decel, u32 jerk);
+void ramp_cache_get_stats(ramp_cache_stats_t *stats);
+void ramp_cache_print_stats(void);
+
+#endif /* SRC_RAMP_CACHE_H_ */
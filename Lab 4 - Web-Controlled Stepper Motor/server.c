@@ -10,179 +10,571 @@
 #include "server.h"
 #include "string.h"
 #include "stepper.h"
+#include "planner.h"
+#include "program.h"
+#include "stream.h"
+#include "batch.h"
+#include "timesync.h"
+#include "httpd.h"
 
 #define MIN_POSITION 0
 #define MAX_POSITION 2048
 #define MIN_DWELL_TIME 0
-#define MAX_SPEED 500
-#define MAX_ACCELERATION 500
+#define DEFAULT_SPEED 250
+#define MAX_JERK 10000
+#define DEFAULT_JERK 2000
 
 void validate_input(motor_parameters_t* motor_pars);
+static void handle_request(httpd_connection_t *connection);
+static _Bool copy_trace(void *context, const void *data, u32 length);
+static void release_trace(void *context);
+static void format_program_status(char *buf, size_t size);
+static void queue_batch(const char *url, char *buf, size_t size);
+static _Bool start_time_conflict(const motor_parameters_t *params, char *buf, size_t size);
+static void format_sync_status(char *buf, size_t size);
+static void set_sync_role(const char *url);
+static char *format_u64(u64 value, char *buf);
 
-/* Main server application thread */
+// Step trace being downloaded (GET /trace); trace_length != 0 while in use
+static u8  trace_buffer[sizeof(stepper_trace_header_t) + STEPPER_TRACE_SIZE * sizeof(stepper_trace_record_t)];
+static u32 trace_length;
+
+/* Main server application thread: the HTTP event loop (httpd.c) */
 void server_application_thread()
 {
-    int sock, new_sd;
-    int size, n;
-    struct sockaddr_in address, remote;
-    char recv_buf[RECV_BUF_SIZE];
-    char http_response[1024];
+    httpd_serve(SERVER_PORT, handle_request);
+}
+
+/*
+ * Answer one complete request (called by httpd.c): the request line is
+ * NUL-terminated at the start of connection->request and the response
+ * is formatted into connection->response.
+ */
+static void handle_request(httpd_connection_t *connection)
+{
+    char *recv_buf = connection->request;
+    char *http_response = connection->response;
     char direction[20];
-    memset(&address, 0, sizeof(address));
+    char start_at[24];
+    stepper_telemetry_t telemetry;
+
+    xil_printf("Received request line: %s\n", recv_buf);
+
+    // One consistent sample of the motor for this request
+    stepper_get_telemetry(&telemetry);
+    motor_pars.rotational_speed= fabsf(telemetry.velocity);
+    motor_pars.current_position= telemetry.position;
+
+    xil_printf("Current Position: %ld\n", motor_pars.current_position);
+
+    // Determine which endpoint is requested.
+    if (strncmp(recv_buf, "GET /getParams", 14) == 0) {
+        // Process GET /getParams
+        planner_eta_t eta;
+
+        planner_get_eta(&eta);
+        if (telemetry.direction > 0) {
+            strcpy(direction, "Clockwise");
+        } else if (telemetry.direction < 0) {
+            strcpy(direction, "Counter-Clockwise");
+        } else {
+            strcpy(direction, "Stopped");
+        }
+        snprintf(http_response, HTTPD_RESPONSE_SIZE,
+                 "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Connection: close\r\n\r\n"
+                 "{"
+        		   "\"current_position\": %ld,"
+                   "\"rotational_accel\": %.2f,"
+                   "\"rotational_decel\": %.2f,"
+                   "\"final_position\": %ld,"
+                   "\"rotational_speed\": %.2f,"
+                   "\"direction\": \"%s\","
+                   "\"phase\": %d,"
+                   "\"move_id\": %lu,"
+                   "\"timestamp_us\": %lu,"
+                   "\"feed_override\": %lu,"
+                   "\"move_eta_ms\": %lu,"
+                   "\"queue_eta_ms\": %lu,"
+                   "\"queued_targets\": %lu"
+                 "}",
+				 motor_pars.current_position,
+                 motor_pars.rotational_accel,
+                 motor_pars.rotational_decel,
+                 motor_pars.final_position,
+                 motor_pars.rotational_speed,
+                 direction,
+                 telemetry.phase,
+                 telemetry.move,
+                 telemetry.timestamp_us,
+                 stepper_get_feed_override(),
+                 eta.move_ms,
+                 eta.queue_ms,
+                 eta.queued);
+    } else if (strncmp(recv_buf, "GET /setParams", 14) == 0) {
+        // Extract the URL part from the request line.
+        char *url_start = recv_buf + 4;  // Skip "GET "
+        char *url_end = strchr(url_start, ' ');
+        motor_parameters_t previous = motor_pars;
+        if (url_end) {
+            *url_end = '\0';  // Terminate the URL string
+        }
+        xil_printf("Clean URL: %s\n", url_start);
+
+        // Process the query string from the clean URL. A retarget
+        // (rt=1), urgent target (ur=1) or start time (st=) applies
+        // to this request only.
+        motor_pars.retarget = 0;
+        motor_pars.urgent = 0;
+        motor_pars.start_at_us = 0;
+        process_query_string(url_start, &motor_pars);
+        validate_input(&motor_pars);
+        if (start_time_conflict(&motor_pars, http_response, HTTPD_RESPONSE_SIZE)) {
+            // Nothing queued, nothing kept
+            motor_pars = previous;
+            return;
+        }
+        xil_printf("After processing, parameters: cis=%ld, fis=%ld, dt=%ld, rs=%.2f, ra=%.2f, rd=%.2f, sm=%d, mp=%d, rj=%.2f\n",
+                   motor_pars.current_position,
+                   motor_pars.final_position,
+                   motor_pars.dwell_time,
+                   motor_pars.rotational_speed,
+                   motor_pars.rotational_accel,
+                   motor_pars.rotational_decel,
+                   motor_pars.step_mode,
+                   motor_pars.motion_profile,
+                   motor_pars.rotational_jerk);
+
+        // Send updated parameters to the motor queue of their lane,
+        // timed for the queue ETA.
+        motor_pars.queued_tick = xTaskGetTickCount();
+        planner_eta_queued(&motor_pars);
+        if (xQueueSend(motor_pars.urgent ? motor_urgent_queue : motor_queue, &motor_pars, 0) != pdPASS) {
+            planner_eta_cancel(&motor_pars);
+        }
+
+
+        snprintf(http_response, HTTPD_RESPONSE_SIZE,
+                 "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Connection: close\r\n\r\n"
+                 "{"
+                    "\"current_position\": %ld,"
+                    "\"final_position\": %ld,"
+                    "\"dwell_time\": %ld,"
+                    "\"rotational_speed\": %.2f,"
+                    "\"rotational_accel\": %.2f,"
+                    "\"rotational_decel\": %.2f,"
+                    "\"step_mode\": %d,"
+                    "\"motion_profile\": %d,"
+                    "\"rotational_jerk\": %.2f,"
+                    "\"retarget\": %d,"
+                    "\"rotary\": %d,"
+                    "\"full_step_cruise\": %d,"
+                    "\"urgent\": %d,"
+                    "\"start_at_us\": %s,"
+                    "\"estimate_ms\": %lu"
+                 "}",
+                 motor_pars.current_position,
+                 motor_pars.final_position,
+                 motor_pars.dwell_time,
+                 motor_pars.rotational_speed,
+                 motor_pars.rotational_accel,
+                 motor_pars.rotational_decel,
+                 motor_pars.step_mode,
+                 motor_pars.motion_profile,
+                 motor_pars.rotational_jerk,
+                 motor_pars.retarget,
+                 motor_pars.rotary,
+                 motor_pars.full_step_cruise,
+                 motor_pars.urgent,
+                 format_u64(motor_pars.start_at_us, start_at),
+                 motor_pars.estimate_ms);
+    } else if (strncmp(recv_buf, "GET /setBatch", 13) == 0) {
+        // Targets to visit in any order, one fis= each, sharing
+        // the other parameters, e.g. /setBatch?fis=300&fis=40&fis=900&rs=600
+        queue_batch(recv_buf + 4, http_response, HTTPD_RESPONSE_SIZE);
+    } else if (strncmp(recv_buf, "GET /getQueue", 13) == 0) {
+        planner_lane_stats_t lanes[PLANNER_LANES];
+
+        planner_get_lane_stats(motor_queue, motor_urgent_queue, lanes);
+        snprintf(http_response, HTTPD_RESPONSE_SIZE,
+                 "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Connection: close\r\n\r\n"
+                 "{"
+                    "\"urgent\": {\"depth\": %lu, \"oldest_ms\": %lu, \"started\": %lu,"
+                                " \"mean_wait_ms\": %lu, \"max_wait_ms\": %lu},"
+                    "\"normal\": {\"depth\": %lu, \"oldest_ms\": %lu, \"started\": %lu,"
+                                " \"mean_wait_ms\": %lu, \"max_wait_ms\": %lu}"
+                 "}",
+                 lanes[PLANNER_LANE_URGENT].depth,
+                 lanes[PLANNER_LANE_URGENT].oldest_ms,
+                 lanes[PLANNER_LANE_URGENT].started,
+                 lanes[PLANNER_LANE_URGENT].mean_wait_ms,
+                 lanes[PLANNER_LANE_URGENT].max_wait_ms,
+                 lanes[PLANNER_LANE_NORMAL].depth,
+                 lanes[PLANNER_LANE_NORMAL].oldest_ms,
+                 lanes[PLANNER_LANE_NORMAL].started,
+                 lanes[PLANNER_LANE_NORMAL].mean_wait_ms,
+                 lanes[PLANNER_LANE_NORMAL].max_wait_ms);
+    } else if (strncmp(recv_buf, "GET /setFeed", 12) == 0) {
+        // Feed-rate override, e.g. /setFeed?pct=50; applies to the
+        // running move from its next step
+        char *pct = strstr(recv_buf, "pct=");
+        if (pct != NULL) {
+            stepper_set_feed_override((u32)atol(pct + 4));
+        }
+        snprintf(http_response, HTTPD_RESPONSE_SIZE,
+                 "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Connection: close\r\n\r\n"
+                 "{\"feed_override\": %lu}",
+                 stepper_get_feed_override());
+    } else if (strncmp(recv_buf, "POST /loadProgram", 17) == 0) {
+        // Motion program image as the body (see program.h), e.g.
+        // curl --data-binary @cycle.bin http://<board>/loadProgram
+        u32 error_offset;
+        int length = (connection->body != NULL) ? (int)connection->body_length : -1;
+
+        if (length > 0 &&
+            program_load((const u8 *)connection->body, (u32)length, &error_offset) == XST_SUCCESS) {
+            format_program_status(http_response, HTTPD_RESPONSE_SIZE);
+        } else {
+            snprintf(http_response, HTTPD_RESPONSE_SIZE,
+                     "HTTP/1.1 400 Bad Request\r\n"
+                     "Content-Type: application/json\r\n"
+                     "Connection: close\r\n\r\n"
+                     "{\"error\": \"Invalid program\", \"offset\": %lu}",
+                     (length > 0) ? error_offset : 0UL);
+        }
+    } else if (strncmp(recv_buf, "GET /runProgram", 15) == 0) {
+        program_request_run();
+        format_program_status(http_response, HTTPD_RESPONSE_SIZE);
+    } else if (strncmp(recv_buf, "GET /stopProgram", 16) == 0) {
+        program_request_stop();
+        format_program_status(http_response, HTTPD_RESPONSE_SIZE);
+    } else if (strncmp(recv_buf, "GET /getProgram", 15) == 0) {
+        format_program_status(http_response, HTTPD_RESPONSE_SIZE);
+    } else if (strncmp(recv_buf, "GET /getSync", 12) == 0) {
+        format_sync_status(http_response, HTTPD_RESPONSE_SIZE);
+    } else if (strncmp(recv_buf, "GET /setSync", 12) == 0) {
+        // Time sync role, e.g. /setSync?role=leader or
+        // /setSync?role=follower&leader=169.254.8.9
+        set_sync_role(recv_buf + 4);
+        format_sync_status(http_response, HTTPD_RESPONSE_SIZE);
+    } else if (strncmp(recv_buf, "GET /getStream", 14) == 0) {
+        stream_stats_t stream;
+
+        stream_get_stats(&stream);
+        snprintf(http_response, HTTPD_RESPONSE_SIZE,
+                 "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Connection: close\r\n\r\n"
+                 "{"
+                    "\"active\": %d,"
+                    "\"connected\": %d,"
+                    "\"received\": %lu,"
+                    "\"buffered\": %lu,"
+                    "\"underruns\": %lu,"
+                    "\"overruns\": %lu,"
+                    "\"late\": %lu,"
+                    "\"position\": %ld,"
+                    "\"setpoint\": %ld"
+                 "}",
+                 stream.active,
+                 stream.connected,
+                 stream.received,
+                 stream.buffered,
+                 stream.underruns,
+                 stream.overruns,
+                 stream.late,
+                 stream.position,
+                 stream.reference);
+    } else if (strncmp(recv_buf, "GET /trace", 10) == 0) {
+        // Binary step trace (decode with tools/trace_decode.c). The body
+        // runs until the connection closes. It is copied out whole and
+        // sent as the client takes it, one download at a time.
+        if (trace_length != 0) {
+            snprintf(http_response, HTTPD_RESPONSE_SIZE,
+                     "HTTP/1.1 503 Service Unavailable\r\n"
+                     "Content-Type: application/json\r\n"
+                     "Connection: close\r\n\r\n"
+                     "{\"error\": \"Trace download in progress\"}");
+        } else {
+            stepper_trace_export(copy_trace, NULL);
+            snprintf(http_response, HTTPD_RESPONSE_SIZE,
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: application/octet-stream\r\n"
+                     "Connection: close\r\n\r\n");
+            httpd_attach(connection, trace_buffer, trace_length, release_trace, NULL);
+        }
+    } else {
+        // Return 404 for any other request.
+        snprintf(http_response, HTTPD_RESPONSE_SIZE,
+                 "HTTP/1.1 404 Not Found\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Connection: close\r\n\r\n"
+                 "{\"error\": \"Unknown endpoint\"}");
+    }
+}
+
+/* Motion program state as a JSON response */
+static void format_program_status(char *buf, size_t size)
+{
+    program_status_t status;
+
+    program_get_status(&status);
+    snprintf(buf, size,
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: application/json\r\n"
+             "Connection: close\r\n\r\n"
+             "{"
+                "\"program\": \"%s\","
+                "\"size\": %lu,"
+                "\"pc\": %lu,"
+                "\"moves\": %lu,"
+                "\"cycles\": %lu"
+             "}",
+             program_state_name(status.state),
+             status.code_size,
+             status.pc,
+             status.moves,
+             status.cycles);
+}
+
+/*
+ * A start time (st=) waits its turn in the normal sequence; a retarget
+ * (rt=1) or urgent target (ur=1) starts at once and would drop it. If a
+ * request asks for both, format 400 Bad Request into buf and return
+ * TRUE.
+ */
+static _Bool start_time_conflict(const motor_parameters_t *params, char *buf, size_t size)
+{
+    if (params->start_at_us == 0 || (!params->retarget && !params->urgent)) {
+        return 0;
+    }
+    snprintf(buf, size,
+             "HTTP/1.1 400 Bad Request\r\n"
+             "Content-Type: application/json\r\n"
+             "Connection: close\r\n\r\n"
+             "{\"error\": \"st= cannot be combined with rt=1 or ur=1\"}");
+    return 1;
+}
+
+/*
+ * Parse a /setBatch request, order its targets with batch_optimize() and
+ * queue them on motor_queue, each starting where the one before it
+ * ends. The first starts where the motor will be when the batch comes
+ * up: where it is now, or where the last queued target leaves it. The
+ * batch is queued whole or not at all. The response (or
+ * error) is formatted into buf.
+ */
+static void queue_batch(const char *url, char *buf, size_t size)
+{
+    motor_parameters_t batch_pars = motor_pars;
+    long targets[BATCH_MAX_TARGETS];
+    u8 order[BATCH_MAX_TARGETS];
+    char order_json[BATCH_MAX_TARGETS * 4 + 3];
+    batch_result_t result;
+    const char *fis = url;
+    u32 count = 0;
+    u32 length = 0;
+    u32 i;
 
-    // Create new socket
-    if ((sock = lwip_socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        xil_printf("Error creating socket.\r\n");
+    batch_pars.retarget = 0;
+    batch_pars.urgent = 0;
+    batch_pars.start_at_us = 0;
+    process_query_string(url, &batch_pars);
+    validate_input(&batch_pars);
+    if (start_time_conflict(&batch_pars, buf, size)) {
         return;
     }
 
-    // Address settings
-    address.sin_family = AF_INET;
-    address.sin_port = htons(SERVER_PORT);
-    address.sin_addr.s_addr = INADDR_ANY;
+    // Every fis= is a target, folded like a single /setParams target
+    while ((fis = strstr(fis, "fis=")) != NULL) {
+        motor_parameters_t target = batch_pars;
+        if (fis[-1] != '?' && fis[-1] != '&') {
+            fis += 4;
+            continue;
+        }
+        if (count == BATCH_MAX_TARGETS) {
+            count++;
+            break;
+        }
+        target.final_position = atol(fis + 4);
+        validate_input(&target);
+        targets[count++] = target.final_position;
+        fis += 4;
+    }
 
-    // Bind socket to address
-    if (lwip_bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        xil_printf("Error on lwip_bind.\r\n");
+    if (count == 0 || count > BATCH_MAX_TARGETS ||
+        uxQueueSpacesAvailable(motor_queue) < count) {
+        snprintf(buf, size,
+                 "HTTP/1.1 400 Bad Request\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Connection: close\r\n\r\n"
+                 "{\"error\": \"Batch needs 1 to %d targets and room in the queue\", \"free\": %lu}",
+                 BATCH_MAX_TARGETS, (u32)uxQueueSpacesAvailable(motor_queue));
         return;
     }
 
-    // Start listening
-    lwip_listen(sock, 0);
-    size = sizeof(remote);
+    // Order from where the batch will actually start, not the request's cp=
+    batch_pars.current_position = planner_queue_end(stepper_get_pos());
+    batch_optimize(&batch_pars, batch_pars.current_position, targets, count, order, &result);
+    xil_printf("batch: %lu targets, %lu ms in submission order, %lu ms ordered (%lu passes)\n",
+               count, (u32)(result.submitted_s * 1000.0f), (u32)(result.optimized_s * 1000.0f),
+               result.passes);
 
-    struct pollfd fds[1];
-    fds[0].fd = sock;
-    fds[0].events = POLLIN;
+    order_json[length++] = '[';
+    for (i = 0; i < count; i++) {
+        motor_parameters_t target = batch_pars;
 
-    while (1) {
-        int ret = poll(fds, 1, 10);
-        if (ret > 0) {
-            new_sd = lwip_accept(sock, (struct sockaddr *)&remote, (socklen_t *)&size);
-            if (new_sd < 0) {
-                xil_printf("Error accepting connection.\r\n");
-                continue;
-            }
-
-            memset(recv_buf, 0, sizeof(recv_buf));
-            n = read(new_sd, recv_buf, RECV_BUF_SIZE - 1);
-            if (n < 0) {
-                xil_printf("Error reading from socket %d, closing.\r\n", new_sd);
-                close(new_sd);
-                continue;
-            }
-
-            recv_buf[n] = '\0';  // Null-terminate
-
-            // Extract only the first line (request line) from the HTTP request.
-            char *line_end = strstr(recv_buf, "\r\n");
-            if (line_end != NULL) {
-                *line_end = '\0';
-            }
-            xil_printf("Received request line: %s\n", recv_buf);
-            motor_pars.rotational_speed= stepper_get_speed();
-            motor_pars.current_position= stepper_get_pos();
-
-            xil_printf("Current Position: %ld\n", motor_pars.current_position);
-
-            // Determine which endpoint is requested.
-            if (strncmp(recv_buf, "GET /getParams", 14) == 0) {
-                // Process GET /getParams
-                if (step_dir > 0) {
-                    strcpy(direction, "Clockwise");
-                } else if (step_dir < 0) {
-                    strcpy(direction, "Counter-Clockwise");
-                } else {
-                    strcpy(direction, "Stopped");
-                }
-                snprintf(http_response, sizeof(http_response),
-                         "HTTP/1.1 200 OK\r\n"
-                         "Content-Type: application/json\r\n"
-                         "Connection: close\r\n\r\n"
-                         "{"
-                		   "\"current_position\": %ld,"
-                           "\"rotational_accel\": %.2f,"
-                           "\"rotational_decel\": %.2f,"
-                           "\"final_position\": %ld,"
-                           "\"rotational_speed\": %.2f,"
-                           "\"direction\": \"%s\""
-                         "}",
-						 motor_pars.current_position,
-                         motor_pars.rotational_accel,
-                         motor_pars.rotational_decel,
-                         motor_pars.final_position,
-                         motor_pars.rotational_speed,
-                         direction);
-            } else if (strncmp(recv_buf, "GET /setParams", 14) == 0) {
-                // Extract the URL part from the request line.
-                char *url_start = recv_buf + 4;  // Skip "GET "
-                char *url_end = strchr(url_start, ' ');
-                if (url_end) {
-                    *url_end = '\0';  // Terminate the URL string
-                }
-                xil_printf("Clean URL: %s\n", url_start);
-
-                // Process the query string from the clean URL.
-                process_query_string(url_start, &motor_pars);
-                validate_input(&motor_pars);
-                xil_printf("After processing, parameters: cis=%ld, fis=%ld, dt=%ld, rs=%.2f, ra=%.2f, rd=%.2f, sm=%d\n",
-                           motor_pars.current_position,
-                           motor_pars.final_position,
-                           motor_pars.dwell_time,
-                           motor_pars.rotational_speed,
-                           motor_pars.rotational_accel,
-                           motor_pars.rotational_decel,
-                           motor_pars.step_mode);
-
-                // Send updated parameters to motor queue.
-                xQueueSend(motor_queue, &motor_pars, 0);
-
-
-                snprintf(http_response, sizeof(http_response),
-                         "HTTP/1.1 200 OK\r\n"
-                         "Content-Type: application/json\r\n"
-                         "Connection: close\r\n\r\n"
-                         "{"
-                            "\"current_position\": %ld,"
-                            "\"final_position\": %ld,"
-                            "\"dwell_time\": %ld,"
-                            "\"rotational_speed\": %.2f,"
-                            "\"rotational_accel\": %.2f,"
-                            "\"rotational_decel\": %.2f,"
-                            "\"step_mode\": %d"
-                         "}",
-                         motor_pars.current_position,
-                         motor_pars.final_position,
-                         motor_pars.dwell_time,
-                         motor_pars.rotational_speed,
-                         motor_pars.rotational_accel,
-                         motor_pars.rotational_decel,
-                         motor_pars.step_mode);
-            } else {
-                // Return 404 for any other request.
-                snprintf(http_response, sizeof(http_response),
-                         "HTTP/1.1 404 Not Found\r\n"
-                         "Content-Type: application/json\r\n"
-                         "Connection: close\r\n\r\n"
-                         "{\"error\": \"Unknown endpoint\"}");
-            }
-            // Send the response and close the socket.
-            write_to_socket(new_sd, http_response);
-            close(new_sd);
+        target.final_position = targets[order[i]];
+        target.queued_tick = xTaskGetTickCount();
+        planner_eta_queued(&target);
+        if (xQueueSend(motor_queue, &target, 0) != pdPASS) {
+            planner_eta_cancel(&target);
         }
+        batch_pars.current_position = target.final_position;
+        // A start time is for the first target; the rest follow it
+        batch_pars.start_at_us = 0;
+        length += snprintf(order_json + length, sizeof(order_json) - length,
+                           (i == 0) ? "%u" : ",%u", order[i]);
     }
+    order_json[length++] = ']';
+    order_json[length] = '\0';
+
+    snprintf(buf, size,
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: application/json\r\n"
+             "Connection: close\r\n\r\n"
+             "{"
+                "\"targets\": %lu,"
+                "\"order\": %s,"
+                "\"submitted_ms\": %lu,"
+                "\"optimized_ms\": %lu"
+             "}",
+             count,
+             order_json,
+             (u32)(result.submitted_s * 1000.0f),
+             (u32)(result.optimized_s * 1000.0f));
 }
 
-/* Helper function to write to socket */
-int write_to_socket(int sd, const char* buffer)
+/* Time sync role, estimate and start time counters as a JSON response */
+static void format_sync_status(char *buf, size_t size)
 {
-    int nwrote = write(sd, buffer, strlen(buffer));
-    if (nwrote < 0) {
-        xil_printf("ERROR responding to client. tried = %d, written = %d\r\n",
-                   (int)strlen(buffer), nwrote);
-        xil_printf("Closing socket %d\r\n", sd);
+    timesync_stats_t sync;
+    char leader_time[24];
+    char offset[24];
+
+    timesync_get_stats(&sync);
+    format_u64(timesync_leader_us(), leader_time);
+    if (sync.offset_us < 0) {
+        offset[0] = '-';
+        format_u64((u64)-sync.offset_us, offset + 1);
+    } else {
+        format_u64((u64)sync.offset_us, offset);
     }
-    return nwrote;
+    snprintf(buf, size,
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: application/json\r\n"
+             "Connection: close\r\n\r\n"
+             "{"
+                "\"role\": \"%s\","
+                "\"synced\": %d,"
+                "\"leader_time_us\": %s,"
+                "\"offset_us\": %s,"
+                "\"drift_ppm\": %.3f,"
+                "\"round_trip_us\": %lu,"
+                "\"error_us\": %lu,"
+                "\"exchanges\": %lu,"
+                "\"fitted\": %lu,"
+                "\"lost\": %lu,"
+                "\"served\": %lu,"
+                "\"starts\": %lu,"
+                "\"late_starts\": %lu,"
+                "\"unsynced_starts\": %lu,"
+                "\"last_start_error_us\": %ld,"
+                "\"max_start_error_us\": %lu"
+             "}",
+             timesync_role_name(sync.role),
+             sync.synced,
+             leader_time,
+             offset,
+             sync.drift_ppm,
+             sync.delay_us,
+             sync.error_us,
+             sync.exchanges,
+             sync.fitted,
+             sync.lost,
+             sync.served,
+             sync.starts,
+             sync.late_starts,
+             sync.unsynced_starts,
+             sync.last_start_error_us,
+             sync.max_start_error_us);
+}
+
+/*
+ * Parse a /setSync request: role=off|leader|follower, and leader=<IPv4>
+ * for a follower. An unknown role or a follower without a leader
+ * address leaves the role as it is.
+ */
+static void set_sync_role(const char *url)
+{
+    const char *role = strstr(url, "role=");
+    const char *leader = strstr(url, "leader=");
+    char address[16];
+
+    if (role == NULL) {
+        return;
+    }
+    role += 5;
+    if (strncmp(role, "off", 3) == 0) {
+        timesync_set_role(TIMESYNC_OFF, 0, 0);
+    } else if (strncmp(role, "leader", 6) == 0) {
+        timesync_set_role(TIMESYNC_LEADER, 0, 0);
+    } else if (strncmp(role, "follower", 8) == 0 && leader != NULL &&
+               sscanf(leader + 7, "%15[0-9.]", address) == 1) {
+        timesync_set_role(TIMESYNC_FOLLOWER, inet_addr(address), TIMESYNC_PORT);
+    }
+}
+
+/* Decimal text of a 64-bit value (xil_printf and newlib-nano lack %llu) */
+static char *format_u64(u64 value, char *buf)
+{
+    char digits[21];
+    int n = 0;
+    int i;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    for (i = 0; i < n; i++) {
+        buf[i] = digits[n - 1 - i];
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+/* stepper_trace_export() sink: copy into trace_buffer */
+static _Bool copy_trace(void *context, const void *data, u32 length)
+{
+    if (trace_length + length > sizeof(trace_buffer)) {
+        return 0;
+    }
+    memcpy(trace_buffer + trace_length, data, length);
+    trace_length += length;
+    return 1;
+}
+
+/* The trace download has ended: the buffer is free again */
+static void release_trace(void *context)
+{
+    trace_length = 0;
 }
 
 /* Process query string: parse name/value pairs into motor_parameters_t */
@@ -232,6 +624,20 @@ int parse_query_parameter(const char* name, const char* value, motor_parameters_
         params->final_position = atol(value); // Use atol instead of atof
     } else if (strcmp(name, "sm") == 0) {
         params->step_mode = atoi(value);
+    } else if (strcmp(name, "mp") == 0) {
+        params->motion_profile = atoi(value);
+    } else if (strcmp(name, "rj") == 0) {
+        params->rotational_jerk = atof(value);
+    } else if (strcmp(name, "fc") == 0) {
+        params->full_step_cruise = (atoi(value) != 0);
+    } else if (strcmp(name, "ro") == 0) {
+        params->rotary = (atoi(value) != 0);
+    } else if (strcmp(name, "rt") == 0) {
+        params->retarget = (atoi(value) != 0);
+    } else if (strcmp(name, "ur") == 0) {
+        params->urgent = (atoi(value) != 0);
+    } else if (strcmp(name, "st") == 0) {
+        params->start_at_us = strtoull(value, NULL, 10);
     } else if (strcmp(name, "dt") == 0) {
         params->dwell_time = atol(value); // Use atol instead of atof
     } else {
@@ -243,21 +649,34 @@ int parse_query_parameter(const char* name, const char* value, motor_parameters_
 }
 
 void validate_input(motor_parameters_t* motor_pars) {
-    // Current and final position
-    if (motor_pars->current_position < MIN_POSITION) {
-        motor_pars->current_position = MIN_POSITION;
-    }
-//    else if (motor_pars->current_position != stepper_get_pos()){
-//    	motor_pars->current_position = stepper_get_pos();
-//    }
-    if (motor_pars->final_position < MIN_POSITION) {
-        motor_pars->final_position = MIN_POSITION;
-    }
-    if (motor_pars->current_position > MAX_POSITION) {
-        motor_pars->current_position %= MAX_POSITION;
+    float max_speed, max_accel;
+
+    // Step Mode
+    if (motor_pars->step_mode > 2 || motor_pars->step_mode < 0) {
+        motor_pars->step_mode = 0;
     }
-    if (motor_pars->final_position > MAX_POSITION) {
-        motor_pars->final_position %= MAX_POSITION;
+
+    // Current and final position. Rotary targets are angles: fold them
+    // into one revolution of the step mode, negative ones included.
+    if (motor_pars->rotary) {
+        long rev = stepper_steps_per_revolution(motor_pars->step_mode);
+        motor_pars->final_position = ((motor_pars->final_position % rev) + rev) % rev;
+    } else {
+        if (motor_pars->current_position < MIN_POSITION) {
+            motor_pars->current_position = MIN_POSITION;
+        }
+//        else if (motor_pars->current_position != stepper_get_pos()){
+//        	motor_pars->current_position = stepper_get_pos();
+//        }
+        if (motor_pars->final_position < MIN_POSITION) {
+            motor_pars->final_position = MIN_POSITION;
+        }
+        if (motor_pars->current_position > MAX_POSITION) {
+            motor_pars->current_position %= MAX_POSITION;
+        }
+        if (motor_pars->final_position > MAX_POSITION) {
+            motor_pars->final_position %= MAX_POSITION;
+        }
     }
 
     // Dwell Time
@@ -265,22 +684,29 @@ void validate_input(motor_parameters_t* motor_pars) {
         motor_pars->dwell_time = MIN_DWELL_TIME;
     }
 
+    // Speed and acceleration limits of the step mode
+    max_speed = stepper_move_max_speed(motor_pars->step_mode, motor_pars->full_step_cruise);
+    max_accel = stepper_max_accel(motor_pars->step_mode);
+
     // Rotational Speed
-    if (motor_pars->rotational_speed > MAX_SPEED || motor_pars->rotational_speed <= 0) {
-        motor_pars->rotational_speed = (MAX_SPEED) / 2;
+    if (motor_pars->rotational_speed > max_speed || motor_pars->rotational_speed <= 0) {
+        motor_pars->rotational_speed = (DEFAULT_SPEED < max_speed) ? DEFAULT_SPEED : max_speed;
     }
 
     // Acceleration Speed
-    if (motor_pars->rotational_accel > MAX_ACCELERATION || motor_pars->rotational_accel <= 0) {
-        motor_pars->rotational_accel = (MAX_ACCELERATION) / 2;
+    if (motor_pars->rotational_accel > max_accel || motor_pars->rotational_accel <= 0) {
+        motor_pars->rotational_accel = max_accel / 2;
     }
     // Deceleration Speed
-    if (motor_pars->rotational_decel > MAX_ACCELERATION || motor_pars->rotational_decel <= 0) {
-        motor_pars->rotational_decel = (MAX_ACCELERATION) / 2;
+    if (motor_pars->rotational_decel > max_accel || motor_pars->rotational_decel <= 0) {
+        motor_pars->rotational_decel = max_accel / 2;
     }
 
-    // Step Mode
-    if (motor_pars->step_mode > 2 || motor_pars->step_mode < 0) {
-        motor_pars->step_mode = 0;
+    // Motion Profile and Jerk
+    if (motor_pars->motion_profile > PROFILE_S_CURVE || motor_pars->motion_profile < 0) {
+        motor_pars->motion_profile = PROFILE_TRAPEZOID;
+    }
+    if (motor_pars->rotational_jerk > MAX_JERK || motor_pars->rotational_jerk <= 0) {
+        motor_pars->rotational_jerk = DEFAULT_JERK;
     }
 }
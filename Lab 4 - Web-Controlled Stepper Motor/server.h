@@ -9,15 +9,17 @@
  * Description:
  * This header declares the interface for the HTTP server module used to
  * configure and monitor stepper motor parameters in an embedded system.
+ * Connections are handled by the event loop in httpd.c, several clients
+ * at a time; server.c answers each complete request.
  *
  * Definitions:
  * - THREAD_STACKSIZE: Stack size for the server task thread (1kB)
- * - RECV_BUF_SIZE:    Buffer size for incoming HTTP requests (2kB)
  * - SERVER_PORT:      TCP port used for HTTP communication (default: 80)
  *
  * Global Variables:
  * - motor_pars: Stores the current stepper motor parameters
- * - button_queue, motor_queue: Shared FreeRTOS queues used by tasks
+ * - button_queue, motor_queue, motor_urgent_queue: Shared FreeRTOS queues
+ *   used by tasks (motor_urgent_queue: targets sent with ur=1)
  *
  */
 
@@ -33,18 +35,17 @@
 #include "stepper.h"
 
 #define THREAD_STACKSIZE 	1024
-#define RECV_BUF_SIZE 		2048
 #define SERVER_PORT 		80
 
 // Globals
 motor_parameters_t motor_pars;
 extern QueueHandle_t button_queue;
 extern QueueHandle_t motor_queue;
+extern QueueHandle_t motor_urgent_queue;
 
 // Function prototypes
 void server_application_thread();
 void process_query_string(const char* query, motor_parameters_t* params);
-int write_to_socket(int sd, const char* send_buf);
 int parse_query_parameter(const char* name, const char* value, motor_parameters_t* motor_parameters);
 
 #endif
@@ -0,0 +1,247 @@
+/*
+ * step_timer.c
+ * ----------------------------------------
+ * Hardware Step Timer Implementation
+ *
+ * Description:
+ * Drives the stepper step deadlines from a TTC counter in interval mode.
+ * The counter restarts from zero each time it matches, so writing a new
+ * interval from inside the callback sets the length of the period that
+ * has just begun. Periods longer than the 16-bit counter are split into
+ * chunks and only the last chunk invokes the callback.
+ *
+ * Key Functions:
+ * - step_timer_initialize(): Configures the TTC and installs the ISR
+ * - step_timer_start(): Arms the first deadline
+ * - step_timer_set_interval(): Sets the next deadline (ISR context)
+ * - step_timer_get_time_us(): Free-running microsecond timestamp
+ * - step_timer_get_counts(): Free-running raw counter timestamp
+ */
+
+#include "step_timer.h"
+
+#ifndef STEP_TIMER_SIMULATED
+
+#include "xttcps.h"
+#include "xtime_l.h"
+#include "FreeRTOS.h"
+
+static XTtcPs step_timer_inst;
+static step_timer_callback_t step_callback = NULL;
+static u32 step_timer_hz;
+static u32 remaining_ticks;
+
+static void step_timer_isr(void *callback_ref);
+
+
+/*
+ * Convert microseconds to counter ticks (never less than one tick).
+ */
+static u32 step_timer_us_to_ticks(u32 interval_us)
+{
+    u32 ticks = (u32)(((u64)interval_us * step_timer_hz) / 1000000ULL);
+    return (ticks > 0) ? ticks : 1;
+}
+
+/*
+ * Program the next match value. Long periods are split so the final
+ * chunk is at least half the counter range, leaving the ISR plenty of
+ * time to reload before it expires.
+ */
+static void step_timer_load(u32 ticks)
+{
+    if (ticks > STEP_TIMER_MAX_TICKS) {
+        u32 chunk = ticks - (STEP_TIMER_MAX_TICKS / 2);
+        if (chunk > STEP_TIMER_MAX_TICKS) {
+            chunk = STEP_TIMER_MAX_TICKS;
+        }
+        remaining_ticks = ticks - chunk;
+        ticks = chunk;
+    } else {
+        remaining_ticks = 0;
+    }
+    XTtcPs_SetInterval(&step_timer_inst, (XInterval)(ticks - 1));
+}
+
+/*
+ * Configure the TTC in interval mode and hook its interrupt.
+ */
+int step_timer_initialize(step_timer_callback_t callback)
+{
+    static _Bool initialized = 0;
+    XTtcPs_Config *config;
+    int status;
+
+    step_callback = callback;
+    if (initialized) {
+        return XST_SUCCESS;
+    }
+
+    config = XTtcPs_LookupConfig(STEP_TIMER_DEVICE_ID);
+    if (NULL == config) {
+        return XST_FAILURE;
+    }
+
+    status = XTtcPs_CfgInitialize(&step_timer_inst, config, config->BaseAddress);
+    if (status != XST_SUCCESS) {
+        return XST_FAILURE;
+    }
+
+    XTtcPs_SetOptions(&step_timer_inst, XTTCPS_OPTION_INTERVAL_MODE | XTTCPS_OPTION_WAVE_DISABLE);
+    XTtcPs_SetPrescaler(&step_timer_inst, STEP_TIMER_PRESCALER);
+    step_timer_hz = config->InputClockHz >> (STEP_TIMER_PRESCALER + 1);
+
+    status = xPortInstallInterruptHandler(STEP_TIMER_INTR_ID, step_timer_isr, NULL);
+    if (status != pdPASS) {
+        return XST_FAILURE;
+    }
+    XTtcPs_EnableInterrupts(&step_timer_inst, XTTCPS_IXR_INTERVAL_MASK);
+    vPortEnableInterrupt(STEP_TIMER_INTR_ID);
+
+    initialized = 1;
+    return XST_SUCCESS;
+}
+
+/*
+ * Start counting towards the first deadline, interval_us from now.
+ */
+void step_timer_start(u32 interval_us)
+{
+    XTtcPs_Stop(&step_timer_inst);
+    step_timer_load(step_timer_us_to_ticks(interval_us));
+    XTtcPs_ResetCounterValue(&step_timer_inst);
+    XTtcPs_Start(&step_timer_inst);
+}
+
+/*
+ * Set the next deadline, measured from the deadline that just fired.
+ * Only valid from inside the step callback.
+ */
+void step_timer_set_interval(u32 interval_us)
+{
+    step_timer_load(step_timer_us_to_ticks(interval_us));
+}
+
+/*
+ * Stop the counter; no further callbacks until the next start.
+ */
+void step_timer_stop(void)
+{
+    XTtcPs_Stop(&step_timer_inst);
+    remaining_ticks = 0;
+}
+
+/*
+ * Microseconds from the 64-bit global timer (wraps after ~71 minutes).
+ * COUNTS_PER_SECOND is not a whole number of counts per microsecond
+ * (333.33 at 666 MHz), so whole seconds and the remainder are converted
+ * apart; dividing by the truncated 333 would run 0.1% fast.
+ */
+u32 step_timer_get_time_us(void)
+{
+    XTime now;
+    XTime_GetTime(&now);
+    return (u32)((now / COUNTS_PER_SECOND) * 1000000ULL
+                 + (now % COUNTS_PER_SECOND) * 1000000ULL / COUNTS_PER_SECOND);
+}
+
+/*
+ * Raw global timer counts (low 32 bits, wraps after ~13 s). Cheaper than
+ * step_timer_get_time_us() as there is no division.
+ */
+u32 step_timer_get_counts(void)
+{
+    XTime now;
+    XTime_GetTime(&now);
+    return (u32)now;
+}
+
+u32 step_timer_counts_per_second(void)
+{
+    return COUNTS_PER_SECOND;
+}
+
+static void step_timer_isr(void *callback_ref)
+{
+    u32 status = XTtcPs_GetInterruptStatus(&step_timer_inst);
+    XTtcPs_ClearInterruptStatus(&step_timer_inst, status);
+
+    if (!(status & XTTCPS_IXR_INTERVAL_MASK)) {
+        return;
+    }
+
+    if (remaining_ticks > 0) {
+        step_timer_load(remaining_ticks);
+        return;
+    }
+
+    if (step_callback != NULL) {
+        step_callback();
+    }
+}
+
+#else /* STEP_TIMER_SIMULATED */
+
+#include <stddef.h>
+
+static step_timer_callback_t step_callback = NULL;
+static u32  sim_now_us;
+static u32  sim_deadline_us;
+static _Bool sim_running;
+
+int step_timer_initialize(step_timer_callback_t callback)
+{
+    step_callback = callback;
+    return XST_SUCCESS;
+}
+
+void step_timer_start(u32 interval_us)
+{
+    sim_deadline_us = sim_now_us + interval_us;
+    sim_running = 1;
+}
+
+void step_timer_set_interval(u32 interval_us)
+{
+    sim_deadline_us += interval_us;
+}
+
+void step_timer_stop(void)
+{
+    sim_running = 0;
+}
+
+u32 step_timer_get_time_us(void)
+{
+    return sim_now_us;
+}
+
+u32 step_timer_get_counts(void)
+{
+    return sim_now_us;
+}
+
+u32 step_timer_counts_per_second(void)
+{
+    return 1000000;
+}
+
+/*
+ * Advance the virtual clock, firing the callback at every deadline
+ * passed on the way. Inside the callback the clock reads exactly the
+ * deadline, so recorded step timestamps carry no jitter.
+ */
+void step_timer_sim_advance(u32 elapsed_us)
+{
+    u32 target_us = sim_now_us + elapsed_us;
+
+    while (sim_running && (s32)(sim_deadline_us - target_us) <= 0) {
+        sim_now_us = sim_deadline_us;
+        if (step_callback != NULL) {
+            step_callback();
+        }
+    }
+    sim_now_us = target_us;
+}
+
+#endif /* STEP_TIMER_SIMULATED */
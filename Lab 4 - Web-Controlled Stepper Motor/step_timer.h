@@ -0,0 +1,47 @@
+/*
+ * step_timer.h
+ * ----------------------------------------
+ * Hardware Step Timer Interface
+ *
+ * Description:
+ * Header file for the microsecond step timer used by the stepper driver.
+ * One Zynq TTC counter runs in interval mode and calls back into the
+ * driver at every step deadline, so step periods are no longer rounded
+ * to whole FreeRTOS ticks.
+ *
+ * Definitions:
+ * - STEP_TIMER_DEVICE_ID: TTC counter used for step timing
+ * - STEP_TIMER_INTR_ID:   GIC interrupt ID of that counter
+ * - STEP_TIMER_PRESCALER: TTC prescaler (clock / 2^(N+1)), ~0.58 us/count
+ *
+ * Building with STEP_TIMER_SIMULATED replaces the TTC with a virtual
+ * microsecond clock that is advanced by step_timer_sim_advance().
+ */
+
+#ifndef SRC_STEP_TIMER_H_
+#define SRC_STEP_TIMER_H_
+
+#include "xparameters.h"
+#include "xil_types.h"
+
+#define STEP_TIMER_DEVICE_ID  XPAR_XTTCPS_0_DEVICE_ID
+#define STEP_TIMER_INTR_ID    XPAR_XTTCPS_0_INTR
+#define STEP_TIMER_PRESCALER  5
+#define STEP_TIMER_MAX_TICKS  0xFFFF   // TTC counters are 16 bits wide
+
+// Called from interrupt context at every step deadline
+typedef void (*step_timer_callback_t)(void);
+
+int  step_timer_initialize(step_timer_callback_t callback);
+void step_timer_start(u32 interval_us);
+void step_timer_set_interval(u32 interval_us);
+void step_timer_stop(void);
+u32  step_timer_get_time_us(void);
+u32  step_timer_get_counts(void);
+u32  step_timer_counts_per_second(void);
+
+#ifdef STEP_TIMER_SIMULATED
+void step_timer_sim_advance(u32 elapsed_us);
+#endif
+
+#endif /* SRC_STEP_TIMER_H_ */
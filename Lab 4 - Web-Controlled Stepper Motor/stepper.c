@@ -15,13 +15,205 @@
  *
  * Key Functions:
  * - stepper_initialize(): Initializes internal variables
- * - stepper_update(): Manages motion step-by-step
+ * - stepper_update(): Plans upcoming steps into the step engine FIFO
+ * - stepper_move_start(): Non-blocking move; completion by notification
+ * - stepper_set_feed_override(): Live feed-rate override of the running move
+ * - stepper_set_full_step_cruise(): Half-step moves cruise in full steps
+ * - stepper_max_speed() / stepper_max_accel(): Safe limits by step mode
+ * - stepper_move_max_speed(): Speed limit with full-step cruise taken in
+ * - stepper_stream_step(): Queues one step at a caller-given time
+ * - stepper_get_telemetry(): Consistent position/velocity sample, any task
+ * - stepper_trace_export(): Streams the per-step trace ring in binary
+ * - stepper_service_task(): Runs stepper_update() for moves in progress
+ * - stepper_step_isr(): Emits one step per hardware timer deadline
+ * - stepper_emergency_stop_from_isr(): Fast deceleration run by the step ISR
+ * - stepper_ramp_benchmark(): Compares the float and fixed-point ramps
+ *   (STEPPER_RAMP_BENCHMARK builds only)
+ * - stepper_build_ramp_table(): Fills a cached accel/decel ramp table
+ *   (trapezoid or jerk-limited S-curve)
+ * - stepper_profile_compare(): Prints planned step times of both profiles
+ *   (STEPPER_RAMP_BENCHMARK builds only)
  * - stepper_disable_motor(): Disables motor coils to save power
  * - stepper_set_next_step(): Updates motor coil signals based on step mode
+ * - stepper_output_benchmark(): Cycles per step of the coil output path
+ *   (STEPPER_RAMP_BENCHMARK builds only)
+ * - stepper_move_linear(): Coordinated N-axis move (Bresenham interpolation)
  */
 
 
 #include "stepper.h"
+#include "estop.h"
+#include "motor_limits.h"
+
+// Safe speeds by step mode, from the motor model (motor_limits.h)
+static const u32 mode_max_speed[3] = MOTOR_LIMIT_SPEED;
+
+
+/*
+ * Steps in one output shaft revolution in the given step mode.
+ */
+long stepper_steps_per_revolution(step_mode_t mode)
+{
+    return (mode == HALF_STEP) ? STEPS_PER_REVOLUTION_HALF_DRIVE
+                               : STEPS_PER_REVOLUTION_FULL_DRIVE;
+}
+
+/*
+ * Highest safe speed (steps/s) in a step mode: the motor model's pull-out
+ * limit with margin, and never above the step engine's STEPPER_MAX_SPEED.
+ */
+float stepper_max_speed(step_mode_t mode)
+{
+    u32 speed = mode_max_speed[(mode <= HALF_STEP) ? mode : FULL_STEP];
+    return (float)((speed < STEPPER_MAX_SPEED) ? speed : STEPPER_MAX_SPEED);
+}
+
+/*
+ * Highest safe speed (steps/s) for moves in a step mode. With full-step
+ * cruise a half-step move cruises at the same step rate in full steps
+ * (stepper_full_step_split()), so it is held to the full-step limit too.
+ */
+float stepper_move_max_speed(step_mode_t mode, _Bool full_step_cruise)
+{
+    float speed = stepper_max_speed(mode);
+
+    if (full_step_cruise && mode == HALF_STEP && stepper_max_speed(FULL_STEP) < speed) {
+        speed = stepper_max_speed(FULL_STEP);
+    }
+    return speed;
+}
+
+/*
+ * Highest safe accel and decel (steps/s^2) in a step mode. The motor
+ * model holds ten times STEPPER_MAX_ACCEL or more in every mode
+ * ("motor_model tables"), so that cap is the limit in all of them.
+ */
+float stepper_max_accel(step_mode_t mode)
+{
+    (void)mode;
+    return (float)STEPPER_MAX_ACCEL;
+}
+
+/*
+ * Rotary axis: the unwrapped position nearest from that lands on target
+ * modulo one revolution. Moves of exactly half a turn go forward.
+ */
+long stepper_rotary_target(long from, long target, step_mode_t mode)
+{
+    long rev = stepper_steps_per_revolution(mode);
+    long angle = ((target % rev) + rev) % rev;
+    long delta = angle - (((from % rev) + rev) % rev);
+
+    if (delta > rev / 2) {
+        delta -= rev;
+    } else if (delta <= -rev / 2) {
+        delta += rev;
+    }
+    return from + delta;
+}
+
+
+#ifndef STEPPER_AMP_REMOTE
+// The step engine. In the AMP build it runs on CPU1 only; CPU0 links
+// motion_link.c in its place (see stepper.h).
+
+// Step engine FIFO: written by the planner (task), consumed by the ISR
+static u32 step_fifo[STEP_FIFO_SIZE];
+static volatile u32 step_fifo_head;
+static volatile u32 step_fifo_tail;
+static u32 pending_step_us;    // period currently being timed by the TTC
+static u32 pending_stride = 1; // positions the step being timed will move
+static u32 curr_stride = 1;    // positions the last emitted step moved
+
+// FIFO entry flag: the step moves two half steps (one full step)
+#define STEP_FIFO_DOUBLE  0x80000000UL
+
+// Axes of the coordinated move in progress (0: single motor)
+static stepper_t *coord_axes[STEPPER_MAX_AXES];
+static int  coord_axis_count;
+static long coord_major_steps;
+
+// Coil patterns by phase index; each length is a power of two
+static const u8 wave_drive_pattern[4] = {
+    WAVE_DRIVE_1, WAVE_DRIVE_2, WAVE_DRIVE_3, WAVE_DRIVE_4
+};
+static const u8 full_step_pattern[4] = {
+    FULL_STEP_1, FULL_STEP_2, FULL_STEP_3, FULL_STEP_4
+};
+static const u8 half_step_pattern[8] = {
+    HALF_STEP_1, HALF_STEP_2, HALF_STEP_3, HALF_STEP_4,
+    HALF_STEP_5, HALF_STEP_6, HALF_STEP_7, HALF_STEP_8
+};
+
+// Emergency stop: the step ISR decelerates on its own until cleared
+static volatile _Bool estop_latched;
+static volatile _Bool estop_first_step;   // latency sample still to take
+static u32 estop_press_us;
+static u32 estop_period_q8;
+static u32 estop_max_q8;         // period of the first step from rest
+static u64 estop_decel_q48;
+
+// Move in progress for the non-blocking API (see stepper_move_start())
+static stepper_move_handle_t move_last_id;        // last started
+static volatile stepper_move_handle_t move_done_id;   // last completed
+static long  move_start_pos;
+static long  move_target_pos;
+static float move_exit_speed;
+static TaskHandle_t move_owner;
+static stepper_move_callback_t move_callback;
+static void *move_context;
+
+// A move retired early because another was started over it
+typedef struct {
+    stepper_move_handle_t move;     // 0: none
+    TaskHandle_t owner;
+    stepper_move_callback_t callback;
+    void *context;
+} stepper_retired_move_t;
+
+// Feed-rate override (%), applied to the running move by the service task
+static volatile u32 feed_override = 100;
+static volatile _Bool feed_changed;
+
+// Half-step move cruising in full steps (see stepper_full_step_split())
+static _Bool full_step_cruise;   // enabled by stepper_set_full_step_cruise()
+static _Bool plan_coarse;        // planning the full-step part
+static _Bool fine_pending;       // half-step part still to be set up
+static long  fine_goal;
+static float fine_entry_speed;
+
+// Retarget that needs a stop first (see stepper_retarget())
+static _Bool retarget_pending;
+static long  retarget_goal;
+static float retarget_exit_speed;
+
+// Telemetry seqlock: sequence is odd while the step ISR is writing
+static struct {
+    volatile u32 sequence;
+    long position;
+    u32  step_us;
+    int  direction;
+    int  phase;
+    u32  stride;
+    stepper_move_handle_t move;
+    u32  timestamp_us;
+} telemetry;
+
+// Step trace ring; not written while an export is copying it out
+static stepper_trace_record_t trace_ring[STEPPER_TRACE_SIZE];
+static volatile u32 trace_head;
+static volatile _Bool trace_paused;
+static volatile u32 trace_lost;
+
+// Step output of the move in progress, chosen by stepper_select_output()
+static void (*step_output)(int direction);
+
+static void stepper_select_output(void);
+static void stepper_publish_telemetry(void);
+static float stepper_feed_speed(void);
+static void stepper_apply_feed_override(void);
+static void stepper_prefetch_ramp(long step_dist, float entry_speed, float exit_speed);
+static void stepper_retarget(long absolute_steps, float exit_speed);
 
 
 /*
@@ -29,7 +221,7 @@
  */
 void stepper_set_step_mode(unsigned char new_mode)
 {
-    	current_step_mode = (step_mode_t)new_mode;
+    stepper_instance_set_step_mode(&stepper_motor, (step_mode_t)new_mode);
 }
 
 /*
@@ -42,20 +234,64 @@ void stepper_pmod_pins_to_output(void)
 }
 
 /*
- * Initializes internal driver variables.
+ * Initializes internal driver variables. The first call also sets up the
+ * motor instance, the step timer and the service task. Later calls, from
+ * the motor task restarted after an e-stop, keep the position and coil
+ * phase: the coils were only switched off at rest, so the shaft is where
+ * the driver left it.
  */
 void stepper_initialize(void)
 {
+    static _Bool initialized = 0;
+
 	motor_signal[0] = 0;
 	motor_signal[1] = 0;
 	motor_signal[2] = 0;
 	motor_signal[3] = 0;
 
-    curr_pos = 0;
+    step_mode_t mode = current_step_mode;
+
+    if (!initialized) {
+        stepper_instance_init(&stepper_motor, &pmod_motor_inst, 1);
+        curr_pos = 0;
+        planned_pos = 0;
+    } else {
+        planned_pos = curr_pos;
+    }
+    stepper_instance_set_step_mode(&stepper_motor, mode);
+    coord_axis_count = 0;
+    stepper_select_output();
+
     target_speed    = 2048.0f / 4.0f;    // initial speed
     accel           = 2048.0f / 10.0f;   // initial acceleration
-    curr_step_time      = 0.0f;
+    motion_profile  = PROFILE_TRAPEZOID;
+    jerk            = 2048.0f;           // initial jerk (S-curve)
+    curr_step_us     = 0;
     step_phase       = 0;
+
+    step_engine_running = 0;
+    step_fifo_head = 0;
+    step_fifo_tail = 0;
+    estop_latched = 0;
+    estop_first_step = 0;
+
+    if (initialized) {
+        return;
+    }
+    initialized = 1;
+
+    if (step_timer_initialize(stepper_step_isr) != XST_SUCCESS) {
+        xil_printf("Step timer initialization failed\n");
+    }
+
+    // The service task outlives motor task restarts; create it only once
+    xTaskCreate( stepper_service_task
+               , "StepperService"
+               , STEPPER_SERVICE_STACK
+               , NULL
+               , STEPPER_SERVICE_PRIORITY
+               , &stepper_task_handle
+               );
 }
 
 /*
@@ -65,6 +301,9 @@ void stepper_initialize(void)
 void stepper_set_pos(long pos)
 {
     curr_pos = pos;
+    planned_pos = pos;
+    stepper_motor.position = pos;
+    stepper_publish_telemetry();
 }
 
 /*
@@ -77,13 +316,16 @@ long stepper_get_pos(void)
 
 /*
  * Prepare for a controlled stop by setting a short "target" for deceleration.
+ * Measured from the last planned step, since up to STEP_FIFO_SIZE steps
+ * may already be queued to the step engine.
  */
 void stepper_setup_stop(void)
 {
+    ramp_exit_steps = 0;
     if (step_dir > 0)
-        goal_pos = curr_pos + stop_margin;
+        goal_pos = planned_pos + stop_margin;
     else
-        goal_pos = curr_pos - stop_margin;
+        goal_pos = planned_pos - stop_margin;
 }
 
 /*
@@ -110,15 +352,83 @@ void stepper_set_decel(float decel_sps2)
     decel = decel_sps2;
 }
 
+/*
+ * Set the feed-rate override in percent of the programmed speed
+ * (clamped to STEPPER_FEED_MIN..STEPPER_FEED_MAX). It applies to the
+ * move in progress from the next step on, and to every later move until
+ * changed. Task context.
+ */
+void stepper_set_feed_override(u32 percent)
+{
+    if (percent < STEPPER_FEED_MIN) {
+        percent = STEPPER_FEED_MIN;
+    } else if (percent > STEPPER_FEED_MAX) {
+        percent = STEPPER_FEED_MAX;
+    }
+    if (percent == feed_override) {
+        return;
+    }
+    feed_override = percent;
+    feed_changed = 1;
+
+    if (stepper_task_handle != NULL) {
+        xTaskNotifyGive(stepper_task_handle);
+    }
+}
+
+u32 stepper_get_feed_override(void)
+{
+    return feed_override;
+}
+
+/*
+ * Cruise speed after the feed-rate override. An override above 100% may
+ * not take a move past the safe speed of its step mode. A programmed
+ * speed past it is left alone: validate_input() keeps targets under it,
+ * and tools/host/motor_model.c programs such speeds to find the limits.
+ */
+static float stepper_feed_speed(void)
+{
+    float speed = target_speed * feed_override / 100.0f;
+    float limit = stepper_move_max_speed(stepper_motor.step_mode, full_step_cruise);
+
+    if (limit < target_speed) {
+        limit = target_speed;
+    }
+    return (speed < limit) ? speed : limit;
+}
+
+/*
+ * Select the velocity profile. jerk_sps3 (steps/s^3) only applies to
+ * PROFILE_S_CURVE.
+ */
+void stepper_set_profile(motion_profile_t profile, float jerk_sps3)
+{
+    motion_profile = profile;
+    jerk = jerk_sps3;
+}
+
+/*
+ * Let HALF_STEP moves run their accel and cruise in full steps at the
+ * same step rate (twice the shaft speed) and switch back to half steps
+ * for the final deceleration. Positions stay in half steps.
+ */
+void stepper_set_full_step_cruise(_Bool enable)
+{
+    full_step_cruise = enable;
+}
+
+_Bool stepper_get_full_step_cruise(void)
+{
+    return full_step_cruise;
+}
+
 /*
  * Move by a relative number of steps (blocking).
  */
 void stepper_move_rel(long steps)
 {
-    stepper_setup_relative_move_steps(steps);
-    while (!stepper_update()) {
-        // Optionally vTaskDelay(1) or do something else
-    }
+    stepper_move_wait(stepper_move_start(curr_pos + steps, 0.0f, 0.0f, NULL, NULL), portMAX_DELAY);
 }
 
 /*
@@ -134,40 +444,259 @@ void stepper_setup_relative_move_steps(long distance_steps)
  */
 void stepper_move_abs(long pos)
 {
-    stepper_setup_move_steps(pos);
-    while (!stepper_update()) {
-        vTaskDelay(1);
-    }
+    stepper_move_wait(stepper_move_start(pos, 0.0f, 0.0f, NULL, NULL), portMAX_DELAY);
     stepper_disable_motor();
 }
 
+/*
+ * Run one segment of a blended sequence (blocking). With exit_speed > 0
+ * this returns as soon as the segment's last step is queued, so the next
+ * segment follows without stopping; otherwise it behaves like
+ * stepper_move_abs().
+ */
+void stepper_move_segment(long pos, float entry_speed, float exit_speed)
+{
+    stepper_move_wait(stepper_move_start(pos, entry_speed, exit_speed, NULL, NULL), portMAX_DELAY);
+    if (exit_speed == 0.0f) {
+        stepper_disable_motor();
+    }
+}
+
+/*
+ * Record a move that has just been set up and wake the service task.
+ * Call with the scheduler suspended, so the service task cannot see the
+ * new goal before the record.
+ */
+static stepper_move_handle_t stepper_move_register(long start_pos, long target_pos, float exit_speed,
+                                                   stepper_move_callback_t callback, void *context)
+{
+    move_last_id++;
+    if (move_last_id == 0) {
+        move_last_id = 1;
+    }
+    move_start_pos  = start_pos;
+    move_target_pos = target_pos;
+    move_exit_speed = exit_speed;
+    move_owner      = xTaskGetCurrentTaskHandle();
+    move_callback   = callback;
+    move_context    = context;
+    return move_last_id;
+}
 
 /*
- * Setup move parameters and ramp for an absolute target.
+ * Retire the move in progress as complete, as starting another one
+ * does, and note who to tell. Call with the scheduler suspended.
  */
-void stepper_setup_move_steps(long absolute_steps)
+static void stepper_move_retire(stepper_retired_move_t *retired)
 {
-    long step_dist = absolute_steps - curr_pos;
-    if (step_dist < 0) {
-        step_dist  = -step_dist;
-        step_dir = -1;
-    } else {
-        step_dir = 1;
+    retired->move = 0;
+    if (!stepper_move_is_complete(move_last_id)) {
+        retired->move     = move_last_id;
+        retired->owner    = move_owner;
+        retired->callback = move_callback;
+        retired->context  = move_context;
+    }
+    move_done_id = move_last_id;
+}
+
+/*
+ * Tell the owner of a retired move, as the service task would have on
+ * completion: its callback runs, and its task is notified unless it is
+ * the one starting the new move. Call once the scheduler is resumed.
+ */
+static void stepper_move_notify_retired(const stepper_retired_move_t *retired)
+{
+    if (retired->move == 0) {
+        return;
+    }
+    if (retired->callback != NULL) {
+        retired->callback(retired->move, retired->context);
+    }
+    if (retired->owner != NULL && retired->owner != xTaskGetCurrentTaskHandle()) {
+        xTaskNotifyGive(retired->owner);
+    }
+}
+
+/*
+ * Start a move (or a blended segment, see stepper_setup_segment()) and
+ * return at once. The step engine service task runs it; on completion
+ * the calling task gets a direct-to-task notification and callback, if
+ * any, is called from the service task. A segment with exit_speed > 0
+ * completes when its last step is planned, so the next one can follow.
+ * Starting a move retires the previous one as complete; its owner is
+ * told here (callback from this task), so a task waiting on it does not
+ * wait out its timeout.
+ */
+stepper_move_handle_t stepper_move_start(long absolute_steps, float entry_speed, float exit_speed,
+                                         stepper_move_callback_t callback, void *context)
+{
+    stepper_move_handle_t move;
+    stepper_retired_move_t retired;
+    long start_pos = (entry_speed > 0.0f) ? planned_pos : curr_pos;
+
+    // A ramp table is built here, not with the scheduler suspended
+    stepper_prefetch_ramp(absolute_steps - start_pos, entry_speed, exit_speed);
+
+    vTaskSuspendAll();
+    stepper_move_retire(&retired);
+    stepper_setup_segment(absolute_steps, entry_speed, exit_speed);
+    move = stepper_move_register(start_pos, absolute_steps, exit_speed, callback, context);
+    xTaskResumeAll();
+    stepper_move_notify_retired(&retired);
+
+    if (stepper_task_handle != NULL) {
+        xTaskNotifyGive(stepper_task_handle);
+    }
+    return move;
+}
+
+/*
+ * Block until move completes or timeout ticks pass.
+ * Returns TRUE if the move is complete.
+ */
+_Bool stepper_move_wait(stepper_move_handle_t move, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    while (!stepper_move_is_complete(move)) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (timeout != portMAX_DELAY && elapsed >= timeout) {
+            return 0;
+        }
+        ulTaskNotifyTake(pdTRUE, (timeout == portMAX_DELAY) ? portMAX_DELAY : (timeout - elapsed));
+    }
+    return 1;
+}
+
+_Bool stepper_move_is_complete(stepper_move_handle_t move)
+{
+    // Ids increase, so anything up to the last completed one is done
+    return (s32)(move_done_id - move) >= 0;
+}
+
+/*
+ * Progress of move. Safe from any task; a move other than the latest is
+ * reported complete.
+ */
+void stepper_move_get_progress(stepper_move_handle_t move, stepper_move_progress_t *progress)
+{
+    taskENTER_CRITICAL();
+    progress->move            = move;
+    progress->start_position  = move_start_pos;
+    progress->target_position = move_target_pos;
+    progress->position        = curr_pos;
+    progress->complete        = stepper_move_is_complete(move);
+    taskEXIT_CRITICAL();
+
+    progress->steps_total = labs(progress->target_position - progress->start_position);
+    progress->steps_done  = labs(progress->position - progress->start_position);
+    if (progress->complete || move != move_last_id || progress->steps_done > progress->steps_total) {
+        progress->steps_done = progress->steps_total;
+    }
+    progress->speed = stepper_get_speed();
+}
+
+/*
+ * One pass of the service task: plan steps into the FIFO and retire the
+ * current move once it is done.
+ */
+static void stepper_service(void)
+{
+    _Bool done;
+    stepper_move_handle_t move = move_last_id;
+
+    if (feed_changed) {
+        feed_changed = 0;
+        stepper_apply_feed_override();
+    }
+    done = stepper_update();
+
+    if (stepper_move_is_complete(move)) {
+        return;
+    }
+    if (done || (move_exit_speed > 0.0f && stepper_segment_planned())) {
+        move_done_id = move;
+        if (move_callback != NULL) {
+            move_callback(move, move_context);
+        }
+        if (move_owner != NULL) {
+            xTaskNotifyGive(move_owner);
+        }
+    }
+}
+
+/*
+ * Step engine service task, created by stepper_initialize(). Keeps the
+ * step FIFO ahead of the ISR and reports completed moves. Woken by the
+ * step ISR at low water and when the engine stops, and by
+ * stepper_move_start().
+ */
+void stepper_service_task(void *p)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, STEPPER_SERVICE_TICKS);
+        stepper_service();
     }
+}
+
+
+// steps/s^2 -> steps/us^2 in Q48: a * 2^48 / 1e12 = a * 2^36 / 5^12
+#define RAMP_RATE_Q48(rate)  (((u64)(rate) << 36) / 244140625ULL)
+
+/*
+ * Integer square root (floor) of a 64-bit value.
+ */
+static u32 isqrt64(u64 value)
+{
+    u64 root = 0;
+    u64 bit = 1ULL << 62;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (u32)root;
+}
+
+/*
+ * Round a float rate to a non-zero integer for the fixed-point ramp.
+ */
+static u32 stepper_rate_to_int(float rate)
+{
+    u32 rate_i = (u32)(rate + 0.5f);
+    return (rate_i > 0) ? rate_i : 1;
+}
 
+#if !STEPPER_FIXED_POINT_RAMP || defined(STEPPER_RAMP_BENCHMARK)
+/*
+ * Float ramp setup: initial period, cruise period and stop_margin.
+ * entry_speed/exit_speed are non-zero for blended segments.
+ */
+static void stepper_setup_ramp_float(long step_dist, float entry_speed, float exit_speed)
+{
     // Compute the speed the user *wants*
-    float user_speed = target_speed;
+    float user_speed = stepper_feed_speed();
 
     // 1) Compute the speed we *can* reach with the given distance
     //    by checking if we have enough distance to accelerate and decelerate fully:
-    //    v_max^2 * (1/(2a) + 1/(2d)) = step_dist
-    // => v_max = sqrt( 2*a*d*step_dist / (a + d) )
+    //    (v_max^2 - v0^2)/(2a) + (v_max^2 - ve^2)/(2d) = step_dist
+    // => v_max = sqrt( (2*a*d*step_dist + d*v0^2 + a*ve^2) / (a + d) )
 
-    float possible_speed = sqrtf( 2.0f * accel * decel * step_dist / (accel + decel) );
+    float possible_speed = sqrtf( (2.0f * accel * decel * step_dist
+                                   + decel * entry_speed * entry_speed
+                                   + accel * exit_speed * exit_speed) / (accel + decel) );
 
     // 2) If the user desired_speed is bigger than the possible max, clamp it down.
     if (user_speed > possible_speed) {
-    	printf("\nspeed clamped from %.2f to %.2f\n", user_speed, possible_speed);
+        xil_printf("\nspeed clamped from %lu to %lu\n", (u32)user_speed, (u32)possible_speed);
         user_speed = possible_speed;
     }
 
@@ -175,182 +704,1822 @@ void stepper_setup_move_steps(long absolute_steps)
     step_interval = 1000.0f / user_speed;  // in ms
 
     // 3) Set up the ramp initial period, stop_margin, etc. using that clamped speed
-    init_step_time = 1000.0f / sqrtf(2.0f * accel);   // first step period
+    init_step_time = (entry_speed > 0.0f)
+                   ? 1000.0f / entry_speed              // carried in from the last segment
+                   : 1000.0f / sqrtf(2.0f * accel);     // first step period
+    if (entry_speed == 0.0f && init_step_time < step_interval) {
+        // So short that v_max is below a first step at full accel
+        init_step_time = step_interval;
+    }
     stop_margin      = (long)roundf( (user_speed * user_speed) / (2.0f * decel) );
+    ramp_exit_steps  = (long)roundf( (exit_speed * exit_speed) / (2.0f * decel) );
 
     // If step_dist is too small to even do 1 step, handle that corner case
     if (step_dist < 1) {
         step_dist = 1;
     }
 
-    // If not enough distance to fully accelerate+decelerate, do partial logic
-    // (some code to half the stop_margin, etc. if you want)
-    if (step_dist <= stop_margin * 2L) {
-        stop_margin = step_dist / 2L;
+    // If not enough distance to fully accelerate+decelerate, split it
+    // between the ramps in proportion to their rates (the split the v_max
+    // clamp above assumes; halving it is only right when accel == decel)
+    if (entry_speed == 0.0f && exit_speed == 0.0f) {
+        long decel_share = (long)(step_dist * accel / (accel + decel));
+        if (stop_margin > decel_share) {
+            stop_margin = decel_share;
+        }
     }
 
     next_step_time    = init_step_time;
+    stop_step_time    = 1000.0f / sqrtf(2.0f * decel);
     accel_rate = accel / 1e6f;
     decel_rate = decel / 1e6f;
-    new_move      = 1;
-
-    // Finally set goal_pos
-    goal_pos = absolute_steps;
 }
+#endif
 
-
+#if STEPPER_FIXED_POINT_RAMP || defined(STEPPER_RAMP_BENCHMARK)
 /*
- * Processes movement step-by-step. Call this periodically (or in a loop).
- * Returns TRUE when motion is complete.
+ * Fixed-point ramp setup. Same clamping as the float version, with the
+ * rates converted to integers once per move and isqrt64() in place of
+ * sqrtf().
  */
-_Bool stepper_update(void)
+static void stepper_setup_ramp_fixed(long step_dist, u32 entry_speed, u32 exit_speed)
 {
-    unsigned long current_time;
-    unsigned long time_since_last_step;
-    long distance_to_target;
+    u32 accel_i = stepper_rate_to_int(accel);
+    u32 decel_i = stepper_rate_to_int(decel);
+    u32 user_speed = (u32)(stepper_feed_speed() + 0.5f);
+    u64 speed_sq = (u64)user_speed * user_speed;
+    u64 possible_sq;
 
-    // Already at target?
-    if (curr_pos == goal_pos) {
-        return 1; // TRUE
-    }
+    // v_max^2 = (2*a*d*step_dist + d*v0^2 + a*ve^2) / (a + d), kept
+    // squared: a short move's v_max is a few steps/s, and rounding it to
+    // a whole one would stretch its steps by up to a tenth
+    possible_sq = (2ULL * accel_i * decel_i * (u64)step_dist
+                   + (u64)decel_i * entry_speed * entry_speed
+                   + (u64)accel_i * exit_speed * exit_speed) / (accel_i + decel_i);
 
-    // First call to start this move
-    if (new_move) {
-        last_step_time = xTaskGetTickCount();
-        new_move = 0;
+    if (speed_sq > possible_sq) {
+        xil_printf("\nspeed clamped from %lu to %lu\n", user_speed, isqrt64(possible_sq));
+        speed_sq = possible_sq;
     }
-
-    current_time         = xTaskGetTickCount();
-    time_since_last_step = current_time - last_step_time;
-
-    // Not time for next step?
-    if (time_since_last_step < (unsigned long)next_step_time) {
-        return 0; // FALSE
+    if (speed_sq == 0) {
+        speed_sq = 1;
     }
 
-    // Determine distance to target
-    distance_to_target = goal_pos - curr_pos;
-    if (distance_to_target < 0) {
-        distance_to_target = -distance_to_target;
+    // Periods in Q24.8 us: 1 s = 256e6
+    ramp_interval_q8 = isqrt64(65536000000000000ULL / speed_sq);
+    ramp_period_q8   = (entry_speed > 0)
+                     ? (1000000UL << RAMP_FRAC_BITS) / entry_speed
+                     : isqrt64( 65536000000000000ULL / (2ULL * accel_i) );   // 256e6 / sqrt(2a)
+    if (entry_speed == 0 && ramp_period_q8 < ramp_interval_q8) {
+        // So short that v_max is below a first step at full accel
+        ramp_period_q8 = ramp_interval_q8;
     }
+    stop_margin      = (long)((speed_sq + decel_i) / (2ULL * decel_i));
+    ramp_exit_steps  = (long)(((u64)exit_speed * exit_speed + decel_i) / (2ULL * decel_i));
 
-    // Start deceleration if close enough
-    if (distance_to_target <= stop_margin) {
-        accel_rate = -decel_rate;
+    if (step_dist < 1) {
+        step_dist = 1;
+    }
+    // Short move: decelerate over the ramps' share of step_dist
+    if (entry_speed == 0 && exit_speed == 0) {
+        long decel_share = (long)(((u64)step_dist * accel_i) / (accel_i + decel_i));
+        if (stop_margin > decel_share) {
+            stop_margin = decel_share;
+        }
     }
 
-    // Perform the actual step
-    stepper_set_next_step(step_dir, current_step_mode);
-
-    // Update position
-    curr_pos += step_dir;
-
-    // Store the last actual step period
-    curr_step_time = next_step_time;
-
-    // Recompute next step period:
-    //   next_step_time *= (1 - accel_rate * next_step_time^2)
-    float period_sq = next_step_time * next_step_time;
-
-    next_step_time = next_step_time * (1.0f - (accel_rate * period_sq));
+    ramp_stop_q8   = isqrt64( 65536000000000000ULL / (2ULL * decel_i) );
+    ramp_accel_q48 = RAMP_RATE_Q48(accel_i);
+    ramp_decel_q48 = RAMP_RATE_Q48(decel_i);
+    ramp_decelerating = 0;
+}
+#endif
 
-    // Clip to desired speed
-    if (next_step_time < step_interval) {
-        next_step_time = step_interval;
-    }
+/*
+ * First accel table index whose period is at or below period_us
+ * (accel_us[] falls monotonically).
+ */
+static u32 stepper_table_accel_index(const ramp_table_t *table, u32 period_us)
+{
+    u32 low = 0;
+    u32 high = table->accel_steps;
 
-    // If the step period is still large, do a minimal delay
-    if (roundf(next_step_time) > 2) {
-        vTaskDelay((TickType_t)next_step_time - 1);
+    while (low < high) {
+        u32 mid = (low + high) / 2;
+        if (table->accel_us[mid] <= period_us) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
     }
+    return low;
+}
 
-    // Record time
-    last_step_time = current_time;
+/*
+ * Steps left at which the decel table reaches period_us, i.e. how far
+ * past the target a stop would be when leaving at that speed
+ * (decel_us[] falls monotonically with steps left).
+ */
+static u32 stepper_table_exit_steps(const ramp_table_t *table, u32 period_us)
+{
+    u32 low = 0;
+    u32 high = table->decel_steps;
 
-    // Check completion
-    if (curr_pos == goal_pos) {
-        curr_step_time = 0.0f;
-        return 1; // TRUE
+    while (low < high) {
+        u32 mid = (low + high) / 2;
+        if (table->decel_us[mid] <= period_us) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
     }
-    return 0; // FALSE
+    return low;
 }
 
-
 /*
- * Write the coil pattern for the next step.
+ * Shortest period (us) a cached trapezoid may plan over step_dist: the
+ * v_max clamp of stepper_setup_ramp_fixed(). Without it a short move
+ * runs the accel table until it crosses the decel table, which peaks
+ * above v_max as both tables step in whole periods from the first step.
  */
-void stepper_set_next_step(int direction, step_mode_t mode)
+static u32 stepper_table_peak_us(const ramp_table_t *table, long step_dist, u32 entry_speed, u32 exit_speed)
 {
-    static int phase_index = 0;
+    u32 accel_i = table->accel;
+    u32 decel_i = table->decel;
+    u32 possible_speed;
+    u32 peak_us;
+
+    possible_speed = isqrt64( (2ULL * accel_i * decel_i * (u64)step_dist
+                               + (u64)decel_i * entry_speed * entry_speed
+                               + (u64)accel_i * exit_speed * exit_speed) / (accel_i + decel_i) );
+    if (possible_speed == 0) {
+        possible_speed = 1;
+    }
+    peak_us = (1000000UL + possible_speed - 1) / possible_speed;
+    return (peak_us > table->cruise_us) ? peak_us : table->cruise_us;
+}
 
-    // Update phase index
-    phase_index += direction;
-    int max_phase = (mode == HALF_STEP) ? 7 : 3;  // 7 for half-step, 3 for others
+/*
+ * Jerk-limited ramp from rest to speed: a jerk phase, a constant
+ * acceleration phase and a second jerk phase. When speed is too low to
+ * reach the configured acceleration, the peak is sqrt(speed * jerk) and
+ * the constant phase disappears. Task context only (double precision).
+ */
+typedef struct {
+    double speed;       // steps/s
+    double jerk;        // steps/s^3
+    double accel;       // peak acceleration actually reached, steps/s^2
+    double jerk_time;   // s, each jerk phase
+    double accel_time;  // s, constant acceleration phase
+} scurve_t;
 
-    // Wrap around behavior
-    if (phase_index < 0) {
-        phase_index = max_phase;
-    } else if (phase_index > max_phase){
-        phase_index = 0;
-     }
-
-    // TODO: Output pattern based on step mode
-    if(mode == WAVE_DRIVE){
-		switch (phase_index) {
-			case 0: XGpio_DiscreteWrite(&pmod_motor_inst, 1, WAVE_DRIVE_1); break;
-			case 1: XGpio_DiscreteWrite(&pmod_motor_inst, 1, WAVE_DRIVE_2); break;
-			case 2: XGpio_DiscreteWrite(&pmod_motor_inst, 1, WAVE_DRIVE_3); break;
-			case 3: XGpio_DiscreteWrite(&pmod_motor_inst, 1, WAVE_DRIVE_4); break;
-		}
-    } else if(mode == FULL_STEP){
-    	switch (phase_index) {
-			case 0: XGpio_DiscreteWrite(&pmod_motor_inst, 1, FULL_STEP_1); break;
-			case 1: XGpio_DiscreteWrite(&pmod_motor_inst, 1, FULL_STEP_2); break;
-			case 2: XGpio_DiscreteWrite(&pmod_motor_inst, 1, FULL_STEP_3); break;
-			case 3: XGpio_DiscreteWrite(&pmod_motor_inst, 1, FULL_STEP_4); break;
-		}
-    } else if(mode == HALF_STEP){
-    	switch (phase_index) {
-			case 0: XGpio_DiscreteWrite(&pmod_motor_inst, 1, HALF_STEP_1); break;
-			case 1: XGpio_DiscreteWrite(&pmod_motor_inst, 1, HALF_STEP_2); break;
-			case 2: XGpio_DiscreteWrite(&pmod_motor_inst, 1, HALF_STEP_3); break;
-			case 3: XGpio_DiscreteWrite(&pmod_motor_inst, 1, HALF_STEP_4); break;
-			case 4: XGpio_DiscreteWrite(&pmod_motor_inst, 1, HALF_STEP_5); break;
-			case 5: XGpio_DiscreteWrite(&pmod_motor_inst, 1, HALF_STEP_6); break;
-			case 6: XGpio_DiscreteWrite(&pmod_motor_inst, 1, HALF_STEP_7); break;
-			case 7: XGpio_DiscreteWrite(&pmod_motor_inst, 1, HALF_STEP_8); break;
-    	}
+static void stepper_scurve_init(scurve_t *curve, double speed, double accel_max, double jerk_max)
+{
+    curve->speed = speed;
+    curve->jerk  = jerk_max;
+    curve->accel = (speed * jerk_max < accel_max * accel_max) ? sqrt(speed * jerk_max) : accel_max;
+    curve->jerk_time  = curve->accel / jerk_max;
+    curve->accel_time = speed / curve->accel - curve->jerk_time;
+    if (curve->accel_time < 0.0) {
+        curve->accel_time = 0.0;
     }
 }
 
+static double stepper_scurve_duration(const scurve_t *curve)
+{
+    return 2.0 * curve->jerk_time + curve->accel_time;
+}
 
 /*
- * Disable the motor to save power.
+ * Ramp length in steps. The velocity curve is point symmetric about its
+ * midpoint, so the ramp covers speed * duration / 2.
  */
-void stepper_disable_motor(void)
+static double stepper_scurve_length(const scurve_t *curve)
 {
-    XGpio_DiscreteWrite(&pmod_motor_inst, 1, WINDINGS_OFF);
+    return 0.5 * curve->speed * stepper_scurve_duration(curve);
 }
 
 /*
- * Return current velocity in steps/s.
+ * Distance (steps) covered t seconds into the ramp.
  */
-float stepper_get_speed(void)
+static double stepper_scurve_distance(const scurve_t *curve, double t)
 {
-    if (curr_step_time == 0.0f) {
-        return 0.0f;
+    double t1 = curve->jerk_time;
+    double v1 = 0.5 * curve->jerk * t1 * t1;
+    double total = stepper_scurve_duration(curve);
+    double u;
+
+    if (t <= 0.0) {
+        return 0.0;
     }
-    // step_dir sets sign
-    return (step_dir > 0)
-        ? (1000.0f / curr_step_time)
-        : -(1000.0f / curr_step_time);
+    if (t < t1) {
+        return curve->jerk * t * t * t / 6.0;
+    }
+    if (t < t1 + curve->accel_time) {
+        u = t - t1;
+        return curve->jerk * t1 * t1 * t1 / 6.0 + v1 * u + 0.5 * curve->accel * u * u;
+    }
+    if (t < total) {
+        // Mirror of the first jerk phase, measured back from the end
+        u = total - t;
+        return stepper_scurve_length(curve) - (curve->speed * u - curve->jerk * u * u * u / 6.0);
+    }
+    return stepper_scurve_length(curve);
 }
 
-
 /*
- * Return TRUE if the motor is at its target position.
+ * Distance (steps) covered by the time the ramp reaches speed.
  */
-_Bool stepper_motion_complete(void)
+static double stepper_scurve_distance_at_speed(const scurve_t *curve, double speed)
 {
-    return (curr_pos == goal_pos);
+    double v1 = 0.5 * curve->accel * curve->jerk_time;  // end of the first jerk phase
+
+    if (speed <= 0.0) {
+        return 0.0;
+    }
+    if (speed >= curve->speed) {
+        return stepper_scurve_length(curve);
+    }
+    if (speed <= v1) {
+        return stepper_scurve_distance(curve, sqrt(2.0 * speed / curve->jerk));
+    }
+    if (speed <= curve->speed - v1) {
+        return stepper_scurve_distance(curve, curve->jerk_time + (speed - v1) / curve->accel);
+    }
+    return stepper_scurve_distance(curve, stepper_scurve_duration(curve)
+                                          - sqrt(2.0 * (curve->speed - speed) / curve->jerk));
 }
+
+/*
+ * Steps needed to accelerate from entry_speed to peak and decelerate
+ * from peak to exit_speed with S-curve ramps.
+ */
+static double stepper_scurve_move_steps(double peak, float entry_speed, float exit_speed)
+{
+    scurve_t up, down;
+
+    stepper_scurve_init(&up, peak, accel, jerk);
+    stepper_scurve_init(&down, peak, decel, jerk);
+    return stepper_scurve_length(&up) - stepper_scurve_distance_at_speed(&up, entry_speed)
+         + stepper_scurve_length(&down) - stepper_scurve_distance_at_speed(&down, exit_speed);
+}
+
+/*
+ * S-curve counterpart of the trapezoid's v_max clamp: the highest peak
+ * speed (at most the feed speed) whose ramps from entry_speed and down to
+ * exit_speed fit in step_dist. The ramp lengths have no simple inverse,
+ * so the peak is found by bisection.
+ */
+static u32 stepper_scurve_speed(long step_dist, float entry_speed, float exit_speed)
+{
+    u32 user_speed = stepper_rate_to_int(stepper_feed_speed());
+    double low = (entry_speed > exit_speed) ? entry_speed : exit_speed;
+    double high = user_speed;
+    int i;
+
+    if (stepper_scurve_move_steps(high, entry_speed, exit_speed) <= step_dist) {
+        return user_speed;
+    }
+    for (i = 0; i < 24; i++) {
+        double mid = 0.5 * (low + high);
+        if (stepper_scurve_move_steps(mid, entry_speed, exit_speed) <= step_dist) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    return (low >= 1.0) ? (u32)low : 1;
+}
+
+/*
+ * Ramp table for a segment of step_dist steps from entry_speed to
+ * exit_speed with the current settings, and the peak speed the segment
+ * reaches (an S-curve clamped to the distance). A trapezoid table is
+ * keyed on the feed speed, so moves of every length share one and the
+ * v_max clamp is applied as it is read (ramp_peak_us): cutting a
+ * constant-acceleration ramp short still leaves a triangle. An S-curve
+ * cut short would jump from full acceleration to none, so its table is
+ * built for the clamped peak and short moves get a jerk-limited
+ * triangle. A miss builds the table, which takes up to a millisecond:
+ * call with the scheduler running, or after stepper_prefetch_ramp().
+ */
+static const ramp_table_t *stepper_segment_ramp(long step_dist, float entry_speed, float exit_speed,
+                                                u32 *peak_speed)
+{
+    u32 jerk_i = 0;
+
+    *peak_speed = stepper_rate_to_int(stepper_feed_speed());
+    if (motion_profile == PROFILE_S_CURVE) {
+        jerk_i      = stepper_rate_to_int(jerk);
+        *peak_speed = stepper_scurve_speed(step_dist, entry_speed, exit_speed);
+    }
+    return ramp_cache_get(*peak_speed, stepper_rate_to_int(accel), stepper_rate_to_int(decel), jerk_i);
+}
+
+/*
+ * Setup move parameters and ramp for an absolute target.
+ */
+void stepper_setup_move_steps(long absolute_steps)
+{
+    stepper_setup_segment(absolute_steps, 0.0f, 0.0f);
+}
+
+/*
+ * Split a half-step move from rest into a full-step part and a final
+ * half-step part, and return the half steps of the latter (0: no split).
+ * The full-step part moves two half steps per step on the odd phases of
+ * the half-step table, which carry the full-step (two coil) patterns;
+ * from an even phase its first step is a single half step to get there.
+ * It slows to *switch_speed full steps/s, the same shaft speed as cruise
+ * in half steps, so the half-step part only has to decelerate. Moves too
+ * short to reach that speed in full steps are not split.
+ */
+static long stepper_full_step_split(long step_dist, float *switch_speed)
+{
+    float speed = stepper_feed_speed();
+    long align = (stepper_motor.phase_index & 1) ? 0 : 1;
+    long fine_steps, coarse_steps;
+
+    if (!full_step_cruise || stepper_motor.step_mode != HALF_STEP ||
+        coord_axis_count != 0 || step_engine_running) {
+        return 0;
+    }
+
+    *switch_speed = speed / 2.0f;
+    fine_steps    = (long)(speed * speed / (2.0f * decel)) + 1;
+    coarse_steps  = labs(step_dist) - align - fine_steps;
+    if (coarse_steps & 1) {
+        coarse_steps--;
+        fine_steps++;
+    }
+    if (coarse_steps / 2 <= (long)(*switch_speed * *switch_speed / (2.0f * accel))) {
+        return 0;
+    }
+    return fine_steps;
+}
+
+/*
+ * Look up, or build, the ramp of a segment about to be set up with the
+ * scheduler suspended, so stepper_setup_segment() finds it cached. The
+ * table depends on the distance for an S-curve, so the full-step split
+ * and speed limits of stepper_setup_segment() are applied first.
+ */
+static void stepper_prefetch_ramp(long step_dist, float entry_speed, float exit_speed)
+{
+    float feed_speed = stepper_feed_speed();
+    float switch_speed = 0.0f;
+    long fine_steps = 0;
+    u32 peak_speed;
+
+    if (entry_speed == 0.0f && exit_speed == 0.0f) {
+        fine_steps = stepper_full_step_split(step_dist, &switch_speed);
+    }
+    if (fine_steps > 0) {
+        step_dist  = (labs(step_dist) - fine_steps + 1) / 2;
+        exit_speed = switch_speed;
+    }
+
+    (void)stepper_segment_ramp(labs(step_dist),
+                               (entry_speed < feed_speed) ? entry_speed : feed_speed,
+                               (exit_speed < feed_speed) ? exit_speed : feed_speed,
+                               &peak_speed);
+}
+
+/*
+ * Start the half-step part of a split move once every step of the
+ * full-step part is planned. Returns TRUE if it was started.
+ */
+static _Bool stepper_start_fine_part(void)
+{
+    if (!fine_pending || planned_pos != goal_pos || estop_latched) {
+        return 0;
+    }
+    stepper_setup_segment(fine_goal, fine_entry_speed, 0.0f);
+    return 1;
+}
+
+/*
+ * Give up the split of the running move: the rest of it is replanned in
+ * half steps. Call inside a critical section.
+ */
+static void stepper_drop_full_step_cruise(void)
+{
+    if (fine_pending) {
+        goal_pos = fine_goal;
+    }
+    plan_coarse  = 0;
+    fine_pending = 0;
+}
+
+/*
+ * Setup one segment of a blended sequence. With entry_speed > 0 the
+ * segment continues from the last planned step of the previous one
+ * without draining the step engine; exit_speed > 0 leaves the motor
+ * moving at that speed when goal_pos is reached. Both must be at or
+ * below the segment's cruise speed and in the same direction as the
+ * previous segment; the look-ahead planner guarantees this.
+ */
+void stepper_setup_segment(long absolute_steps, float entry_speed, float exit_speed)
+{
+    _Bool continuing = (entry_speed > 0.0f);
+    long start_pos = continuing ? planned_pos : curr_pos;
+    long step_dist = absolute_steps - start_pos;
+    float feed_speed = stepper_feed_speed();
+    u32 peak_speed;
+    const ramp_table_t *ramp;
+    long segment_goal = absolute_steps;
+    long fine_steps = 0;
+    float switch_speed = 0.0f;
+
+    // A half-step move may run most of its way in full steps: plan that
+    // part first, in full steps, slowing to the switch speed
+    if (!continuing && exit_speed == 0.0f) {
+        fine_steps = stepper_full_step_split(step_dist, &switch_speed);
+    }
+    if (fine_steps > 0) {
+        long dir = (step_dist < 0) ? -1 : 1;
+        segment_goal = absolute_steps - dir * fine_steps;
+        step_dist    = dir * ((labs(segment_goal - start_pos) + 1) / 2);
+        exit_speed   = switch_speed;
+    }
+
+    // Junction speeds were planned without the feed-rate override
+    if (entry_speed > feed_speed) {
+        entry_speed = feed_speed;
+    }
+    if (exit_speed > feed_speed) {
+        exit_speed = feed_speed;
+    }
+
+    // Use the cached ramp for this profile when there is one. An S-curve
+    // peak is clamped here; the trapezoid clamps in its ramp setup
+    ramp = stepper_segment_ramp(labs(step_dist), entry_speed, exit_speed, &peak_speed);
+    if (motion_profile == PROFILE_S_CURVE && peak_speed < stepper_rate_to_int(feed_speed)) {
+        xil_printf("\nspeed clamped from %lu to %lu\n", stepper_rate_to_int(feed_speed), peak_speed);
+    }
+    if (ramp == NULL && motion_profile == PROFILE_S_CURVE) {
+        // The per-step recurrence only knows the trapezoid
+        xil_printf("\nS-curve ramp does not fit the ramp cache, using a trapezoid\n");
+    }
+
+    // The step ISR may be planning from these while a segment continues
+    taskENTER_CRITICAL();
+
+    if (estop_latched) {
+        // No new motion until stepper_emergency_clear()
+        taskEXIT_CRITICAL();
+        return;
+    }
+
+    if (!continuing && step_engine_running && coord_axis_count == 0) {
+        // Already moving: replan from the current motion, not from rest
+        stepper_retarget(absolute_steps, exit_speed);
+        taskEXIT_CRITICAL();
+        return;
+    }
+    retarget_pending = 0;
+    plan_coarse      = (fine_steps > 0);
+    fine_pending     = plan_coarse;
+    fine_goal        = absolute_steps;
+    fine_entry_speed = 2.0f * switch_speed;
+
+    if (!continuing) {
+        stepper_select_output();
+    }
+
+    if (step_dist < 0) {
+        step_dist  = -step_dist;
+        step_dir = -1;
+    } else {
+        step_dir = 1;
+    }
+
+    active_ramp = ramp;
+    if (active_ramp != NULL) {
+        ramp_index = continuing
+                   ? stepper_table_accel_index(active_ramp, (u32)(1e6f / entry_speed))
+                   : 0;
+        ramp_exit_steps = (exit_speed > 0.0f)
+                        ? (long)stepper_table_exit_steps(active_ramp, (u32)(1e6f / exit_speed))
+                        : 0;
+        stop_margin = (long)active_ramp->decel_steps;
+        if (active_ramp->jerk == 0) {
+            ramp_peak_us = stepper_table_peak_us(active_ramp, step_dist, (u32)(entry_speed + 0.5f),
+                                                 (u32)(exit_speed + 0.5f));
+        } else {
+            ramp_peak_us = active_ramp->cruise_us;
+        }
+    } else {
+#if STEPPER_FIXED_POINT_RAMP
+        stepper_setup_ramp_fixed(step_dist, (u32)(entry_speed + 0.5f), (u32)(exit_speed + 0.5f));
+#else
+        stepper_setup_ramp_float(step_dist, entry_speed, exit_speed);
+#endif
+    }
+    if (!continuing) {
+        new_move  = 1;
+    }
+
+    // Finally set goal_pos
+    goal_pos = segment_goal;
+
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Restart the ramp from the speed of the step in flight, over the
+ * step_dist steps after it. Queued steps are dropped; with the
+ * fixed-point ramp the step ISR plans the next step itself if the FIFO
+ * has not been refilled by then. The per-step recurrence is used since
+ * it can start at any speed. Call inside a critical section while the
+ * engine runs.
+ */
+static void stepper_replan_in_flight(long step_dist, float exit_speed)
+{
+    float entry_speed = pending_stride * 1e6f / pending_step_us;
+
+    step_fifo_head = step_fifo_tail;
+    planned_pos = curr_pos + step_dir * (long)pending_stride;
+    active_ramp = NULL;
+#if STEPPER_FIXED_POINT_RAMP
+    stepper_setup_ramp_fixed(step_dist, (u32)(entry_speed + 0.5f), (u32)(exit_speed + 0.5f));
+#else
+    stepper_setup_ramp_float(step_dist, entry_speed, exit_speed);
+#endif
+}
+
+/*
+ * A new target while the engine is running. If it is ahead with room to
+ * stop on it, the move carries on from the current speed. Otherwise the
+ * motor stops as quickly as decel allows and stepper_update() starts
+ * towards the target from rest. Call inside a critical section.
+ */
+static void stepper_retarget(long absolute_steps, float exit_speed)
+{
+    float speed = pending_stride * 1e6f / pending_step_us;
+    long next_pos = curr_pos + step_dir * (long)pending_stride;   // after the step in flight
+    long ahead = (absolute_steps - next_pos) * step_dir;
+    long stop_steps = (long)(speed * speed / (2.0f * decel) + 0.5f);
+
+    stepper_drop_full_step_cruise();
+
+    if (ahead > 0 && ahead >= stop_steps) {
+        retarget_pending = 0;
+        goal_pos = absolute_steps;
+        stepper_replan_in_flight(ahead, exit_speed);
+    } else {
+        retarget_pending = 1;
+        retarget_goal = absolute_steps;
+        retarget_exit_speed = exit_speed;
+        goal_pos = next_pos + step_dir * stop_steps;
+        stepper_replan_in_flight(stop_steps, 0.0f);
+    }
+}
+
+/*
+ * Re-derive the rest of the running move for a new feed-rate override:
+ * the ramp restarts from the step in flight and accelerates or slows to
+ * the new cruise speed, so the change shows from the next step (a cached
+ * or S-curve ramp finishes as a trapezoid, and a split move in half
+ * steps). A move already in its final deceleration is left alone.
+ * Called by the service task.
+ */
+static void stepper_apply_feed_override(void)
+{
+    float feed_speed = stepper_feed_speed();
+    float entry_speed, exit_speed;
+    long remaining;
+
+    taskENTER_CRITICAL();
+
+    if (!step_engine_running || estop_latched || new_move || pending_step_us == 0) {
+        // At rest: the next move picks the override up in its setup
+        taskEXIT_CRITICAL();
+        return;
+    }
+
+    entry_speed = pending_stride * 1e6f / pending_step_us;
+    exit_speed  = (move_exit_speed < feed_speed) ? move_exit_speed : feed_speed;
+    remaining   = labs((fine_pending ? fine_goal : goal_pos) - curr_pos)
+                - (long)pending_stride;             // the step in flight still runs
+
+    if (remaining <= 0 ||
+        remaining + (fine_pending ? 0 : ramp_exit_steps) <= (long)(entry_speed * entry_speed / (2.0f * decel))) {
+        taskEXIT_CRITICAL();
+        return;
+    }
+
+    stepper_drop_full_step_cruise();
+    stepper_replan_in_flight(remaining, exit_speed);
+
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Return TRUE once every step of the current segment has been handed to
+ * the step engine, i.e. the next segment may be set up.
+ */
+_Bool stepper_segment_planned(void)
+{
+    return (!new_move && !retarget_pending && !fine_pending && planned_pos == goal_pos);
+}
+
+
+/*
+ * Distance from the last planned step to the target.
+ */
+static long stepper_planned_distance(void)
+{
+    long distance_to_target = goal_pos - planned_pos;
+    if (distance_to_target < 0) {
+        distance_to_target = -distance_to_target;
+    }
+    if (plan_coarse) {
+        // In full steps; an odd count starts with one half step
+        distance_to_target = (distance_to_target + 1) / 2;
+    }
+    return distance_to_target;
+}
+
+#if !STEPPER_FIXED_POINT_RAMP || defined(STEPPER_RAMP_BENCHMARK)
+/*
+ * Advance the float ramp by one step from planned_pos and return the
+ * period (us) that precedes that step.
+ */
+static u32 stepper_plan_step_float(void)
+{
+    float step_time;
+
+    // Start deceleration if close enough
+    if (stepper_planned_distance() + ramp_exit_steps <= stop_margin) {
+        accel_rate = -decel_rate;
+    }
+
+    step_time = next_step_time;
+    planned_pos += step_dir;
+
+    // Recompute next step period:
+    //   next_step_time *= (1 - accel_rate * next_step_time^2)
+    float period_sq = next_step_time * next_step_time;
+
+    if (accel_rate > 0.0f && next_step_time < step_interval) {
+        // Above cruise after a feed override cut: slow down to it
+        next_step_time = next_step_time * (1.0f + (decel_rate * period_sq));
+        if (next_step_time > step_interval) {
+            next_step_time = step_interval;
+        }
+    } else {
+        next_step_time = next_step_time * (1.0f - (accel_rate * period_sq));
+
+        // Clip to desired speed
+        if (next_step_time < step_interval) {
+            next_step_time = step_interval;
+        }
+        // The recurrence overshoots in the last steps; cap at a stop from rest
+        if (accel_rate < 0.0f && next_step_time > stop_step_time) {
+            next_step_time = stop_step_time;
+        }
+    }
+
+    return (u32)(step_time * 1000.0f);
+}
+#endif
+
+/*
+ * Fixed-point version of the same recurrence, c -= a*c^3 (c in us):
+ *   c^2 (Q0) -> a*c^2 (Q24) -> a*c^3 (Q8)
+ * a*c^2 stays below ~1/2 along the ramp, so no product overflows.
+ * Both shifts round: at speed the change is only a few Q8 counts per
+ * step, and truncating it loses that much of the ramp at every step.
+ */
+static u32 stepper_ramp_next_q8(u32 period_q8, u64 rate_q48, _Bool decelerating)
+{
+    u64 period_sq = ((u64)period_q8 * period_q8) >> (2 * RAMP_FRAC_BITS);
+    u64 rate_q24  = (period_sq * rate_q48 + (1ULL << 23)) >> 24;
+    u32 delta_q8  = (u32)((rate_q24 * period_q8 + (1ULL << 23)) >> 24);
+
+    return decelerating ? (period_q8 + delta_q8) : (period_q8 - delta_q8);
+}
+
+#if STEPPER_FIXED_POINT_RAMP || defined(STEPPER_RAMP_BENCHMARK)
+/*
+ * Advance the fixed-point ramp by one step from planned_pos and return
+ * the period (us) that precedes that step.
+ */
+static u32 stepper_plan_step_fixed(void)
+{
+    u32 step_q8 = ramp_period_q8;
+
+    // Start deceleration if close enough
+    if (stepper_planned_distance() + ramp_exit_steps <= stop_margin) {
+        ramp_decelerating = 1;
+    }
+
+    planned_pos += step_dir;
+
+    if (ramp_decelerating) {
+        // The recurrence overshoots in the last steps; cap at a stop from rest
+        ramp_period_q8 = stepper_ramp_next_q8(ramp_period_q8, ramp_decel_q48, 1);
+        if (ramp_period_q8 > ramp_stop_q8) {
+            ramp_period_q8 = ramp_stop_q8;
+        }
+    } else if (ramp_period_q8 < ramp_interval_q8) {
+        // Above cruise after a feed override cut: slow down to it
+        ramp_period_q8 = stepper_ramp_next_q8(ramp_period_q8, ramp_decel_q48, 1);
+        if (ramp_period_q8 > ramp_interval_q8) {
+            ramp_period_q8 = ramp_interval_q8;
+        }
+    } else if (ramp_period_q8 > ramp_interval_q8) {
+        // At cruise there is nothing to do. A short move may cruise
+        // slower than a first step from rest, where the recurrence's
+        // change exceeds the period itself
+        ramp_period_q8 = stepper_ramp_next_q8(ramp_period_q8, ramp_accel_q48, 0);
+
+        // Clip to desired speed
+        if (ramp_period_q8 < ramp_interval_q8) {
+            ramp_period_q8 = ramp_interval_q8;
+        }
+    }
+
+    return step_q8 >> RAMP_FRAC_BITS;
+}
+#endif
+
+/*
+ * Cached ramp: the period is the slowest of the accel entry for this
+ * step, the peak period and the decel entry for the steps left. Short
+ * moves get a triangular profile, peaking at the v_max their distance
+ * allows (ramp_peak_us), where the two ramps meet.
+ */
+static u32 stepper_plan_step_table(void)
+{
+    long steps_left = stepper_planned_distance() + ramp_exit_steps;
+    u32 step_us = ramp_peak_us;
+
+    if (ramp_index < active_ramp->accel_steps && active_ramp->accel_us[ramp_index] > step_us) {
+        step_us = active_ramp->accel_us[ramp_index];
+    }
+    if (steps_left <= (long)active_ramp->decel_steps &&
+        active_ramp->decel_us[steps_left - 1] > step_us) {
+        step_us = active_ramp->decel_us[steps_left - 1];
+    }
+
+    ramp_index++;
+    planned_pos += step_dir;
+    return step_us;
+}
+
+static u32 stepper_plan_step(void)
+{
+    _Bool full_step = plan_coarse && ((goal_pos - planned_pos) & 1) == 0;
+    u32 step_us;
+
+    if (active_ramp != NULL) {
+        step_us = stepper_plan_step_table();
+    } else {
+#if STEPPER_FIXED_POINT_RAMP
+        step_us = stepper_plan_step_fixed();
+#else
+        step_us = stepper_plan_step_float();
+#endif
+    }
+
+    if (full_step) {
+        planned_pos += step_dir;
+        step_us |= STEP_FIFO_DOUBLE;
+    }
+    return step_us;
+}
+
+/*
+ * Make a FIFO entry the step being timed.
+ */
+static inline void stepper_load_step(u32 entry)
+{
+    pending_step_us = entry & ~STEP_FIFO_DOUBLE;
+    pending_stride  = (entry & STEP_FIFO_DOUBLE) ? 2 : 1;
+}
+
+static u32 step_fifo_level(void)
+{
+    return step_fifo_head - step_fifo_tail;
+}
+
+/*
+ * Plans upcoming steps into the step engine. Call this periodically (or
+ * whenever the step ISR notifies the task); the ISR emits the steps at
+ * microsecond deadlines.
+ * Returns TRUE when motion is complete.
+ */
+_Bool stepper_update(void)
+{
+    // A retarget that had to stop first has come to rest: set out for it
+    if (retarget_pending && !step_engine_running && curr_pos == goal_pos) {
+        retarget_pending = 0;
+        stepper_setup_segment(retarget_goal, 0.0f, retarget_exit_speed);
+    }
+
+    // First call to start this move
+    if (new_move) {
+        new_move = 0;
+        step_fifo_head = 0;
+        step_fifo_tail = 0;
+        planned_pos = curr_pos;
+    }
+
+    // Queue as many planned steps as fit; the half-step part of a split
+    // move follows on as soon as its full-step part is planned
+    do {
+        while (!estop_latched && planned_pos != goal_pos && step_fifo_level() < STEP_FIFO_SIZE) {
+#if STEPPER_FIXED_POINT_RAMP
+            // The ISR may plan a step itself, so keep it out mid-update
+            taskENTER_CRITICAL();
+            if (!estop_latched && planned_pos != goal_pos) {
+                step_fifo[step_fifo_head & (STEP_FIFO_SIZE - 1)] = stepper_plan_step();
+                step_fifo_head++;
+            }
+            taskEXIT_CRITICAL();
+#else
+            step_fifo[step_fifo_head & (STEP_FIFO_SIZE - 1)] = stepper_plan_step();
+            step_fifo_head++;
+#endif
+        }
+    } while (stepper_start_fine_part());
+
+    // Start the timer for a new move, or restart it after an underrun
+    if (!step_engine_running && !estop_latched && step_fifo_level() > 0) {
+        stepper_load_step(step_fifo[step_fifo_tail & (STEP_FIFO_SIZE - 1)]);
+        step_fifo_tail++;
+        step_engine_running = 1;
+        step_timer_start(pending_step_us);
+    }
+
+    // Check completion
+    return (curr_pos == goal_pos && !step_engine_running && !fine_pending);
+}
+
+/*
+ * Free step engine FIFO entries, for stepper_stream_step().
+ */
+u32 stepper_stream_space(void)
+{
+    return STEP_FIFO_SIZE - step_fifo_level();
+}
+
+/*
+ * Queue one step timed by the caller instead of the ramp planner: the
+ * step is emitted at step_time_us on the step_timer_get_time_us() clock,
+ * or at once if that has passed. Only while no planned move is running.
+ * The engine runs dry between bursts without counting an underrun.
+ * Returns FALSE if the FIFO is full, an emergency stop is latched, or
+ * steps in the other direction have still to be emitted.
+ */
+_Bool stepper_stream_step(int direction, u32 step_time_us)
+{
+    static u32 last_step_us;     // deadline of the last queued step
+    _Bool queued = 0;
+
+    taskENTER_CRITICAL();
+    if (!estop_latched && step_fifo_level() < STEP_FIFO_SIZE &&
+        (!step_engine_running || direction == step_dir)) {
+        u32 now = step_timer_get_time_us();
+        u32 interval;
+
+        if (!step_engine_running) {
+            // New burst: the interval counts from now
+            step_fifo_head = 0;
+            step_fifo_tail = 0;
+            step_dir = direction;
+            planned_pos = curr_pos;
+            last_step_us = now;
+            stepper_select_output();
+        }
+        if ((s32)(step_time_us - last_step_us) < STEP_STREAM_MIN_US) {
+            step_time_us = last_step_us + STEP_STREAM_MIN_US;
+        }
+        interval = step_time_us - last_step_us;
+        last_step_us = step_time_us;
+
+        step_fifo[step_fifo_head & (STEP_FIFO_SIZE - 1)] = interval;
+        step_fifo_head++;
+        planned_pos += direction;
+        goal_pos = planned_pos;
+
+        if (!step_engine_running) {
+            stepper_load_step(step_fifo[step_fifo_tail & (STEP_FIFO_SIZE - 1)]);
+            step_fifo_tail++;
+            step_engine_running = 1;
+            step_timer_start(pending_step_us);
+        }
+        queued = 1;
+    }
+    taskEXIT_CRITICAL();
+    return queued;
+}
+
+
+/*
+ * Publish a telemetry sample (single writer: the step ISR, or a task
+ * while the engine is idle). Readers retry if they overlap a write, so
+ * the writer never waits.
+ */
+static void stepper_publish_telemetry(void)
+{
+    telemetry.sequence++;
+    __sync_synchronize();
+    telemetry.position     = curr_pos;
+    telemetry.step_us      = curr_step_us;
+    telemetry.direction    = (curr_step_us != 0) ? step_dir : 0;
+    telemetry.phase        = stepper_motor.phase_index;
+    telemetry.stride       = curr_stride;
+    telemetry.move         = move_last_id;
+    telemetry.timestamp_us = step_timer_get_time_us();
+    __sync_synchronize();
+    telemetry.sequence++;
+}
+
+/*
+ * Copy out the latest telemetry sample. Never blocks the step ISR: the
+ * copy is retried if a step was published while it was being taken.
+ */
+void stepper_get_telemetry(stepper_telemetry_t *sample)
+{
+    u32 sequence;
+    u32 step_us;
+    u32 stride;
+
+    do {
+        sequence = telemetry.sequence;
+        __sync_synchronize();
+        sample->position     = telemetry.position;
+        step_us              = telemetry.step_us;
+        sample->direction    = telemetry.direction;
+        sample->phase        = telemetry.phase;
+        stride               = telemetry.stride;
+        sample->move         = telemetry.move;
+        sample->timestamp_us = telemetry.timestamp_us;
+        __sync_synchronize();
+    } while ((sequence & 1) || sequence != telemetry.sequence);
+
+    sample->sequence = sequence;
+    sample->velocity = (step_us != 0) ? (sample->direction * (stride * 1e6f / step_us)) : 0.0f;
+}
+
+/*
+ * Stream the step trace through write(): a stepper_trace_header_t, then
+ * the recorded steps oldest first. Steps taken meanwhile are not traced;
+ * the next export reports them as lost. Returns the bytes written.
+ */
+u32 stepper_trace_export(stepper_trace_write_t write, void *context)
+{
+    stepper_trace_header_t header;
+    u32 head, first, i;
+    u32 written = 0;
+
+    taskENTER_CRITICAL();
+    trace_paused = 1;
+    head = trace_head;
+    header.lost = trace_lost;
+    trace_lost = 0;
+    taskEXIT_CRITICAL();
+
+    header.magic             = STEPPER_TRACE_MAGIC;
+    header.version           = STEPPER_TRACE_VERSION;
+    header.record_size       = sizeof(stepper_trace_record_t);
+    header.counts_per_second = step_timer_counts_per_second();
+    header.record_count      = (head < STEPPER_TRACE_SIZE) ? head : STEPPER_TRACE_SIZE;
+
+    if (write(context, &header, sizeof(header))) {
+        written = sizeof(header);
+
+        // Copy out contiguous runs of the ring
+        first = head - header.record_count;
+        for (i = 0; i < header.record_count; ) {
+            u32 index = (first + i) & (STEPPER_TRACE_SIZE - 1);
+            u32 run = STEPPER_TRACE_SIZE - index;
+            if (run > header.record_count - i) {
+                run = header.record_count - i;
+            }
+            if (!write(context, &trace_ring[index], run * sizeof(stepper_trace_record_t))) {
+                break;
+            }
+            written += run * sizeof(stepper_trace_record_t);
+            i += run;
+        }
+    }
+
+    __sync_synchronize();
+    trace_paused = 0;
+    return written;
+}
+
+/*
+ * Emergency stop from the button ISR: drop the planned steps and
+ * decelerate at decel_sps2, starting with the step the timer is already
+ * counting. The step ISR plans the rest of the stop itself, so nothing
+ * waits for a task. New moves are refused until stepper_emergency_clear().
+ * Returns TRUE if the motor was moving.
+ */
+_Bool stepper_emergency_stop_from_isr(u32 press_us, u32 decel_sps2)
+{
+    UBaseType_t saved_mask = taskENTER_CRITICAL_FROM_ISR();
+    _Bool moving = step_engine_running;
+
+    if (estop_latched) {
+        // Already stopping (or stopped)
+        taskEXIT_CRITICAL_FROM_ISR(saved_mask);
+        return moving;
+    }
+
+    if (moving) {
+        u32 speed = pending_stride * 1000000UL / pending_step_us;
+        long stop_steps = (long)(((u64)speed * speed) / (2ULL * decel_sps2)) + 1;
+        long remaining;
+
+        // The step in flight may be a full step; the stop is in half steps
+        stepper_drop_full_step_cruise();
+        remaining = labs(goal_pos - curr_pos) - (long)pending_stride + 1;
+        if (stop_steps > remaining) {
+            stop_steps = remaining;
+        }
+        stop_steps += (long)pending_stride - 1;
+        estop_period_q8  = (pending_step_us << RAMP_FRAC_BITS) / pending_stride;
+        estop_max_q8     = isqrt64( 65536000000000000ULL / (2ULL * decel_sps2) );
+        estop_decel_q48  = RAMP_RATE_Q48(decel_sps2);
+        estop_press_us   = press_us;
+        estop_first_step = 1;
+        step_fifo_tail   = step_fifo_head;
+        goal_pos = curr_pos + step_dir * stop_steps;
+    } else {
+        goal_pos = curr_pos;
+    }
+    planned_pos = goal_pos;
+    ramp_exit_steps = 0;
+    new_move = 0;
+    estop_latched = 1;
+
+    taskEXIT_CRITICAL_FROM_ISR(saved_mask);
+    return moving;
+}
+
+/*
+ * Emergency deceleration, step ISR side: time the next step with the
+ * decel recurrence, or stop once the stop distance is covered.
+ */
+static void stepper_emergency_next_step(void)
+{
+    if (estop_first_step) {
+        estop_first_step = 0;
+        estop_record_latency(step_timer_get_time_us() - estop_press_us);
+    }
+
+    if (curr_pos == goal_pos) {
+        step_timer_stop();
+        step_engine_running = 0;
+        curr_step_us = 0;
+        return;
+    }
+
+    // The recurrence overshoots in the last steps; cap at a stop from rest
+    estop_period_q8 = stepper_ramp_next_q8(estop_period_q8, estop_decel_q48, 1);
+    if (estop_period_q8 > estop_max_q8) {
+        estop_period_q8 = estop_max_q8;
+    }
+    pending_step_us = estop_period_q8 >> RAMP_FRAC_BITS;
+    pending_stride  = 1;
+    step_timer_set_interval(pending_step_us);
+}
+
+/*
+ * TRUE while an emergency stop is latched.
+ */
+_Bool stepper_emergency_latched(void)
+{
+    return estop_latched;
+}
+
+/*
+ * Release a latched emergency stop once the motor is at rest, allowing
+ * new moves again.
+ */
+void stepper_emergency_clear(void)
+{
+    taskENTER_CRITICAL();
+    estop_latched = 0;
+    estop_first_step = 0;
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Step engine callback, run from the TTC interrupt at every deadline.
+ * Integer only: with the float ramp the planner converts periods to
+ * microseconds in task context; with the fixed-point ramp the ISR may
+ * also plan a step itself rather than run dry.
+ */
+void stepper_step_isr(void)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    // Perform the actual step
+    step_output(step_dir * (int)pending_stride);
+    curr_pos += step_dir * (long)pending_stride;
+
+    // Store the last actual step period
+    curr_step_us = pending_step_us;
+    curr_stride  = pending_stride;
+
+    // Trace the step: three words, no division
+    if (!trace_paused) {
+        stepper_trace_record_t *record = &trace_ring[trace_head & (STEPPER_TRACE_SIZE - 1)];
+        record->timestamp   = step_timer_get_counts();
+        record->position    = curr_pos;
+        record->interval_us = curr_step_us;
+        trace_head++;
+    } else {
+        trace_lost++;
+    }
+
+    if (estop_latched) {
+        // Emergency deceleration replaces the planned steps
+        stepper_emergency_next_step();
+    } else {
+#if STEPPER_FIXED_POINT_RAMP
+        if (step_fifo_level() == 0 && planned_pos != goal_pos) {
+            step_fifo[step_fifo_head & (STEP_FIFO_SIZE - 1)] = stepper_plan_step();
+            step_fifo_head++;
+        }
+#endif
+
+        if (step_fifo_level() == 0) {
+            step_timer_stop();
+            step_engine_running = 0;
+            if (curr_pos == goal_pos) {
+                curr_step_us = 0;
+            } else {
+                step_underruns++;
+            }
+        } else {
+            stepper_load_step(step_fifo[step_fifo_tail & (STEP_FIFO_SIZE - 1)]);
+            step_fifo_tail++;
+            step_timer_set_interval(pending_step_us);
+        }
+    }
+
+    stepper_publish_telemetry();
+
+    if (stepper_task_handle != NULL &&
+        (!step_engine_running || (!estop_latched && step_fifo_level() <= STEP_FIFO_LOW_WATER))) {
+        vTaskNotifyGiveFromISR(stepper_task_handle, &xHigherPriorityTaskWoken);
+    }
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+
+/*
+ * Coil patterns and phase mask of a step mode.
+ */
+static const u8 *stepper_mode_pattern(step_mode_t mode)
+{
+    switch (mode) {
+        case WAVE_DRIVE: return wave_drive_pattern;
+        case HALF_STEP:  return half_step_pattern;
+        default:         return full_step_pattern;
+    }
+}
+
+static u32 stepper_mode_phase_mask(step_mode_t mode)
+{
+    return (mode == HALF_STEP) ? 7 : 3;
+}
+
+/*
+ * One step of stepper_motor: a phase update, one table load and one GPIO
+ * register write. Called with constant pattern/mask from the per-mode
+ * wrappers below so each compiles to its own straight-line path.
+ */
+static inline void stepper_output_single(const u8 *pattern, u32 phase_mask, int direction)
+{
+    u32 phase = (u32)(stepper_motor.phase_index + direction) & phase_mask;
+
+    stepper_motor.phase_index = phase;
+    XGpio_WriteReg(stepper_motor.channel_base, XGPIO_DATA_OFFSET, pattern[phase]);
+    stepper_motor.position += direction;
+}
+
+static void stepper_output_wave(int direction)
+{
+    stepper_output_single(wave_drive_pattern, 3, direction);
+}
+
+static void stepper_output_full(int direction)
+{
+    stepper_output_single(full_step_pattern, 3, direction);
+}
+
+static void stepper_output_half(int direction)
+{
+    stepper_output_single(half_step_pattern, 7, direction);
+}
+
+/*
+ * Coordinated move: Bresenham, every axis steps delta times over
+ * coord_major_steps.
+ */
+static void stepper_output_coordinated(int direction)
+{
+    int i;
+
+    (void)direction;
+    for (i = 0; i < coord_axis_count; i++) {
+        stepper_t *axis = coord_axes[i];
+        axis->error += axis->delta;
+        if (axis->error >= coord_major_steps) {
+            axis->error -= coord_major_steps;
+            stepper_instance_step(axis, axis->dir);
+        }
+    }
+}
+
+/*
+ * Choose the step ISR's output path for the move being set up, so the
+ * per-step path carries no step mode or axis count decisions.
+ */
+static void stepper_select_output(void)
+{
+    if (coord_axis_count > 0) {
+        step_output = stepper_output_coordinated;
+        return;
+    }
+    switch (stepper_motor.step_mode) {
+        case WAVE_DRIVE: step_output = stepper_output_wave; break;
+        case HALF_STEP:  step_output = stepper_output_half; break;
+        default:         step_output = stepper_output_full; break;
+    }
+}
+
+/*
+ * Write the coil pattern for the next step.
+ */
+void stepper_set_next_step(int direction, step_mode_t mode)
+{
+    u32 phase = (u32)(stepper_motor.phase_index + direction) & stepper_mode_phase_mask(mode);
+
+    stepper_motor.phase_index = phase;
+    XGpio_WriteReg(stepper_motor.channel_base, XGPIO_DATA_OFFSET, stepper_mode_pattern(mode)[phase]);
+}
+
+
+/*
+ * Bind a motor instance to its GPIO and reset its phase and position.
+ * The GPIO must already be initialized with XGpio_Initialize().
+ */
+void stepper_instance_init(stepper_t *motor, XGpio *gpio, unsigned channel)
+{
+    motor->gpio        = gpio;
+    motor->channel     = channel;
+    motor->channel_base = gpio->BaseAddress + (channel - 1) * XGPIO_CHAN_OFFSET;
+    motor->phase_index = 0;
+    motor->position    = 0;
+    motor->dir         = 0;
+    motor->delta       = 0;
+    motor->error       = 0;
+    stepper_instance_set_step_mode(motor, FULL_STEP);
+
+    XGpio_SetDataDirection(gpio, channel, 0x00);
+    XGpio_DiscreteWrite(gpio, channel, WINDINGS_OFF);
+}
+
+/*
+ * Set a motor's position (in steps) without causing rotation.
+ */
+void stepper_instance_set_pos(stepper_t *motor, long pos)
+{
+    motor->position = pos;
+    if (motor == &stepper_motor) {
+        stepper_set_pos(pos);
+    }
+}
+
+long stepper_instance_get_pos(const stepper_t *motor)
+{
+    return motor->position;
+}
+
+void stepper_instance_set_step_mode(stepper_t *motor, step_mode_t mode)
+{
+    motor->step_mode  = mode;
+    motor->pattern    = stepper_mode_pattern(mode);
+    motor->phase_mask = stepper_mode_phase_mask(mode);
+    if (motor == &stepper_motor) {
+        current_step_mode = mode;
+    }
+}
+
+/*
+ * Take one step in direction on a single motor.
+ */
+void stepper_instance_step(stepper_t *motor, int direction)
+{
+    u32 phase = (u32)(motor->phase_index + direction) & motor->phase_mask;
+
+    motor->phase_index = phase;
+    XGpio_WriteReg(motor->channel_base, XGPIO_DATA_OFFSET, motor->pattern[phase]);
+    motor->position += direction;
+}
+
+/*
+ * De-energize a motor's coils.
+ */
+void stepper_instance_disable(stepper_t *motor)
+{
+    XGpio_DiscreteWrite(motor->gpio, motor->channel, WINDINGS_OFF);
+}
+
+/*
+ * Setup an interpolated linear move of axis_count motors to targets[].
+ * The step engine times steps of the axis with the longest travel
+ * (speed, accel and decel apply to it) and the other axes follow by
+ * Bresenham, so all of them arrive together.
+ */
+void stepper_setup_linear_move(stepper_t *const axes[], const long targets[], int axis_count)
+{
+    long major = 0;
+    int i;
+
+    if (axis_count > STEPPER_MAX_AXES) {
+        axis_count = STEPPER_MAX_AXES;
+    }
+
+    for (i = 0; i < axis_count; i++) {
+        long delta = targets[i] - axes[i]->position;
+        axes[i]->dir   = (delta < 0) ? -1 : 1;
+        axes[i]->delta = (delta < 0) ? -delta : delta;
+        if (axes[i]->delta > major) {
+            major = axes[i]->delta;
+        }
+    }
+    for (i = 0; i < axis_count; i++) {
+        axes[i]->error = major / 2;     // round rather than truncate
+        coord_axes[i] = axes[i];
+    }
+
+    // The engine counts path steps 0..major along the longest axis
+    coord_axis_count  = axis_count;
+    coord_major_steps = major;
+    curr_pos    = 0;
+    planned_pos = 0;
+    stepper_setup_move_steps(major);
+}
+
+/*
+ * Coordinated linear move, blocking until every axis has arrived.
+ */
+void stepper_move_linear(stepper_t *const axes[], const long targets[], int axis_count)
+{
+    stepper_move_handle_t move;
+    stepper_retired_move_t retired;
+    long major = 0;
+    int i;
+
+    // A ramp table is built here, not with the scheduler suspended
+    for (i = 0; i < axis_count; i++) {
+        long delta = labs(targets[i] - axes[i]->position);
+        if (delta > major) {
+            major = delta;
+        }
+    }
+    stepper_prefetch_ramp(major, 0.0f, 0.0f);
+
+    vTaskSuspendAll();
+    stepper_move_retire(&retired);
+    stepper_setup_linear_move(axes, targets, axis_count);
+    move = stepper_move_register(0, coord_major_steps, 0.0f, NULL, NULL);
+    xTaskResumeAll();
+    stepper_move_notify_retired(&retired);
+
+    if (stepper_task_handle != NULL) {
+        xTaskNotifyGive(stepper_task_handle);
+    }
+    stepper_move_wait(move, portMAX_DELAY);
+
+    for (i = 0; i < coord_axis_count; i++) {
+        stepper_instance_disable(coord_axes[i]);
+    }
+
+    // Back to single-motor path coordinates
+    coord_axis_count = 0;
+    stepper_select_output();
+    curr_pos    = stepper_motor.position;
+    planned_pos = curr_pos;
+    goal_pos    = curr_pos;
+    stepper_publish_telemetry();
+}
+
+
+/*
+ * Disable the motor to save power.
+ */
+void stepper_disable_motor(void)
+{
+    stepper_instance_disable(&stepper_motor);
+}
+
+/*
+ * Return current velocity in steps/s.
+ */
+float stepper_get_speed(void)
+{
+    u32 step_us = curr_step_us;
+
+    if (step_us == 0) {
+        return 0.0f;
+    }
+    // step_dir sets sign
+    return (step_dir > 0)
+        ? (curr_stride * 1e6f / step_us)
+        : -(curr_stride * 1e6f / step_us);
+}
+
+
+/*
+ * Return TRUE if the motor is at its target position.
+ */
+_Bool stepper_motion_complete(void)
+{
+    return (curr_pos == goal_pos && !step_engine_running && !fine_pending);
+}
+
+
+/*
+ * Step periods (us) of an S-curve ramp from rest: periods[k] precedes
+ * step k. Each step time solves distance(t) = k by bisection.
+ * Returns the number of steps, or capacity + 1 if they do not fit.
+ */
+static u32 stepper_scurve_periods(const scurve_t *curve, u32 cruise_us, u32 *periods, u32 capacity)
+{
+    double total = stepper_scurve_duration(curve);
+    double step_time = 0.0;
+    u32 steps = (u32)stepper_scurve_length(curve);
+    u32 k;
+    int i;
+
+    if (steps > capacity) {
+        return capacity + 1;
+    }
+
+    for (k = 0; k < steps; k++) {
+        double low = step_time;
+        double high = total;
+        u32 period_us;
+
+        for (i = 0; i < 32; i++) {
+            double mid = 0.5 * (low + high);
+            if (stepper_scurve_distance(curve, mid) < (double)(k + 1)) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        period_us = (u32)((high - step_time) * 1e6 + 0.5);
+        periods[k] = (period_us > cruise_us) ? period_us : cruise_us;
+        step_time = high;
+    }
+    return steps;
+}
+
+/*
+ * S-curve version of stepper_build_ramp_table(). The decel ramp is the
+ * accel construction with decel, read back from rest, so it is already
+ * indexed by steps remaining.
+ */
+static _Bool stepper_build_scurve_table(ramp_table_t *table, u32 *storage, u32 capacity)
+{
+    scurve_t curve;
+    u32 cruise_us = 1000000UL / table->speed;
+    u32 n;
+
+    stepper_scurve_init(&curve, table->speed, table->accel, table->jerk);
+    n = stepper_scurve_periods(&curve, cruise_us, storage, capacity);
+    if (n > capacity) {
+        return 0;
+    }
+    table->accel_us = storage;
+    table->accel_steps = n;
+
+    stepper_scurve_init(&curve, table->speed, table->decel, table->jerk);
+    table->decel_us = storage + n;
+    table->decel_steps = stepper_scurve_periods(&curve, cruise_us, table->decel_us, capacity - n);
+    if (table->decel_steps > capacity - n) {
+        return 0;
+    }
+    table->cruise_us = cruise_us;
+
+    return 1;
+}
+
+/*
+ * Fill a ramp table for table->speed/accel/decel into storage using the
+ * fixed-point recurrence. The decel segment starts at cruise speed and is
+ * stored back to front so it is indexed by steps remaining. Tables with
+ * a non-zero jerk hold an S-curve instead.
+ * Returns FALSE if both segments do not fit in capacity entries.
+ */
+_Bool stepper_build_ramp_table(ramp_table_t *table, u32 *storage, u32 capacity)
+{
+    u64 accel_q48 = RAMP_RATE_Q48(table->accel);
+    u64 decel_q48 = RAMP_RATE_Q48(table->decel);
+    u32 interval_q8 = (1000000UL << RAMP_FRAC_BITS) / table->speed;
+    u32 period_q8 = isqrt64( 65536000000000000ULL / (2ULL * table->accel) );
+    u32 decel_steps = (u32)(((u64)table->speed * table->speed + table->decel) / (2ULL * table->decel));
+    u32 n = 0;
+    u32 r;
+
+    if (table->jerk > 0) {
+        return stepper_build_scurve_table(table, storage, capacity);
+    }
+
+    // Accel segment: from rest until the ramp reaches cruise speed
+    while (period_q8 > interval_q8) {
+        if (n >= capacity) {
+            return 0;
+        }
+        storage[n++] = period_q8 >> RAMP_FRAC_BITS;
+        period_q8 = stepper_ramp_next_q8(period_q8, accel_q48, 0);
+    }
+    table->accel_us = storage;
+    table->accel_steps = n;
+
+    if (n + decel_steps > capacity) {
+        return 0;
+    }
+
+    // Decel segment: cruise speed down to rest
+    table->decel_us = storage + n;
+    period_q8 = interval_q8;
+    for (r = decel_steps; r > 0; r--) {
+        table->decel_us[r - 1] = period_q8 >> RAMP_FRAC_BITS;
+        period_q8 = stepper_ramp_next_q8(period_q8, decel_q48, 1);
+    }
+    table->decel_steps = decel_steps;
+    table->cruise_us = interval_q8 >> RAMP_FRAC_BITS;
+
+    return 1;
+}
+
+
+#ifdef STEPPER_RAMP_BENCHMARK
+/*
+ * Plan a move of distance_steps with both ramp implementations, using the
+ * current speed/accel/decel, and print cycles per planned step, total move
+ * time and the largest step timestamp difference between the two. The
+ * figures are copied to result, if not NULL. Returns TRUE if the
+ * difference is within STEPPER_RAMP_TOLERANCE of the float move time.
+ * Plans only (no motion); call while the motor is idle.
+ */
+_Bool stepper_ramp_benchmark(long distance_steps, stepper_ramp_compare_t *result)
+{
+    XTime start, end;
+    u64 float_counts, fixed_counts;
+    u32 float_time_us = 0;
+    u32 fixed_time_us = 0;
+    u32 max_deviation_us = 0;
+    _Bool within;
+    long i;
+
+    if (distance_steps < 1) {
+        return 1;
+    }
+
+    step_dir = 1;
+    goal_pos = curr_pos + distance_steps;
+
+    // Float ramp
+    planned_pos = curr_pos;
+    stepper_setup_ramp_float(distance_steps, 0.0f, 0.0f);
+    XTime_GetTime(&start);
+    for (i = 0; i < distance_steps; i++) {
+        float_time_us += stepper_plan_step_float();
+    }
+    XTime_GetTime(&end);
+    float_counts = end - start;
+
+    // Fixed-point ramp
+    planned_pos = curr_pos;
+    stepper_setup_ramp_fixed(distance_steps, 0, 0);
+    XTime_GetTime(&start);
+    for (i = 0; i < distance_steps; i++) {
+        fixed_time_us += stepper_plan_step_fixed();
+    }
+    XTime_GetTime(&end);
+    fixed_counts = end - start;
+
+    // Step-by-step timestamp comparison (shared stop_margin)
+    u32 float_stamp_us = 0;
+    u32 fixed_stamp_us = 0;
+    planned_pos = curr_pos;
+    stepper_setup_ramp_float(distance_steps, 0.0f, 0.0f);
+    stepper_setup_ramp_fixed(distance_steps, 0, 0);
+    for (i = 0; i < distance_steps; i++) {
+        long pos = planned_pos;
+        float_stamp_us += stepper_plan_step_float();
+        planned_pos = pos;
+        fixed_stamp_us += stepper_plan_step_fixed();
+
+        u32 deviation_us = (float_stamp_us > fixed_stamp_us)
+            ? (float_stamp_us - fixed_stamp_us)
+            : (fixed_stamp_us - float_stamp_us);
+        if (deviation_us > max_deviation_us) {
+            max_deviation_us = deviation_us;
+        }
+    }
+
+    // Leave the driver idle at its current position
+    planned_pos = curr_pos;
+    goal_pos = curr_pos;
+    new_move = 0;
+
+    // The global timer counts at half the CPU clock
+    xil_printf("\nramp benchmark: %ld steps\n", distance_steps);
+    xil_printf("  float: %lu cycles/step, move %lu us\n",
+               (u32)((float_counts * 2) / distance_steps), float_time_us);
+    xil_printf("  fixed: %lu cycles/step, move %lu us\n",
+               (u32)((fixed_counts * 2) / distance_steps), fixed_time_us);
+    within = (max_deviation_us <= STEPPER_RAMP_TOLERANCE * float_time_us);
+    xil_printf("  max step timestamp deviation: %lu us (%s)\n", max_deviation_us,
+               within ? "within tolerance" : "OVER TOLERANCE");
+
+    if (result != NULL) {
+        result->float_move_us    = float_time_us;
+        result->fixed_move_us    = fixed_time_us;
+        result->max_deviation_us = max_deviation_us;
+    }
+    return within;
+}
+
+
+/*
+ * Plan a rest-to-rest move of distance_steps with the trapezoid and the
+ * S-curve profile, using the current speed/accel/decel/jerk, and print
+ * the planned timestamp (us from the start) of every few steps for both.
+ * Plans only (no motion); call while the motor is idle.
+ */
+void stepper_profile_compare(long distance_steps)
+{
+    const ramp_table_t *ramps[2];
+    u32 stamp_us[2] = { 0, 0 };
+    u32 peaks_us[2];
+    long sample_every;
+    long i;
+    int p;
+
+    if (distance_steps < 1) {
+        return;
+    }
+
+    ramps[0] = ramp_cache_get(stepper_rate_to_int(target_speed),
+                              stepper_rate_to_int(accel),
+                              stepper_rate_to_int(decel),
+                              0);
+    ramps[1] = ramp_cache_get(stepper_scurve_speed(distance_steps, 0.0f, 0.0f),
+                              stepper_rate_to_int(accel),
+                              stepper_rate_to_int(decel),
+                              stepper_rate_to_int(jerk));
+    if (ramps[0] == NULL || ramps[1] == NULL) {
+        xil_printf("\nprofile compare: ramps do not fit the ramp cache\n");
+        return;
+    }
+
+    peaks_us[0] = stepper_table_peak_us(ramps[0], distance_steps, 0, 0);
+    peaks_us[1] = ramps[1]->cruise_us;
+
+    sample_every = (distance_steps > 32) ? (distance_steps / 32) : 1;
+    xil_printf("\nprofile compare: %ld steps, jerk %lu steps/s^3\n",
+               distance_steps, stepper_rate_to_int(jerk));
+    xil_printf("  step  trapezoid_us  s_curve_us\n");
+
+    step_dir = 1;
+    goal_pos = curr_pos + distance_steps;
+    ramp_exit_steps = 0;
+    for (i = 0; i < distance_steps; i++) {
+        for (p = 0; p < 2; p++) {
+            active_ramp  = ramps[p];
+            ramp_index   = (u32)i;
+            ramp_peak_us = peaks_us[p];
+            planned_pos = curr_pos + i;
+            stamp_us[p] += stepper_plan_step_table();
+        }
+        if ((i + 1) % sample_every == 0 || i + 1 == distance_steps) {
+            xil_printf("  %4ld  %12lu  %10lu\n", i + 1, stamp_us[0], stamp_us[1]);
+        }
+    }
+
+    // Leave the driver idle at its current position
+    active_ramp = NULL;
+    ramp_index  = 0;
+    planned_pos = curr_pos;
+    goal_pos    = curr_pos;
+    new_move    = 0;
+}
+
+
+/*
+ * Reference for stepper_output_benchmark(): the mode if/else chain and
+ * phase switch that the table-driven output replaced.
+ */
+static void stepper_output_legacy(stepper_t *motor, int direction, step_mode_t mode)
+{
+    XGpio *gpio = motor->gpio;
+    unsigned channel = motor->channel;
+    int phase_index = motor->phase_index + direction;
+    int max_phase = (mode == HALF_STEP) ? 7 : 3;
+
+    if (phase_index < 0) {
+        phase_index = max_phase;
+    } else if (phase_index > max_phase) {
+        phase_index = 0;
+    }
+    motor->phase_index = phase_index;
+
+    if (mode == WAVE_DRIVE) {
+        switch (phase_index) {
+            case 0: XGpio_DiscreteWrite(gpio, channel, WAVE_DRIVE_1); break;
+            case 1: XGpio_DiscreteWrite(gpio, channel, WAVE_DRIVE_2); break;
+            case 2: XGpio_DiscreteWrite(gpio, channel, WAVE_DRIVE_3); break;
+            case 3: XGpio_DiscreteWrite(gpio, channel, WAVE_DRIVE_4); break;
+        }
+    } else if (mode == FULL_STEP) {
+        switch (phase_index) {
+            case 0: XGpio_DiscreteWrite(gpio, channel, FULL_STEP_1); break;
+            case 1: XGpio_DiscreteWrite(gpio, channel, FULL_STEP_2); break;
+            case 2: XGpio_DiscreteWrite(gpio, channel, FULL_STEP_3); break;
+            case 3: XGpio_DiscreteWrite(gpio, channel, FULL_STEP_4); break;
+        }
+    } else if (mode == HALF_STEP) {
+        switch (phase_index) {
+            case 0: XGpio_DiscreteWrite(gpio, channel, HALF_STEP_1); break;
+            case 1: XGpio_DiscreteWrite(gpio, channel, HALF_STEP_2); break;
+            case 2: XGpio_DiscreteWrite(gpio, channel, HALF_STEP_3); break;
+            case 3: XGpio_DiscreteWrite(gpio, channel, HALF_STEP_4); break;
+            case 4: XGpio_DiscreteWrite(gpio, channel, HALF_STEP_5); break;
+            case 5: XGpio_DiscreteWrite(gpio, channel, HALF_STEP_6); break;
+            case 6: XGpio_DiscreteWrite(gpio, channel, HALF_STEP_7); break;
+            case 7: XGpio_DiscreteWrite(gpio, channel, HALF_STEP_8); break;
+        }
+    }
+    motor->position += direction;
+}
+
+/*
+ * Time steps coil outputs per step mode with the legacy if/switch path
+ * and the selected table-driven path, and print cycles per step for
+ * each. Drives the coils; call with the motor idle and unloaded.
+ */
+void stepper_output_benchmark(u32 steps)
+{
+    static const char *const mode_names[] = { "wave", "full", "half" };
+    step_mode_t saved_mode = stepper_motor.step_mode;
+    long saved_pos = stepper_motor.position;
+    XTime start, end;
+    u64 legacy_counts, table_counts;
+    int mode;
+    u32 i;
+
+    if (steps == 0) {
+        return;
+    }
+
+    xil_printf("\ncoil output benchmark: %lu steps\n", steps);
+    for (mode = WAVE_DRIVE; mode <= HALF_STEP; mode++) {
+        stepper_instance_set_step_mode(&stepper_motor, (step_mode_t)mode);
+        stepper_select_output();
+
+        XTime_GetTime(&start);
+        for (i = 0; i < steps; i++) {
+            stepper_output_legacy(&stepper_motor, 1, (step_mode_t)mode);
+        }
+        XTime_GetTime(&end);
+        legacy_counts = end - start;
+
+        XTime_GetTime(&start);
+        for (i = 0; i < steps; i++) {
+            step_output(1);
+        }
+        XTime_GetTime(&end);
+        table_counts = end - start;
+
+        // The global timer counts at half the CPU clock
+        xil_printf("  %s: legacy %lu cycles/step, table %lu cycles/step\n",
+                   mode_names[mode],
+                   (u32)((legacy_counts * 2) / steps),
+                   (u32)((table_counts * 2) / steps));
+    }
+
+    stepper_instance_set_step_mode(&stepper_motor, saved_mode);
+    stepper_select_output();
+    stepper_motor.position = saved_pos;
+    stepper_disable_motor();
+}
+#endif /* STEPPER_RAMP_BENCHMARK */
+
+#endif /* STEPPER_AMP_REMOTE */
@@ -12,6 +12,9 @@
  * step sequences for different modes, motor parameter structures,
  * and function prototypes. This driver supports WAVE, FULL, and HALF
  * step modes and provides an API for motion planning and real-time control.
+ * Each motor is a stepper_t; several can be driven together by
+ * interpolated linear moves from the one step timer. The AMP build puts
+ * the step engine on the second core (see AMP Build below).
  *
  */
 
@@ -37,6 +40,11 @@
 
 #include "math.h"
 
+#include "xtime_l.h"
+
+#include "step_timer.h"
+#include "ramp_cache.h"
+
 /********************** Stepper Motor Patterns **********************/
 #define PMOD_MOTOR_DEVICE_ID  XPAR_STEPPER_MOTOR_DEVICE_ID
 #define STEPS_PER_REVOLUTION_HALF_DRIVE  4096
@@ -76,6 +84,16 @@ typedef enum {
     HALF_STEP
 } step_mode_t;
 
+/**
+ * Velocity profile of a move. PROFILE_S_CURVE limits jerk (the rate of
+ * change of acceleration) so acceleration ramps in and out instead of
+ * switching on and off at the start and end of each ramp.
+ */
+typedef enum {
+    PROFILE_TRAPEZOID,
+    PROFILE_S_CURVE
+} motion_profile_t;
+
 /**
  * Optional struct if you want to store multiple motor parameters
  * or keep them in one place.
@@ -88,10 +106,44 @@ typedef struct {
     float     rotational_accel;
     float     rotational_decel;
     step_mode_t step_mode;
+    motion_profile_t motion_profile;
+    float     rotational_jerk;      // steps/s^3, S-curve only
+    _Bool     retarget;             // take over the move in progress at once
+    _Bool     rotary;               // final_position modulo one revolution, shortest way
+    _Bool     full_step_cruise;     // HALF_STEP only: cruise in full steps, stop in half steps
+    _Bool     urgent;               // sent through the urgent lane (see planner.h)
+    TickType_t queued_tick;         // when it was queued, for lane statistics
+    u32       estimate_ms;          // queued duration estimate, dwell included
+    u64       start_at_us;          // leader clock time to start at (timesync.h), 0: at once
 } motor_parameters_t;
 
+/**
+ * One stepper motor output: the GPIO driving its coils, its phase in the
+ * step sequence and its position. The step engine drives one motor on
+ * its own (stepper_motor, the legacy single-motor API) or a group of
+ * motors through a coordinated linear move.
+ */
+typedef struct {
+    XGpio      *gpio;
+    unsigned    channel;
+    UINTPTR     channel_base;   // GPIO registers of this channel
+    int         phase_index;
+    step_mode_t step_mode;
+    const u8   *pattern;        // coil patterns of step_mode, by phase
+    u32         phase_mask;     // phases per cycle - 1 (power of two)
+    volatile long position;     // steps
+
+    // Coordinated move (Bresenham) state
+    int         dir;
+    long        delta;          // |steps| to travel this move
+    long        error;
+} stepper_t;
+
+#define STEPPER_MAX_AXES  4
+
 // XGpio device
 XGpio pmod_motor_inst;
+stepper_t stepper_motor;    // motor on pmod_motor_inst
 
 int motor_signal[4];
 int step_phase;
@@ -101,23 +153,160 @@ step_mode_t current_step_mode;
 float target_speed;      // Desired speed in steps/s
 float accel;              // Acceleration in steps/s^2
 float decel;              // Deceleration in steps/s^2
-float curr_step_time;        // Current period between steps (ms)
+motion_profile_t motion_profile;
+float jerk;               // Jerk in steps/s^3 (S-curve profile)
+volatile u32 curr_step_us;   // Period of the last emitted step (us), 0 when idle
 
-long curr_pos;    // Current position in steps
+volatile long curr_pos;    // Current position in steps (updated by the step ISR)
 long goal_pos;     // Target position in steps
+long planned_pos;  // Position after the last step queued to the step engine
 long stop_margin;      // Steps needed for deceleration
+long ramp_exit_steps;  // Steps past goal_pos a blended segment would need to stop
 
 float init_step_time;    // ms (approx. from ramp formula)
 float step_interval;    // ms at cruising speed
 float next_step_time;       // Next step period in ms
+float stop_step_time;   // ms, slowest decel period (a first step from rest)
 float accel_rate; // us**2
 float decel_rate; // us**2
 
 _Bool new_move;
-unsigned long last_step_time;
+
+/********************** Ramp Arithmetic **********************/
+// 1: fixed-point ramp, no VFP use in the per-step path (ISR safe)
+// 0: original float ramp
+#ifndef STEPPER_FIXED_POINT_RAMP
+#define STEPPER_FIXED_POINT_RAMP 1
+#endif
+
+#define RAMP_FRAC_BITS  8    // step periods held as Q24.8 microseconds
+
+// The two ramps' step timestamps may differ by this fraction of the move
+// time (stepper_ramp_benchmark(), tools/host/stepper_bench.c)
+#define STEPPER_RAMP_TOLERANCE  0.01f
+
+// Result of stepper_ramp_benchmark()
+typedef struct {
+    u32 float_move_us;      // move time with the float ramp
+    u32 fixed_move_us;      // move time with the fixed-point ramp
+    u32 max_deviation_us;   // largest step timestamp difference
+} stepper_ramp_compare_t;
+
+u32 ramp_period_q8;      // next step period (us, Q24.8)
+u32 ramp_interval_q8;    // cruise step period (us, Q24.8)
+u32 ramp_stop_q8;        // slowest decel period (us, Q24.8): a first step from rest
+u64 ramp_accel_q48;      // acceleration in steps/us^2, Q48
+u64 ramp_decel_q48;      // deceleration in steps/us^2, Q48
+_Bool ramp_decelerating;
+
+// Cached ramp for the current move (NULL: ramp computed per step)
+const ramp_table_t *active_ramp;
+u32 ramp_index;          // steps planned so far in this move
+u32 ramp_peak_us;        // shortest period the table may give: v_max for the distance
+
+/********************** Step Engine **********************/
+// Planned step intervals (us) waiting to be emitted by the timer ISR.
+// Must be a power of two.
+#define STEP_FIFO_SIZE       32
+#define STEP_FIFO_LOW_WATER  8    // wake the planner below this level
+#define STEP_STREAM_MIN_US   200  // shortest interval of an externally timed step
+
+volatile _Bool step_engine_running;
+volatile unsigned long step_underruns;   // ISR ran out of planned steps mid-move
+TaskHandle_t stepper_task_handle;        // service task, notified by the step ISR
+
+#define STEPPER_SERVICE_PRIORITY  (configMAX_PRIORITIES - 1)
+#define STEPPER_SERVICE_STACK     (configMINIMAL_STACK_SIZE * 4)
+#define STEPPER_SERVICE_TICKS     pdMS_TO_TICKS(10)   // poll period if never woken
+
+/********************** Step Trace **********************/
+// Every emitted step is recorded into a ring of STEPPER_TRACE_SIZE
+// records (a power of two). stepper_trace_export() streams the ring,
+// oldest first, as a trace header followed by the records, all little
+// endian. tools/trace_decode.c reads this format.
+#define STEPPER_TRACE_SIZE     1024
+#define STEPPER_TRACE_MAGIC    0x43525453   // "STRC"
+#define STEPPER_TRACE_VERSION  1
+
+typedef struct {
+    u32 timestamp;          // step_timer_get_counts() at the step
+    s32 position;           // steps, after the step
+    u32 interval_us;        // planned period that ended with this step
+} stepper_trace_record_t;
+
+typedef struct {
+    u32 magic;
+    u16 version;
+    u16 record_size;
+    u32 counts_per_second;  // timestamp rate
+    u32 record_count;
+    u32 lost;               // steps not recorded while exports ran
+} stepper_trace_header_t;
+
+// Sink for stepper_trace_export(); returns FALSE to abort
+typedef _Bool (*stepper_trace_write_t)(void *context, const void *data, u32 length);
+
+/********************** Move API **********************/
+// A move is identified by its id; ids increase and 0 is never used.
+typedef u32 stepper_move_handle_t;
+
+// Runs in the service task when a move completes, or in the task that
+// starts the next move if that retires it first; keep it short
+typedef void (*stepper_move_callback_t)(stepper_move_handle_t move, void *context);
+
+typedef struct {
+    stepper_move_handle_t move;
+    long  start_position;    // steps
+    long  target_position;   // steps
+    long  position;          // steps, now
+    long  steps_done;
+    long  steps_total;
+    float speed;             // steps/s, now
+    _Bool complete;
+} stepper_move_progress_t;
+
+/********************** Limits **********************/
+// Step periods are timed by the TTC, not the 1 ms tick. These bound every
+// step mode; stepper_max_speed() gives the (lower) speed limit of the
+// motor in each mode, from the table in motor_limits.h.
+#define STEPPER_MAX_SPEED     1000   // steps/s
+#define STEPPER_MAX_ACCEL     500    // steps/s^2, accel and decel
+
+/********************** Feed-Rate Override **********************/
+// Percent of the programmed speed. Junction speeds are capped by it and
+// accel/decel are not scaled. An override above 100% never takes the
+// speed past the step mode's stepper_move_max_speed().
+#define STEPPER_FEED_MIN      10
+#define STEPPER_FEED_MAX      150
+#define STEPPER_FEED_STEP     10     // per pushbutton press
+
+/********************** Telemetry **********************/
+// Consistent sample of the motor, published by the step ISR after every
+// step. Any task may read it with stepper_get_telemetry().
+typedef struct {
+    long  position;         // steps
+    float velocity;         // steps/s, signed; 0 at rest
+    int   direction;        // +1, -1, or 0 at rest
+    int   phase;            // coil phase index
+    stepper_move_handle_t move;     // latest move started
+    u32   timestamp_us;     // step_timer_get_time_us() at the step
+    u32   sequence;         // increases by 2 per published sample
+} stepper_telemetry_t;
 
 _Bool stepper_update(void);
 _Bool stepper_motion_complete(void);
+void stepper_step_isr(void);
+
+// Emergency stop (see estop.h)
+_Bool stepper_emergency_stop_from_isr(u32 press_us, u32 decel_sps2);
+_Bool stepper_emergency_latched(void);
+void stepper_emergency_clear(void);
+#ifdef STEPPER_RAMP_BENCHMARK
+_Bool stepper_ramp_benchmark(long distance_steps, stepper_ramp_compare_t *result);
+void stepper_profile_compare(long distance_steps);
+void stepper_output_benchmark(u32 steps);
+#endif
+_Bool stepper_build_ramp_table(ramp_table_t *table, u32 *storage, u32 capacity);
 
 extern QueueHandle_t emergQueue;
 
@@ -132,17 +321,72 @@ void stepper_setup_stop(void);
 void stepper_set_speed(float speed_sps);
 void stepper_set_accel(float accel_sps2);
 void stepper_set_decel(float decel_sps2);
+void stepper_set_profile(motion_profile_t profile, float jerk_sps3);
+void stepper_set_full_step_cruise(_Bool enable);
+_Bool stepper_get_full_step_cruise(void);
+void stepper_set_feed_override(u32 percent);
+u32  stepper_get_feed_override(void);
 float stepper_get_speed(void);  // steps per second
 long  stepper_get_pos(void);
+long  stepper_steps_per_revolution(step_mode_t mode);
+long  stepper_rotary_target(long from, long target, step_mode_t mode);
+float stepper_max_speed(step_mode_t mode);
+float stepper_move_max_speed(step_mode_t mode, _Bool full_step_cruise);
+float stepper_max_accel(step_mode_t mode);
 
 // Movement
 void stepper_move_rel(long steps);
 void stepper_setup_relative_move_steps(long distance_steps);
 void stepper_setup_move_steps(long absolute_steps);
+void stepper_setup_segment(long absolute_steps, float entry_speed, float exit_speed);
+_Bool stepper_segment_planned(void);
+u32   stepper_stream_space(void);
+_Bool stepper_stream_step(int direction, u32 step_time_us);
 void stepper_move_abs(long pos);
+void stepper_move_segment(long pos, float entry_speed, float exit_speed);
 void stepper_set_next_step(int direction, step_mode_t mode);
 
+// Motor instances and coordinated linear moves
+void stepper_instance_init(stepper_t *motor, XGpio *gpio, unsigned channel);
+void stepper_instance_set_pos(stepper_t *motor, long pos);
+long stepper_instance_get_pos(const stepper_t *motor);
+void stepper_instance_set_step_mode(stepper_t *motor, step_mode_t mode);
+void stepper_instance_step(stepper_t *motor, int direction);
+void stepper_instance_disable(stepper_t *motor);
+void stepper_setup_linear_move(stepper_t *const axes[], const long targets[], int axis_count);
+void stepper_move_linear(stepper_t *const axes[], const long targets[], int axis_count);
+
+// Telemetry
+void  stepper_get_telemetry(stepper_telemetry_t *telemetry);
+
+// Step trace
+u32   stepper_trace_export(stepper_trace_write_t write, void *context);
+
+// Non-blocking moves
+void stepper_service_task(void *p);
+stepper_move_handle_t stepper_move_start(long absolute_steps, float entry_speed, float exit_speed,
+                                         stepper_move_callback_t callback, void *context);
+_Bool stepper_move_wait(stepper_move_handle_t move, TickType_t timeout);
+_Bool stepper_move_is_complete(stepper_move_handle_t move);
+void  stepper_move_get_progress(stepper_move_handle_t move, stepper_move_progress_t *progress);
+
 // Motor control
 void stepper_disable_motor(void);
 
+/********************** AMP Build **********************/
+// With STEPPER_AMP the step engine runs on CPU1 (cpu1/motion_core.c,
+// which also defines STEPPER_AMP_CPU1) and CPU0 keeps FreeRTOS and the
+// network. On CPU0 the calls above that the tasks use are provided by
+// motion_link.c over the shared memory of amp_link.h, and the engine
+// state they read is taken from CPU1's telemetry.
+#if defined(STEPPER_AMP) && !defined(STEPPER_AMP_CPU1)
+#define STEPPER_AMP_REMOTE
+
+_Bool motion_link_engine_running(void);
+int   motion_link_step_dir(void);
+
+#define step_engine_running  motion_link_engine_running()
+#define step_dir             motion_link_step_dir()
+#endif
+
 #endif /* SRC_STEPPER_H_ */
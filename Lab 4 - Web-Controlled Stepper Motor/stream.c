@@ -0,0 +1,360 @@
+/*
+ * stream.c
+ * ----------------------------------------
+ * Streaming Trajectory Follower Implementation
+ *
+ * Description:
+ * The stream server thread receives setpoints into a single-producer,
+ * single-consumer ring (the jitter buffer). The motor task runs the
+ * follower, like a motion program, while no queued target is running:
+ * every tick it advances a commanded position towards the interpolated
+ * setpoint, a slice at a time and never faster than the speed limit,
+ * and queues a step at each time the command crosses half way to the
+ * next position, STREAM_LEAD_US ahead of the step engine.
+ *
+ * Key Functions:
+ * - stream_server_thread(): Accepts a client and fills the jitter buffer
+ * - stream_execute(): Follows the stream to its end (motor task)
+ * - stream_get_stats(): Buffer level, underrun/overrun/late counters
+ */
+
+#include <string.h>
+#include "lwip/sockets.h"
+#include "xil_printf.h"
+#include "stepper.h"
+#include "program.h"
+#include "stream.h"
+
+// Jitter buffer: head written by the server thread, tail by the follower
+static stream_setpoint_t stream_buffer[STREAM_BUFFER_SIZE];
+static volatile u32 stream_head;
+static volatile u32 stream_tail;
+
+static volatile _Bool stream_connected;
+static volatile _Bool stream_requested;
+static volatile _Bool stream_active;
+static volatile stream_stats_t stream_stats;
+
+// Follower state (motor task only)
+static struct {
+    _Bool synced;           // playback clock set from the first setpoint
+    s32   offset_us;        // board time = host time + offset_us
+    u32   slice_us;         // board time the command is planned up to
+    float command;          // commanded position at slice_us, steps
+    long  queued_pos;       // position after the last queued step
+    u32   step_us;          // time of the last queued step
+    u32   checked;          // setpoints checked for lateness
+    _Bool holding;          // past the last setpoint
+} follower;
+
+
+static stream_setpoint_t *stream_at(u32 index)
+{
+    return &stream_buffer[index & (STREAM_BUFFER_SIZE - 1)];
+}
+
+static u32 stream_le32(const u8 *p)
+{
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+/*
+ * Add a received setpoint to the jitter buffer (server thread).
+ */
+static void stream_push(const u8 *record)
+{
+    stream_setpoint_t setpoint;
+    u32 head = stream_head;
+
+    setpoint.time_us  = stream_le32(record);
+    setpoint.position = (s32)stream_le32(record + 4);
+
+    if (head != stream_tail && (s32)(setpoint.time_us - stream_at(head - 1)->time_us) <= 0) {
+        stream_stats.late++;
+        return;
+    }
+    if (head - stream_tail >= STREAM_BUFFER_SIZE) {
+        stream_stats.overruns++;
+        return;
+    }
+    *stream_at(head) = setpoint;
+    __sync_synchronize();
+    stream_head = head + 1;
+    stream_stats.received++;
+}
+
+/*
+ * Setpoint position at host time host_us, interpolated between the two
+ * setpoints around it; setpoints before those are released. Sets
+ * *past_end when host_us is past the last setpoint received.
+ */
+static float stream_reference(u32 host_us, _Bool *past_end)
+{
+    u32 head = stream_head;
+    const stream_setpoint_t *a, *b;
+
+    while (head - stream_tail >= 2 && (s32)(stream_at(stream_tail + 1)->time_us - host_us) <= 0) {
+        stream_tail++;
+    }
+    a = stream_at(stream_tail);
+    *past_end = (head - stream_tail == 1 && (s32)(host_us - a->time_us) > 0);
+    if (head - stream_tail == 1 || (s32)(host_us - a->time_us) <= 0) {
+        return (float)a->position;
+    }
+    b = stream_at(stream_tail + 1);
+    return a->position + (float)(b->position - a->position)
+                         * (s32)(host_us - a->time_us) / (s32)(b->time_us - a->time_us);
+}
+
+/*
+ * Plan the command up to STREAM_LEAD_US past now and queue its steps.
+ * A slice whose steps do not fit in the step engine, or that reverses
+ * while steps in the old direction are still running, is retried on the
+ * next call.
+ */
+static void stream_follow(u32 now)
+{
+    float max_speed = stepper_max_speed(current_step_mode);
+    float speed = (target_speed > 0.0f && target_speed < max_speed) ? target_speed : max_speed;
+    float limit = speed * STREAM_SLICE_US / 1e6f;
+    u32 period_us = (u32)(1e6f / speed);
+    u32 head = stream_head;
+
+    if (!follower.synced) {
+        if (head == stream_tail) {
+            return;
+        }
+        follower.synced     = 1;
+        follower.offset_us  = (s32)(now + STREAM_DELAY_US - stream_at(stream_tail)->time_us);
+        follower.slice_us   = now;
+        follower.queued_pos = stepper_get_pos();
+        follower.command    = (float)follower.queued_pos;
+        follower.step_us    = now - period_us;
+        follower.checked    = stream_tail;
+    }
+
+    // Setpoints that arrived after their playback time are followed late
+    for (; follower.checked != head; follower.checked++) {
+        if ((s32)(stream_at(follower.checked)->time_us + follower.offset_us - follower.slice_us) < 0) {
+            stream_stats.late++;
+        }
+    }
+
+    while ((s32)(now + STREAM_LEAD_US - follower.slice_us) > 0) {
+        u32 end = follower.slice_us + STREAM_SLICE_US;
+        _Bool past_end;
+        float reference = stream_reference(end - follower.offset_us, &past_end);
+        float next = reference;
+        int direction;
+        u32 times[4];
+        u32 steps = 0;
+        u32 i;
+        long pos = follower.queued_pos;
+
+        if (next > follower.command + limit) {
+            next = follower.command + limit;
+        } else if (next < follower.command - limit) {
+            next = follower.command - limit;
+        }
+
+        // Step times: where the command crosses half way to the next position
+        direction = (next > follower.command) ? 1 : -1;
+        while (steps < 4 && direction * (next - (pos + direction * 0.5f)) >= 0.0f) {
+            float crossing = (pos + direction * 0.5f - follower.command) / (next - follower.command);
+            times[steps++] = follower.slice_us + (u32)(crossing * STREAM_SLICE_US);
+            pos += direction;
+        }
+        if (steps > 0) {
+            if (steps > stepper_stream_space() ||
+                (step_engine_running && step_dir != direction)) {
+                return;
+            }
+            for (i = 0; i < steps; i++) {
+                // Steps keep to the speed limit too, also across a reversal
+                if ((s32)(times[i] - follower.step_us) < (s32)period_us) {
+                    times[i] = follower.step_us + period_us;
+                }
+                if (!stepper_stream_step(direction, times[i])) {
+                    return;
+                }
+                follower.queued_pos += direction;
+                follower.step_us = times[i];
+            }
+        }
+
+        // Running past the last setpoint is only an underrun mid-stream
+        if (past_end && !follower.holding && stream_connected) {
+            stream_stats.underruns++;
+        }
+        follower.holding  = past_end;
+        follower.command  = next;
+        follower.slice_us = end;
+        stream_stats.reference = (long)(reference + ((reference < 0.0f) ? -0.5f : 0.5f));
+    }
+}
+
+/*
+ * TRUE when a client has connected and the motor task should follow it.
+ */
+_Bool stream_pending(void)
+{
+    return stream_requested;
+}
+
+/*
+ * Follow the connected stream until the client has gone and the motor
+ * has reached the last setpoint, or an emergency stop. Call from the
+ * motor task while no queued target is running.
+ */
+void stream_execute(void)
+{
+    stream_active = 1;
+    stream_requested = 0;
+    memset(&follower, 0, sizeof(follower));
+    xil_printf("\nstream: following\n");
+
+    while (!stepper_emergency_latched()) {
+        stream_follow(step_timer_get_time_us());
+        stream_stats.position = stepper_get_pos();
+        // Client gone and the last setpoint reached
+        if (!stream_connected && stepper_motion_complete() &&
+            (stream_head == stream_tail ||
+             (follower.holding && follower.queued_pos == stream_at(stream_tail)->position))) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(STREAM_POLL_MS));
+    }
+
+    stepper_disable_motor();
+    stream_active = 0;
+    stream_print_stats();
+}
+
+/*
+ * Forget a stream cut off by an emergency stop. Called when the motor
+ * task restarts.
+ */
+void stream_abort(void)
+{
+    stream_requested = 0;
+    stream_active = 0;
+}
+
+_Bool stream_is_active(void)
+{
+    return stream_active || stream_requested;
+}
+
+/*
+ * Receive one client's setpoints until it disconnects or the follower
+ * stops.
+ */
+static void stream_receive(int sd)
+{
+    u8  buf[STREAM_RECORD_SIZE * 32];
+    u32 partial = 0;
+    struct pollfd fds[1];
+
+    fds[0].fd = sd;
+    fds[0].events = POLLIN;
+
+    while (stream_requested || stream_active) {
+        int n;
+        u32 i;
+
+        if (poll(fds, 1, 10) <= 0) {
+            continue;
+        }
+        n = read(sd, buf + partial, sizeof(buf) - partial);
+        if (n <= 0) {
+            break;
+        }
+        n += partial;
+        for (i = 0; i + STREAM_RECORD_SIZE <= (u32)n; i += STREAM_RECORD_SIZE) {
+            stream_push(buf + i);
+        }
+        partial = n - i;
+        memmove(buf, buf + i, partial);
+    }
+}
+
+/*
+ * Stream server thread: one client at a time. A client is turned away
+ * while a stream or motion program runs, or an emergency stop is
+ * latched.
+ */
+void stream_server_thread(void *p)
+{
+    int sock, sd;
+    int size;
+    struct sockaddr_in address, remote;
+    program_status_t program;
+
+    memset(&address, 0, sizeof(address));
+    if ((sock = lwip_socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        xil_printf("stream: error creating socket.\r\n");
+        vTaskDelete(NULL);
+        return;
+    }
+    address.sin_family = AF_INET;
+    address.sin_port = htons(STREAM_PORT);
+    address.sin_addr.s_addr = INADDR_ANY;
+    if (lwip_bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        xil_printf("stream: error on lwip_bind.\r\n");
+        vTaskDelete(NULL);
+        return;
+    }
+    lwip_listen(sock, 0);
+    size = sizeof(remote);
+
+    while (1) {
+        sd = lwip_accept(sock, (struct sockaddr *)&remote, (socklen_t *)&size);
+        if (sd < 0) {
+            continue;
+        }
+        program_get_status(&program);
+        if (stream_is_active() || program.state == PROGRAM_RUNNING || stepper_emergency_latched()) {
+            xil_printf("stream: busy, connection refused\r\n");
+            close(sd);
+            continue;
+        }
+
+        stream_head = 0;
+        stream_tail = 0;
+        memset((void *)&stream_stats, 0, sizeof(stream_stats));
+        stream_connected = 1;
+        stream_requested = 1;
+
+        stream_receive(sd);
+
+        stream_connected = 0;
+        close(sd);
+        while (stream_is_active()) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+}
+
+/*
+ * Copy out the stream state and counters.
+ */
+void stream_get_stats(stream_stats_t *stats)
+{
+    *stats = *(stream_stats_t *)&stream_stats;
+    stats->active    = stream_is_active();
+    stats->connected = stream_connected;
+    stats->buffered  = stream_head - stream_tail;
+}
+
+/*
+ * Print the stream state and counters.
+ */
+void stream_print_stats(void)
+{
+    stream_stats_t stats;
+
+    stream_get_stats(&stats);
+    xil_printf("stream: %s, %lu setpoints, %lu buffered, %lu underruns, %lu overruns, %lu late, at %ld (setpoint %ld)\n",
+               stats.active ? "active" : "idle", stats.received, stats.buffered,
+               stats.underruns, stats.overruns, stats.late, stats.position, stats.reference);
+}
@@ -0,0 +1,77 @@
+/*
+ * stream.h
+ * ----------------------------------------
+ * Streaming Trajectory Follower Interface
+ *
+ * Description:
+ * A host connects to STREAM_PORT and sends (timestamp, position)
+ * setpoints, typically at 100 to 1000 Hz, for the motor to follow as
+ * they arrive instead of as a list of discrete targets. Each setpoint is
+ * an 8-byte little-endian record:
+ *
+ *   u32 time_us       host clock, any origin, increasing
+ *   s32 position      steps, in the step mode of the last /setParams
+ *
+ * The board plays the trajectory back STREAM_DELAY_US behind the first
+ * setpoint, so setpoints that arrive up to that much late in network
+ * jitter are still in time. Between setpoints the position is
+ * interpolated linearly and the motor follows it at no more than the
+ * last /setParams speed, nor the speed limit of the step mode
+ * (stepper_max_speed()); steps are timed to the microsecond by the step
+ * engine.
+ *
+ * If the stream runs dry the motor holds the last setpoint position and
+ * an underrun is counted; it catches up when setpoints resume. Setpoints
+ * that do not fit the jitter buffer are dropped and counted as overruns.
+ * One client at a time; queued targets and motion programs wait while a
+ * stream runs. The stream ends when the client closes the connection and
+ * the motor has reached the last setpoint, or at an emergency stop.
+ *
+ * Definitions:
+ * - STREAM_PORT:         TCP port of the setpoint stream
+ * - STREAM_BUFFER_SIZE:  Jitter buffer, setpoints (a power of two)
+ * - STREAM_DELAY_US:     Playback delay behind the first setpoint
+ * - STREAM_LEAD_US:      Steps are queued this far ahead of now
+ * - STREAM_SLICE_US:     Interpolation interval of the follower
+ */
+
+#ifndef SRC_STREAM_H_
+#define SRC_STREAM_H_
+
+#include "xil_types.h"
+
+#define STREAM_PORT          5001
+#define STREAM_BUFFER_SIZE   64
+#define STREAM_DELAY_US      20000
+#define STREAM_LEAD_US       5000
+#define STREAM_SLICE_US      1000
+#define STREAM_POLL_MS       1
+
+#define STREAM_RECORD_SIZE   8
+
+typedef struct {
+    u32 time_us;
+    s32 position;
+} stream_setpoint_t;
+
+typedef struct {
+    _Bool active;           // following a stream
+    _Bool connected;        // client connected
+    u32 received;           // setpoints accepted into the buffer
+    u32 buffered;           // setpoints in the buffer now
+    u32 underruns;          // times the follower ran past the last setpoint
+    u32 overruns;           // setpoints dropped, buffer full
+    u32 late;               // setpoints out of order or already past due
+    long position;          // motor position
+    long reference;         // interpolated setpoint position
+} stream_stats_t;
+
+void  stream_server_thread(void *p);
+_Bool stream_pending(void);
+void  stream_execute(void);
+void  stream_abort(void);
+_Bool stream_is_active(void);
+void  stream_get_stats(stream_stats_t *stats);
+void  stream_print_stats(void);
+
+#endif /* SRC_STREAM_H_ */
@@ -0,0 +1,541 @@
+/*
+ * timesync.c
+ * ----------------------------------------
+ * Multi-Board Time Sync Implementation
+ *
+ * Description:
+ * One UDP socket serves both roles: the leader answers requests, a
+ * follower sends them and fits the clock model to the replies (see
+ * timesync.h). The model is published under a critical section, as it
+ * is read by the motor task and the HTTP server while the sync thread
+ * updates it.
+ *
+ * Packet (TIMESYNC_PACKET_SIZE bytes, little-endian):
+ *   u32 magic, u32 type, u32 sequence,
+ *   u64 t1 (request sent, follower clock),
+ *   u64 t2 (request received, leader clock),
+ *   u64 t3 (reply sent, leader clock)
+ *
+ * Key Functions:
+ * - timesync_service(): Answers or sends one exchange, fits the model
+ * - timesync_leader_us(): Leader clock now, from the local clock
+ * - timesync_start_at(): Busy-waits to a start time and records the error
+ */
+
+#include <math.h>
+#include <string.h>
+#include "lwip/sockets.h"
+#include "xil_printf.h"
+#include "xtime_l.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timesync.h"
+
+#define TIMESYNC_REQUEST  1
+#define TIMESYNC_REPLY    2
+
+typedef struct {
+    u64 local_us;           // follower clock, middle of the exchange
+    s64 offset_us;          // leader - follower clock
+    u32 delay_us;           // round trip on the wire
+} timesync_sample_t;
+
+// Role as last set; the exchange picks it up on its next pass
+static volatile struct {
+    timesync_role_t role;
+    u32 leader_addr;
+    u16 leader_port;
+    u32 version;
+} config;
+
+// Exchange state (sync thread only)
+static struct {
+    timesync_role_t role;
+    struct sockaddr_in leader;
+    u32 version;
+    u32 sequence;
+    _Bool waiting;          // request sent, no reply yet
+    u64 sent_us;
+    u64 next_request_us;
+    timesync_sample_t samples[TIMESYNC_SAMPLES];
+    u32 count;              // exchanges since the role was set
+} exchange;
+
+// Clock model: leader = local + offset_us + drift * (local - ref_us)
+typedef struct {
+    u64    ref_us;
+    s64    offset_us;
+    double drift;
+    _Bool  synced;
+} timesync_model_t;
+
+static timesync_model_t model;
+static timesync_stats_t stats;
+
+
+static void timesync_put32(u8 *p, u32 value)
+{
+    p[0] = (u8)value;
+    p[1] = (u8)(value >> 8);
+    p[2] = (u8)(value >> 16);
+    p[3] = (u8)(value >> 24);
+}
+
+static u32 timesync_get32(const u8 *p)
+{
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static void timesync_put64(u8 *p, u64 value)
+{
+    timesync_put32(p, (u32)value);
+    timesync_put32(p + 4, (u32)(value >> 32));
+}
+
+static u64 timesync_get64(const u8 *p)
+{
+    return (u64)timesync_get32(p) | ((u64)timesync_get32(p + 4) << 32);
+}
+
+/*
+ * Local clock: the global timer in microseconds, 64 bits (no wrap).
+ */
+u64 timesync_local_us(void)
+{
+    XTime now;
+
+    XTime_GetTime(&now);
+    return (now / COUNTS_PER_SECOND) * 1000000ULL
+           + (now % COUNTS_PER_SECOND) * 1000000ULL / COUNTS_PER_SECOND;
+}
+
+/*
+ * Leader clock at local time local_us, from the model.
+ */
+static u64 timesync_leader_at(const timesync_model_t *m, u64 local_us)
+{
+    s64 since_ref = (s64)(local_us - m->ref_us);
+
+    return local_us + (u64)(m->offset_us + (s64)llround(m->drift * (double)since_ref));
+}
+
+/*
+ * Leader clock now. The leader's own clock as the leader or with sync
+ * off; the estimate from the last fit as a follower.
+ */
+u64 timesync_leader_us(void)
+{
+    timesync_model_t m;
+    u64 local = timesync_local_us();
+
+    taskENTER_CRITICAL();
+    m = model;
+    taskEXIT_CRITICAL();
+    return timesync_leader_at(&m, local);
+}
+
+/*
+ * Is the leader clock known? Always, except on a follower not synced
+ * yet (or again, after a role change).
+ */
+_Bool timesync_synced(void)
+{
+    _Bool synced;
+
+    taskENTER_CRITICAL();
+    synced = model.synced || stats.role != TIMESYNC_FOLLOWER;
+    taskEXIT_CRITICAL();
+    return synced;
+}
+
+/*
+ * Leader clock microseconds until leader_us; negative once it has
+ * passed, and 0 on a follower that is not synced.
+ */
+s64 timesync_until_us(u64 leader_us)
+{
+    timesync_model_t m;
+    u64 local = timesync_local_us();
+
+    taskENTER_CRITICAL();
+    m = model;
+    taskEXIT_CRITICAL();
+    if (!m.synced && stats.role == TIMESYNC_FOLLOWER) {
+        return 0;
+    }
+    return (s64)(leader_us - timesync_leader_at(&m, local));
+}
+
+/*
+ * Set the role. A follower asks the leader at leader_addr (IPv4,
+ * network order) and leader_port; the estimate starts over.
+ */
+void timesync_set_role(timesync_role_t role, u32 leader_addr, u16 leader_port)
+{
+    taskENTER_CRITICAL();
+    config.role        = role;
+    config.leader_addr = leader_addr;
+    config.leader_port = leader_port;
+    config.version++;
+    taskEXIT_CRITICAL();
+}
+
+const char *timesync_role_name(timesync_role_t role)
+{
+    switch (role) {
+    case TIMESYNC_LEADER:   return "leader";
+    case TIMESYNC_FOLLOWER: return "follower";
+    default:                return "off";
+    }
+}
+
+/*
+ * Take a new role from timesync_set_role(): forget the exchanges and
+ * start from the local clock.
+ */
+static void timesync_take_config(void)
+{
+    if (exchange.version == config.version) {
+        return;
+    }
+    taskENTER_CRITICAL();
+    exchange.version = config.version;
+    exchange.role    = config.role;
+    memset(&exchange.leader, 0, sizeof(exchange.leader));
+    exchange.leader.sin_family      = AF_INET;
+    exchange.leader.sin_port        = htons(config.leader_port);
+    exchange.leader.sin_addr.s_addr = config.leader_addr;
+
+    memset(&model, 0, sizeof(model));
+    model.synced = (exchange.role == TIMESYNC_LEADER);
+    stats.role        = exchange.role;
+    stats.leader_addr = (exchange.role == TIMESYNC_FOLLOWER) ? config.leader_addr : 0;
+    stats.exchanges   = 0;
+    stats.fitted      = 0;
+    stats.lost        = 0;
+    stats.delay_us    = 0;
+    stats.error_us    = 0;
+    taskEXIT_CRITICAL();
+
+    exchange.waiting = 0;
+    exchange.count   = 0;
+    exchange.next_request_us = timesync_local_us();
+}
+
+/*
+ * Fit the clock model to the exchanges in the window whose round trip
+ * is close to the shortest: a least-squares line through their offsets
+ * once they span TIMESYNC_MIN_SPAN_US, before that their mean offset
+ * with the drift left as it was.
+ */
+static void timesync_fit(void)
+{
+    u32 n = (exchange.count < TIMESYNC_SAMPLES) ? exchange.count : TIMESYNC_SAMPLES;
+    u32 min_delay = 0xFFFFFFFFU;
+    u32 limit, used = 0;
+    const timesync_sample_t *ref = NULL;
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    double slope = model.drift * 1e6;   // us per s: ppm
+    double intercept, residual = 0.0, span = 0.0;
+    timesync_model_t fitted;
+    u32 i;
+
+    for (i = 0; i < n; i++) {
+        if (exchange.samples[i].delay_us < min_delay) {
+            min_delay = exchange.samples[i].delay_us;
+        }
+    }
+    limit = min_delay + ((min_delay / 2 > TIMESYNC_DELAY_SLACK_US) ? min_delay / 2
+                                                                    : TIMESYNC_DELAY_SLACK_US);
+    // The newest kept exchange is the reference point
+    for (i = 0; i < n; i++) {
+        const timesync_sample_t *s = &exchange.samples[i];
+        if (s->delay_us <= limit && (ref == NULL || s->local_us > ref->local_us)) {
+            ref = s;
+        }
+    }
+
+    // x: seconds before the reference, y: offset from the reference's, us
+    for (i = 0; i < n; i++) {
+        const timesync_sample_t *s = &exchange.samples[i];
+        double x, y;
+
+        if (s->delay_us > limit) {
+            continue;
+        }
+        x = (double)(s64)(s->local_us - ref->local_us) / 1e6;
+        y = (double)(s->offset_us - ref->offset_us);
+        sx  += x;
+        sy  += y;
+        sxx += x * x;
+        sxy += x * y;
+        if (-x > span) {
+            span = -x;
+        }
+        used++;
+    }
+    if (used >= TIMESYNC_MIN_FIT && span * 1e6 >= TIMESYNC_MIN_SPAN_US) {
+        slope = (used * sxy - sx * sy) / (used * sxx - sx * sx);
+        if (slope > TIMESYNC_MAX_DRIFT_PPM) {
+            slope = TIMESYNC_MAX_DRIFT_PPM;
+        } else if (slope < -TIMESYNC_MAX_DRIFT_PPM) {
+            slope = -TIMESYNC_MAX_DRIFT_PPM;
+        }
+    }
+    intercept = (sy - slope * sx) / used;
+
+    for (i = 0; i < n; i++) {
+        const timesync_sample_t *s = &exchange.samples[i];
+        double x, e;
+
+        if (s->delay_us > limit) {
+            continue;
+        }
+        x = (double)(s64)(s->local_us - ref->local_us) / 1e6;
+        e = (double)(s->offset_us - ref->offset_us) - intercept - slope * x;
+        residual += e * e;
+    }
+
+    fitted.ref_us    = ref->local_us;
+    fitted.offset_us = ref->offset_us + (s64)llround(intercept);
+    fitted.drift     = slope / 1e6;
+    fitted.synced    = (used >= TIMESYNC_MIN_FIT);
+
+    taskENTER_CRITICAL();
+    model = fitted;
+    stats.delay_us = min_delay;
+    stats.error_us = (u32)sqrt(residual / used);
+    stats.fitted   = used;
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Follower: one exchange finished.
+ */
+static void timesync_add_exchange(u64 t1, u64 t2, u64 t3, u64 t4)
+{
+    timesync_sample_t *s = &exchange.samples[exchange.count % TIMESYNC_SAMPLES];
+    s64 delay = (s64)(t4 - t1) - (s64)(t3 - t2);
+
+    s->local_us  = t1 + (t4 - t1) / 2;
+    s->offset_us = ((s64)(t2 - t1) + (s64)(t3 - t4)) / 2;
+    s->delay_us  = (delay > 0) ? (u32)delay : 0;
+    exchange.count++;
+
+    taskENTER_CRITICAL();
+    stats.exchanges++;
+    taskEXIT_CRITICAL();
+    timesync_fit();
+}
+
+/*
+ * Follower: send the next request.
+ */
+static void timesync_send_request(int sock)
+{
+    u8 packet[TIMESYNC_PACKET_SIZE];
+
+    memset(packet, 0, sizeof(packet));
+    exchange.sequence++;
+    timesync_put32(packet, TIMESYNC_MAGIC);
+    timesync_put32(packet + 4, TIMESYNC_REQUEST);
+    timesync_put32(packet + 8, exchange.sequence);
+    exchange.sent_us = timesync_local_us();
+    timesync_put64(packet + 12, exchange.sent_us);
+    if (lwip_sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *)&exchange.leader,
+                    sizeof(exchange.leader)) == sizeof(packet)) {
+        exchange.waiting = 1;
+    }
+    exchange.next_request_us = exchange.sent_us + TIMESYNC_PERIOD_MS * 1000ULL;
+}
+
+/*
+ * Open the exchange socket on a UDP port. Returns it, or -1.
+ */
+int timesync_open(u16 port)
+{
+    int sock;
+    struct sockaddr_in address;
+
+    memset(&address, 0, sizeof(address));
+    if ((sock = lwip_socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        xil_printf("timesync: error creating socket.\r\n");
+        return -1;
+    }
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = INADDR_ANY;
+    if (lwip_bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        xil_printf("timesync: error on lwip_bind.\r\n");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ * One pass of the exchange: as a follower, send a request when one is
+ * due; then wait up to timeout_ms (less if a request falls due sooner)
+ * for a packet and answer it (leader) or take it as the reply
+ * (follower). Stale replies and packets for the other role are dropped.
+ */
+void timesync_service(int sock, u32 timeout_ms)
+{
+    u8 packet[TIMESYNC_PACKET_SIZE];
+    struct sockaddr_in remote;
+    socklen_t size = sizeof(remote);
+    struct pollfd fds[1];
+    u64 now, due;
+    int n;
+
+    timesync_take_config();
+    if (exchange.role == TIMESYNC_FOLLOWER) {
+        now = timesync_local_us();
+        if (exchange.waiting && now - exchange.sent_us > TIMESYNC_REPLY_TIMEOUT_MS * 1000ULL) {
+            exchange.waiting = 0;
+            taskENTER_CRITICAL();
+            stats.lost++;
+            taskEXIT_CRITICAL();
+        }
+        if (!exchange.waiting && (s64)(now - exchange.next_request_us) >= 0) {
+            timesync_send_request(sock);
+            now = timesync_local_us();
+        }
+        // Wake for the reply timeout or the next request, whichever is next
+        due = exchange.waiting ? exchange.sent_us + TIMESYNC_REPLY_TIMEOUT_MS * 1000ULL + 1
+                               : exchange.next_request_us;
+        if ((s64)(due - now) < (s64)timeout_ms * 1000) {
+            timeout_ms = ((s64)(due - now) > 0) ? (u32)((due - now) / 1000) + 1 : 0;
+        }
+    }
+
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+    if (poll(fds, 1, timeout_ms) <= 0) {
+        return;
+    }
+    n = lwip_recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *)&remote, &size);
+    now = timesync_local_us();
+    if (n != TIMESYNC_PACKET_SIZE || timesync_get32(packet) != TIMESYNC_MAGIC) {
+        return;
+    }
+
+    switch (timesync_get32(packet + 4)) {
+    case TIMESYNC_REQUEST:
+        if (exchange.role != TIMESYNC_LEADER) {
+            break;
+        }
+        timesync_put32(packet + 4, TIMESYNC_REPLY);
+        timesync_put64(packet + 20, now);
+        timesync_put64(packet + 28, timesync_local_us());
+        if (lwip_sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *)&remote, size) == sizeof(packet)) {
+            taskENTER_CRITICAL();
+            stats.served++;
+            taskEXIT_CRITICAL();
+        }
+        break;
+    case TIMESYNC_REPLY:
+        if (exchange.role != TIMESYNC_FOLLOWER || !exchange.waiting ||
+            timesync_get32(packet + 8) != exchange.sequence) {
+            break;
+        }
+        exchange.waiting = 0;
+        timesync_add_exchange(exchange.sent_us, timesync_get64(packet + 20),
+                              timesync_get64(packet + 28), now);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Sync thread: serves the exchange for whatever role is set.
+ */
+void timesync_thread(void *p)
+{
+    int sock = timesync_open(TIMESYNC_PORT);
+
+    if (sock < 0) {
+        vTaskDelete(NULL);
+        return;
+    }
+    while (1) {
+        timesync_service(sock, TIMESYNC_PERIOD_MS);
+    }
+}
+
+/*
+ * Busy-wait until leader_us on the leader clock (the caller has waited
+ * out all but the last TIMESYNC_SPIN_US) and record how late it is
+ * returning. A start time already past returns at once and counts as
+ * late if it is more than TIMESYNC_LATE_US past; so does one on a
+ * follower that is not synced, counted as unsynced.
+ */
+void timesync_start_at(u64 leader_us)
+{
+    timesync_stats_t now;
+    s64 error_us;
+
+    while (timesync_until_us(leader_us) > 0) {
+    }
+    error_us = -timesync_until_us(leader_us);
+    timesync_get_stats(&now);
+
+    taskENTER_CRITICAL();
+    if (now.role == TIMESYNC_FOLLOWER && !now.synced) {
+        stats.unsynced_starts++;
+        taskEXIT_CRITICAL();
+        return;
+    }
+    stats.starts++;
+    stats.last_start_error_us = (error_us > 0x7FFFFFFF) ? 0x7FFFFFFF : (s32)error_us;
+    if (error_us > TIMESYNC_LATE_US) {
+        stats.late_starts++;
+    } else if ((u32)error_us > stats.max_start_error_us) {
+        stats.max_start_error_us = (u32)error_us;
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Copy out the role, the estimate now and the counters.
+ */
+void timesync_get_stats(timesync_stats_t *out)
+{
+    timesync_model_t m;
+    u64 local = timesync_local_us();
+
+    taskENTER_CRITICAL();
+    m = model;
+    *out = stats;
+    taskEXIT_CRITICAL();
+    out->synced    = m.synced;
+    out->offset_us = (s64)(timesync_leader_at(&m, local) - local);
+    out->drift_ppm = (float)(m.drift * 1e6);
+}
+
+/*
+ * Print the role, the estimate and the start time counters.
+ */
+void timesync_print_stats(void)
+{
+    timesync_stats_t s;
+    u64 offset;
+
+    timesync_get_stats(&s);
+    offset = (s.offset_us < 0) ? (u64)-s.offset_us : (u64)s.offset_us;
+    xil_printf("sync: %s, %s", timesync_role_name(s.role), s.synced ? "synced" : "not synced");
+    if (s.role == TIMESYNC_FOLLOWER) {
+        xil_printf(" to %d.%d.%d.%d\n", (int)(s.leader_addr & 0xFF), (int)((s.leader_addr >> 8) & 0xFF),
+                   (int)((s.leader_addr >> 16) & 0xFF), (int)(s.leader_addr >> 24));
+        xil_printf("  offset %s%lu.%06lu s, drift %ld ppb, round trip %lu us, error %lu us\n",
+                   (s.offset_us < 0) ? "-" : "", (u32)(offset / 1000000), (u32)(offset % 1000000),
+                   (s32)(s.drift_ppm * 1000.0f), s.delay_us, s.error_us);
+        xil_printf("  %lu exchanges (%lu fitted), %lu lost\n", s.exchanges, s.fitted, s.lost);
+    } else {
+        xil_printf(", %lu requests served\n", s.served);
+    }
+    xil_printf("  %lu timed starts, %lu late, %lu unsynced, last %ld us, max %lu us\n",
+               s.starts, s.late_starts, s.unsynced_starts, s.last_start_error_us,
+               s.max_start_error_us);
+}
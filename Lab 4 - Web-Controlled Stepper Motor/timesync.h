@@ -0,0 +1,124 @@
+/*
+ * timesync.h
+ * ----------------------------------------
+ * Multi-Board Time Sync Interface
+ *
+ * Description:
+ * Lets several boards start moves together. One board is the leader;
+ * the others (followers) estimate the leader's clock from their own
+ * over UDP, and a target queued with a start time (st=, leader clock
+ * microseconds) waits for that time before it starts.
+ *
+ * A follower sends a request every TIMESYNC_PERIOD_MS and the leader
+ * answers with the times it received and answered it. From the four
+ * timestamps of an exchange (request sent t1 and reply received t4 on
+ * the follower clock, t2 and t3 on the leader clock) come
+ *
+ *   delay  = (t4 - t1) - (t3 - t2)            round trip on the wire
+ *   offset = ((t2 - t1) + (t3 - t4)) / 2      leader - follower clock
+ *
+ * The offset is exact when the two directions take equally long, so
+ * only exchanges with a round trip close to the shortest of the last
+ * TIMESYNC_SAMPLES are kept. A line fitted through their offsets gives
+ * the offset now and the drift (the rate difference of the two
+ * crystals), so the estimate stays good between exchanges and across a
+ * lost reply. The RMS residual of the fit is reported as the sync error.
+ *
+ * Clocks are the 64-bit global timer in microseconds
+ * (timesync_local_us()). The leader's estimate of its own clock is
+ * exact; with sync off, start times are in this board's own clock. A
+ * follower that is not synced yet has no idea of the leader clock: the
+ * motor task holds a timed target until it is (timesync_synced()), and
+ * a start that still finds it unsynced (the role changed at the last
+ * moment) runs at once and is counted as an unsynced start. A start
+ * time only goes with a target of the normal sequence: /setParams and
+ * /setBatch reject st= together with rt=1 or ur=1, which start at once.
+ *
+ * To start boards together: set one leader and point the followers at
+ * it (/setSync), read leader_time_us from /getSync on any board, and
+ * queue the targets on every board with the same st= a little later.
+ * The motor task waits out the last TIMESYNC_SPIN_US of a start time
+ * busy, so starts are not rounded to a tick, and records how far from
+ * the start time on the leader clock each move really started.
+ *
+ * The exchange runs from timesync_service(), which only uses the socket
+ * calls lwIP and POSIX share, so tools/host/timesync_loopback.c runs it
+ * in several host processes with skewed clocks.
+ *
+ * Definitions:
+ * - TIMESYNC_PORT:          UDP port of the exchange (leader and followers)
+ * - TIMESYNC_PERIOD_MS:     Follower request interval
+ * - TIMESYNC_SAMPLES:       Exchanges the estimate is fitted to
+ * - TIMESYNC_MIN_FIT:       Kept exchanges needed before the follower is synced
+ * - TIMESYNC_MIN_SPAN_US:   Time the kept exchanges must span to fit a drift
+ * - TIMESYNC_DELAY_SLACK_US: Round trip over the shortest that is still kept
+ * - TIMESYNC_MAX_DRIFT_PPM: Largest credible drift; larger fits are clamped
+ * - TIMESYNC_SPIN_US:       Busy-waited end of a start time wait
+ * - TIMESYNC_LATE_US:       A start this far past its time counts as late
+ */
+
+#ifndef SRC_TIMESYNC_H_
+#define SRC_TIMESYNC_H_
+
+#include "xil_types.h"
+
+#define TIMESYNC_PORT             5002
+#define TIMESYNC_PERIOD_MS        250
+#define TIMESYNC_REPLY_TIMEOUT_MS 100
+#define TIMESYNC_SAMPLES          32
+#define TIMESYNC_MIN_FIT          4
+#define TIMESYNC_MIN_SPAN_US      2000000
+#define TIMESYNC_DELAY_SLACK_US   50
+#define TIMESYNC_MAX_DRIFT_PPM    500
+#define TIMESYNC_SPIN_US          2000
+#define TIMESYNC_LATE_US          100
+
+#define TIMESYNC_MAGIC            0x314E5953U   // "SYN1"
+#define TIMESYNC_PACKET_SIZE      36
+
+typedef enum {
+    TIMESYNC_OFF,
+    TIMESYNC_LEADER,
+    TIMESYNC_FOLLOWER
+} timesync_role_t;
+
+typedef struct {
+    timesync_role_t role;
+    _Bool synced;               // leader clock known (always, as the leader)
+    u32   leader_addr;          // follower: IPv4 address, network order
+    s64   offset_us;            // leader - local clock, now
+    float drift_ppm;            // leader clock rate over the local one, - 1
+    u32   delay_us;             // shortest round trip in the window
+    u32   error_us;             // RMS residual of the fit
+    u32   exchanges;            // replies received
+    u32   fitted;               // exchanges in the fit
+    u32   lost;                 // requests with no reply in time
+    u32   served;               // requests answered as the leader
+    u32   starts;               // moves started at a start time
+    u32   late_starts;          // of those, more than TIMESYNC_LATE_US late
+    u32   unsynced_starts;      // started at once, follower not synced
+    s32   last_start_error_us;  // leader clock at the start - start time
+    u32   max_start_error_us;   // largest |error| of a start on time
+} timesync_stats_t;
+
+// Exchange (the sync thread, or a host process)
+void timesync_thread(void *p);
+int  timesync_open(u16 port);
+void timesync_service(int sock, u32 timeout_ms);
+
+void timesync_set_role(timesync_role_t role, u32 leader_addr, u16 leader_port);
+const char *timesync_role_name(timesync_role_t role);
+
+// Clocks
+u64  timesync_local_us(void);
+u64  timesync_leader_us(void);
+s64  timesync_until_us(u64 leader_us);
+_Bool timesync_synced(void);
+
+// Start times (motor task)
+void timesync_start_at(u64 leader_us);
+
+void timesync_get_stats(timesync_stats_t *stats);
+void timesync_print_stats(void);
+
+#endif /* SRC_TIMESYNC_H_ */
@@ -0,0 +1,312 @@
+/*
+ * amp_ring_stress.c
+ * ----------------------------------------
+ * Host-side Stress Test of the Inter-Core Motion Link
+ *
+ * Description:
+ * Runs amp_link.c between two threads playing the two cores of the AMP
+ * build: the producer (CPU0) pushes numbered commands into the ring and
+ * reads telemetry; the consumer (CPU1) takes the commands, "applies"
+ * each for a random number of spins, publishes telemetry and releases
+ * the slot. Checked:
+ * - every command arrives once, in order, with every field intact (each
+ *   field is a different function of the command number, so a slot read
+ *   before it was complete or after it was reused shows up),
+ * - every telemetry sample read is one the consumer wrote whole (again,
+ *   each field a function of one counter) and never older than the last
+ *   one read,
+ * - once the ring reads empty, the telemetry reflects every command
+ *   pushed (the sync motion_link.c relies on).
+ *
+ * The producer also pushes in bursts and pauses, so the ring runs both
+ * full and empty. x86 hosts keep stores in order, which hides a missing
+ * barrier; run it on an ARM host (or the A9 itself) to test the barrier
+ * placement too. Built with AMP_LINK_STRESS, amp_link.c also gives up
+ * the CPU at random at each point where the other core may get in, so
+ * on any host, single-CPU included, the other thread runs there.
+ *
+ * Build and run from the Lab 4 directory:
+ *   cc -O2 -pthread -DAMP_LINK_STRESS -Itools/host/include -I. \
+ *      tools/host/amp_ring_stress.c amp_link.c -o amp_ring_stress
+ *   ./amp_ring_stress [commands] [seed]
+ * The exit status is 1 if any check failed.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "amp_link.h"
+
+#define STRESS_DEFAULT_COMMANDS  5000000UL
+#define STRESS_MAX_SPIN          64       // consumer "apply" time, spins
+#define STRESS_BURST             (AMP_RING_SIZE * 2)
+#define STRESS_SYNC_EVERY        4096     // commands between syncs
+#define STRESS_REPORT_LIMIT      10
+#define STRESS_PREEMPT_ONE_IN    4        // yields at an AMP_LINK_PREEMPT() point
+
+static amp_shared_t shared __attribute__((aligned(AMP_CACHE_LINE)));
+static u32 commands_total;
+static u32 seed;
+
+// Consumer results (read once it has finished)
+static u32 consumer_errors;
+
+// Producer results
+static u32 producer_errors;
+static u64 ring_full;
+static u64 telemetry_reads;
+static u32 syncs;
+
+static volatile u32 failures_reported;
+static u64 preemptions;
+static __thread u32 preempt_state;
+
+
+static void stress_report(const char *side, const char *what, u32 expected, u32 got)
+{
+    if (__sync_fetch_and_add(&failures_reported, 1) < STRESS_REPORT_LIMIT) {
+        printf("%s: %s (expected %lu, got %lu)\n", side, what,
+               (unsigned long)expected, (unsigned long)got);
+    }
+}
+
+static u32 stress_random(u32 *state)
+{
+    // xorshift32, so a seed gives the same run on every host
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/*
+ * amp_link.c preemption point: let the other thread run, now and then.
+ */
+void amp_link_preempt(void)
+{
+    if (preempt_state == 0) {
+        preempt_state = (u32)(UINTPTR)&preempt_state | 1;
+    }
+    if (stress_random(&preempt_state) % STRESS_PREEMPT_ONE_IN == 0) {
+        __sync_fetch_and_add(&preemptions, 1);
+        sched_yield();
+    }
+}
+
+/*
+ * Command number n, every field a different function of n.
+ */
+static void stress_command(u32 n, amp_command_t *command)
+{
+    command->type             = AMP_CMD_INIT + n % 8;
+    command->move             = n;
+    command->position         = (s32)(n * 2654435761U);
+    command->direction        = (s32)~n;
+    command->value            = n ^ 0xA5A5A5A5U;
+    command->step_mode        = (u8)(n >> 3);
+    command->profile          = (u8)(n >> 11);
+    command->full_step_cruise = (u8)(n >> 19);
+    command->reserved         = (u8)(n >> 27);
+    command->entry_speed      = (float)(n & 0xFFFF);
+    command->exit_speed       = (float)(n >> 16);
+    command->speed            = (float)(n % 1000);
+    command->accel            = (float)(n % 777);
+    command->decel            = (float)(n % 555);
+    command->jerk             = (float)(n % 333);
+}
+
+/*
+ * Telemetry after c commands, every field a different function of c.
+ */
+static void stress_telemetry(u32 c, amp_telemetry_t *sample)
+{
+    memset(sample, 0, sizeof(*sample));
+    sample->position         = (s32)c;
+    sample->velocity         = (float)(c & 0xFFFFF);
+    sample->direction        = (s32)~c;
+    sample->phase            = (s32)(c % 8);
+    sample->timestamp_us     = c * 7;
+    sample->move_started     = c;
+    sample->move_done        = c ^ 0x5A5A5A5AU;
+    sample->running          = (u8)c;
+    sample->complete         = (u8)(c >> 8);
+    sample->estop_latched    = (u8)(c >> 16);
+    sample->reserved         = (u8)(c >> 24);
+    sample->queued_dir       = (s32)(c * 3);
+    sample->fifo_space       = c % 33;
+    sample->estop_taken      = c + 1;
+    sample->estop_stops      = c * 13;
+    sample->estop_latency_us = c >> 4;
+    sample->feed_override    = c % 151;
+    sample->stream_rejected  = c * 31;
+}
+
+/*
+ * CPU1: take each command, check it, apply it for a while, publish the
+ * count of commands applied, then release the slot.
+ */
+static void *stress_consumer(void *p)
+{
+    u32 state = seed * 2 + 1;
+    u32 expected = 1;
+    amp_telemetry_t sample;
+
+    (void)p;
+    while (expected <= commands_total) {
+        amp_command_t command, reference;
+        u32 spins, i;
+
+        if (!amp_ring_peek(&shared.commands, &command)) {
+            // Idle: keep rewriting telemetry, as the motion core does
+            // after every step
+            stress_telemetry(expected - 1, &sample);
+            amp_telemetry_write(&shared.telemetry, &sample);
+            sched_yield();
+            continue;
+        }
+        stress_command(expected, &reference);
+        if (command.move != expected) {
+            stress_report("consumer", "command out of order", expected, command.move);
+            consumer_errors++;
+            expected = command.move;
+            stress_command(expected, &reference);
+        }
+        if (memcmp(&command, &reference, sizeof(command)) != 0) {
+            stress_report("consumer", "torn command", expected, command.move);
+            consumer_errors++;
+        }
+
+        spins = stress_random(&state) % STRESS_MAX_SPIN;
+        for (i = 0; i < spins; i++) {
+            __asm__ volatile ("" ::: "memory");
+        }
+
+        stress_telemetry(expected, &sample);
+        amp_telemetry_write(&shared.telemetry, &sample);
+        amp_ring_release(&shared.commands);
+        expected++;
+    }
+    return NULL;
+}
+
+/*
+ * CPU0: check a telemetry sample is whole and not older than the last.
+ */
+static void stress_check_telemetry(u32 *last)
+{
+    amp_telemetry_t sample, reference;
+    u32 c;
+
+    amp_telemetry_read(&shared.telemetry, &sample);
+    telemetry_reads++;
+    c = sample.move_started;
+    stress_telemetry(c, &reference);
+    reference.sequence = sample.sequence;
+    if (memcmp(&sample, &reference, sizeof(sample)) != 0) {
+        stress_report("producer", "torn telemetry", c, (u32)sample.position);
+        producer_errors++;
+    }
+    if (c < *last) {
+        stress_report("producer", "telemetry went back", *last, c);
+        producer_errors++;
+    }
+    *last = c;
+}
+
+/*
+ * CPU0: push the commands in bursts, reading telemetry between them,
+ * and now and then wait for the ring to drain and check the telemetry
+ * has caught up.
+ */
+static void *stress_producer(void *p)
+{
+    u32 state = seed;
+    u32 last = 0;
+    u32 n = 1;
+
+    (void)p;
+    while (n <= commands_total) {
+        u32 burst = 1 + stress_random(&state) % STRESS_BURST;
+
+        for (; burst > 0 && n <= commands_total; burst--) {
+            amp_command_t command;
+
+            stress_command(n, &command);
+            while (!amp_ring_push(&shared.commands, &command)) {
+                ring_full++;
+                stress_check_telemetry(&last);
+                sched_yield();
+            }
+            if (n % STRESS_SYNC_EVERY == 0) {
+                while (amp_ring_level(&shared.commands) != 0) {
+                    sched_yield();
+                }
+                stress_check_telemetry(&last);
+                if (last != n) {
+                    stress_report("producer", "telemetry behind an empty ring", n, last);
+                    producer_errors++;
+                }
+                syncs++;
+            }
+            n++;
+        }
+        stress_check_telemetry(&last);
+        if (stress_random(&state) % 16 == 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static double stress_now_s(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t producer, consumer;
+    double start, elapsed;
+    u32 errors;
+
+    commands_total = (argc > 1) ? (u32)strtoul(argv[1], NULL, 0) : STRESS_DEFAULT_COMMANDS;
+    seed           = (argc > 2) ? (u32)strtoul(argv[2], NULL, 0) : 1;
+    if (seed == 0) {
+        seed = 1;
+    }
+
+    amp_ring_init(&shared.commands);
+    {
+        amp_telemetry_t sample;
+        stress_telemetry(0, &sample);
+        amp_telemetry_write(&shared.telemetry, &sample);
+    }
+    shared.magic = AMP_MAGIC;
+
+    start = stress_now_s();
+    pthread_create(&consumer, NULL, stress_consumer, NULL);
+    pthread_create(&producer, NULL, stress_producer, NULL);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    elapsed = stress_now_s() - start;
+
+    errors = producer_errors + consumer_errors;
+    printf("\namp_ring_stress: %lu commands through %d slots, seed %lu\n",
+           (unsigned long)commands_total, AMP_RING_SIZE, (unsigned long)seed);
+    printf("  %.2f s, %.2f M commands/s\n", elapsed, commands_total / elapsed / 1e6);
+    printf("  ring full: %llu pushes retried\n", (unsigned long long)ring_full);
+    printf("  telemetry: %llu reads, %lu samples written\n",
+           (unsigned long long)telemetry_reads, (unsigned long)(shared.telemetry.sequence / 2));
+    printf("  syncs: %lu, preemptions: %llu\n", (unsigned long)syncs,
+           (unsigned long long)preemptions);
+    printf("  errors: %lu (producer %lu, consumer %lu)\n", (unsigned long)errors,
+           (unsigned long)producer_errors, (unsigned long)consumer_errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * batch_bench.c
+ * ----------------------------------------
+ * Host-side Move-Order Optimizer Benchmark
+ *
+ * Description:
+ * Runs batch_optimize() on randomized batches of 2 to BATCH_MAX_TARGETS
+ * targets in 0..MAX_POSITION, with motion parameters inside the limits
+ * validate_input() enforces, and compares the motion time of the order
+ * chosen against submission order (both timed by batch_route_time()).
+ * Batches are grouped by what changes the search: no dwell (moves in
+ * the same direction blend), a dwell at every target (every move stops),
+ * and the rotary axis (moves take the shortest way round).
+ *
+ * Also reported: host time per batch_optimize() call and the most
+ * orders timed for one batch, the figure that bounds its time on the
+ * A9.
+ *
+ * Build and run from the Lab 4 directory:
+ *   cc -O2 -fcommon -DSTEP_TIMER_SIMULATED -Itools/host/include -I. \
+ *      tools/host/batch_bench.c tools/host/host_stubs.c batch.c \
+ *      stepper.c ramp_cache.c planner.c step_timer.c -lm -o batch_bench
+ *   ./batch_bench [batches] [seed]
+ * The exit status is 1 if any order chosen was slower than submission
+ * order, or not the order its time was reported for.
+ */
+
+#include "stepper.h"
+#include "batch.h"
+
+#define BENCH_DEFAULT_BATCHES  3000
+#define BENCH_MAX_POSITION     2048     // MAX_POSITION in server.c
+#define BENCH_MIN_TARGETS      2
+
+typedef enum {
+    CLASS_BLENDED,      // no dwell
+    CLASS_DWELL,        // dwell at each target
+    CLASS_ROTARY,       // shortest way round, no dwell
+    CLASS_COUNT
+} bench_class_t;
+
+static const char *class_names[CLASS_COUNT] = { "blended", "dwell", "rotary" };
+
+typedef struct {
+    u32 batches;
+    double submitted_s;
+    double optimized_s;
+    double saving_total;        // fraction of submission order time
+    double saving_max;
+    double optimize_ns_total;
+    double optimize_ns_max;
+    u32 timings_max;
+    u32 passes_max;
+    u32 slower;
+} bench_class_stats_t;
+
+extern int host_quiet;
+
+static u32 rng_state;
+
+
+static u32 bench_random(void)
+{
+    // xorshift32, so a seed gives the same batches on every host
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static u32 bench_random_range(u32 low, u32 high)
+{
+    return low + bench_random() % (high - low + 1);
+}
+
+static double bench_now_ns(void)
+{
+    XTime now;
+
+    XTime_GetTime(&now);
+    return (double)now * (1e9 / COUNTS_PER_SECOND);
+}
+
+int main(int argc, char **argv)
+{
+    u32 batches = (argc > 1) ? (u32)strtoul(argv[1], NULL, 0) : BENCH_DEFAULT_BATCHES;
+    u32 seed    = (argc > 2) ? (u32)strtoul(argv[2], NULL, 0) : 1;
+    bench_class_stats_t classes[CLASS_COUNT] = { 0 };
+    u32 failures = 0;
+    u32 b;
+    int c;
+
+    rng_state = (seed != 0) ? seed : 1;
+    host_quiet = 1;
+
+    for (b = 0; b < batches; b++) {
+        bench_class_t class = (bench_class_t)(b % CLASS_COUNT);
+        bench_class_stats_t *stats = &classes[class];
+        motor_parameters_t params;
+        long targets[BATCH_MAX_TARGETS];
+        u8 order[BATCH_MAX_TARGETS];
+        batch_result_t result;
+        u32 count = bench_random_range(BENCH_MIN_TARGETS, BATCH_MAX_TARGETS);
+        long start = bench_random_range(0, BENCH_MAX_POSITION);
+        double t0, elapsed, saving;
+        u32 i;
+
+        memset(&params, 0, sizeof(params));
+        params.rotational_speed = (float)bench_random_range(50, STEPPER_MAX_SPEED);
+        params.rotational_accel = (float)bench_random_range(50, STEPPER_MAX_ACCEL);
+        params.rotational_decel = (float)bench_random_range(50, STEPPER_MAX_ACCEL);
+        params.rotational_jerk  = (float)bench_random_range(500, 10000);
+        params.motion_profile   = (bench_random() % 4 == 0) ? PROFILE_S_CURVE : PROFILE_TRAPEZOID;
+        params.step_mode        = FULL_STEP;
+        params.dwell_time       = (class == CLASS_DWELL) ? bench_random_range(10, 500) : 0;
+        params.rotary           = (class == CLASS_ROTARY);
+        for (i = 0; i < count; i++) {
+            targets[i] = bench_random_range(0, BENCH_MAX_POSITION);
+        }
+
+        t0 = bench_now_ns();
+        batch_optimize(&params, start, targets, count, order, &result);
+        elapsed = bench_now_ns() - t0;
+
+        // The order reported must be the one timed, and a permutation
+        {
+            u32 seen = 0;
+            for (i = 0; i < count; i++) {
+                seen |= 1u << order[i];
+            }
+            if (seen != (1u << count) - 1 ||
+                fabsf(batch_route_time(&params, start, targets, order, count) - result.optimized_s) > 1e-3f) {
+                printf("batch %lu: order is not a permutation or does not match its time\n",
+                       (unsigned long)b);
+                failures++;
+            }
+        }
+
+        saving = (result.submitted_s > 0.0f) ? 1.0 - result.optimized_s / result.submitted_s : 0.0;
+        stats->batches++;
+        stats->submitted_s       += result.submitted_s;
+        stats->optimized_s       += result.optimized_s;
+        stats->saving_total      += saving;
+        stats->optimize_ns_total += elapsed;
+        if (saving > stats->saving_max) {
+            stats->saving_max = saving;
+        }
+        if (elapsed > stats->optimize_ns_max) {
+            stats->optimize_ns_max = elapsed;
+        }
+        if (result.timings > stats->timings_max) {
+            stats->timings_max = result.timings;
+        }
+        if (result.passes > stats->passes_max) {
+            stats->passes_max = result.passes;
+        }
+        if (result.optimized_s > result.submitted_s) {
+            stats->slower++;
+            failures++;
+        }
+    }
+
+    printf("\nbatch_bench: %lu batches of %d to %d targets, seed %lu\n", (unsigned long)batches,
+           BENCH_MIN_TARGETS, BATCH_MAX_TARGETS, (unsigned long)seed);
+    printf("  class     batches  submitted  optimized  saving (mean, max)  optimize us (mean, max)  orders  passes  slower\n");
+    for (c = 0; c < CLASS_COUNT; c++) {
+        bench_class_stats_t *stats = &classes[c];
+        u32 n = stats->batches ? stats->batches : 1;
+
+        printf("  %-8s  %7lu  %8.1fs  %8.1fs  %7.1f%%  %7.1f%%  %10.1f  %10.1f  %6lu  %6lu  %6lu\n",
+               class_names[c], (unsigned long)stats->batches, stats->submitted_s, stats->optimized_s,
+               100.0 * stats->saving_total / n, 100.0 * stats->saving_max,
+               stats->optimize_ns_total / n / 1000.0, stats->optimize_ns_max / 1000.0,
+               (unsigned long)stats->timings_max, (unsigned long)stats->passes_max,
+               (unsigned long)stats->slower);
+    }
+    printf("  failures: %lu\n", (unsigned long)failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * host_stubs.c
+ * ----------------------------------------
+ * Host Build Support for the Stepper Driver
+ *
+ * Description:
+ * Stand-ins for the FreeRTOS, AXI GPIO and global timer calls made by
+ * stepper.c, ramp_cache.c and planner.c, so they build and run on a
+ * development machine. Time comes from the simulated step timer
+ * (step_timer.c built with STEP_TIMER_SIMULATED): ticks are whole
+ * milliseconds of the virtual clock. No tasks run; the caller plays the
+ * step engine service task by calling stepper_update() between
+ * step_timer_sim_advance() calls.
+ *
+ * Key Variables:
+ * - host_quiet:      Drops xil_printf() output when set
+ * - host_gpio_data:  Last value written to a coil GPIO channel
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "xgpio.h"
+#include "xtime_l.h"
+#include "xil_printf.h"
+#include "step_timer.h"
+
+int host_quiet;
+u32 host_gpio_data;
+
+
+void xil_printf(const char *format, ...)
+{
+    va_list args;
+
+    if (host_quiet) {
+        return;
+    }
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+void XTime_GetTime(XTime *time)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    *time = (XTime)now.tv_sec * 1000000000ULL + (XTime)now.tv_nsec;
+}
+
+void XGpio_SetDataDirection(XGpio *gpio, unsigned channel, u32 direction)
+{
+    (void)gpio; (void)channel; (void)direction;
+}
+
+void XGpio_DiscreteWrite(XGpio *gpio, unsigned channel, u32 data)
+{
+    (void)gpio; (void)channel;
+    host_gpio_data = data;
+}
+
+u32 XGpio_DiscreteRead(XGpio *gpio, unsigned channel)
+{
+    (void)gpio; (void)channel;
+    return 0;
+}
+
+/*
+ * Tasks are not run, so the service task is never created and the step
+ * ISR has no task to notify.
+ */
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *handle)
+{
+    (void)code; (void)name; (void)stack; (void)parameters; (void)priority;
+    if (handle != NULL) {
+        *handle = NULL;
+    }
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return NULL;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return step_timer_get_time_us() / 1000;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    step_timer_sim_advance(ticks * 1000);
+}
+
+void vTaskSuspendAll(void)
+{
+}
+
+BaseType_t xTaskResumeAll(void)
+{
+    return pdFALSE;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    (void)task;
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    (void)task; (void)woken;
+}
+
+/*
+ * A blocked wait lets one tick of virtual time pass.
+ */
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    (void)clear; (void)ticks;
+    step_timer_sim_advance(1000);
+    return 0;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    (void)queue; (void)item; (void)ticks;
+    return pdFAIL;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    (void)queue; (void)item; (void)ticks;
+    return pdFAIL;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    (void)queue;
+    return 0;
+}
+
+/*
+ * estop.c is not part of the host build.
+ */
+void estop_record_latency(u32 latency_us)
+{
+    (void)latency_us;
+}
@@ -0,0 +1,390 @@
+/*
+ * http_load.c
+ * ----------------------------------------
+ * Host-side Load Test of the HTTP Server Loop
+ *
+ * Description:
+ * Runs the event loop of httpd.c on loopback next to a copy of the loop
+ * it replaced (poll the listening socket every 10 ms, then one client at
+ * a time: a single blocking read, the response, close; listen backlog
+ * 0), both answering every request with a /getParams-sized JSON body,
+ * and measures them with the same clients:
+ *
+ * - Throughput: 1 to LOAD_MAX_CLIENTS clients, each sending requests
+ *   back to back (connect, request, read to close), for the given time
+ *   per point. Reported as requests/s, the median and 99th percentile
+ *   request time, and the requests that got no response within
+ *   LOAD_CLIENT_TIMEOUT_S (connections the listen backlog turned away
+ *   until the client gave up).
+ * - Slow clients: LOAD_SLOW_CLIENTS clients that connect, say nothing
+ *   for LOAD_SLOW_SILENCE_MS (as a browser's speculative connection
+ *   does) and then send their request in two halves, next to 4 clients
+ *   polling every LOAD_POLL_PERIOD_MS as the web page does. The old loop
+ *   sits in read() on each slow client; reported are the polling
+ *   clients' request times, and how many slow requests got a whole
+ *   response.
+ *
+ * On a host with few CPUs the clients and the server share them, so
+ * the absolute figures are lower than the loop can do; the comparison
+ * holds.
+ *
+ * Build and run from the Lab 4 directory:
+ *   cc -O2 -pthread -Itools/host/include -I. tools/host/http_load.c \
+ *      httpd.c -o http_load
+ *   ./http_load [seconds per point]
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "xil_printf.h"
+#include "lwip/sockets.h"
+#include "httpd.h"
+
+#define LOAD_PORT              18000    // + 2 * (pid % 1000): the last run's
+                                        // server sockets linger in TIME_WAIT
+#define LOAD_MAX_CLIENTS       64
+#define LOAD_MAX_SAMPLES       200000   // request times kept per point
+#define LOAD_SLOW_CLIENTS      4
+#define LOAD_SLOW_SILENCE_MS   200
+#define LOAD_SLOW_GAP_MS       100      // between the two halves
+#define LOAD_POLL_PERIOD_MS    20
+#define LOAD_LEGACY_POLL_MS    10
+#define LOAD_CLIENT_TIMEOUT_S  2        // connect, send or receive: a failed request
+
+static const char load_request[] = "GET /getParams HTTP/1.1\r\nHost: board\r\nUser-Agent: http_load\r\n\r\n";
+
+typedef struct {
+    u16 port;
+    _Bool slow;
+    u32 period_ms;          // 0: back to back
+    volatile _Bool *stop;
+    u32 requests;           // whole responses
+    u32 failures;
+} load_client_t;
+
+static u16 event_port, legacy_port;
+static pthread_mutex_t samples_lock = PTHREAD_MUTEX_INITIALIZER;
+static double samples[LOAD_MAX_SAMPLES];
+static u32 sample_count;
+
+
+static double load_now_s(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    static double start;
+
+    if (start == 0.0) {
+        start = load_now_s();
+    }
+    return (TickType_t)((load_now_s() - start) * 1000.0);
+}
+
+void xil_printf(const char *format, ...)
+{
+    (void)format;
+}
+
+/*
+ * The response both servers send: a /getParams-sized JSON body.
+ */
+static void load_format_response(char *buf, size_t size)
+{
+    snprintf(buf, size,
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: application/json\r\n"
+             "Connection: close\r\n\r\n"
+             "{"
+                "\"current_position\": %ld,"
+                "\"rotational_accel\": %.2f,"
+                "\"rotational_decel\": %.2f,"
+                "\"final_position\": %ld,"
+                "\"rotational_speed\": %.2f,"
+                "\"direction\": \"%s\","
+                "\"phase\": %d,"
+                "\"move_id\": %u,"
+                "\"timestamp_us\": %u,"
+                "\"feed_override\": %u,"
+                "\"move_eta_ms\": %u,"
+                "\"queue_eta_ms\": %u,"
+                "\"queued_targets\": %u"
+             "}",
+             1024L, 500.0, 500.0, 2048L, 250.0, "Clockwise", 3, 17U,
+             (unsigned)xTaskGetTickCount() * 1000U, 100U, 1500U, 4000U, 2U);
+}
+
+static void load_handler(httpd_connection_t *connection)
+{
+    load_format_response(connection->response, sizeof(connection->response));
+}
+
+static void *load_event_server(void *p)
+{
+    (void)p;
+    httpd_serve(event_port, load_handler);
+    fprintf(stderr, "http_load: event server could not start\n");
+    exit(1);
+}
+
+/*
+ * The loop httpd.c replaced, as it was in server.c.
+ */
+static void *load_legacy_server(void *p)
+{
+    struct sockaddr_in address, remote;
+    socklen_t size = sizeof(remote);
+    char recv_buf[HTTPD_REQUEST_SIZE];
+    char response[HTTPD_RESPONSE_SIZE];
+    struct pollfd fds[1];
+    int sock, sd, n;
+
+    (void)p;
+    memset(&address, 0, sizeof(address));
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(legacy_port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sock < 0 || bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "http_load: legacy server could not start\n");
+        exit(1);
+    }
+    listen(sock, 0);
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+
+    while (1) {
+        if (poll(fds, 1, LOAD_LEGACY_POLL_MS) <= 0) {
+            continue;
+        }
+        size = sizeof(remote);
+        sd = accept(sock, (struct sockaddr *)&remote, &size);
+        if (sd < 0) {
+            continue;
+        }
+        n = read(sd, recv_buf, sizeof(recv_buf) - 1);
+        if (n < 0) {
+            close(sd);
+            continue;
+        }
+        recv_buf[n] = '\0';
+        load_format_response(response, sizeof(response));
+        if (write(sd, response, strlen(response)) < 0) {
+            // as before: reported, then closed
+        }
+        close(sd);
+    }
+    return NULL;
+}
+
+static void load_sleep_ms(u32 ms)
+{
+    struct timespec delay = { ms / 1000, (long)(ms % 1000) * 1000000L };
+
+    nanosleep(&delay, NULL);
+}
+
+/*
+ * One request: connect, send (slowly for a slow client), read to close.
+ * Returns 1 for a whole response.
+ */
+static _Bool load_request_once(const load_client_t *client)
+{
+    struct timeval timeout = { LOAD_CLIENT_TIMEOUT_S, 0 };
+    struct sockaddr_in address;
+    char buf[2048];
+    u32 received = 0;
+    int sd, n;
+    _Bool ok;
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(client->port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sd < 0) {
+        return 0;
+    }
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(sd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(sd);
+        return 0;
+    }
+    if (client->slow) {
+        u32 half = (sizeof(load_request) - 1) / 2;
+
+        load_sleep_ms(LOAD_SLOW_SILENCE_MS);
+        ok = write(sd, load_request, half) == (int)half;
+        load_sleep_ms(LOAD_SLOW_GAP_MS);
+        ok = ok && write(sd, load_request + half, sizeof(load_request) - 1 - half)
+                   == (int)(sizeof(load_request) - 1 - half);
+    } else {
+        ok = write(sd, load_request, sizeof(load_request) - 1) == (int)(sizeof(load_request) - 1);
+    }
+    while (ok && (n = read(sd, buf + received, sizeof(buf) - 1 - received)) > 0) {
+        received += n;
+    }
+    close(sd);
+    buf[received] = '\0';
+    return ok && strncmp(buf, "HTTP/1.1 200 OK", 15) == 0 && strstr(buf, "\"queued_targets\"") != NULL;
+}
+
+static void *load_client(void *p)
+{
+    load_client_t *client = p;
+
+    while (!*client->stop) {
+        double start = load_now_s();
+
+        if (!load_request_once(client)) {
+            client->failures++;
+            continue;
+        }
+        client->requests++;
+        if (!client->slow) {
+            double elapsed = load_now_s() - start;
+
+            pthread_mutex_lock(&samples_lock);
+            if (sample_count < LOAD_MAX_SAMPLES) {
+                samples[sample_count++] = elapsed;
+            }
+            pthread_mutex_unlock(&samples_lock);
+        }
+        if (client->period_ms > 0 && !client->slow) {
+            load_sleep_ms(client->period_ms);
+        }
+    }
+    return NULL;
+}
+
+static int load_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    double rate;            // fast requests/s
+    double p50_ms;
+    double p99_ms;
+    double max_ms;
+    u32 failures;
+    u32 slow_done;
+    u32 slow_failed;
+} load_point_t;
+
+/*
+ * Run fast and slow clients against a port for seconds.
+ */
+static void load_run(u16 port, u32 fast, u32 slow, u32 period_ms, double seconds, load_point_t *point)
+{
+    pthread_t threads[LOAD_MAX_CLIENTS + LOAD_SLOW_CLIENTS];
+    load_client_t clients[LOAD_MAX_CLIENTS + LOAD_SLOW_CLIENTS];
+    volatile _Bool stop = 0;
+    u32 requests = 0, i;
+    double start, elapsed;
+
+    sample_count = 0;
+    memset(point, 0, sizeof(*point));
+    start = load_now_s();
+    for (i = 0; i < fast + slow; i++) {
+        clients[i].port     = port;
+        clients[i].slow     = (i >= fast);
+        clients[i].period_ms = period_ms;
+        clients[i].stop     = &stop;
+        clients[i].requests = 0;
+        clients[i].failures = 0;
+        pthread_create(&threads[i], NULL, load_client, &clients[i]);
+    }
+    load_sleep_ms((u32)(seconds * 1000.0));
+    stop = 1;
+    elapsed = load_now_s() - start;
+    for (i = 0; i < fast + slow; i++) {
+        pthread_join(threads[i], NULL);
+        if (clients[i].slow) {
+            point->slow_done   += clients[i].requests;
+            point->slow_failed += clients[i].failures;
+        } else {
+            requests        += clients[i].requests;
+            point->failures += clients[i].failures;
+        }
+    }
+
+    point->rate = requests / elapsed;
+    if (sample_count > 0) {
+        qsort(samples, sample_count, sizeof(samples[0]), load_compare);
+        point->p50_ms = samples[sample_count / 2] * 1000.0;
+        point->p99_ms = samples[(u32)(sample_count * 0.99)] * 1000.0;
+        point->max_ms = samples[sample_count - 1] * 1000.0;
+    }
+    // Let the servers drain before the next point
+    load_sleep_ms(200);
+}
+
+static void load_print(const load_point_t *point)
+{
+    printf("  %9.0f %8.2f %8.2f %6lu", point->rate, point->p50_ms, point->p99_ms,
+           (unsigned long)point->failures);
+}
+
+int main(int argc, char **argv)
+{
+    static const u32 levels[] = { 1, 2, 4, 8, 16, 32, 64 };
+    double seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+    pthread_t event_server, legacy_server;
+    load_point_t legacy, event;
+    u32 i;
+
+    event_port  = (u16)(LOAD_PORT + 2 * (getpid() % 1000));
+    legacy_port = event_port + 1;
+    xTaskGetTickCount();
+    pthread_create(&event_server, NULL, load_event_server, NULL);
+    pthread_create(&legacy_server, NULL, load_legacy_server, NULL);
+    load_sleep_ms(100);
+
+    printf("\nhttp_load: %.1f s per point, loopback, /getParams-sized responses\n", seconds);
+    printf("  %7s | %-35s | %-35s\n", "", "old loop (one client at a time)",
+           "httpd.c (event loop)");
+    printf("  %7s | %9s %8s %8s %6s | %9s %8s %8s %6s\n", "clients",
+           "req/s", "p50 ms", "p99 ms", "failed", "req/s", "p50 ms", "p99 ms", "failed");
+    for (i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        load_run(legacy_port, levels[i], 0, 0, seconds, &legacy);
+        load_run(event_port, levels[i], 0, 0, seconds, &event);
+        printf("  %7lu |", (unsigned long)levels[i]);
+        load_print(&legacy);
+        printf(" |");
+        load_print(&event);
+        printf("\n");
+    }
+
+    printf("\n  4 clients polling every %d ms next to %d slow ones (%d ms silent, request in two halves):\n",
+           LOAD_POLL_PERIOD_MS, LOAD_SLOW_CLIENTS, LOAD_SLOW_SILENCE_MS);
+    load_run(legacy_port, 4, LOAD_SLOW_CLIENTS, LOAD_POLL_PERIOD_MS, seconds * 4, &legacy);
+    load_run(event_port, 4, LOAD_SLOW_CLIENTS, LOAD_POLL_PERIOD_MS, seconds * 4, &event);
+    printf("  %7s | %9s %8s %8s %6s | %9s %8s %8s %6s\n", "",
+           "req/s", "p50 ms", "p99 ms", "failed", "req/s", "p50 ms", "p99 ms", "failed");
+    printf("  %7s |", "polling");
+    load_print(&legacy);
+    printf(" |");
+    load_print(&event);
+    printf("\n  %7s | %8.1f ms longest request %6s | %8.1f ms longest request\n", "",
+           legacy.max_ms, "", event.max_ms);
+    printf("  %7s | %5lu whole, %lu failed %13s | %5lu whole, %lu failed\n", "slow",
+           (unsigned long)legacy.slow_done, (unsigned long)legacy.slow_failed, "",
+           (unsigned long)event.slow_done, (unsigned long)event.slow_failed);
+    return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * FreeRTOS.h (host build)
+ * ----------------------------------------
+ * Minimal FreeRTOS kernel definitions for building the stepper driver on
+ * a development machine. There is no scheduler: critical sections are
+ * no-ops and ticks come from the virtual clock (see host_stubs.c).
+ */
+
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t      TickType_t;
+typedef long          BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE   1
+#define pdFALSE  0
+#define pdPASS   1
+#define pdFAIL   0
+
+#define portMAX_DELAY       0xFFFFFFFFUL
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+#define configMAX_PRIORITIES      8
+#define configMINIMAL_STACK_SIZE  200
+#define DEFAULT_THREAD_PRIO       2
+
+#define portYIELD_FROM_ISR(woken)          ((void)(woken))
+#define taskENTER_CRITICAL()               ((void)0)
+#define taskEXIT_CRITICAL()                ((void)0)
+#define taskENTER_CRITICAL_FROM_ISR()      0
+#define taskEXIT_CRITICAL_FROM_ISR(mask)   ((void)(mask))
+
+#endif /* HOST_FREERTOS_H_ */
@@ -0,0 +1,27 @@
+/*
+ * lwip/sockets.h (host build)
+ * ----------------------------------------
+ * lwIP socket calls on the host's BSD sockets, for modules that only
+ * use the calls the two share (timesync.c, httpd.c).
+ */
+
+#ifndef HOST_LWIP_SOCKETS_H_
+#define HOST_LWIP_SOCKETS_H_
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define lwip_socket    socket
+#define lwip_bind      bind
+#define lwip_listen    listen
+#define lwip_accept    accept
+#define lwip_sendto    sendto
+#define lwip_recvfrom  recvfrom
+#define lwip_fcntl     fcntl
+
+#endif /* HOST_LWIP_SOCKETS_H_ */
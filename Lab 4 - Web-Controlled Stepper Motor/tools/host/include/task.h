@@ -0,0 +1,27 @@
+/*
+ * task.h (host build)
+ * ----------------------------------------
+ * Task API used by the stepper driver. Tasks are never run on the host;
+ * xTaskCreate() only reports success.
+ */
+
+#ifndef HOST_TASK_H_
+#define HOST_TASK_H_
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+
+BaseType_t   xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack,
+                         void *parameters, UBaseType_t priority, TaskHandle_t *handle);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t   xTaskGetTickCount(void);
+void         vTaskDelay(TickType_t ticks);
+void         vTaskDelete(TaskHandle_t task);
+void         vTaskSuspendAll(void);
+BaseType_t   xTaskResumeAll(void);
+BaseType_t   xTaskNotifyGive(TaskHandle_t task);
+void         vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+uint32_t     ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+#endif /* HOST_TASK_H_ */
@@ -0,0 +1,29 @@
+/*
+ * xgpio.h (host build)
+ * ----------------------------------------
+ * AXI GPIO driver calls made by the stepper driver and the program
+ * interpreter. Coil writes land in host_gpio_data (see host_stubs.c);
+ * inputs read as released.
+ */
+
+#ifndef HOST_XGPIO_H_
+#define HOST_XGPIO_H_
+
+#include "xil_types.h"
+
+typedef struct {
+    UINTPTR BaseAddress;
+} XGpio;
+
+#define XGPIO_DATA_OFFSET  0x0
+#define XGPIO_CHAN_OFFSET  0x8
+
+extern u32 host_gpio_data;
+
+#define XGpio_WriteReg(base, offset, data)  ((void)(base), (void)(offset), host_gpio_data = (u32)(data))
+
+void XGpio_SetDataDirection(XGpio *gpio, unsigned channel, u32 direction);
+void XGpio_DiscreteWrite(XGpio *gpio, unsigned channel, u32 data);
+u32  XGpio_DiscreteRead(XGpio *gpio, unsigned channel);
+
+#endif /* HOST_XGPIO_H_ */
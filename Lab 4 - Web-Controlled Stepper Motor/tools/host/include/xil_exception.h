@@ -0,0 +1,8 @@
+/*
+ * xil_exception.h (host build)
+ */
+
+#ifndef HOST_XIL_EXCEPTION_H_
+#define HOST_XIL_EXCEPTION_H_
+
+#endif /* HOST_XIL_EXCEPTION_H_ */
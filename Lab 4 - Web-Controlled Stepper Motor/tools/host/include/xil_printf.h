@@ -0,0 +1,10 @@
+/*
+ * xil_printf.h (host build)
+ */
+
+#ifndef HOST_XIL_PRINTF_H_
+#define HOST_XIL_PRINTF_H_
+
+void xil_printf(const char *format, ...);
+
+#endif /* HOST_XIL_PRINTF_H_ */
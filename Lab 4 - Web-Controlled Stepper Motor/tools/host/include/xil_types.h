@@ -0,0 +1,21 @@
+/*
+ * xil_types.h (host build)
+ */
+
+#ifndef HOST_XIL_TYPES_H_
+#define HOST_XIL_TYPES_H_
+
+#include <stdint.h>
+
+typedef uint8_t   u8;
+typedef uint16_t  u16;
+typedef uint32_t  u32;
+typedef uint64_t  u64;
+typedef int32_t   s32;
+typedef int64_t   s64;
+typedef uintptr_t UINTPTR;
+
+#define XST_SUCCESS  0
+#define XST_FAILURE  1
+
+#endif /* HOST_XIL_TYPES_H_ */
@@ -0,0 +1,17 @@
+/*
+ * xparameters.h (host build)
+ * ----------------------------------------
+ * Device IDs referenced by the driver headers. Values are arbitrary.
+ */
+
+#ifndef HOST_XPARAMETERS_H_
+#define HOST_XPARAMETERS_H_
+
+#include "xil_types.h"
+
+#define XPAR_STEPPER_MOTOR_DEVICE_ID                   0
+#define XPAR_XTTCPS_0_DEVICE_ID                        0
+#define XPAR_XTTCPS_0_INTR                             42
+#define XPAR_FABRIC_AXI_GPIO_INPUTS_IP2INTC_IRPT_INTR  61
+
+#endif /* HOST_XPARAMETERS_H_ */
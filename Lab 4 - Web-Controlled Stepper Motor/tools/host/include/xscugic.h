@@ -0,0 +1,8 @@
+/*
+ * xscugic.h (host build)
+ */
+
+#ifndef HOST_XSCUGIC_H_
+#define HOST_XSCUGIC_H_
+
+#endif /* HOST_XSCUGIC_H_ */
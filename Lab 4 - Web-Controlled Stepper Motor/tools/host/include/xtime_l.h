@@ -0,0 +1,18 @@
+/*
+ * xtime_l.h (host build)
+ * ----------------------------------------
+ * Global timer on the host monotonic clock, in nanoseconds.
+ */
+
+#ifndef HOST_XTIME_L_H_
+#define HOST_XTIME_L_H_
+
+#include "xil_types.h"
+
+typedef u64 XTime;
+
+#define COUNTS_PER_SECOND  1000000000ULL
+
+void XTime_GetTime(XTime *time);
+
+#endif /* HOST_XTIME_L_H_ */
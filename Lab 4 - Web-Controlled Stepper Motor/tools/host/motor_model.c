@@ -0,0 +1,397 @@
+/*
+ * motor_model.c
+ * ----------------------------------------
+ * Host-side Virtual 28BYJ-48 Motor Model
+ *
+ * Description:
+ * Drives a physical model of the 28BYJ-48 (through its ULN2003 board)
+ * with the coil patterns the step engine writes, so speed and accel can
+ * be tuned without risking steps on the hardware. stepper.c runs
+ * against host_stubs.c and the simulated step timer exactly as in
+ * stepper_bench.c; every coil write (the step ISR's output path, or
+ * stepper_set_next_step()) is time-stamped and fed to the model.
+ *
+ * The model, on the motor side of the 64:1 gearbox:
+ * - four unipolar coils at 0, 90, 180 and 270 electrical degrees, each a
+ *   first-order R-L circuit: supply less the driver drop while it is
+ *   energized, decaying through the clamp diode when released, with the
+ *   back-EMF of the rotor. The current rise time is what makes torque
+ *   fall with step rate;
+ * - 8 pole pairs (32 full steps per rotor turn), coil torque
+ *   -Kt * i * sin(theta - coil angle), and a detent torque with four
+ *   detents per electrical cycle;
+ * - rotor and gear train inertia, viscous and Coulomb friction.
+ * Rotor angles are electrical: one full step is 90 degrees, one half
+ * step 45.
+ *
+ * A move has missed steps when, held at its last pattern to settle, the
+ * rotor rests a whole number of steps away from the commanded angle, or
+ * when it lagged more than half an electrical cycle (a slip) on the way.
+ *
+ * The table search, for each step mode: the highest speed every cruise
+ * speed up to which a gentle ramp holds (pull-out), in MODEL_SPEED_STEP
+ * increments and stopped at the first failure. The table keeps
+ * MODEL_MARGIN of it, written as motor_limits.h, which
+ * stepper_max_speed() and validate_input() read. The highest accel that
+ * holds at the table speed is printed as well, in MODEL_ACCEL_STEP
+ * increments; it is not written, as it is far above STEPPER_MAX_ACCEL in
+ * every mode.
+ *
+ * The constants below are nominal 5 V 28BYJ-48 figures; measure the
+ * motor and its load and adjust them before trusting the tables.
+ *
+ * Build and run from the Lab 4 directory:
+ *   cc -O2 -fcommon -DSTEP_TIMER_SIMULATED -Itools/host/include -I. \
+ *      tools/host/motor_model.c tools/host/host_stubs.c \
+ *      stepper.c ramp_cache.c step_timer.c -lm -o motor_model
+ *   ./motor_model tables [motor_limits.h]
+ *   ./motor_model move <mode 0-2> <speed> <accel> <steps>
+ */
+
+#include "stepper.h"
+
+// Electrical (ULN2003 at 5 V)
+#define MODEL_SUPPLY_V        5.0
+#define MODEL_DRIVER_DROP_V   0.9       // Darlington saturation
+#define MODEL_CLAMP_V         0.7       // decay through the clamp diode
+#define MODEL_R_OHM           50.0      // per coil (half winding)
+#define MODEL_L_H             0.060
+
+// Mechanical, rotor side
+#define MODEL_POLE_PAIRS      8
+#define MODEL_KT_NM_PER_A     4.7e-3    // also V*s/rad of back-EMF
+#define MODEL_DETENT_NM       5.0e-5
+#define MODEL_INERTIA_KGM2    1.2e-8    // rotor and gear train
+#define MODEL_VISCOUS_NMS     1.0e-7
+#define MODEL_COULOMB_NM      2.0e-4    // gear train, rotor side
+#define MODEL_LOAD_NM         0.0       // extra load, rotor side
+
+// Simulation and search
+#define MODEL_DT_S            5e-6
+#define MODEL_SERVICE_US      1000      // service task period, as on the board
+#define MODEL_SETTLE_US       100000
+#define MODEL_EVENTS          256
+#define MODEL_SEARCH_ACCEL    250.0f    // ramp of the speed search, steps/s^2
+#define MODEL_CRUISE_S        0.25f     // cruise held at each tried speed
+#define MODEL_SPEED_STEP      25
+#define MODEL_SPEED_CEILING   4000
+#define MODEL_ACCEL_STEP      50
+#define MODEL_ACCEL_CEILING   20000
+#define MODEL_MARGIN          0.8f
+
+#define MODEL_PI              3.14159265358979323846
+
+typedef struct {
+    u32 time_us;
+    u32 pattern;
+} model_event_t;
+
+typedef struct {
+    double theta;           // rotor, electrical rad
+    double omega;           // rotor, mechanical rad/s
+    double current[4];      // coil currents, A
+    u32    pattern;         // coils energized
+    double command;         // commanded electrical angle, unwrapped
+    double rest_lag;        // command - theta at rest before the move
+    double max_lag;         // largest |command - theta - rest_lag| this move
+    u32    time_us;
+} model_state_t;
+
+typedef struct {
+    long   lost_steps;      // after settling, in steps of the mode
+    double max_lag_steps;
+    _Bool  slipped;
+} model_result_t;
+
+extern int host_quiet;
+
+static model_state_t model;
+static model_event_t events[MODEL_EVENTS];
+static u32 event_count;
+
+static const char *mode_names[3] = { "wave", "full", "half" };
+
+
+/*
+ * Electrical angle of a coil pattern: the direction of the sum of its
+ * energized coils.
+ */
+static double model_pattern_angle(u32 pattern)
+{
+    double x = 0.0, y = 0.0;
+    int k;
+
+    for (k = 0; k < 4; k++) {
+        if (pattern & (1u << k)) {
+            x += cos(k * MODEL_PI / 2.0);
+            y += sin(k * MODEL_PI / 2.0);
+        }
+    }
+    return atan2(y, x);
+}
+
+/*
+ * Apply a coil write: the commanded angle moves by the (under half a
+ * turn) change of the pattern angle.
+ */
+static void model_set_pattern(u32 pattern)
+{
+    pattern &= 0xF;
+    if (pattern == model.pattern) {
+        return;
+    }
+    if (pattern != 0 && model.pattern != 0) {
+        double delta = model_pattern_angle(pattern) - model_pattern_angle(model.pattern);
+        while (delta > MODEL_PI) {
+            delta -= 2.0 * MODEL_PI;
+        }
+        while (delta <= -MODEL_PI) {
+            delta += 2.0 * MODEL_PI;
+        }
+        model.command += delta;
+    }
+    model.pattern = pattern;
+}
+
+/*
+ * Integrate the motor over one time step.
+ */
+static void model_integrate(double dt)
+{
+    double torque = MODEL_DETENT_NM * -sin(4.0 * model.theta);
+    double coulomb = MODEL_COULOMB_NM + MODEL_LOAD_NM;
+    int k;
+
+    for (k = 0; k < 4; k++) {
+        double s = sin(model.theta - k * MODEL_PI / 2.0);
+        double emf = -MODEL_KT_NM_PER_A * model.omega * s;
+        double v = (model.pattern & (1u << k)) ? MODEL_SUPPLY_V - MODEL_DRIVER_DROP_V
+                                               : (model.current[k] > 0.0 ? -MODEL_CLAMP_V : 0.0);
+
+        model.current[k] += (v - MODEL_R_OHM * model.current[k] - emf) / MODEL_L_H * dt;
+        if (model.current[k] < 0.0) {
+            model.current[k] = 0.0;     // the driver only sinks current
+        }
+        torque += -MODEL_KT_NM_PER_A * model.current[k] * s;
+    }
+    torque -= MODEL_VISCOUS_NMS * model.omega;
+    torque -= coulomb * tanh(model.omega / 0.5);
+
+    model.omega += torque / MODEL_INERTIA_KGM2 * dt;
+    model.theta += MODEL_POLE_PAIRS * model.omega * dt;
+    if (fabs(model.command - model.theta - model.rest_lag) > model.max_lag) {
+        model.max_lag = fabs(model.command - model.theta - model.rest_lag);
+    }
+}
+
+/*
+ * Run the model up to time_us, applying the coil writes recorded on
+ * the way.
+ */
+static void model_advance(u32 time_us)
+{
+    u32 e = 0;
+
+    while ((s32)(time_us - model.time_us) > 0) {
+        while (e < event_count && (s32)(events[e].time_us - model.time_us) <= 0) {
+            model_set_pattern(events[e++].pattern);
+        }
+        model_integrate(MODEL_DT_S);
+        model.time_us += (u32)(MODEL_DT_S * 1e6);
+    }
+    while (e < event_count) {
+        model_set_pattern(events[e++].pattern);
+    }
+    event_count = 0;
+    model_set_pattern(host_gpio_data);
+}
+
+/*
+ * Step timer callback: run the driver's step ISR and record the coil
+ * pattern it wrote.
+ */
+static void model_step_isr(void)
+{
+    stepper_step_isr();
+    if (event_count < MODEL_EVENTS) {
+        events[event_count].time_us = step_timer_get_time_us();
+        events[event_count].pattern = host_gpio_data;
+        event_count++;
+    }
+}
+
+/*
+ * Let the clock and the model run for us, the step engine idle.
+ */
+static void model_wait(u32 us)
+{
+    step_timer_sim_advance(us);
+    model_advance(step_timer_get_time_us());
+}
+
+/*
+ * Run one move from rest in mode and report the steps it missed.
+ */
+static model_result_t model_move(step_mode_t mode, float speed, float accel, long distance)
+{
+    model_result_t result;
+    double step_angle = (mode == HALF_STEP) ? MODEL_PI / 4.0 : MODEL_PI / 2.0;
+    u32 start_us;
+
+    // Energize the current phase and let the rotor settle on it
+    stepper_set_step_mode(mode);
+    stepper_set_pos(0);
+    stepper_set_next_step(0, mode);
+    model.pattern = 0;
+    model_set_pattern(host_gpio_data);
+    model.command = model_pattern_angle(model.pattern);
+    model.theta   = model.command;
+    model.omega   = 0.0;
+    model_wait(MODEL_SETTLE_US);
+    model.rest_lag = model.command - model.theta;
+    model.max_lag  = 0.0;
+
+    stepper_set_speed(speed);
+    stepper_set_accel(accel);
+    stepper_set_decel(accel);
+    stepper_set_profile(PROFILE_TRAPEZOID, 0.0f);
+    stepper_setup_move_steps(distance);
+
+    start_us = step_timer_get_time_us();
+    while (!stepper_update()) {
+        step_timer_sim_advance(MODEL_SERVICE_US);
+        model_advance(step_timer_get_time_us());
+        if (step_timer_get_time_us() - start_us > 600000000UL) {
+            break;
+        }
+    }
+    // Hold the last phase while the rotor settles
+    stepper_set_next_step(0, mode);
+    model_wait(MODEL_SETTLE_US);
+
+    result.lost_steps    = lround((model.command - model.theta - model.rest_lag) / step_angle);
+    result.max_lag_steps = model.max_lag / step_angle;
+    result.slipped       = model.max_lag > MODEL_PI;
+    return result;
+}
+
+static _Bool model_holds(model_result_t result)
+{
+    return result.lost_steps == 0 && !result.slipped;
+}
+
+/*
+ * Highest cruise speed that holds with every slower one, for mode.
+ */
+static u32 model_search_speed(step_mode_t mode)
+{
+    u32 speed, best = 0;
+
+    for (speed = MODEL_SPEED_STEP; speed <= MODEL_SPEED_CEILING; speed += MODEL_SPEED_STEP) {
+        long distance = (long)((float)speed * speed / MODEL_SEARCH_ACCEL + speed * MODEL_CRUISE_S);
+        if (!model_holds(model_move(mode, (float)speed, MODEL_SEARCH_ACCEL, distance))) {
+            break;
+        }
+        best = speed;
+    }
+    return best;
+}
+
+/*
+ * Highest accel (and decel) that holds up to speed, for mode.
+ */
+static u32 model_search_accel(step_mode_t mode, u32 speed)
+{
+    u32 accel, best = 0;
+
+    for (accel = MODEL_ACCEL_STEP; accel <= MODEL_ACCEL_CEILING; accel += MODEL_ACCEL_STEP) {
+        long distance = (long)((float)speed * speed / accel + speed * 0.1f) + 1;
+        if (!model_holds(model_move(mode, (float)speed, (float)accel, distance))) {
+            break;
+        }
+        best = accel;
+    }
+    return best;
+}
+
+static int model_write_tables(const char *path, const u32 speed[3])
+{
+    FILE *out = fopen(path, "w");
+    char speeds[64];
+
+    if (out == NULL) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    snprintf(speeds, sizeof(speeds), "{ %lu, %lu, %lu }",
+             (unsigned long)speed[0], (unsigned long)speed[1], (unsigned long)speed[2]);
+    fprintf(out,
+            "/*\n"
+            " * motor_limits.h\n"
+            " * ----------------------------------------\n"
+            " * Per-Step-Mode Speed Limits\n"
+            " *\n"
+            " * Description:\n"
+            " * Generated by tools/host/motor_model.c from its 28BYJ-48 model: %d%% of\n"
+            " * the highest speed (steps/s of the mode) a gentle ramp holds.\n"
+            " * Regenerate after changing the model constants:\n"
+            " *   ./motor_model tables motor_limits.h\n"
+            " *\n"
+            " * Definitions:\n"
+            " * - MOTOR_LIMIT_SPEED:  Highest speed by step mode (wave, full, half)\n"
+            " */\n"
+            "\n"
+            "#ifndef SRC_MOTOR_LIMITS_H_\n"
+            "#define SRC_MOTOR_LIMITS_H_\n"
+            "\n"
+            "#define MOTOR_LIMIT_SPEED  %-22s  // steps/s\n"
+            "\n"
+            "#endif /* SRC_MOTOR_LIMITS_H_ */\n",
+            (int)(MODEL_MARGIN * 100.0f + 0.5f), speeds);
+    fclose(out);
+    printf("tables written to %s\n", path);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    host_quiet = 1;
+    stepper_initialize();
+    step_timer_initialize(model_step_isr);
+
+    if (argc == 6 && strcmp(argv[1], "move") == 0) {
+        step_mode_t mode = (step_mode_t)atoi(argv[2]);
+        model_result_t result;
+
+        if (mode > HALF_STEP) {
+            fprintf(stderr, "mode is 0 (wave), 1 (full) or 2 (half)\n");
+            return 1;
+        }
+        result = model_move(mode, (float)atof(argv[3]), (float)atof(argv[4]), atol(argv[5]));
+        printf("%s step, %s sps, %s sps^2, %s steps: %ld missed steps, max lag %.2f steps%s\n",
+               mode_names[mode], argv[3], argv[4], argv[5], result.lost_steps,
+               result.max_lag_steps, result.slipped ? ", slipped" : "");
+        return model_holds(result) ? 0 : 1;
+    }
+
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "tables") == 0) {
+        u32 speed[3];
+        int m;
+
+        printf("mode   pull-out sps  table speed  max accel sps^2 (engine cap %d)\n", STEPPER_MAX_ACCEL);
+        for (m = WAVE_DRIVE; m <= HALF_STEP; m++) {
+            u32 top_speed = model_search_speed((step_mode_t)m);
+            u32 top_accel;
+
+            speed[m]  = (u32)(top_speed * MODEL_MARGIN);
+            top_accel = model_search_accel((step_mode_t)m, speed[m]);
+            printf("%-5s  %12lu  %11lu  %15lu\n", mode_names[m], (unsigned long)top_speed,
+                   (unsigned long)speed[m], (unsigned long)top_accel);
+        }
+        return (argc == 3) ? model_write_tables(argv[2], speed) : 0;
+    }
+
+    fprintf(stderr, "usage: %s tables [motor_limits.h]\n"
+                    "       %s move <mode 0-2> <speed> <accel> <steps>\n", argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,185 @@
+/*
+ * program_bench.c
+ * ----------------------------------------
+ * Host-side Motion Program Loader Check
+ *
+ * Description:
+ * Runs program_load() on a set of hand-assembled programs and checks
+ * that each is accepted or rejected as the loader promises, and that a
+ * rejected program is reported at the right byte. Most cases are loops:
+ * the motor task runs above the server and emergency tasks, so a loop
+ * that can pass without blocking (a move back to where the motor
+ * already is, a zero dwell) would starve them, /stopProgram included,
+ * and must not load. Loops that block on every pass must still load.
+ *
+ * Build and run from the Lab 4 directory:
+ *   cc -O2 -fcommon -DSTEP_TIMER_SIMULATED -Itools/host/include -I. \
+ *      tools/host/program_bench.c tools/host/host_stubs.c program.c \
+ *      stepper.c ramp_cache.c step_timer.c -lm -o program_bench
+ *   ./program_bench
+ * The exit status is 1 if any program was accepted or rejected wrongly.
+ */
+
+#include "stepper.h"
+#include "program.h"
+
+#define BENCH_MAX_CODE  64
+
+typedef struct {
+    const char *name;
+    _Bool accept;
+    int error_op;           // rejected: instruction reported (0 = first)
+    u8 code[BENCH_MAX_CODE];
+    u32 size;
+} bench_program_t;
+
+extern int host_quiet;
+
+static bench_program_t program;
+
+
+static void bench_begin(const char *name, _Bool accept, int error_op)
+{
+    memset(&program, 0, sizeof(program));
+    program.name     = name;
+    program.accept   = accept;
+    program.error_op = error_op;
+}
+
+static void bench_op(u8 opcode, u32 operand, u32 operand_size)
+{
+    u32 i;
+
+    program.code[program.size++] = opcode;
+    for (i = 0; i < operand_size; i++) {
+        program.code[program.size++] = (u8)(operand >> (8 * i));
+    }
+}
+
+/*
+ * Load the program under test. Returns TRUE if the loader did as
+ * expected.
+ */
+static _Bool bench_load(void)
+{
+    u8 image[PROGRAM_HEADER_SIZE + BENCH_MAX_CODE];
+    u32 error_offset;
+    u32 expected_offset = PROGRAM_HEADER_SIZE;
+    u32 pc = 0;
+    int op;
+    int status;
+    _Bool ok;
+
+    image[0] = (u8)PROGRAM_MAGIC;
+    image[1] = (u8)(PROGRAM_MAGIC >> 8);
+    image[2] = (u8)(PROGRAM_MAGIC >> 16);
+    image[3] = (u8)(PROGRAM_MAGIC >> 24);
+    image[4] = PROGRAM_VERSION;
+    image[5] = 0;
+    image[6] = (u8)program.size;
+    image[7] = (u8)(program.size >> 8);
+    memcpy(image + PROGRAM_HEADER_SIZE, program.code, program.size);
+
+    // Offset of instruction error_op
+    for (op = 0; op < program.error_op; op++) {
+        u8 opcode = program.code[pc];
+        pc += 1 + ((opcode == PROGRAM_OP_END || opcode == PROGRAM_OP_END_LOOP) ? 0
+                 : (opcode == PROGRAM_OP_WAIT_BUTTON) ? 1
+                 : (opcode == PROGRAM_OP_MOVE_ABS || opcode == PROGRAM_OP_MOVE_REL ||
+                    opcode == PROGRAM_OP_DWELL) ? 4 : 2);
+    }
+    expected_offset += pc;
+
+    status = program_load(image, PROGRAM_HEADER_SIZE + program.size, &error_offset);
+    if (program.accept) {
+        ok = (status == XST_SUCCESS);
+        printf("  %-40s %s%s\n", program.name, (status == XST_SUCCESS) ? "loaded" : "rejected",
+               ok ? "" : "  WRONG");
+    } else {
+        ok = (status != XST_SUCCESS && error_offset == expected_offset);
+        printf("  %-40s %s", program.name, (status == XST_SUCCESS) ? "loaded" : "rejected");
+        if (status != XST_SUCCESS) {
+            printf(" at byte %lu", (unsigned long)error_offset);
+        }
+        printf("%s\n", ok ? "" : "  WRONG");
+    }
+    return ok;
+}
+
+int main(void)
+{
+    u32 wrong = 0;
+
+    host_quiet = 1;
+    stepper_initialize();
+
+    printf("\nprogram_bench: program_load() checks\n");
+
+    bench_begin("loop 0 / move 100 / endloop", 0, 2);
+    bench_op(PROGRAM_OP_LOOP, 0, 2);
+    bench_op(PROGRAM_OP_MOVE_ABS, 100, 4);
+    bench_op(PROGRAM_OP_END_LOOP, 0, 0);
+    wrong += !bench_load();
+
+    bench_begin("loop 0 / rel 0 / endloop", 0, 2);
+    bench_op(PROGRAM_OP_LOOP, 0, 2);
+    bench_op(PROGRAM_OP_MOVE_REL, 0, 4);
+    bench_op(PROGRAM_OP_END_LOOP, 0, 0);
+    wrong += !bench_load();
+
+    bench_begin("loop 0 / move 100 / dwell 0 / move 100", 0, 4);
+    bench_op(PROGRAM_OP_LOOP, 0, 2);
+    bench_op(PROGRAM_OP_MOVE_ABS, 100, 4);
+    bench_op(PROGRAM_OP_DWELL, 0, 4);
+    bench_op(PROGRAM_OP_MOVE_ABS, 100, 4);
+    bench_op(PROGRAM_OP_END_LOOP, 0, 0);
+    wrong += !bench_load();
+
+    bench_begin("loop 0 / loop 2 / move 100 / endloop", 0, 3);
+    bench_op(PROGRAM_OP_LOOP, 0, 2);
+    bench_op(PROGRAM_OP_LOOP, 2, 2);
+    bench_op(PROGRAM_OP_MOVE_ABS, 100, 4);
+    bench_op(PROGRAM_OP_END_LOOP, 0, 0);
+    bench_op(PROGRAM_OP_MOVE_ABS, 200, 4);
+    bench_op(PROGRAM_OP_END_LOOP, 0, 0);
+    wrong += !bench_load();
+
+    bench_begin("loop 0 / move 0 / move 100 / endloop", 1, 0);
+    bench_op(PROGRAM_OP_LOOP, 0, 2);
+    bench_op(PROGRAM_OP_MOVE_ABS, 0, 4);
+    bench_op(PROGRAM_OP_MOVE_ABS, 100, 4);
+    bench_op(PROGRAM_OP_END_LOOP, 0, 0);
+    wrong += !bench_load();
+
+    bench_begin("loop 0 / rel -512 / endloop", 1, 0);
+    bench_op(PROGRAM_OP_LOOP, 0, 2);
+    bench_op(PROGRAM_OP_MOVE_REL, (u32)-512, 4);
+    bench_op(PROGRAM_OP_END_LOOP, 0, 0);
+    wrong += !bench_load();
+
+    bench_begin("loop 0 / move 100 / dwell 250 / endloop", 1, 0);
+    bench_op(PROGRAM_OP_LOOP, 0, 2);
+    bench_op(PROGRAM_OP_MOVE_ABS, 100, 4);
+    bench_op(PROGRAM_OP_DWELL, 250, 4);
+    bench_op(PROGRAM_OP_END_LOOP, 0, 0);
+    wrong += !bench_load();
+
+    bench_begin("loop 0 / move 100 / wait 0x02 / endloop", 1, 0);
+    bench_op(PROGRAM_OP_LOOP, 0, 2);
+    bench_op(PROGRAM_OP_MOVE_ABS, 100, 4);
+    bench_op(PROGRAM_OP_WAIT_BUTTON, 0x02, 1);
+    bench_op(PROGRAM_OP_END_LOOP, 0, 0);
+    wrong += !bench_load();
+
+    bench_begin("move 100 / loop 3 / rel 0 / dwell 10", 1, 0);
+    bench_op(PROGRAM_OP_MOVE_ABS, 100, 4);
+    bench_op(PROGRAM_OP_LOOP, 3, 2);
+    bench_op(PROGRAM_OP_MOVE_REL, 0, 4);
+    bench_op(PROGRAM_OP_DWELL, 10, 4);
+    bench_op(PROGRAM_OP_END_LOOP, 0, 0);
+    bench_op(PROGRAM_OP_END, 0, 0);
+    wrong += !bench_load();
+
+    printf("  wrong: %lu\n", (unsigned long)wrong);
+    return (wrong != 0) ? 1 : 0;
+}
@@ -0,0 +1,653 @@
+/*
+ * stepper_bench.c
+ * ----------------------------------------
+ * Host-side Stepper Planner Simulator and Benchmark
+ *
+ * Description:
+ * Runs stepper.c on a development machine against the stubs in
+ * host_stubs.c and the virtual clock of the simulated step timer. Each
+ * of a few thousand randomized moves (speed, accel, decel, profile,
+ * distance) is planned and executed step by step, then checked:
+ * - executed steps and final position against the planned move,
+ * - the planned stop distance (stop_margin, or the cached decel table)
+ *   against the (v^2 - v_end^2)/(2*decel) steps needed from the executed
+ *   peak v down to the speed v_end of the last step,
+ * - deceleration steps executed against the planned stop distance,
+ * - peak speed against the planned (possibly clamped) peak,
+ * - the last step, which must be slow enough to stop on: at most
+ *   BENCH_STOP_FACTOR times the speed of a first step from rest,
+ * - for an S-curve, the speed on either side of the peak, which may fall
+ *   away from it by no more than jerk * t^2 / 2 in t seconds (within
+ *   BENCH_JERK_FACTOR and two microseconds of period rounding).
+ * Moves are grouped by ramp path and by whether the "speed clamped" or
+ * the short-move stop_margin clamp was taken, since those are where the
+ * plan and the executed steps can drift apart.
+ *
+ * A fixed case then runs one move per step mode (and half steps with
+ * full-step cruise) programmed at the mode's speed limit with a 150%
+ * feed-rate override; its peak may not exceed the limit.
+ *
+ * Each move's virtual duration is also checked against
+ * planner_segment_time(), the figure behind the /getParams ETAs. It may
+ * be off by BENCH_ETA_TOLERANCE of the estimate plus twice the time of
+ * a first step from rest at each end (sqrt(2/a) and sqrt(2/d), or
+ * cbrt(6/j) if longer for an S-curve): the closed form is continuous,
+ * while the driver times whole steps and shortens the first and last. A
+ * fixed case times a half-step move with and without full-step cruise
+ * the same way.
+ *
+ * The two ramp implementations are compared on BENCH_RAMP_MOVES
+ * randomized trapezoids with stepper_ramp_benchmark(): the step
+ * timestamps of the fixed-point ramp may not drift from the float ramp's
+ * by more than STEPPER_RAMP_TOLERANCE of the move time.
+ *
+ * Also reported: host planning time per move (ramp table build on a
+ * cache miss included) and host time per step (stepper_update() plus
+ * the step ISR).
+ *
+ * Build and run from the Lab 4 directory:
+ *   cc -O2 -fcommon -DSTEP_TIMER_SIMULATED -DSTEPPER_RAMP_BENCHMARK \
+ *      -Itools/host/include -I. tools/host/stepper_bench.c \
+ *      tools/host/host_stubs.c stepper.c ramp_cache.c planner.c \
+ *      step_timer.c -lm -o stepper_bench
+ *   ./stepper_bench [moves] [seed]
+ * Add -DSTEPPER_FIXED_POINT_RAMP=0 to run the float ramp instead.
+ * The exit status is 1 if any move mismatched, went over a limit, took
+ * longer or shorter than its estimate allows, or the two ramps drifted
+ * apart.
+ */
+
+#include "stepper.h"
+#include "planner.h"
+
+#ifndef STEPPER_RAMP_BENCHMARK
+#error "build with -DSTEPPER_RAMP_BENCHMARK: the ramp comparison lives in stepper.c"
+#endif
+
+#define BENCH_DEFAULT_MOVES    2000
+#define BENCH_MAX_STEPS        12000
+#define BENCH_SERVICE_US       1000     // service task period (one tick)
+#define BENCH_DECEL_TOLERANCE  3        // steps
+#define BENCH_STOP_FACTOR      4.0f
+#define BENCH_JERK_FACTOR      1.5
+#define BENCH_ETA_TOLERANCE    0.05     // of the estimate, plus a step from rest at each end
+#define BENCH_REPORT_LIMIT     10
+#define BENCH_PRESETS          8        // repeated profiles, for ramp cache hits
+#define BENCH_RAMP_MOVES       2000
+
+typedef enum {
+    PATH_TABLE,         // cached trapezoid table
+    PATH_RECURRENCE,    // per-step ramp (table did not fit)
+    PATH_S_CURVE,       // cached S-curve table
+    PATH_COUNT
+} bench_path_t;
+
+static const char *path_names[PATH_COUNT] = { "table", "recurrence", "s-curve" };
+
+typedef struct {
+    u32 moves;
+    u32 clamped;
+    u32 margin_clamped;
+    u32 mismatches;
+    u32 clamped_mismatches;
+    u32 margin_mismatches;
+    double stop_ratio_total;    // last step speed / first step from rest
+    double stop_ratio_max;
+} bench_path_stats_t;
+
+extern int host_quiet;
+
+static u32 step_intervals[BENCH_MAX_STEPS];
+static u32 step_count;
+static u32 last_step_us;
+static u32 rng_state;
+
+
+static u32 bench_random(void)
+{
+    // xorshift32, so a seed gives the same moves on every host
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static u32 bench_random_range(u32 low, u32 high)
+{
+    return low + bench_random() % (high - low + 1);
+}
+
+static motor_parameters_t bench_random_params(_Bool s_curve)
+{
+    motor_parameters_t params;
+
+    memset(&params, 0, sizeof(params));
+    params.rotational_speed = (float)bench_random_range(50, (u32)stepper_max_speed(stepper_motor.step_mode));
+    params.rotational_accel = (float)bench_random_range(50, 5000);
+    params.rotational_decel = (float)bench_random_range(50, 5000);
+    params.rotational_jerk  = (float)bench_random_range(500, 50000);
+    params.motion_profile   = s_curve ? PROFILE_S_CURVE : PROFILE_TRAPEZOID;
+    return params;
+}
+
+static double bench_now_ns(void)
+{
+    XTime now;
+
+    XTime_GetTime(&now);
+    return (double)now * (1e9 / COUNTS_PER_SECOND);
+}
+
+/*
+ * Step timer callback: record the period that ended with this step, then
+ * run the driver's step ISR.
+ */
+static void bench_step_isr(void)
+{
+    u32 now_us = step_timer_get_time_us();
+
+    if (step_count < BENCH_MAX_STEPS) {
+        step_intervals[step_count] = now_us - last_step_us;
+    }
+    step_count++;
+    last_step_us = now_us;
+    stepper_step_isr();
+}
+
+/*
+ * Peak speed the driver planned for this move, after any clamping.
+ */
+static float bench_planned_peak(long distance)
+{
+    if (active_ramp != NULL) {
+        // The table path clamps to ramp_peak_us, v_max for the distance
+        float peak = 1e6f / ramp_peak_us;
+
+        if (active_ramp->jerk == 0) {
+            // ...which must agree with the v_max clamp of the recurrence
+            float reachable = sqrtf(2.0f * accel * decel * distance / (accel + decel));
+            if (reachable < peak) {
+                peak = reachable;
+            }
+        }
+        return peak;
+    }
+#if STEPPER_FIXED_POINT_RAMP
+    return (float)(1000000UL << RAMP_FRAC_BITS) / ramp_interval_q8;
+#else
+    return 1000.0f / step_interval;
+#endif
+}
+
+/*
+ * Deceleration steps the plan calls for from a peak step period.
+ */
+static long bench_planned_decel_steps(u32 peak_us)
+{
+    long steps = 0;
+    u32 r;
+
+    if (active_ramp == NULL) {
+        return stop_margin;
+    }
+    for (r = 1; r <= active_ramp->decel_steps; r++) {
+        if (active_ramp->decel_us[r - 1] > peak_us) {
+            steps++;
+        }
+    }
+    return steps;
+}
+
+/*
+ * Largest speed change away from the executed peak (steps first_peak to
+ * last_peak) against the jerk limit, as a multiple of jerk * t^2 / 2
+ * plus the speed of two microseconds of period rounding at the peak. A
+ * jerk-limited ramp leaves its peak with zero acceleration; a ramp cut
+ * short at the peak jumps to full acceleration and fails this by far.
+ */
+static double bench_jerk_ratio(u32 first_peak, u32 last_peak, u32 count)
+{
+    double peak_speed = 1e6 / step_intervals[first_peak];
+    double rounding = peak_speed - 1e6 / (step_intervals[first_peak] + 2);
+    double worst = 0.0;
+    double t;
+    long i;
+
+    if (count > BENCH_MAX_STEPS) {
+        count = BENCH_MAX_STEPS;
+    }
+
+    t = 0.0;
+    for (i = (long)first_peak; i >= 0; i--) {
+        double change = peak_speed - 1e6 / step_intervals[i];
+        double ratio;
+
+        t += step_intervals[i] / 1e6;
+        ratio = change / (jerk * t * t / 2.0 + rounding);
+        if (ratio > worst) {
+            worst = ratio;
+        }
+    }
+
+    t = 0.0;
+    for (i = (long)last_peak; i < (long)count; i++) {
+        double change = peak_speed - 1e6 / step_intervals[i];
+        double ratio;
+
+        t += step_intervals[i] / 1e6;
+        ratio = change / (jerk * t * t / 2.0 + rounding);
+        if (ratio > worst) {
+            worst = ratio;
+        }
+    }
+    return worst;
+}
+
+/*
+ * Largest difference (s) between a move's virtual duration and the
+ * planner's estimate that the bench accepts: BENCH_ETA_TOLERANCE of the
+ * estimate, plus two first steps from rest at each end of the move.
+ */
+static double bench_eta_allowed(const motor_parameters_t *params, double estimate)
+{
+    double accel_step = sqrt(2.0 / params->rotational_accel);
+    double decel_step = sqrt(2.0 / params->rotational_decel);
+
+    if (params->motion_profile == PROFILE_S_CURVE) {
+        // A jerk-limited start covers j t^3 / 6
+        double jerk_step = cbrt(6.0 / params->rotational_jerk);
+        accel_step = (jerk_step > accel_step) ? jerk_step : accel_step;
+        decel_step = (jerk_step > decel_step) ? jerk_step : decel_step;
+    }
+    return BENCH_ETA_TOLERANCE * estimate + 2.0 * (accel_step + decel_step);
+}
+
+/*
+ * Run one move from rest to the target, playing the service task.
+ * Returns its virtual duration (s), up to the last step.
+ */
+static double bench_run_move(long target)
+{
+    u32 start_us;
+
+    stepper_setup_move_steps(target);
+    step_count = 0;
+    start_us = last_step_us = step_timer_get_time_us();
+    while (!stepper_update()) {
+        step_timer_sim_advance(BENCH_SERVICE_US);
+        if (step_timer_get_time_us() - start_us > 600000000UL) {
+            break;
+        }
+    }
+    return (last_step_us - start_us) / 1e6;
+}
+
+/*
+ * Moves programmed at each step mode's speed limit (as validate_input()
+ * holds it, full-step cruise included) with the feed-rate override at
+ * STEPPER_FEED_MAX. Returns the number whose executed peak went past
+ * the limit.
+ */
+static u32 bench_override_limit(void)
+{
+    static const struct {
+        step_mode_t mode;
+        _Bool full_step_cruise;
+        const char *name;
+    } cases[] = {
+        { WAVE_DRIVE, 0, "wave" },
+        { FULL_STEP,  0, "full" },
+        { HALF_STEP,  0, "half" },
+        { HALF_STEP,  1, "half, full-step cruise" },
+    };
+    step_mode_t mode = stepper_motor.step_mode;
+    u32 failures = 0;
+    u32 c, i;
+
+    printf("  feed override %d%% at the step mode limit:\n", STEPPER_FEED_MAX);
+    for (c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        float limit = stepper_move_max_speed(cases[c].mode, cases[c].full_step_cruise);
+        u32 peak_us = 0xFFFFFFFF;
+        float peak;
+
+        stepper_set_step_mode(cases[c].mode);
+        stepper_set_full_step_cruise(cases[c].full_step_cruise);
+        stepper_set_speed(limit);
+        stepper_set_accel(STEPPER_MAX_ACCEL);
+        stepper_set_decel(STEPPER_MAX_ACCEL);
+        stepper_set_profile(PROFILE_TRAPEZOID, 0.0f);
+        stepper_set_feed_override(STEPPER_FEED_MAX);
+
+        bench_run_move(curr_pos + 4000);
+        for (i = 0; i < step_count && i < BENCH_MAX_STEPS; i++) {
+            if (step_intervals[i] < peak_us) {
+                peak_us = step_intervals[i];
+            }
+        }
+        // The step rate: a full step of a split move is one period
+        peak = 1e6f / peak_us;
+        printf("    %-24s limit %4.0f sps, peak %4.0f sps%s\n", cases[c].name, limit, peak,
+               (peak > 1.01f * limit + 1.0f) ? "  OVER LIMIT" : "");
+        if (peak > 1.01f * limit + 1.0f) {
+            failures++;
+        }
+    }
+
+    stepper_set_feed_override(100);
+    stepper_set_full_step_cruise(0);
+    stepper_set_step_mode(mode);
+    return failures;
+}
+
+/*
+ * Plan BENCH_RAMP_MOVES randomized trapezoids with both ramps (planning
+ * only) and compare their step timestamps. Returns the number that
+ * drifted apart by more than STEPPER_RAMP_TOLERANCE of the move time.
+ */
+static u32 bench_ramp_compare(void)
+{
+    stepper_ramp_compare_t result;
+    double ratio, ratio_max = 0.0;
+    u32 failures = 0;
+    u32 m;
+
+    for (m = 0; m < BENCH_RAMP_MOVES; m++) {
+        motor_parameters_t params = bench_random_params(0);
+        long distance = (long)bench_random_range(1, BENCH_MAX_STEPS);
+
+        stepper_set_speed(params.rotational_speed);
+        stepper_set_accel(params.rotational_accel);
+        stepper_set_decel(params.rotational_decel);
+        if (!stepper_ramp_benchmark(distance, &result)) {
+            failures++;
+            if (failures <= BENCH_REPORT_LIMIT) {
+                printf("  ramps apart: v=%.0f a=%.0f d=%.0f dist=%ld: %lu us of %lu us\n",
+                       params.rotational_speed, params.rotational_accel, params.rotational_decel,
+                       distance, (unsigned long)result.max_deviation_us,
+                       (unsigned long)result.float_move_us);
+            }
+        }
+        ratio = (double)result.max_deviation_us / result.float_move_us;
+        if (ratio > ratio_max) {
+            ratio_max = ratio;
+        }
+    }
+    printf("  ramps:     fixed-point vs float over %d moves, max drift %.3f%% of the move"
+           " (tolerance %.1f%%)\n", BENCH_RAMP_MOVES, 100.0 * ratio_max, 100.0 * STEPPER_RAMP_TOLERANCE);
+    return failures;
+}
+
+/*
+ * Half-step moves with and without full-step cruise, timed against
+ * planner_segment_time(). Returns the number out of tolerance.
+ */
+static u32 bench_eta_full_step(void)
+{
+    step_mode_t mode = stepper_motor.step_mode;
+    motor_parameters_t params;
+    u32 failures = 0;
+    int cruise;
+
+    memset(&params, 0, sizeof(params));
+    params.rotational_speed = 700.0f;
+    params.rotational_accel = STEPPER_MAX_ACCEL;
+    params.rotational_decel = STEPPER_MAX_ACCEL;
+    params.motion_profile   = PROFILE_TRAPEZOID;
+    params.step_mode        = HALF_STEP;
+
+    printf("  ETA of 8000 half steps at %.0f sps:\n", params.rotational_speed);
+    stepper_set_step_mode(HALF_STEP);
+    stepper_set_speed(params.rotational_speed);
+    stepper_set_accel(params.rotational_accel);
+    stepper_set_decel(params.rotational_decel);
+    stepper_set_profile(PROFILE_TRAPEZOID, 0.0f);
+    for (cruise = 0; cruise <= 1; cruise++) {
+        double estimate, duration;
+        _Bool ok;
+
+        params.full_step_cruise = cruise;
+        stepper_set_full_step_cruise(cruise);
+        estimate = planner_segment_time(&params, 8000, 0.0f, 0.0f);
+        duration = bench_run_move(curr_pos + 8000);
+        ok = fabs(duration - estimate) <= bench_eta_allowed(&params, estimate);
+        printf("    %-24s estimate %6.3f s, ran %6.3f s%s\n",
+               cruise ? "full-step cruise" : "half steps", estimate, duration, ok ? "" : "  OVER TOLERANCE");
+        failures += !ok;
+    }
+
+    stepper_set_full_step_cruise(0);
+    stepper_set_step_mode(mode);
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    u32 moves = (argc > 1) ? (u32)strtoul(argv[1], NULL, 0) : BENCH_DEFAULT_MOVES;
+    u32 seed  = (argc > 2) ? (u32)strtoul(argv[2], NULL, 0) : 1;
+    bench_path_stats_t paths[PATH_COUNT] = { 0 };
+    double plan_ns_total = 0.0, plan_ns_max = 0.0;
+    double run_ns_total = 0.0;
+    double duration_s_total = 0.0;
+    // Estimate error by executed profile: [0] trapezoid, [1] S-curve
+    double estimate_error_total[2] = { 0.0 }, estimate_error_max[2] = { 0.0 };
+    u32 estimate_moves[2] = { 0 };
+    u32 estimate_failures = 0;
+    unsigned long steps_total = 0;
+    u32 mismatches = 0;
+    u32 over_limit;
+    u32 ramps_apart;
+    unsigned long underruns_before;
+    ramp_cache_stats_t cache;
+    u32 m;
+    int p;
+
+    rng_state = (seed != 0) ? seed : 1;
+    host_quiet = 1;
+
+    stepper_initialize();
+    step_timer_initialize(bench_step_isr);
+    stepper_set_step_mode(HALF_STEP);   // the fastest mode, up to STEPPER_MAX_SPEED
+
+    for (m = 0; m < moves; m++) {
+        motor_parameters_t params;
+        long start = curr_pos;
+        long distance = bench_random_range(1, BENCH_MAX_STEPS - 1);
+        long target = (bench_random() & 1) ? start + distance : start - distance;
+        _Bool s_curve = (bench_random() % 4) == 0;
+        long planned_decel, executed_accel, executed_decel;
+        long needed_decel;
+        float planned_peak, executed_peak, end_speed, stop_speed;
+        u32 peak_us, first_peak, last_peak, start_us, i;
+        bench_path_t path;
+        _Bool clamped, margin_clamped;
+        double t0, plan_ns, run_ns;
+        double duration_s;
+        char problem[160] = "";
+
+        // Half the moves reuse a few profiles, as a web client would
+        if (bench_random() & 1) {
+            u32 preset_seed = rng_state;
+            rng_state = seed + 1 + bench_random_range(1, BENCH_PRESETS) * 7919;
+            s_curve = (bench_random() % 4) == 0;
+            params = bench_random_params(s_curve);
+            rng_state = preset_seed;
+        } else {
+            params = bench_random_params(s_curve);
+        }
+
+        stepper_set_speed(params.rotational_speed);
+        stepper_set_accel(params.rotational_accel);
+        stepper_set_decel(params.rotational_decel);
+        stepper_set_profile(params.motion_profile, params.rotational_jerk);
+
+        // Plan
+        t0 = bench_now_ns();
+        stepper_setup_move_steps(target);
+        plan_ns = bench_now_ns() - t0;
+
+        path = (active_ramp == NULL) ? PATH_RECURRENCE
+             : (active_ramp->jerk != 0) ? PATH_S_CURVE : PATH_TABLE;
+        planned_peak = bench_planned_peak(distance);
+        clamped = planned_peak < target_speed - 1.0f;
+        margin_clamped = (active_ramp == NULL && stop_margin == distance / 2 &&
+                          stop_margin < (long)(planned_peak * planned_peak / (2.0f * decel)) - 1);
+
+        // Execute, playing the service task every BENCH_SERVICE_US
+        step_count = 0;
+        start_us = last_step_us = step_timer_get_time_us();
+        underruns_before = step_underruns;
+        t0 = bench_now_ns();
+        while (!stepper_update()) {
+            step_timer_sim_advance(BENCH_SERVICE_US);
+            if (step_timer_get_time_us() - start_us > 600000000UL) {
+                break;      // stalled: more than ten minutes of virtual time
+            }
+        }
+        run_ns = bench_now_ns() - t0;
+        duration_s = (last_step_us - start_us) / 1e6;
+
+        // Shape of the executed move
+        peak_us = 0xFFFFFFFF;
+        first_peak = last_peak = 0;
+        for (i = 0; i < step_count && i < BENCH_MAX_STEPS; i++) {
+            if (step_intervals[i] < peak_us) {
+                peak_us = step_intervals[i];
+                first_peak = i;
+            }
+            if (step_intervals[i] == peak_us) {
+                last_peak = i;
+            }
+        }
+        executed_accel = first_peak;
+        executed_decel = (step_count > 0) ? (long)(step_count - 1 - last_peak) : 0;
+        executed_peak  = 1e6f / peak_us;
+        end_speed      = (step_count > 0) ? 1e6f / step_intervals[step_count - 1] : 0.0f;
+        stop_speed     = sqrtf(2.0f * decel);   // 1 / first period from rest
+        planned_decel  = bench_planned_decel_steps(peak_us);
+        // From the peak down to the speed of the last step, which the stop
+        // check below holds to BENCH_STOP_FACTOR times a step from rest
+        needed_decel   = (end_speed < executed_peak)
+                       ? (long)((executed_peak * executed_peak - end_speed * end_speed) / (2.0f * decel) + 0.5f)
+                       : 0;
+        (void)executed_accel;
+
+        // Planned vs executed
+        if (step_count != (u32)distance || curr_pos != target) {
+            snprintf(problem, sizeof(problem), "executed %lu of %ld steps, ended at %ld",
+                     (unsigned long)step_count, distance, curr_pos);
+        } else if (path != PATH_S_CURVE &&
+                   labs(needed_decel - planned_decel) > BENCH_DECEL_TOLERANCE &&
+                   labs(needed_decel - planned_decel) > needed_decel / 10) {
+            snprintf(problem, sizeof(problem), "stop planned over %ld steps, %.0f sps needs %ld",
+                     planned_decel, executed_peak, needed_decel);
+        } else if (labs(executed_decel - planned_decel) > BENCH_DECEL_TOLERANCE &&
+                   labs(executed_decel - planned_decel) > planned_decel / 10) {
+            snprintf(problem, sizeof(problem), "decel planned %ld steps, executed %ld",
+                     planned_decel, executed_decel);
+        } else if (executed_peak < 0.9f * planned_peak || executed_peak > 1.05f * planned_peak + 1.0f) {
+            snprintf(problem, sizeof(problem), "peak planned %.0f sps, executed %.0f sps",
+                     planned_peak, executed_peak);
+        } else if (end_speed > BENCH_STOP_FACTOR * stop_speed) {
+            snprintf(problem, sizeof(problem), "abrupt stop at %.0f sps", end_speed);
+        } else if (path == PATH_S_CURVE && step_count == (u32)distance &&
+                   bench_jerk_ratio(first_peak, last_peak, step_count) > BENCH_JERK_FACTOR) {
+            snprintf(problem, sizeof(problem), "speed leaves the %.0f sps peak faster than jerk allows",
+                     executed_peak);
+        } else if (step_underruns != underruns_before) {
+            snprintf(problem, sizeof(problem), "%lu step FIFO underruns", step_underruns - underruns_before);
+        }
+
+        paths[path].moves++;
+        paths[path].clamped += clamped;
+        paths[path].margin_clamped += margin_clamped;
+        paths[path].stop_ratio_total += end_speed / stop_speed;
+        if (end_speed / stop_speed > paths[path].stop_ratio_max) {
+            paths[path].stop_ratio_max = end_speed / stop_speed;
+        }
+        if (problem[0] != '\0') {
+            paths[path].mismatches++;
+            paths[path].clamped_mismatches += clamped;
+            paths[path].margin_mismatches += margin_clamped;
+            if (mismatches < BENCH_REPORT_LIMIT) {
+                printf("move %lu (%s%s%s): %ld steps, v %.0f a %.0f d %.0f j %.0f: %s\n",
+                       (unsigned long)m, path_names[path],
+                       clamped ? ", speed clamped" : "", margin_clamped ? ", stop_margin clamped" : "",
+                       distance, params.rotational_speed, params.rotational_accel,
+                       params.rotational_decel, params.rotational_jerk, problem);
+            }
+            mismatches++;
+        }
+
+        // Timing
+        plan_ns_total += plan_ns;
+        if (plan_ns > plan_ns_max) {
+            plan_ns_max = plan_ns;
+        }
+        run_ns_total += run_ns;
+        steps_total += step_count;
+        duration_s_total += duration_s;
+        if (step_count == (u32)distance) {
+            // An S-curve move whose table did not fit ran the trapezoid
+            motor_parameters_t executed = params;
+            int s_curve = (path == PATH_S_CURVE);
+            double estimate, error;
+
+            if (!s_curve) {
+                executed.motion_profile = PROFILE_TRAPEZOID;
+            }
+            estimate = planner_segment_time(&executed, distance, 0.0f, 0.0f);
+            error = fabs(duration_s - estimate) / estimate;
+            if (fabs(duration_s - estimate) > bench_eta_allowed(&executed, estimate)) {
+                if (estimate_failures < BENCH_REPORT_LIMIT) {
+                    printf("move %lu (%s): %ld steps, v %.0f a %.0f d %.0f j %.0f: ran %.3f s, "
+                           "estimate %.3f s\n", (unsigned long)m, path_names[path], distance,
+                           params.rotational_speed, params.rotational_accel,
+                           params.rotational_decel, params.rotational_jerk, duration_s, estimate);
+                }
+                estimate_failures++;
+            }
+
+            estimate_error_total[s_curve] += error;
+            if (error > estimate_error_max[s_curve]) {
+                estimate_error_max[s_curve] = error;
+            }
+            estimate_moves[s_curve]++;
+        }
+
+        stepper_set_pos(target);    // a stalled move must not shift the next one
+    }
+
+    ramp_cache_get_stats(&cache);
+
+    printf("\nstepper_bench: %lu moves, seed %lu, %s ramp\n", (unsigned long)moves, (unsigned long)seed,
+           STEPPER_FIXED_POINT_RAMP ? "fixed-point" : "float");
+    printf("  path        moves  clamped  margin  last step (mean, max)  mismatches (clamped, margin)\n");
+    for (p = 0; p < PATH_COUNT; p++) {
+        printf("  %-10s  %5lu  %7lu  %6lu  %8.2fx  %8.2fx  %10lu (%lu, %lu)\n", path_names[p],
+               (unsigned long)paths[p].moves, (unsigned long)paths[p].clamped,
+               (unsigned long)paths[p].margin_clamped,
+               paths[p].moves ? paths[p].stop_ratio_total / paths[p].moves : 0.0,
+               paths[p].stop_ratio_max, (unsigned long)paths[p].mismatches,
+               (unsigned long)paths[p].clamped_mismatches, (unsigned long)paths[p].margin_mismatches);
+    }
+    printf("  planning:  mean %.2f us, max %.2f us per move (ramp cache %lu hits, %lu misses)\n",
+           plan_ns_total / moves / 1000.0, plan_ns_max / 1000.0,
+           (unsigned long)cache.hits, (unsigned long)cache.misses);
+    printf("  execution: %lu steps, %.1f ns host time per step\n",
+           steps_total, steps_total ? run_ns_total / steps_total : 0.0);
+    printf("  duration:  %.1f s virtual, trapezoid estimate error mean %.2f%%, max %.2f%%\n",
+           duration_s_total,
+           estimate_moves[0] ? 100.0 * estimate_error_total[0] / estimate_moves[0] : 0.0,
+           100.0 * estimate_error_max[0]);
+    printf("             S-curve estimate error mean %.2f%%, max %.2f%%\n",
+           estimate_moves[1] ? 100.0 * estimate_error_total[1] / estimate_moves[1] : 0.0,
+           100.0 * estimate_error_max[1]);
+    ramps_apart = bench_ramp_compare();
+    over_limit = bench_override_limit();
+    estimate_failures += bench_eta_full_step();
+    printf("  mismatches: %lu, over the speed limit: %lu, over the estimate tolerance: %lu,"
+           " ramps apart: %lu\n", (unsigned long)mismatches, (unsigned long)over_limit,
+           (unsigned long)estimate_failures, (unsigned long)ramps_apart);
+
+    return (mismatches != 0 || over_limit != 0 || estimate_failures != 0 || ramps_apart != 0) ? 1 : 0;
+}
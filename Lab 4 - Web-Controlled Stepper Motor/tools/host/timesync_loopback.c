@@ -0,0 +1,284 @@
+/*
+ * timesync_loopback.c
+ * ----------------------------------------
+ * Host-side Test of the Multi-Board Time Sync
+ *
+ * Description:
+ * Runs timesync.c in several processes on the loopback interface, one
+ * leader and N followers, each playing a board. Every process has its
+ * own global timer: the host monotonic clock with a random offset (up
+ * to TIMESYNC_LOOPBACK_OFFSET_S) and a random rate error (up to
+ * TIMESYNC_LOOPBACK_DRIFT_PPM), as two crystals would give. The
+ * followers sync to the leader for a while, then every process waits
+ * for the same start time on the leader clock, as the motor task does
+ * for a target queued with st=, and reports back when it started.
+ *
+ * The host monotonic clock is the same in every process, so it is the
+ * ground truth: it gives the true start skew across the processes, and
+ * each follower's estimate of the leader clock can be checked against
+ * the leader's real clock. The last part of the wait is a sleep on the
+ * host clock to the estimated start (a compare on the board's own timer
+ * would do the same), not a busy wait, so the processes do not starve
+ * each other on a host with few CPUs.
+ *
+ * Reported per process: the injected and estimated drift, exchanges
+ * kept in the fit, shortest round trip, the fit's own error figure, the
+ * real error of the leader clock estimate at the start, and the start
+ * time as measured by the process (what /getSync reports on a board)
+ * and on the true clock. The clock error is what the sync adds to the
+ * skew; the rest is the host waking the processes, which a host with
+ * fewer CPUs than processes does one after the other.
+ *
+ * Build and run from the Lab 4 directory:
+ *   cc -O2 -Itools/host/include -I. tools/host/timesync_loopback.c \
+ *      timesync.c -lm -o timesync_loopback
+ *   ./timesync_loopback [followers] [sync seconds] [seed]
+ * The exit status is 1 if a follower did not sync or the true start
+ * skew is over TIMESYNC_LOOPBACK_MAX_SKEW_US.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "xtime_l.h"
+#include "xil_printf.h"
+#include "lwip/sockets.h"
+#include "timesync.h"
+
+#define TIMESYNC_LOOPBACK_PORT        15002    // leader; followers on the ports above
+#define TIMESYNC_LOOPBACK_MAX_NODES   16
+#define TIMESYNC_LOOPBACK_OFFSET_S    1000.0
+#define TIMESYNC_LOOPBACK_DRIFT_PPM   100.0
+#define TIMESYNC_LOOPBACK_START_S     0.5      // start time, after the sync period
+#define TIMESYNC_LOOPBACK_MAX_SKEW_US 1000
+
+typedef struct {
+    double offset_ns;       // board clock = host clock * rate + offset_ns
+    double rate;
+} loopback_clock_t;
+
+typedef struct {
+    u32   node;
+    u32   synced;
+    u32   exchanges;
+    u32   fitted;
+    u32   delay_us;
+    u32   error_us;
+    float drift_ppm;        // estimated
+    double estimate_error_us;   // leader clock estimate - leader clock, at the start
+    s32   start_error_us;   // as measured by the process
+    double start_ns;        // true clock
+} loopback_result_t;
+
+static loopback_clock_t board_clock;
+
+
+static double loopback_host_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+static double loopback_board_us(const loopback_clock_t *clock, double host_ns)
+{
+    return (host_ns * clock->rate + clock->offset_ns) / 1000.0;
+}
+
+/*
+ * The process's global timer (xtime_l.h): nanosecond counts of its
+ * skewed clock.
+ */
+void XTime_GetTime(XTime *time)
+{
+    *time = (XTime)(loopback_host_ns() * board_clock.rate + board_clock.offset_ns);
+}
+
+void xil_printf(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    (void)task;
+    exit(1);
+}
+
+static u32 loopback_random(u32 *state)
+{
+    // xorshift32, so a seed gives the same clocks on every host
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static double loopback_uniform(u32 *state, double limit)
+{
+    return ((double)loopback_random(state) / 4294967295.0 * 2.0 - 1.0) * limit;
+}
+
+/*
+ * One board: sync (followers), wait for the start time on the leader
+ * clock and report it.
+ */
+static void loopback_node(u32 node, const loopback_clock_t *leader_clock, u64 start_at_us, int out)
+{
+    loopback_result_t result;
+    timesync_stats_t stats;
+    struct timespec wake;
+    double wake_ns;
+    s64 until_us;
+    int sock;
+
+    sock = timesync_open((u16)(TIMESYNC_LOOPBACK_PORT + node));
+    if (sock < 0) {
+        exit(1);
+    }
+    if (node == 0) {
+        timesync_set_role(TIMESYNC_LEADER, 0, 0);
+    } else {
+        timesync_set_role(TIMESYNC_FOLLOWER, htonl(INADDR_LOOPBACK), TIMESYNC_LOOPBACK_PORT);
+    }
+
+    // Serve the exchange until synced and the start time is near...
+    do {
+        timesync_service(sock, 1);
+        timesync_get_stats(&stats);
+        until_us = timesync_until_us(start_at_us);
+    } while (!stats.synced || until_us > TIMESYNC_SPIN_US);
+    // ...then sleep to it on the estimate and take the start
+    timesync_get_stats(&stats);
+    wake_ns = loopback_host_ns() + (double)timesync_until_us(start_at_us) * 1000.0
+                                   / (1.0 + stats.drift_ppm * 1e-6) / board_clock.rate;
+    wake.tv_sec  = (time_t)(wake_ns / 1e9);
+    wake.tv_nsec = (long)(wake_ns - (double)wake.tv_sec * 1e9);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    timesync_start_at(start_at_us);
+    result.start_ns = loopback_host_ns();
+
+    timesync_get_stats(&stats);
+    result.node              = node;
+    result.synced            = stats.synced;
+    result.exchanges         = stats.exchanges;
+    result.fitted            = stats.fitted;
+    result.delay_us          = stats.delay_us;
+    result.error_us          = stats.error_us;
+    result.drift_ppm         = stats.drift_ppm;
+    result.start_error_us    = stats.last_start_error_us;
+    {
+        double host_ns = loopback_host_ns();
+        double estimate = (double)timesync_leader_us();
+        result.estimate_error_us = estimate - loopback_board_us(leader_clock, host_ns);
+    }
+    if (write(out, &result, sizeof(result)) != sizeof(result)) {
+        exit(1);
+    }
+    close(sock);
+    exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    loopback_clock_t clocks[TIMESYNC_LOOPBACK_MAX_NODES];
+    loopback_result_t results[TIMESYNC_LOOPBACK_MAX_NODES];
+    u32 followers = (argc > 1) ? (u32)strtoul(argv[1], NULL, 0) : 4;
+    double sync_s = (argc > 2) ? atof(argv[2]) : 10.0;
+    u32 seed      = (argc > 3) ? (u32)strtoul(argv[3], NULL, 0) : 1;
+    u32 state, nodes, received = 0, unsynced = 0, i;
+    double first_ns = 0.0, last_ns = 0.0, skew_us;
+    u64 start_at_us;
+    int pipe_fds[2];
+
+    if (followers < 1 || followers >= TIMESYNC_LOOPBACK_MAX_NODES) {
+        fprintf(stderr, "followers: 1 to %d\n", TIMESYNC_LOOPBACK_MAX_NODES - 1);
+        return 1;
+    }
+    if (seed == 0) {
+        seed = 1;
+    }
+    nodes = followers + 1;
+    state = seed;
+    for (i = 0; i < nodes; i++) {
+        clocks[i].offset_ns = (TIMESYNC_LOOPBACK_OFFSET_S + loopback_uniform(&state, TIMESYNC_LOOPBACK_OFFSET_S)) * 1e9;
+        clocks[i].rate      = 1.0 + loopback_uniform(&state, TIMESYNC_LOOPBACK_DRIFT_PPM) * 1e-6;
+    }
+    start_at_us = (u64)loopback_board_us(&clocks[0],
+                                         loopback_host_ns() + (sync_s + TIMESYNC_LOOPBACK_START_S) * 1e9);
+
+    if (pipe(pipe_fds) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    for (i = 0; i < nodes; i++) {
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            close(pipe_fds[0]);
+            board_clock = clocks[i];
+            loopback_node(i, &clocks[0], start_at_us, pipe_fds[1]);
+        }
+    }
+    close(pipe_fds[1]);
+    while (received < nodes && read(pipe_fds[0], &results[received], sizeof(results[0])) == sizeof(results[0])) {
+        received++;
+    }
+    for (i = 0; i < nodes; i++) {
+        wait(NULL);
+    }
+    if (received < nodes) {
+        fprintf(stderr, "only %lu of %lu processes reported\n", (unsigned long)received, (unsigned long)nodes);
+        return 1;
+    }
+
+    printf("\ntimesync_loopback: 1 leader + %lu followers on 127.0.0.1, %.1f s of sync, seed %lu\n",
+           (unsigned long)followers, sync_s, (unsigned long)seed);
+    printf("  %-10s %10s %10s %6s %8s %8s %10s %10s %10s\n", "board", "drift ppm", "estimate",
+           "fitted", "rtt us", "fit us", "clock us", "start us", "true us");
+    for (i = 0; i < nodes; i++) {
+        if (i == 0 || results[i].start_ns < first_ns) {
+            first_ns = results[i].start_ns;
+        }
+        if (i == 0 || results[i].start_ns > last_ns) {
+            last_ns = results[i].start_ns;
+        }
+    }
+    for (i = 0; i < nodes; i++) {
+        const loopback_result_t *r = &results[i];
+        const loopback_clock_t *c = &clocks[r->node];
+        char name[16];
+
+        snprintf(name, sizeof(name), r->node == 0 ? "leader" : "follower %lu", (unsigned long)r->node);
+        if (!r->synced) {
+            unsynced++;
+        }
+        printf("  %-10s %10.3f %10.3f %6lu %8lu %8lu %10.1f %10ld %10.1f%s\n", name,
+               (clocks[0].rate / c->rate - 1.0) * 1e6, r->drift_ppm,
+               (unsigned long)r->fitted, (unsigned long)r->delay_us, (unsigned long)r->error_us,
+               r->estimate_error_us, (long)r->start_error_us, (r->start_ns - first_ns) / 1000.0,
+               r->synced ? "" : "  NOT SYNCED");
+    }
+    skew_us = (last_ns - first_ns) / 1000.0;
+    printf("  drift: leader clock rate over the board's; clock: error of the leader clock\n"
+           "  estimate at the start; start: lateness the board measured; true: start on\n"
+           "  the host clock after the first board\n");
+    printf("  start skew: %.1f us across %lu boards\n", skew_us, (unsigned long)nodes);
+    return (unsynced != 0 || skew_us > TIMESYNC_LOOPBACK_MAX_SKEW_US) ? 1 : 0;
+}
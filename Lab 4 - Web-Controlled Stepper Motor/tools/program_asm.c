@@ -0,0 +1,171 @@
+/*
+ * program_asm.c
+ * ----------------------------------------
+ * Host-side Motion Program Assembler
+ *
+ * Description:
+ * Assembles a text listing into the motion program bytecode described
+ * in program.h, ready to upload to the board. One instruction per line;
+ * '#' starts a comment:
+ *
+ *   speed 600          # steps/s
+ *   accel 400          # steps/s^2
+ *   decel 400
+ *   loop 10            # or "loop forever"
+ *     move 2048        # absolute, steps
+ *     dwell 250        # ms
+ *     rel -512         # relative, steps
+ *     wait 0x02        # press of BTN1
+ *   endloop
+ *   end
+ *
+ * Build and run on the host:
+ *   cc -O2 -o program_asm program_asm.c
+ *   ./program_asm cycle.txt cycle.bin
+ *   curl --data-binary @cycle.bin http://<board>/loadProgram
+ *   curl http://<board>/runProgram
+ *
+ * The board checks ranges and loop nesting again when it loads the
+ * program, and rejects a loop that can pass without moving or waiting
+ * (see program.h). It answers with the offset of the first bad byte.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGRAM_MAGIC        0x4752504Du   // "MPRG"
+#define PROGRAM_VERSION      1
+#define PROGRAM_HEADER_SIZE  8
+#define PROGRAM_MAX_SIZE     1024
+
+typedef struct {
+    const char *name;
+    uint8_t opcode;
+    int operand_size;       // bytes
+} instruction_t;
+
+static const instruction_t instructions[] = {
+    { "end",     0x00, 0 },
+    { "move",    0x01, 4 },
+    { "rel",     0x02, 4 },
+    { "dwell",   0x03, 4 },
+    { "speed",   0x04, 2 },
+    { "accel",   0x05, 2 },
+    { "decel",   0x06, 2 },
+    { "loop",    0x07, 2 },
+    { "endloop", 0x08, 0 },
+    { "wait",    0x09, 1 },
+};
+
+#define INSTRUCTION_COUNT  (sizeof(instructions) / sizeof(instructions[0]))
+
+static uint8_t image[PROGRAM_MAX_SIZE];
+static uint32_t image_size = PROGRAM_HEADER_SIZE;
+
+static void put_le(uint32_t value, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++) {
+        image[image_size++] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    char line[256];
+    int line_number = 0;
+    int depth = 0;
+    uint32_t code_size;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s program.txt program.bin\n", argv[0]);
+        return 1;
+    }
+    in = fopen(argv[1], "r");
+    if (in == NULL) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        char name[32], operand[64];
+        const instruction_t *instruction = NULL;
+        char *comment = strchr(line, '#');
+        char *end;
+        long value = 0;
+        int fields;
+        size_t i;
+
+        line_number++;
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        fields = sscanf(line, "%31s %63s", name, operand);
+        if (fields <= 0) {
+            continue;
+        }
+
+        for (i = 0; i < INSTRUCTION_COUNT; i++) {
+            if (strcmp(name, instructions[i].name) == 0) {
+                instruction = &instructions[i];
+            }
+        }
+        if (instruction == NULL) {
+            fprintf(stderr, "%s:%d: unknown instruction '%s'\n", argv[1], line_number, name);
+            return 1;
+        }
+        if ((fields == 2) != (instruction->operand_size != 0)) {
+            fprintf(stderr, "%s:%d: '%s' takes %s operand\n", argv[1], line_number, name,
+                    instruction->operand_size ? "one" : "no");
+            return 1;
+        }
+        if (fields == 2) {
+            if (instruction->opcode == 0x07 && strcmp(operand, "forever") == 0) {
+                value = 0;
+            } else {
+                value = strtol(operand, &end, 0);
+                if (*end != '\0') {
+                    fprintf(stderr, "%s:%d: bad number '%s'\n", argv[1], line_number, operand);
+                    return 1;
+                }
+            }
+        }
+
+        depth += (instruction->opcode == 0x07) - (instruction->opcode == 0x08);
+        if (depth < 0) {
+            fprintf(stderr, "%s:%d: endloop without loop\n", argv[1], line_number);
+            return 1;
+        }
+        if (image_size + 1 + instruction->operand_size > PROGRAM_MAX_SIZE) {
+            fprintf(stderr, "%s:%d: program longer than %d bytes\n", argv[1], line_number, PROGRAM_MAX_SIZE);
+            return 1;
+        }
+        image[image_size++] = instruction->opcode;
+        put_le((uint32_t)value, instruction->operand_size);
+    }
+    fclose(in);
+
+    if (depth != 0) {
+        fprintf(stderr, "%s: %d loop(s) not closed\n", argv[1], depth);
+        return 1;
+    }
+
+    code_size = image_size - PROGRAM_HEADER_SIZE;
+    image_size = 0;
+    put_le(PROGRAM_MAGIC, 4);
+    put_le(PROGRAM_VERSION, 2);
+    put_le(code_size, 2);
+
+    out = fopen(argv[2], "wb");
+    if (out == NULL || fwrite(image, 1, PROGRAM_HEADER_SIZE + code_size, out) != PROGRAM_HEADER_SIZE + code_size) {
+        fprintf(stderr, "cannot write %s\n", argv[2]);
+        return 1;
+    }
+    fclose(out);
+    printf("%u bytes of code written to %s\n", code_size, argv[2]);
+    return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * trace_decode.c
+ * ----------------------------------------
+ * Host-side Step Trace Decoder
+ *
+ * Description:
+ * Decodes a binary step trace exported by stepper_trace_export(), either
+ * the body of GET /trace or a UART capture of the console "trace"
+ * command (the trace is found by its header magic). Prints step timing
+ * jitter (measured step period minus planned period) and optionally
+ * writes a velocity CSV for plotting.
+ *
+ * Build and run on the host:
+ *   cc -O2 -o trace_decode trace_decode.c -lm
+ *   curl -o trace.bin http://<board>/trace
+ *   ./trace_decode trace.bin velocity.csv
+ *
+ * Consecutive steps further apart than their planned period plus
+ * IDLE_GAP_US are treated as separate moves and not counted as jitter.
+ * A step moves the position by one, or by two in the full-step part of
+ * a half-step move with full-step cruise.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC        0x43525453u   // "STRC"
+#define TRACE_VERSION      1
+#define TRACE_HEADER_SIZE  20
+#define TRACE_RECORD_SIZE  12
+#define IDLE_GAP_US        100000.0
+
+typedef struct {
+    double   time_us;       // unwrapped, from the first record
+    int32_t  position;
+    uint32_t interval_us;
+} step_t;
+
+static uint32_t read_u32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t read_u16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static unsigned char *read_file(const char *path, long *size)
+{
+    FILE *file = fopen(path, "rb");
+    unsigned char *data;
+
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = malloc(*size > 0 ? *size : 1);
+    if (data != NULL && fread(data, 1, *size, file) != (size_t)*size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char *data;
+    const unsigned char *header = NULL;
+    long size, offset;
+    uint32_t counts_per_second, count, lost, i;
+    uint16_t version, record_size;
+    step_t *steps;
+    double *jitter;
+    uint32_t jitter_count = 0;
+    uint32_t moves = 1;
+    uint32_t last_counts = 0;
+    double sum = 0.0, sum_sq = 0.0;
+    FILE *csv = NULL;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s trace.bin [velocity.csv]\n", argv[0]);
+        return 1;
+    }
+
+    data = read_file(argv[1], &size);
+    if (data == NULL) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+
+    // Find the header (UART captures have text around the trace)
+    for (offset = 0; offset + TRACE_HEADER_SIZE <= size; offset++) {
+        if (read_u32(data + offset) == TRACE_MAGIC) {
+            header = data + offset;
+            break;
+        }
+    }
+    if (header == NULL) {
+        fprintf(stderr, "no step trace found in %s\n", argv[1]);
+        return 1;
+    }
+
+    version           = read_u16(header + 4);
+    record_size       = read_u16(header + 6);
+    counts_per_second = read_u32(header + 8);
+    count             = read_u32(header + 12);
+    lost              = read_u32(header + 16);
+    if (version != TRACE_VERSION || record_size != TRACE_RECORD_SIZE || counts_per_second == 0) {
+        fprintf(stderr, "unsupported trace (version %u, record size %u)\n", version, record_size);
+        return 1;
+    }
+    if (offset + TRACE_HEADER_SIZE + (long)count * TRACE_RECORD_SIZE > size) {
+        count = (uint32_t)((size - offset - TRACE_HEADER_SIZE) / TRACE_RECORD_SIZE);
+        fprintf(stderr, "trace truncated, decoding %u records\n", count);
+    }
+
+    steps  = calloc(count + 1, sizeof(step_t));
+    jitter = calloc(count + 1, sizeof(double));
+    if (steps == NULL || jitter == NULL) {
+        return 1;
+    }
+
+    // Unwrap the 32-bit timestamps into microseconds
+    for (i = 0; i < count; i++) {
+        const unsigned char *record = header + TRACE_HEADER_SIZE + (long)i * TRACE_RECORD_SIZE;
+        uint32_t counts = read_u32(record);
+
+        steps[i].time_us     = (i == 0) ? 0.0
+                             : steps[i - 1].time_us + (uint32_t)(counts - last_counts) * 1e6 / counts_per_second;
+        steps[i].position    = (int32_t)read_u32(record + 4);
+        steps[i].interval_us = read_u32(record + 8);
+        last_counts = counts;
+    }
+
+    if (argc > 2) {
+        csv = fopen(argv[2], "w");
+        if (csv == NULL) {
+            fprintf(stderr, "cannot write %s\n", argv[2]);
+            return 1;
+        }
+        fprintf(csv, "time_s,position,planned_velocity,measured_velocity\n");
+    }
+
+    for (i = 1; i < count; i++) {
+        double measured_us = steps[i].time_us - steps[i - 1].time_us;
+        int32_t moved = steps[i].position - steps[i - 1].position;
+        double planned_velocity, measured_velocity;
+
+        if (moved == 0 || moved > 2 || moved < -2 || steps[i].interval_us == 0 ||
+            measured_us > steps[i].interval_us + IDLE_GAP_US) {
+            moves++;    // idle gap or lost records: start of another move
+            continue;
+        }
+
+        jitter[jitter_count] = measured_us - steps[i].interval_us;
+        sum    += jitter[jitter_count];
+        sum_sq += jitter[jitter_count] * jitter[jitter_count];
+        jitter_count++;
+
+        planned_velocity  = moved * 1e6 / steps[i].interval_us;
+        measured_velocity = moved * 1e6 / measured_us;
+        if (csv != NULL) {
+            fprintf(csv, "%.6f,%d,%.2f,%.2f\n", steps[i].time_us / 1e6, steps[i].position,
+                    planned_velocity, measured_velocity);
+        }
+    }
+
+    printf("step trace: %u records, %u lost, %u moves, timer %u counts/s\n",
+           count, lost, moves, counts_per_second);
+    if (jitter_count > 0) {
+        double mean = sum / jitter_count;
+        double variance = sum_sq / jitter_count - mean * mean;
+
+        qsort(jitter, jitter_count, sizeof(double), compare_double);
+        printf("jitter (measured - planned period) over %u steps:\n", jitter_count);
+        printf("  mean %.2f us, stddev %.2f us\n", mean, sqrt(variance > 0.0 ? variance : 0.0));
+        printf("  min %.2f us, median %.2f us, p99 %.2f us, max %.2f us\n",
+               jitter[0], jitter[jitter_count / 2],
+               jitter[(uint32_t)((jitter_count - 1) * 0.99)], jitter[jitter_count - 1]);
+    }
+    if (csv != NULL) {
+        fclose(csv);
+        printf("velocity CSV written to %s\n", argv[2]);
+    }
+
+    free(steps);
+    free(jitter);
+    free(data);
+    return 0;
+}